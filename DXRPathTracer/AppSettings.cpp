@@ -26,6 +26,13 @@ static const char* ClusterRasterizationModesLabels[] =
     "Conservative",
 };
 
+static const char* SampleModesLabels[] =
+{
+    "CMJ",
+    "Owen-Scrambled Sobol",
+    "Precomputed Sobol Tiles",
+};
+
 namespace AppSettings
 {
     static SettingsContainer Settings;
@@ -46,8 +53,19 @@ namespace AppSettings
     BoolSetting ClampRoughness;
     BoolSetting AvoidCausticPaths;
     IntSetting SqrtNumSamples;
+    SampleModesSetting SampleMode;
     IntSetting MaxPathLength;
     IntSetting MaxAnyHitPathLength;
+    BoolSetting EnableAdaptiveSampling;
+    FloatSetting AdaptiveErrorThreshold;
+    IntSetting AdaptiveMinSamples;
+    IntSetting AdaptiveMaxSampleScale;
+    BoolSetting EnableLightBVH;
+    IntSetting NumLightSamples;
+    BoolSetting EnableSkyImportanceSampling;
+    BoolSetting EnableRussianRoulette;
+    IntSetting RussianRouletteMinDepth;
+    BoolSetting EnableRayConeLOD;
     FloatSetting Exposure;
     FloatSetting BloomExposure;
     FloatSetting BloomMagnitude;
@@ -67,6 +85,11 @@ namespace AppSettings
     BoolSetting EnableWhiteFurnaceMode;
     BoolSetting AlwaysResetPathTrace;
     BoolSetting ShowProgressBar;
+    Button RenderCPUReference;
+    BoolSetting EnableCPUDenoiser;
+    IntSetting CPUDenoiserIterations;
+    BoolSetting EnableCPURayStats;
+    Button RunSamplerConvergenceTest;
 
     ConstantBuffer CBuffer;
     const uint32 CBufferRegister = 12;
@@ -138,12 +161,45 @@ namespace AppSettings
         SqrtNumSamples.Initialize("SqrtNumSamples", "Path Tracing", "Sqrt Num Samples", "The square root of the number of per-pixel sample rays to use for path tracing", 4, 1, 100);
         Settings.AddSetting(&SqrtNumSamples);
 
-        MaxPathLength.Initialize("MaxPathLength", "Path Tracing", "Max Path Length", "Maximum path length (bounces) to use for path tracing", 3, 2, 8);
+        SampleMode.Initialize("SampleMode", "Path Tracing", "Sample Mode", "Sample generator used for the path tracers. Precomputed tiles are only used by the CPU path tracer, the GPU generates the same Owen-scrambled Sobol samples on the fly.", SampleModes::CMJ, 3, SampleModesLabels);
+        Settings.AddSetting(&SampleMode);
+
+        MaxPathLength.Initialize("MaxPathLength", "Path Tracing", "Max Path Length", "Maximum path length (bounces) to use for path tracing", 3, 2, 16);
         Settings.AddSetting(&MaxPathLength);
 
-        MaxAnyHitPathLength.Initialize("MaxAnyHitPathLength", "Path Tracing", "Max Any-Hit Path Length", "The maximum path length where any-hit shaders will be used for alpha testing. Increasing this with improve the render quality, but will also increase frame times", 1, 0, 8);
+        MaxAnyHitPathLength.Initialize("MaxAnyHitPathLength", "Path Tracing", "Max Any-Hit Path Length", "The maximum path length where any-hit shaders will be used for alpha testing. Increasing this with improve the render quality, but will also increase frame times", 1, 0, 16);
         Settings.AddSetting(&MaxAnyHitPathLength);
 
+        EnableAdaptiveSampling.Initialize("EnableAdaptiveSampling", "Path Tracing", "Enable Adaptive Sampling", "Stops sampling pixels once their estimated error drops below the error threshold, and spends those samples on noisier pixels instead", false);
+        Settings.AddSetting(&EnableAdaptiveSampling);
+
+        AdaptiveErrorThreshold.Initialize("AdaptiveErrorThreshold", "Path Tracing", "Adaptive Error Threshold", "A pixel is converged once the standard error of its mean luminance is below this fraction of the mean", 0.0200f, 0.0010f, 1.0000f, 0.0010f, ConversionMode::None, 1.0000f);
+        Settings.AddSetting(&AdaptiveErrorThreshold);
+
+        AdaptiveMinSamples.Initialize("AdaptiveMinSamples", "Path Tracing", "Adaptive Min Samples", "The number of samples that every pixel takes before it can be considered converged", 8, 2, 1024);
+        Settings.AddSetting(&AdaptiveMinSamples);
+
+        AdaptiveMaxSampleScale.Initialize("AdaptiveMaxSampleScale", "Path Tracing", "Adaptive Max Sample Scale", "Noisy pixels can take up to this many times the regular per-pixel sample count", 4, 1, 16);
+        Settings.AddSetting(&AdaptiveMaxSampleScale);
+
+        EnableLightBVH.Initialize("EnableLightBVH", "Path Tracing", "Enable Light BVH", "Picks spot lights for each shading point by walking a light hierarchy, instead of evaluating every light", false);
+        Settings.AddSetting(&EnableLightBVH);
+
+        NumLightSamples.Initialize("NumLightSamples", "Path Tracing", "Num Light Samples", "The number of spot lights that are picked from the light hierarchy at each shading point", 1, 1, 4);
+        Settings.AddSetting(&NumLightSamples);
+
+        EnableSkyImportanceSampling.Initialize("EnableSkyImportanceSampling", "Path Tracing", "Enable Sky Importance Sampling", "Importance samples the sky by luminance in the CPU reference path tracer, and combines it with BRDF sampling using multiple importance sampling", true);
+        Settings.AddSetting(&EnableSkyImportanceSampling);
+
+        EnableRussianRoulette.Initialize("EnableRussianRoulette", "Path Tracing", "Enable Russian Roulette", "Randomly ends paths with a probability based on their throughput, and scales up the ones that continue to keep the result unbiased", false);
+        Settings.AddSetting(&EnableRussianRoulette);
+
+        RussianRouletteMinDepth.Initialize("RussianRouletteMinDepth", "Path Tracing", "Russian Roulette Min Depth", "The path length where Russian roulette starts to be applied", 3, 1, 16);
+        Settings.AddSetting(&RussianRouletteMinDepth);
+
+        EnableRayConeLOD.Initialize("EnableRayConeLOD", "Path Tracing", "Enable Ray Cone LOD", "Tracks a ray cone along each path, and uses its footprint to pick a mip level for every texture lookup instead of always sampling the top mip", false);
+        Settings.AddSetting(&EnableRayConeLOD);
+
         Exposure.Initialize("Exposure", "Post Processing", "Exposure", "Simple exposure value applied to the scene before tone mapping (uses log2 scale)", -14.0000f, -24.0000f, 24.0000f, 0.1000f, ConversionMode::None, 1.0000f);
         Settings.AddSetting(&Exposure);
 
@@ -202,6 +258,21 @@ namespace AppSettings
         ShowProgressBar.Initialize("ShowProgressBar", "Debug", "Show Progress Bar", "", true);
         Settings.AddSetting(&ShowProgressBar);
 
+        RenderCPUReference.Initialize("RenderCPUReference", "Debug", "Render CPU Reference", "Renders the current view with the CPU reference path tracer, and saves the result to CPUReference.exr");
+        Settings.AddSetting(&RenderCPUReference);
+
+        EnableCPUDenoiser.Initialize("EnableCPUDenoiser", "Debug", "Enable CPU Denoiser", "Runs an edge-aware denoiser on CPU reference renders, guided by first-hit albedo, normal and depth. The denoised result is saved next to the noisy one.", true);
+        Settings.AddSetting(&EnableCPUDenoiser);
+
+        CPUDenoiserIterations.Initialize("CPUDenoiserIterations", "Debug", "CPU Denoiser Iterations", "Number of a-trous wavelet iterations for the CPU denoiser, where each one doubles the filter radius", 5, 1, 8);
+        Settings.AddSetting(&CPUDenoiserIterations);
+
+        EnableCPURayStats.Initialize("EnableCPURayStats", "Debug", "Enable CPU Ray Stats", "Counts rays, BVH nodes, triangle tests and any-hit calls in CPU reference renders. The totals are written to the log, and the per-pixel costs are saved next to the image as a heatmap.", false);
+        Settings.AddSetting(&EnableCPURayStats);
+
+        RunSamplerConvergenceTest.Initialize("RunSamplerConvergenceTest", "Debug", "Run Sampler Convergence Test", "Compares the integration error of CMJ and Owen-scrambled Sobol samples for a few analytic functions, and writes the results to the log");
+        Settings.AddSetting(&RunSamplerConvergenceTest);
+
         ConstantBufferInit cbInit;
         cbInit.Size = sizeof(AppSettingsCBuffer);
         cbInit.Dynamic = true;
@@ -229,8 +300,19 @@ namespace AppSettings
         cbData.ClampRoughness = ClampRoughness;
         cbData.AvoidCausticPaths = AvoidCausticPaths;
         cbData.SqrtNumSamples = SqrtNumSamples;
+        cbData.SampleMode = SampleMode;
         cbData.MaxPathLength = MaxPathLength;
         cbData.MaxAnyHitPathLength = MaxAnyHitPathLength;
+        cbData.EnableAdaptiveSampling = EnableAdaptiveSampling;
+        cbData.AdaptiveErrorThreshold = AdaptiveErrorThreshold;
+        cbData.AdaptiveMinSamples = AdaptiveMinSamples;
+        cbData.AdaptiveMaxSampleScale = AdaptiveMaxSampleScale;
+        cbData.EnableLightBVH = EnableLightBVH;
+        cbData.NumLightSamples = NumLightSamples;
+        cbData.EnableSkyImportanceSampling = EnableSkyImportanceSampling;
+        cbData.EnableRussianRoulette = EnableRussianRoulette;
+        cbData.RussianRouletteMinDepth = RussianRouletteMinDepth;
+        cbData.EnableRayConeLOD = EnableRayConeLOD;
         cbData.Exposure = Exposure;
         cbData.BloomExposure = BloomExposure;
         cbData.BloomMagnitude = BloomMagnitude;
@@ -26,6 +26,18 @@ enum ClusterRasterizationModes
     Conservative
 }
 
+enum SampleModes
+{
+    [EnumLabel("CMJ")]
+    CMJ = 0,
+
+    [EnumLabel("Owen-Scrambled Sobol")]
+    Sobol,
+
+    [EnumLabel("Precomputed Sobol Tiles")]
+    SobolTables,
+}
+
 enum DepthSortModes
 {
     None,
@@ -114,7 +126,8 @@ public class Settings
     const uint SampleTileSize = 32;
     const uint NumPixelsPerTile = SampleTileSize * SampleTileSize;
 
-    const uint MaxPathLengthSetting = 8;
+    const uint MaxPathLengthSetting = 16;
+    const uint MaxLightSamples = 4;
 
     [ExpandGroup(true)]
     public class PathTracing
@@ -133,6 +146,10 @@ public class Settings
         [DisplayName("Sqrt Num Samples")]
         int SqrtNumSamples = 4;
 
+        [HelpText("Sample generator used for the path tracers. Precomputed tiles are only used by the CPU path tracer, the GPU generates the same Owen-scrambled Sobol samples on the fly.")]
+        [DisplayName("Sample Mode")]
+        SampleModes SampleMode = SampleModes.CMJ;
+
         [HelpText("Maximum path length (bounces) to use for path tracing")]
         [MinValue(2)]
         [MaxValue(MaxPathLengthSetting)]
@@ -144,6 +161,56 @@ public class Settings
         [MaxValue(MaxPathLengthSetting)]
         [DisplayName("Max Any-Hit Path Length")]
         int MaxAnyHitPathLength = 1;
+
+        [HelpText("Stops sampling pixels once their estimated error drops below the error threshold, and spends those samples on noisier pixels instead")]
+        bool EnableAdaptiveSampling = false;
+
+        [HelpText("A pixel is converged once the standard error of its mean luminance is below this fraction of the mean")]
+        [MinValue(0.001f)]
+        [MaxValue(1.0f)]
+        [StepSize(0.001f)]
+        [DisplayName("Adaptive Error Threshold")]
+        float AdaptiveErrorThreshold = 0.02f;
+
+        [HelpText("The number of samples that every pixel takes before it can be considered converged")]
+        [MinValue(2)]
+        [MaxValue(1024)]
+        [DisplayName("Adaptive Min Samples")]
+        int AdaptiveMinSamples = 8;
+
+        [HelpText("Noisy pixels can take up to this many times the regular per-pixel sample count")]
+        [MinValue(1)]
+        [MaxValue(16)]
+        [DisplayName("Adaptive Max Sample Scale")]
+        int AdaptiveMaxSampleScale = 4;
+
+        [HelpText("Picks spot lights for each shading point by walking a light hierarchy, instead of evaluating every light")]
+        [DisplayName("Enable Light BVH")]
+        bool EnableLightBVH = false;
+
+        [HelpText("The number of spot lights that are picked from the light hierarchy at each shading point")]
+        [MinValue(1)]
+        [MaxValue(MaxLightSamples)]
+        [DisplayName("Num Light Samples")]
+        int NumLightSamples = 1;
+
+        [HelpText("Importance samples the sky by luminance in the CPU reference path tracer, and combines it with BRDF sampling using multiple importance sampling")]
+        [DisplayName("Enable Sky Importance Sampling")]
+        bool EnableSkyImportanceSampling = true;
+
+        [HelpText("Randomly ends paths with a probability based on their throughput, and scales up the ones that continue to keep the result unbiased")]
+        [DisplayName("Enable Russian Roulette")]
+        bool EnableRussianRoulette = false;
+
+        [HelpText("The path length where Russian roulette starts to be applied")]
+        [MinValue(1)]
+        [MaxValue(MaxPathLengthSetting)]
+        [DisplayName("Russian Roulette Min Depth")]
+        int RussianRouletteMinDepth = 3;
+
+        [HelpText("Tracks a ray cone along each path, and uses its footprint to pick a mip level for every texture lookup instead of always sampling the top mip")]
+        [DisplayName("Enable Ray Cone LOD")]
+        bool EnableRayConeLOD = false;
     }
 
     [ExpandGroup(false)]
@@ -234,5 +301,30 @@ public class Settings
 
         [UseAsShaderConstant(false)]
         bool ShowProgressBar = true;
+
+        [DisplayName("Render CPU Reference")]
+        [HelpText("Renders the current view with the CPU reference path tracer, and saves the result to CPUReference.exr")]
+        Button RenderCPUReference;
+
+        [UseAsShaderConstant(false)]
+        [DisplayName("Enable CPU Denoiser")]
+        [HelpText("Runs an edge-aware denoiser on CPU reference renders, guided by first-hit albedo, normal and depth. The denoised result is saved next to the noisy one.")]
+        bool EnableCPUDenoiser = true;
+
+        [UseAsShaderConstant(false)]
+        [MinValue(1)]
+        [MaxValue(8)]
+        [DisplayName("CPU Denoiser Iterations")]
+        [HelpText("Number of a-trous wavelet iterations for the CPU denoiser, where each one doubles the filter radius")]
+        int CPUDenoiserIterations = 5;
+
+        [UseAsShaderConstant(false)]
+        [DisplayName("Enable CPU Ray Stats")]
+        [HelpText("Counts rays, BVH nodes, triangle tests and any-hit calls in CPU reference renders. The totals are written to the log, and the per-pixel costs are saved next to the image as a heatmap.")]
+        bool EnableCPURayStats = false;
+
+        [DisplayName("Run Sampler Convergence Test")]
+        [HelpText("Compares the integration error of CMJ and Owen-scrambled Sobol samples for a few analytic functions, and writes the results to the log")]
+        Button RunSamplerConvergenceTest;
     }
 }
\ No newline at end of file
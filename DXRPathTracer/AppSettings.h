@@ -41,6 +41,17 @@ enum class ClusterRasterizationModes
 
 typedef EnumSettingT<ClusterRasterizationModes> ClusterRasterizationModesSetting;
 
+enum class SampleModes
+{
+    CMJ = 0,
+    Sobol = 1,
+    SobolTables = 2,
+
+    NumValues
+};
+
+typedef EnumSettingT<SampleModes> SampleModesSetting;
+
 namespace AppSettings
 {
     static const uint64 ClusterTileSize = 16;
@@ -52,7 +63,8 @@ namespace AppSettings
     static const uint64 NumSampleSets = 8;
     static const uint64 SampleTileSize = 32;
     static const uint64 NumPixelsPerTile = 1024;
-    static const uint64 MaxPathLengthSetting = 8;
+    static const uint64 MaxPathLengthSetting = 16;
+    static const uint64 MaxLightSamples = 4;
 
     extern BoolSetting EnableSun;
     extern BoolSetting EnableSky;
@@ -70,8 +82,19 @@ namespace AppSettings
     extern BoolSetting ClampRoughness;
     extern BoolSetting AvoidCausticPaths;
     extern IntSetting SqrtNumSamples;
+    extern SampleModesSetting SampleMode;
     extern IntSetting MaxPathLength;
     extern IntSetting MaxAnyHitPathLength;
+    extern BoolSetting EnableAdaptiveSampling;
+    extern FloatSetting AdaptiveErrorThreshold;
+    extern IntSetting AdaptiveMinSamples;
+    extern IntSetting AdaptiveMaxSampleScale;
+    extern BoolSetting EnableLightBVH;
+    extern IntSetting NumLightSamples;
+    extern BoolSetting EnableSkyImportanceSampling;
+    extern BoolSetting EnableRussianRoulette;
+    extern IntSetting RussianRouletteMinDepth;
+    extern BoolSetting EnableRayConeLOD;
     extern FloatSetting Exposure;
     extern FloatSetting BloomExposure;
     extern FloatSetting BloomMagnitude;
@@ -91,6 +114,11 @@ namespace AppSettings
     extern BoolSetting EnableWhiteFurnaceMode;
     extern BoolSetting AlwaysResetPathTrace;
     extern BoolSetting ShowProgressBar;
+    extern Button RenderCPUReference;
+    extern BoolSetting EnableCPUDenoiser;
+    extern IntSetting CPUDenoiserIterations;
+    extern BoolSetting EnableCPURayStats;
+    extern Button RunSamplerConvergenceTest;
 
     struct AppSettingsCBuffer
     {
@@ -105,8 +133,19 @@ namespace AppSettings
         bool32 ClampRoughness;
         bool32 AvoidCausticPaths;
         int32 SqrtNumSamples;
+        int32 SampleMode;
         int32 MaxPathLength;
         int32 MaxAnyHitPathLength;
+        bool32 EnableAdaptiveSampling;
+        float AdaptiveErrorThreshold;
+        int32 AdaptiveMinSamples;
+        int32 AdaptiveMaxSampleScale;
+        bool32 EnableLightBVH;
+        int32 NumLightSamples;
+        bool32 EnableSkyImportanceSampling;
+        bool32 EnableRussianRoulette;
+        int32 RussianRouletteMinDepth;
+        bool32 EnableRayConeLOD;
         float Exposure;
         float BloomExposure;
         float BloomMagnitude;
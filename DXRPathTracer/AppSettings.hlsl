@@ -11,8 +11,19 @@ struct AppSettings_Layout
     bool ClampRoughness;
     bool AvoidCausticPaths;
     int SqrtNumSamples;
+    int SampleMode;
     int MaxPathLength;
     int MaxAnyHitPathLength;
+    bool EnableAdaptiveSampling;
+    float AdaptiveErrorThreshold;
+    int AdaptiveMinSamples;
+    int AdaptiveMaxSampleScale;
+    bool EnableLightBVH;
+    int NumLightSamples;
+    bool EnableSkyImportanceSampling;
+    bool EnableRussianRoulette;
+    int RussianRouletteMinDepth;
+    bool EnableRayConeLOD;
     float Exposure;
     float BloomExposure;
     float BloomMagnitude;
@@ -46,6 +57,10 @@ static const int ClusterRasterizationModes_MSAA4x = 1;
 static const int ClusterRasterizationModes_MSAA8x = 2;
 static const int ClusterRasterizationModes_Conservative = 3;
 
+static const int SampleModes_CMJ = 0;
+static const int SampleModes_Sobol = 1;
+static const int SampleModes_SobolTables = 2;
+
 static const uint ClusterTileSize = 16;
 static const uint NumZTiles = 16;
 static const uint MaxSpotLights = 32;
@@ -55,4 +70,5 @@ static const float SpotShadowNearClip = 0.1000f;
 static const uint NumSampleSets = 8;
 static const uint SampleTileSize = 32;
 static const uint NumPixelsPerTile = 1024;
-static const uint MaxPathLengthSetting = 8;
+static const uint MaxPathLengthSetting = 16;
+static const uint MaxLightSamples = 4;
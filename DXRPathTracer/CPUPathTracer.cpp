@@ -0,0 +1,1260 @@
+//=================================================================================================
+//
+//  DXR Path Tracer
+//  by MJP
+//  http://mynameismjp.wordpress.com/
+//
+//  All code and content licensed under the MIT license
+//
+//=================================================================================================
+
+#include <PCH.h>
+
+#include "CPUPathTracer.h"
+
+#include <Utility.h>
+#include <Timer.h>
+#include <Graphics/Skybox.h>
+#include <Graphics/Sampling.h>
+#include <Graphics/BRDF.h>
+#include <EnkiTS/TaskScheduler.h>
+
+// Opacity values below this are treated as a miss by the any-hit alpha test
+static const float AlphaTestThreshold = 0.35f;
+
+// A refit BVH gets rebuilt in the background once its SAH cost has grown by this factor
+static const float RebuildSAHRatio = 1.5f;
+
+// Upper limit on the number of paths that a tile pushes through the pipeline at once
+static const uint32 MaxWavefrontPaths = 16 * 1024;
+
+// Ray origins are sorted by their cell in a grid of this many cells per axis
+static const uint32 SortGridSize = 512;
+
+// How much of the latest render time gets blended into a tile's cost history
+static const float TileCostBlend = 0.5f;
+
+// Memory for decoded texture tiles that's shared by all of the worker threads
+static const uint64 TextureCacheSize = 256 * 1024 * 1024;
+
+// Precomputed Sobol tiles fall back to generating samples on the fly if they'd need more memory than this
+static const uint64 MaxSampleTableSize = 256 * 1024 * 1024;
+
+static_assert((AppSettings::SampleTileSize & (AppSettings::SampleTileSize - 1)) == 0, "Morton tile order needs a power-of-2 tile size");
+
+static Float3 Reflect(const Float3& i, const Float3& n)
+{
+    return i - 2.0f * Float3::Dot(n, i) * n;
+}
+
+// Weight for combining two sampling techniques with multiple importance sampling [Veach95]
+static float PowerHeuristic(float pdf, float otherPDF)
+{
+    if(pdf <= 0.0f)
+        return 0.0f;
+    return (pdf * pdf) / (pdf * pdf + otherPDF * otherPDF);
+}
+
+// Widens the ray cone after a bounce by roughly the angular width of the sampled lobe, same as RayTrace.hlsl
+static float BounceConeSpread(float coneSpread, bool diffuse, float roughness)
+{
+    return coneSpread + 2.0f * (diffuse ? 1.0f : roughness);
+}
+
+// Stop using the any-hit shader once we've hit the max path length, since it's *really* expensive
+static uint32 PathRayFlags(uint32 pathLength)
+{
+    return int32(pathLength) > AppSettings::MaxAnyHitPathLength ? BVHRayFlag_ForceOpaque : BVHRayFlag_None;
+}
+
+// Spreads the low 9 bits out so that there are 2 zero bits between each of them
+static uint32 SpreadBits3D(uint32 x)
+{
+    x &= 0x1FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+static uint32 MortonCode3D(uint32 x, uint32 y, uint32 z)
+{
+    return SpreadBits3D(x) | (SpreadBits3D(y) << 1) | (SpreadBits3D(z) << 2);
+}
+
+// Spreads the low 16 bits out so that there's a zero bit between each of them
+static uint32 SpreadBits2D(uint32 x)
+{
+    x &= 0xFFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+static uint32 MortonCode2D(uint32 x, uint32 y)
+{
+    return SpreadBits2D(x) | (SpreadBits2D(y) << 1);
+}
+
+static void AddTraversalStats(BVHTraversalStats& dst, const BVHTraversalStats& src)
+{
+    dst.NumNodesVisited += src.NumNodesVisited;
+    dst.NumTriangleTests += src.NumTriangleTests;
+    dst.NumAnyHitCalls += src.NumAnyHitCalls;
+}
+
+void CPUPathTracer::Initialize(const Model* sceneModel, enki::TaskScheduler* taskScheduler)
+{
+    Shutdown();
+
+    model = sceneModel;
+    scheduler = taskScheduler;
+
+    BVH& bvh = bvhs[currBVH];
+    bvh.Initialize(*model, scheduler);
+
+    const BVHBuildStats& stats = bvh.BuildStats();
+    WriteLog("CPU BVH %s: %u triangles, %u nodes (%u interior, %u leaves), max depth %u, SAH cost %.2f, "
+             "%u 8-wide nodes, %u triangle packets, %.2f ms", stats.LoadedFromCache ? "cache load" : "build", stats.NumTriangles, stats.NumNodes, stats.NumInteriorNodes,
+             stats.NumLeaves, stats.MaxDepth, stats.SAHCost, stats.NumWideNodes, stats.NumTrianglePackets, stats.BuildTimeMS);
+
+    // Load the material textures on the CPU, using the same sRGB logic as LoadMaterialResources()
+    const GrowableList<MaterialTexture*>& materialTextures = model->MaterialTextures();
+    const uint64 numTextures = materialTextures.Count();
+    Array<uint8> useSRGB(numTextures, 0);
+    Array<uint8> visited(numTextures, 0);
+    Array<uint8> isOpacity(numTextures, 0);
+    for(const MeshMaterial& material : model->Materials())
+    {
+        const uint32 opacityTexIdx = material.TextureIndices[uint64(MaterialTextures::Opacity)];
+        if(opacityTexIdx < numTextures)
+            isOpacity[opacityTexIdx] = 1;
+
+        for(uint64 texType = 0; texType < uint64(MaterialTextures::Count); ++texType)
+        {
+            const uint32 texIdx = material.TextureIndices[texType];
+            if(texIdx >= numTextures || visited[texIdx])
+                continue;
+
+            visited[texIdx] = 1;
+            useSRGB[texIdx] = model->ForceSRGB() && texType == uint64(MaterialTextures::Albedo) ? 1 : 0;
+        }
+    }
+
+    // BC textures get sampled straight from their compressed blocks, so the only ones that need to be
+    // decoded up front are the opacity maps that the micromap is built from
+    Array<TextureData<Float4>> textures(numTextures);
+    Array<BCTextureData> bcTextures(numTextures);
+    for(uint64 i = 0; i < numTextures; ++i)
+    {
+        const wchar* filePath = materialTextures[i]->Name.c_str();
+        const bool compressed = LoadBCTextureData(filePath, bcTextures[i], useSRGB[i] != 0);
+        if(compressed == false || isOpacity[i])
+            LoadTextureData(filePath, textures[i], useSRGB[i] != 0);
+    }
+
+    // Classify alpha-tested triangles up front, so that the alpha test only runs where it's needed
+    opacityMicromap.Initialize(*model, textures, AlphaTestThreshold, scheduler);
+    bvhs[0].SetOpacityMicromap(&opacityMicromap);
+    bvhs[1].SetOpacityMicromap(&opacityMicromap);
+
+    // Shading reads the textures through the texture cache, so the loaded copies can go away after this
+    textureCache.Initialize(textures, bcTextures, TextureCacheSize);
+
+    // Pixels within a tile are rendered in Morton order, which keeps consecutive paths close together on screen
+    const uint32 tileSize = uint32(AppSettings::SampleTileSize);
+    tilePixelOrder.Init(AppSettings::NumPixelsPerTile);
+    for(uint32 y = 0; y < tileSize; ++y)
+        for(uint32 x = 0; x < tileSize; ++x)
+            tilePixelOrder[MortonCode2D(x, y)] = x | (y << 16);
+
+    const OpacityMicromapStats& ommStats = opacityMicromap.Stats();
+    WriteLog("CPU opacity micromap%s: %u alpha-tested triangles (%u opaque, %u transparent, %u unknown, %u subdivided), "
+             "%.1f%% unknown micro-triangles, %.2f ms", ommStats.LoadedFromCache ? " (cached)" : "", ommStats.NumAlphaTestedTriangles,
+             ommStats.NumOpaqueTriangles, ommStats.NumTransparentTriangles, ommStats.NumUnknownTriangles, ommStats.NumSubdividedTriangles,
+             ommStats.UnknownMicroTriangleFraction * 100.0f, ommStats.BuildTimeMS);
+}
+
+void CPUPathTracer::Shutdown()
+{
+    if(rebuildPending)
+    {
+        rebuildThread.join();
+        rebuildPending = false;
+    }
+
+    for(BVH& bvh : bvhs)
+    {
+        bvh.SetOpacityMicromap(nullptr);
+        bvh.Shutdown();
+    }
+    currBVH = 0;
+    opacityMicromap.Shutdown();
+    sunShadowBatch.ChildOrders.Shutdown();
+    wavefronts.Shutdown();
+    tileQueues.Shutdown();
+    tileOrder.Shutdown();
+    tileCosts.Shutdown();
+    tileCostsWidth = 0;
+    tileCostsHeight = 0;
+    tilePixelOrder.Shutdown();
+    textureCache.Shutdown();
+    sampleTable.Shutdown();
+    model = nullptr;
+    scheduler = nullptr;
+}
+
+void CPUPathTracer::UpdateGeometry()
+{
+    Assert_(model != nullptr && scheduler != nullptr);
+
+    SwapRebuiltBVH();
+
+    BVH& bvh = bvhs[currBVH];
+    bvh.Refit(*model, scheduler);
+
+    const BVHRefitStats& stats = bvh.RefitStats();
+    if(rebuildPending || stats.SAHRatio <= RebuildSAHRatio)
+        return;
+
+    WriteLog("CPU BVH SAH cost went from %.2f to %.2f after %u refits, starting a background rebuild",
+             bvh.BuildStats().SAHCost, stats.SAHCost, stats.NumRefits);
+
+    // The rebuild works on its own copy of the triangles, so that the current BVH can keep being refit
+    BVH& rebuildBVH = bvhs[currBVH ^ 1];
+    rebuildBVH.CopyTriangles(bvh);
+
+    // The build runs single-threaded, since only the task scheduler's own threads can add task sets to it
+    rebuildComplete = false;
+    rebuildThread = std::thread([this, &rebuildBVH]()
+    {
+        rebuildBVH.Rebuild(nullptr);
+        rebuildComplete = true;
+    });
+
+    rebuildPending = true;
+}
+
+// Switches over to the BVH from a finished background rebuild
+void CPUPathTracer::SwapRebuiltBVH()
+{
+    if(rebuildPending == false || rebuildComplete == false)
+        return;
+
+    rebuildThread.join();
+    rebuildPending = false;
+
+    // The geometry may have moved again while it was being rebuilt
+    BVH& rebuiltBVH = bvhs[currBVH ^ 1];
+    rebuiltBVH.Refit(*model, scheduler);
+
+    bvhs[currBVH].Shutdown();
+    currBVH ^= 1;
+
+    const BVHBuildStats& stats = rebuiltBVH.BuildStats();
+    WriteLog("CPU BVH background rebuild: SAH cost %.2f, %.2f ms", rebuiltBVH.RefitStats().SAHCost, stats.BuildTimeMS);
+}
+
+void CPUPathTracer::Render(const CPUPathTracerParams& renderParams, TextureData<Float4>& output, DenoiserAOVs* aovs)
+{
+    Assert_(model != nullptr && scheduler != nullptr);
+    Assert_(renderParams.SkyCache != nullptr);
+
+    Timer renderTimer;
+
+    SwapRebuiltBVH();
+    const BVH& bvh = bvhs[currBVH];
+    const bool rebuildRunning = rebuildPending;
+
+    output.Init(renderParams.Width, renderParams.Height, 1);
+    output.Texels.Fill(Float4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    params = &renderParams;
+    target = &output;
+    aovTarget = aovs;
+    if(aovs != nullptr)
+        aovs->Init(renderParams.Width, renderParams.Height);
+
+    // Every sun shadow ray has the same direction, so the traversal order only needs to be set up once
+    bvh.PrepareOcclusionBatch(renderParams.SunDirectionWS, sunShadowBatch);
+
+    // Ray origins get sorted by their cell in a grid that covers the scene
+    const Float3 sceneExtents = model->AABBMax() - model->AABBMin();
+    sortBoundsMin = model->AABBMin();
+    sortBoundsScale.x = float(SortGridSize) / Max(sceneExtents.x, 0.0001f);
+    sortBoundsScale.y = float(SortGridSize) / Max(sceneExtents.y, 0.0001f);
+    sortBoundsScale.z = float(SortGridSize) / Max(sceneExtents.z, 0.0001f);
+
+    // Each worker thread keeps its own wavefront, so that the queues are only allocated once
+    const uint32 numThreads = scheduler->GetNumTaskThreads();
+    if(wavefronts.Size() != numThreads)
+        wavefronts.Init(numThreads);
+
+    for(Wavefront& wavefront : wavefronts)
+    {
+        std::fill(std::begin(wavefront.PathLengthCounts), std::end(wavefront.PathLengthCounts), 0);
+        wavefront.RayStats = CPURayStats();
+    }
+
+    if(AppSettings::EnableCPURayStats)
+        rayStatsHeatmap.Init(renderParams.Width, renderParams.Height, 1);
+
+    textureCache.ResetStats();
+
+    // The sample tables cover the same tiles that the image gets split into. Every bounce can take a sample
+    // for each picked light, the sky, the BRDF, and Russian roulette, plus one for the primary ray.
+    if(AppSettings::SampleMode == SampleModes::SobolTables)
+    {
+        const uint32 numSamples = uint32(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples);
+        const uint32 numDimensions = 1 + uint32(AppSettings::MaxPathLength) * (uint32(AppSettings::NumLightSamples) + 3);
+        if(sampleTable.NumSamples() != numSamples || sampleTable.NumDimensions() != numDimensions)
+        {
+            Timer timer;
+            if(sampleTable.Initialize(uint32(AppSettings::SampleTileSize), numSamples, numDimensions, MaxSampleTableSize))
+            {
+                timer.Update();
+                WriteLog("CPU Sobol sample table: %u samples x %u dimensions, %.2f MB, %.2f ms", numSamples, numDimensions,
+                         sampleTable.MemorySize() / (1024.0 * 1024.0), timer.ElapsedMillisecondsF());
+            }
+            else
+            {
+                WriteLog("CPU Sobol sample table for %u samples x %u dimensions is over the %llu MB limit, generating samples on the fly instead",
+                         numSamples, numDimensions, MaxSampleTableSize / (1024 * 1024));
+            }
+        }
+    }
+
+    const uint32 numTilesX = (renderParams.Width + uint32(AppSettings::SampleTileSize) - 1) / uint32(AppSettings::SampleTileSize);
+    const uint32 numTilesY = (renderParams.Height + uint32(AppSettings::SampleTileSize) - 1) / uint32(AppSettings::SampleTileSize);
+    const uint32 numTiles = numTilesX * numTilesY;
+
+    // The cost history only carries over between renders at the same resolution
+    if(tileCostsWidth != renderParams.Width || tileCostsHeight != renderParams.Height)
+    {
+        tileCosts.Init(numTiles, 0.0f);
+        tileCostsWidth = renderParams.Width;
+        tileCostsHeight = renderParams.Height;
+    }
+
+    BuildTileQueues(numTiles, numThreads);
+
+    // One task per queue, with each one claiming tiles until there are none left in any queue
+    enki::TaskSet taskSet(numThreads, [this](enki::TaskSetPartition range, uint32_t threadNum)
+    {
+        for(uint32 queueIdx = range.start; queueIdx < range.end; ++queueIdx)
+            RenderTiles(queueIdx, wavefronts[threadNum]);
+    });
+
+    scheduler->AddTaskSetToPipe(&taskSet);
+    scheduler->WaitforTaskSet(&taskSet);
+
+    uint64 numPaths = 0;
+    uint64 totalPathLength = 0;
+    for(const Wavefront& wavefront : wavefronts)
+    {
+        for(uint32 pathLength = 1; pathLength < ArraySize_(wavefront.PathLengthCounts); ++pathLength)
+        {
+            numPaths += wavefront.PathLengthCounts[pathLength];
+            totalPathLength += wavefront.PathLengthCounts[pathLength] * pathLength;
+        }
+    }
+    avgPathLength = numPaths > 0 ? float(double(totalPathLength) / double(numPaths)) : 0.0f;
+
+    // Every thread counted into its own wavefront, so the totals only need to be summed up here
+    rayStats = CPURayStats();
+    for(const Wavefront& wavefront : wavefronts)
+    {
+        for(uint32 pathLength = 0; pathLength < ArraySize_(rayStats.NumRays); ++pathLength)
+            rayStats.NumRays[pathLength] += wavefront.RayStats.NumRays[pathLength];
+        rayStats.NumShadowRays += wavefront.RayStats.NumShadowRays;
+        rayStats.NumUnoccludedShadowRays += wavefront.RayStats.NumUnoccludedShadowRays;
+        AddTraversalStats(rayStats.Traversal, wavefront.RayStats.Traversal);
+    }
+
+    // A background rebuild shouldn't slow down rendering, so log the render time next to the last one
+    // without a rebuild to check that it stays flat
+    renderTimer.Update();
+    const float renderTimeMS = renderTimer.ElapsedMillisecondsF();
+    if(rebuildRunning)
+        WriteLog("CPU render during a background BVH rebuild: %.2f ms (%.2f ms without one)", renderTimeMS, lastRenderTimeMS);
+    else
+        lastRenderTimeMS = renderTimeMS;
+
+    params = nullptr;
+    target = nullptr;
+    aovTarget = nullptr;
+}
+
+// Sorts the tiles by their cost from previous renders, and deals them out round-robin so that
+// every queue starts with one of the most expensive tiles
+void CPUPathTracer::BuildTileQueues(uint32 numTiles, uint32 numQueues)
+{
+    Array<uint32> sortedTiles(numTiles);
+    for(uint32 tileIdx = 0; tileIdx < numTiles; ++tileIdx)
+        sortedTiles[tileIdx] = tileIdx;
+
+    std::stable_sort(sortedTiles.Data(), sortedTiles.Data() + numTiles, [this](uint32 a, uint32 b)
+    {
+        return tileCosts[a] > tileCosts[b];
+    });
+
+    if(tileQueues.Size() != numQueues)
+        tileQueues.Init(numQueues);
+    if(tileOrder.Size() != numTiles)
+        tileOrder.Init(numTiles);
+
+    uint32 start = 0;
+    for(uint32 queueIdx = 0; queueIdx < numQueues; ++queueIdx)
+    {
+        TileQueue& queue = tileQueues[queueIdx];
+        queue.NextTile.store(0, std::memory_order_relaxed);
+        queue.Start = start;
+        queue.NumTiles = 0;
+
+        for(uint32 i = queueIdx; i < numTiles; i += numQueues)
+            tileOrder[start + queue.NumTiles++] = sortedTiles[i];
+
+        start += queue.NumTiles;
+    }
+}
+
+// Renders all tiles from a worker's own queue, and then steals from the other queues. Claiming a tile is
+// a single atomic increment, and since every queue is sorted by cost a thief also picks up the most
+// expensive tile that hasn't been started yet.
+void CPUPathTracer::RenderTiles(uint32 queueIdx, Wavefront& wavefront)
+{
+    const uint32 numQueues = uint32(tileQueues.Size());
+    for(uint32 i = 0; i < numQueues; ++i)
+    {
+        TileQueue& queue = tileQueues[(queueIdx + i) % numQueues];
+        while(true)
+        {
+            const uint32 queueTileIdx = queue.NextTile.fetch_add(1, std::memory_order_relaxed);
+            if(queueTileIdx >= queue.NumTiles)
+                break;
+
+            const uint32 tileIdx = tileOrder[queue.Start + queueTileIdx];
+
+            Timer timer;
+            RenderTile(tileIdx, wavefront);
+            timer.Update();
+
+            // Only one worker renders a given tile, so its history can be updated without synchronization
+            const float cost = timer.ElapsedMillisecondsF();
+            const float prevCost = tileCosts[tileIdx];
+            tileCosts[tileIdx] = prevCost > 0.0f ? Lerp(prevCost, cost, TileCostBlend) : cost;
+        }
+    }
+}
+
+// Renders a tile as a series of waves, where each wave runs all samples for a group of pixels.
+// Instead of recursively tracing each path, all paths in the wave advance one bounce at a time
+// through the extend, shade, and shadow stages, with rays and hits sorted before each stage.
+void CPUPathTracer::RenderTile(uint32 tileIdx, Wavefront& wavefront)
+{
+    const uint32 width = params->Width;
+    const uint32 height = params->Height;
+    const uint32 tileSize = uint32(AppSettings::SampleTileSize);
+    const uint32 numTilesX = (width + tileSize - 1) / tileSize;
+
+    const uint32 startX = (tileIdx % numTilesX) * tileSize;
+    const uint32 startY = (tileIdx / numTilesX) * tileSize;
+    const uint32 endX = Min(startX + tileSize, width);
+    const uint32 endY = Min(startY + tileSize, height);
+
+    // Tiles along the right and bottom edges of the image skip the pixels that are out of bounds
+    if(wavefront.TilePixels.Size() == 0)
+        wavefront.TilePixels.Init(AppSettings::NumPixelsPerTile);
+
+    uint32 numTilePixels = 0;
+    for(uint64 i = 0; i < tilePixelOrder.Size(); ++i)
+    {
+        const uint32 x = startX + (tilePixelOrder[i] & 0xFFFF);
+        const uint32 y = startY + (tilePixelOrder[i] >> 16);
+        if(x < endX && y < endY)
+            wavefront.TilePixels[numTilePixels++] = y * width + x;
+    }
+
+    const uint32 numSamples = uint32(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples);
+    const uint32 pixelsPerWave = Max(MaxWavefrontPaths / numSamples, 1u);
+    const uint32 maxPaths = pixelsPerWave * numSamples;
+
+    // Every shading point can queue up a shadow ray for each spot light or light BVH sample, one for the
+    // sampled sky direction, and one for the sky in the BRDF direction
+    if(wavefront.Paths.Size() < maxPaths)
+    {
+        wavefront.Paths.Init(maxPaths);
+        wavefront.ExtensionRays[0].Reserve(maxPaths);
+        wavefront.ExtensionRays[1].Reserve(maxPaths);
+        wavefront.Hits.Hits.Init(maxPaths);
+        wavefront.Hits.RayIdx.Init(maxPaths);
+        wavefront.Hits.SortedHits.Init(maxPaths);
+        wavefront.SunShadowRays.Reserve(maxPaths);
+    }
+    wavefront.ShadowRays.Reserve(uint64(maxPaths) * (Max<uint64>(params->NumLights, AppSettings::MaxLightSamples) + 2));
+
+    for(uint32 firstPixel = 0; firstPixel < numTilePixels; firstPixel += pixelsPerWave)
+    {
+        const uint32 numWavePixels = Min(pixelsPerWave, numTilePixels - firstPixel);
+        const uint32 numPaths = numWavePixels * numSamples;
+
+        // Generate a primary ray for every path
+        RayQueue& primaryRays = wavefront.ExtensionRays[0];
+        primaryRays.Count = 0;
+
+        for(uint32 pathIdx = 0; pathIdx < numPaths; ++pathIdx)
+        {
+            const uint32 pixelIdx = wavefront.TilePixels[firstPixel + pathIdx / numSamples];
+            const uint32 x = pixelIdx % width;
+            const uint32 y = pixelIdx / width;
+
+            PathState& pathState = wavefront.Paths[pathIdx];
+            pathState = PathState();
+            pathState.PathLength = 1;
+            pathState.ConeSpread = params->PixelSpreadAngle;
+            pathState.PixelIdx = pixelIdx;
+            pathState.SampleIdx = pathIdx % numSamples;
+            pathState.SampleSetIdx = 0;
+
+            // Form a primary ray by un-projecting the pixel coordinate using the inverse view * projection matrix
+            const Float2 primaryRaySample = SamplePoint(pathState);
+
+            const float ncdX = ((x + primaryRaySample.x) / (width * 0.5f)) - 1.0f;
+            const float ncdY = -(((y + primaryRaySample.y) / (height * 0.5f)) - 1.0f);
+            const Float4 rayStart = Float4::Transform(Float4(ncdX, ncdY, 0.0f, 1.0f), params->InvViewProjection);
+            const Float4 rayEnd = Float4::Transform(Float4(ncdX, ncdY, 1.0f, 1.0f), params->InvViewProjection);
+
+            const Float3 rayStartPos = rayStart.To3D() / rayStart.w;
+            const Float3 rayEndPos = rayEnd.To3D() / rayEnd.w;
+
+            BVHRay ray;
+            ray.Origin = rayStartPos;
+            ray.Direction = Float3::Normalize(rayEndPos - rayStartPos);
+            ray.TMin = 0.0f;
+            ray.TMax = Float3::Length(rayEndPos - rayStartPos);
+
+            primaryRays.Add(ray, PathRayFlags(pathState.PathLength), pathIdx);
+        }
+
+        // Push the paths through one bounce at a time, until none of them are left
+        uint32 currQueue = 0;
+        while(wavefront.ExtensionRays[currQueue].Count > 0)
+        {
+            RayQueue& rays = wavefront.ExtensionRays[currQueue];
+            RayQueue& nextRays = wavefront.ExtensionRays[currQueue ^ 1];
+            nextRays.Count = 0;
+            wavefront.ShadowRays.Count = 0;
+            wavefront.SunShadowRays.Count = 0;
+
+            ExtendPaths(wavefront, rays);
+            ShadePaths(wavefront, rays, nextRays);
+            ConnectShadowRays(wavefront);
+
+            currQueue ^= 1;
+        }
+
+        for(uint32 wavePixelIdx = 0; wavePixelIdx < numWavePixels; ++wavePixelIdx)
+        {
+            const PathState* pixelPaths = &wavefront.Paths[wavePixelIdx * numSamples];
+            Float3 currValue;
+            float luminanceMean = 0.0f;
+            float luminanceM2 = 0.0f;
+            Float3 albedoSum;
+            Float3 normalSum;
+            float depthSum = 0.0f;
+            uint32 numHits = 0;
+            BVHTraversalStats pixelTraversal;
+
+            for(uint32 sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+            {
+                const PathState& pathState = pixelPaths[sampleIdx];
+                const Float3 radiance = Float3::Clamp(pathState.Radiance, 0.0f, FP16Max);
+                wavefront.PathLengthCounts[pathState.PathLength] += 1;
+
+                // Update the progressive result with the new radiance sample
+                const float lerpFactor = sampleIdx / (sampleIdx + 1.0f);
+                currValue = Lerp(radiance, currValue, lerpFactor);
+
+                // Running luminance variance [Welford62], and the first-hit AOVs
+                const float luminance = ComputeLuminance(radiance);
+                const float delta = luminance - luminanceMean;
+                luminanceMean += delta / (sampleIdx + 1.0f);
+                luminanceM2 += delta * (luminance - luminanceMean);
+
+                AddTraversalStats(pixelTraversal, pathState.Traversal);
+
+                albedoSum += pathState.FirstHitAlbedo;
+                if(pathState.FirstHitDepth > 0.0f)
+                {
+                    normalSum += pathState.FirstHitNormal;
+                    depthSum += pathState.FirstHitDepth;
+                    numHits += 1;
+                }
+            }
+
+            const uint32 pixelIdx = pixelPaths[0].PixelIdx;
+            target->Texels[pixelIdx] = Float4(currValue, 1.0f);
+
+            if(AppSettings::EnableCPURayStats)
+            {
+                AddTraversalStats(wavefront.RayStats.Traversal, pixelTraversal);
+                const float invNumSamples = 1.0f / numSamples;
+                rayStatsHeatmap.Texels[pixelIdx] = Float4(pixelTraversal.NumNodesVisited * invNumSamples, pixelTraversal.NumTriangleTests * invNumSamples,
+                                                          pixelTraversal.NumAnyHitCalls * invNumSamples, 1.0f);
+            }
+
+            if(aovTarget != nullptr)
+            {
+                const float normalLength = Float3::Length(normalSum);
+                aovTarget->Albedo.Texels[pixelIdx] = Float4(albedoSum / float(numSamples), 1.0f);
+                aovTarget->Normal.Texels[pixelIdx] = Float4(normalLength > 0.0f ? normalSum / normalLength : Float3(0.0f), 0.0f);
+                aovTarget->Depth.Texels[pixelIdx] = numHits > 0 ? depthSum / numHits : 0.0f;
+
+                // Variance of the mean, where a single sample has nothing to go on besides its own magnitude
+                aovTarget->Variance.Texels[pixelIdx] = numSamples > 1 ? luminanceM2 / ((numSamples - 1.0f) * numSamples) : luminanceMean * luminanceMean;
+            }
+        }
+    }
+}
+
+Float2 CPUPathTracer::SamplePoint(PathState& pathState) const
+{
+    const uint32 setIdx = pathState.SampleSetIdx;
+    if(AppSettings::SampleMode == SampleModes::SobolTables && sampleTable.Contains(pathState.SampleIdx, setIdx))
+    {
+        pathState.SampleSetIdx += 1;
+        return sampleTable.Sample(pathState.PixelIdx % params->Width, pathState.PixelIdx / params->Width, pathState.SampleIdx, setIdx);
+    }
+    else if(AppSettings::SampleMode != SampleModes::CMJ)
+    {
+        pathState.SampleSetIdx += 1;
+        return SampleSobol2D(pathState.SampleIdx, SobolSeed(pathState.PixelIdx, setIdx));
+    }
+
+    const uint32 totalNumPixels = params->Width * params->Height;
+    const uint32 permutation = pathState.SampleSetIdx * totalNumPixels + pathState.PixelIdx;
+    pathState.SampleSetIdx += 1;
+
+    const uint32 sqrtNumSamples = uint32(AppSettings::SqrtNumSamples);
+    return SampleCMJ2D(pathState.SampleIdx, sqrtNumSamples, sqrtNumSamples, permutation);
+}
+
+// Finds the closest hit for every queued extension ray. Misses are resolved right away, while hits
+// get sorted by material so that shading works through one material's textures at a time.
+void CPUPathTracer::ExtendPaths(Wavefront& wavefront, RayQueue& rays) const
+{
+    const BVH& bvh = bvhs[currBVH];
+    const bool gatherStats = AppSettings::EnableCPURayStats;
+    SortRays(rays);
+
+    HitQueue& hits = wavefront.Hits;
+    hits.Count = 0;
+
+    for(uint32 i = 0; i < rays.Count; ++i)
+    {
+        const uint32 rayIdx = uint32(rays.SortedRays[i]);
+        const BVHRay ray = rays.Ray(rayIdx);
+        PathState& pathState = wavefront.Paths[rays.PathIdx[rayIdx]];
+
+        if(gatherStats)
+            wavefront.RayStats.NumRays[pathState.PathLength] += 1;
+
+        BVHHit hit;
+        if(bvh.TraceRay(ray, rays.Flags[rayIdx], hit, AnyHit, const_cast<CPUPathTracer*>(this), gatherStats ? &pathState.Traversal : nullptr) == false)
+        {
+            pathState.Radiance += pathState.Throughput * Miss(ray.Direction, pathState);
+            continue;
+        }
+
+        const uint32 materialIdx = model->Meshes()[hit.GeometryIdx].MeshParts()[0].MaterialIdx;
+        hits.Hits[hits.Count] = hit;
+        hits.RayIdx[hits.Count] = rayIdx;
+        hits.SortedHits[hits.Count] = (uint64(materialIdx) << 32) | hits.Count;
+        hits.Count += 1;
+    }
+
+    std::sort(hits.SortedHits.Data(), hits.SortedHits.Data() + hits.Count);
+}
+
+void CPUPathTracer::ShadePaths(Wavefront& wavefront, const RayQueue& rays, RayQueue& nextRays) const
+{
+    const HitQueue& hits = wavefront.Hits;
+    for(uint32 i = 0; i < hits.Count; ++i)
+    {
+        const uint32 hitIdx = uint32(hits.SortedHits[i]);
+        const BVHHit& hit = hits.Hits[hitIdx];
+        const uint32 rayIdx = hits.RayIdx[hitIdx];
+
+        float triangleLODConstant = 0.0f;
+        const MeshVertex hitSurface = GetHitSurface(hit, &triangleLODConstant);
+        const MeshMaterial& material = GetGeometryMaterial(hit.GeometryIdx);
+
+        Shade(hitSurface, material, rays.Ray(rayIdx), hit.T, triangleLODConstant, rays.PathIdx[rayIdx], wavefront, nextRays);
+    }
+}
+
+// Shades a hit point for a path, with the same estimator as PathTrace() in RayTrace.hlsl. Emission is
+// added to the path directly, while shadow rays and the next bounce are queued up for later stages.
+void CPUPathTracer::Shade(const MeshVertex& hitSurface, const MeshMaterial& material, const BVHRay& incomingRay, float hitDistance,
+                          float triangleLODConstant, uint32 pathIdx, Wavefront& wavefront, RayQueue& nextRays) const
+{
+    PathState& pathState = wavefront.Paths[pathIdx];
+
+    if((!AppSettings::EnableDiffuse && !AppSettings::EnableSpecular) ||
+        (!AppSettings::EnableDirect && !AppSettings::EnableIndirect))
+        return;
+
+    if(pathState.PathLength > 1 && !AppSettings::EnableIndirect)
+        return;
+
+    Float3x3 tangentToWorld = Float3x3(hitSurface.Tangent, hitSurface.Bitangent, hitSurface.Normal);
+
+    const Float3 positionWS = hitSurface.Position;
+
+    const Float3 incomingRayOriginWS = incomingRay.Origin;
+    const Float3 incomingRayDirWS = incomingRay.Direction;
+
+    // Grow the ray cone out to the hit point, and project its width onto the triangle's UV space [AkenineMoller21]
+    const float coneWidth = Max(pathState.ConeWidth + pathState.ConeSpread * hitDistance, 0.00001f);
+    const float coneLOD = triangleLODConstant + std::log2(coneWidth / Max(std::abs(Float3::Dot(hitSurface.Normal, incomingRayDirWS)), 0.0001f));
+
+    Float3 normalWS = hitSurface.Normal;
+    if(AppSettings::EnableNormalMaps)
+    {
+        // Sample the normal map, and convert the normal to world space
+        const Float4 normalMapSample = SampleMaterialTexture(material, MaterialTextures::Normal, hitSurface.UV, coneLOD);
+
+        Float3 normalTS;
+        normalTS.x = normalMapSample.x * 2.0f - 1.0f;
+        normalTS.y = normalMapSample.y * 2.0f - 1.0f;
+        normalTS.z = std::sqrt(1.0f - Saturate(normalTS.x * normalTS.x + normalTS.y * normalTS.y));
+        normalWS = Float3::Normalize(Float3::Transform(normalTS, tangentToWorld));
+
+        tangentToWorld.SetZBasis(normalWS);
+    }
+
+    Float3 baseColor = 1.0f;
+    if(AppSettings::EnableAlbedoMaps && !AppSettings::EnableWhiteFurnaceMode)
+        baseColor = SampleMaterialTexture(material, MaterialTextures::Albedo, hitSurface.UV, coneLOD).To3D();
+
+    const float metallicSample = AppSettings::EnableWhiteFurnaceMode ? 1.0f : SampleMaterialTexture(material, MaterialTextures::Metallic, hitSurface.UV, coneLOD).x;
+    const float metallic = Saturate(metallicSample * AppSettings::MetallicScale);
+
+    // The denoiser's albedo includes both lobes, so that it can be divided out of all of the lighting
+    if(pathState.PathLength == 1)
+    {
+        pathState.FirstHitAlbedo = Lerp(baseColor, Float3(0.0f), metallic) + Lerp(Float3(0.03f), baseColor, metallic);
+        pathState.FirstHitNormal = normalWS;
+        pathState.FirstHitDepth = Float3::Length(positionWS - params->CameraPosWS);
+    }
+
+    const bool enableDiffuse = (AppSettings::EnableDiffuse && metallic < 1.0f) || AppSettings::EnableWhiteFurnaceMode;
+    const bool enableSpecular = (AppSettings::EnableSpecular && (AppSettings::EnableIndirectSpecular ? !(AppSettings::AvoidCausticPaths && pathState.IsDiffuse) : (pathState.PathLength == 1)));
+
+    if(enableDiffuse == false && enableSpecular == false)
+        return;
+
+    const float roughnessSample = AppSettings::EnableWhiteFurnaceMode ? 1.0f : SampleMaterialTexture(material, MaterialTextures::Roughness, hitSurface.UV, coneLOD).x;
+    const float sqrtRoughness = Saturate(roughnessSample * AppSettings::RoughnessScale);
+
+    const Float3 diffuseAlbedo = Lerp(baseColor, Float3(0.0f), metallic) * (enableDiffuse ? 1.0f : 0.0f);
+    const Float3 specularAlbedo = Lerp(Float3(0.03f), baseColor, metallic) * (enableSpecular ? 1.0f : 0.0f);
+    float roughness = sqrtRoughness * sqrtRoughness;
+    if(AppSettings::ClampRoughness)
+        roughness = Max(roughness, pathState.Roughness);
+
+    Float3 msEnergyCompensation = 1.0f;
+    if(AppSettings::ApplyMultiscatteringEnergyCompensation)
+    {
+        Float2 DFG = GGXEnvironmentBRDFScaleBias(Saturate(Float3::Dot(normalWS, -incomingRayDirWS)), sqrtRoughness);
+
+        // Improve energy preservation by applying a scaled version of the original
+        // single scattering specular lobe. Based on "Practical multiple scattering
+        // compensation for microfacet models" [Turquin19].
+        float Ess = DFG.x;
+        msEnergyCompensation = Float3(1.0f) + specularAlbedo * (1.0f / Ess - 1.0f);
+    }
+
+    // White furnace mode replaces all of the lighting at the last vertex with the path throughput,
+    // and direct lighting is skipped for the first hit when it's disabled
+    const bool applyDirectLighting = (pathState.PathLength > 1 || AppSettings::EnableDirect) && !AppSettings::EnableWhiteFurnaceMode;
+    if(applyDirectLighting)
+    {
+        const Float3 emissive = SampleMaterialTexture(material, MaterialTextures::Emissive, hitSurface.UV, coneLOD).To3D();
+        pathState.Radiance += pathState.Throughput * emissive;
+
+        // Stop using the any-hit shader once we've hit the max path length, since it's *really* expensive
+        const uint32 shadowRayFlags = PathRayFlags(pathState.PathLength);
+
+        // Apply sun light
+        if(AppSettings::EnableSun)
+        {
+            Float3 sunDirection = params->SunDirectionWS;
+
+            if(AppSettings::SunAreaLightApproximation)
+            {
+                Float3 D = params->SunDirectionWS;
+                Float3 R = Reflect(incomingRayDirWS, normalWS);
+                float r = params->SinSunAngularRadius;
+                float d = params->CosSunAngularRadius;
+                float DDotR = Float3::Dot(D, R);
+                Float3 S = R - DDotR * D;
+                sunDirection = DDotR < d ? Float3::Normalize(d * D + Float3::Normalize(S) * r) : R;
+            }
+
+            // Queue up a shadow ray to see if the sun is occluded
+            BVHRay ray;
+            ray.Origin = positionWS;
+            ray.Direction = params->SunDirectionWS;
+            ray.TMin = 0.00001f;
+            ray.TMax = FloatMax;
+
+            const Float3 sunLighting = CalcLighting(normalWS, sunDirection, params->SunIrradiance, diffuseAlbedo, specularAlbedo,
+                                                    roughness, positionWS, incomingRayOriginWS, msEnergyCompensation);
+            wavefront.SunShadowRays.Add(ray, shadowRayFlags, pathIdx, pathState.Throughput * sunLighting);
+        }
+
+        // Apply spot lights
+        if(AppSettings::RenderLights)
+        {
+            auto queueSpotLight = [&](uint32 spotLightIdx, float weight)
+            {
+                const SpotLight& spotLight = params->Lights[spotLightIdx];
+
+                Float3 surfaceToLight = spotLight.Position - positionWS;
+                float distanceToLight = Float3::Length(surfaceToLight);
+                surfaceToLight /= distanceToLight;
+                float angleFactor = Saturate(Float3::Dot(surfaceToLight, spotLight.Direction));
+                float angularAttenuation = Smoothstep(spotLight.AngularAttenuationY, spotLight.AngularAttenuationX, angleFactor);
+
+                float d = distanceToLight / spotLight.Range;
+                float falloff = Saturate(1.0f - (d * d * d * d));
+                falloff = (falloff * falloff) / (distanceToLight * distanceToLight + 1.0f);
+
+                angularAttenuation *= falloff;
+
+                if(angularAttenuation > 0.0f)
+                {
+                    BVHRay ray;
+                    ray.Origin = positionWS + normalWS * 0.01f;
+                    ray.Direction = surfaceToLight;
+                    ray.TMin = AppSettings::SpotShadowNearClip;
+                    ray.TMax = distanceToLight - AppSettings::SpotShadowNearClip;
+
+                    Float3 intensity = spotLight.Intensity * angularAttenuation;
+
+                    const Float3 spotLighting = CalcLighting(normalWS, surfaceToLight, intensity, diffuseAlbedo, specularAlbedo,
+                                                             roughness, positionWS, incomingRayOriginWS, msEnergyCompensation);
+                    wavefront.ShadowRays.Add(ray, shadowRayFlags, pathIdx, pathState.Throughput * spotLighting * weight);
+                }
+            };
+
+            if(AppSettings::EnableLightBVH && params->LightBVH != nullptr)
+            {
+                // Pick a few lights from the light BVH in proportion to how much they can contribute,
+                // with the same sample sets as the GPU path tracer
+                const uint32 numLightSamples = uint32(AppSettings::NumLightSamples);
+                for(uint32 lightSampleIdx = 0; lightSampleIdx < numLightSamples; ++lightSampleIdx)
+                {
+                    const float lightSample = SamplePoint(pathState).x;
+
+                    uint32 spotLightIdx = 0;
+                    float lightPDF = 0.0f;
+                    if(params->LightBVH->SampleLight(positionWS, normalWS, lightSample, spotLightIdx, lightPDF))
+                        queueSpotLight(spotLightIdx, 1.0f / (lightPDF * numLightSamples));
+                }
+            }
+            else
+            {
+                for(uint32 spotLightIdx = 0; spotLightIdx < params->NumLights; ++spotLightIdx)
+                    queueSpotLight(spotLightIdx, 1.0f);
+            }
+        }
+    }
+
+    // Each lobe gets picked with this probability when sampling the BRDF below
+    const float diffuseSelectProbability = enableDiffuse ? (enableSpecular ? 0.5f : 1.0f) : 0.0f;
+    const float specularSelectProbability = enableSpecular ? (enableDiffuse ? 0.5f : 1.0f) : 0.0f;
+    const float a2 = roughness * roughness;
+
+    // Same as the energy compensation applied to the sampled specular lobe below
+    Float3 specularCompensation = 1.0f;
+    if(AppSettings::ApplyMultiscatteringEnergyCompensation)
+    {
+        // Matches the shader, which uses the world-space incoming direction here
+        Float2 DFG = GGXEnvironmentBRDFScaleBias(Saturate(Float3::Dot(Float3(0.0f, 0.0f, 1.0f), -incomingRayDirWS)), sqrtRoughness);
+
+        float Ess = DFG.x;
+        specularCompensation = Float3(1.0f) + specularAlbedo * (1.0f / Ess - 1.0f);
+    }
+
+    // Importance sample the sky by luminance, and combine that with the BRDF sample using MIS. Each lobe
+    // is weighted separately, since the BRDF sample only ever picks one of them.
+    const bool sampleSky = AppSettings::EnableSky && AppSettings::EnableSkyImportanceSampling &&
+                           !AppSettings::EnableWhiteFurnaceMode && params->SkyCache->CanSampleCubeMap();
+    if(sampleSky)
+    {
+        float skyPDF = 0.0f;
+        const Float3 skyDir = params->SkyCache->SampleCubeMapDirection(SamplePoint(pathState), skyPDF);
+
+        const Float3 viewDir = -incomingRayDirWS;
+        const float nDotL = Float3::Dot(normalWS, skyDir);
+        const float nDotV = Float3::Dot(normalWS, viewDir);
+        if(skyPDF > 0.0f && nDotL > 0.0f)
+        {
+            // Diffuse BRDF * N dot L, and the PDF of sampling it with a cosine-weighted hemisphere
+            const Float3 diffuse = diffuseAlbedo * InvPi * nDotL;
+            const float diffusePDF = nDotL * InvPi;
+
+            // Specular BRDF * N dot L, and the PDF of sampling it from the distribution of visible normals.
+            // Their ratio is the same F * G2 / G1 that the sampled specular lobe uses.
+            Float3 specular = 0.0f;
+            float specularPDF = 0.0f;
+            if(enableSpecular && nDotV > 0.0f)
+            {
+                const Float3 h = Float3::Normalize(viewDir + skyDir);
+                const float nDotH = Saturate(Float3::Dot(normalWS, h));
+                const float D = a2 / (Pi * Square(nDotH * nDotH * (a2 - 1.0f) + 1.0f));
+                const float G1 = SmithGGXMasking(normalWS, skyDir, viewDir, a2);
+                const float G2 = SmithGGXMaskingShadowing(normalWS, skyDir, viewDir, a2);
+                specular = Fresnel(specularAlbedo, h, skyDir) * (D * G2 / (4.0f * nDotV)) * specularCompensation;
+                specularPDF = G1 * D / (4.0f * nDotV);
+            }
+
+            const Float3 skyRadiance = Float3(SampleCubemap(skyDir, params->SkyCache->CubeMapData));
+            const Float3 skyLighting = (diffuse * PowerHeuristic(skyPDF, diffuseSelectProbability * diffusePDF) +
+                                        specular * PowerHeuristic(skyPDF, specularSelectProbability * specularPDF)) * skyRadiance / skyPDF;
+
+            BVHRay ray;
+            ray.Origin = positionWS;
+            ray.Direction = skyDir;
+            ray.TMin = 0.00001f;
+            ray.TMax = FloatMax;
+            wavefront.ShadowRays.Add(ray, PathRayFlags(pathState.PathLength), pathIdx, pathState.Throughput * skyLighting);
+        }
+    }
+
+    // Choose our next path by importance sampling our BRDFs
+    Float2 brdfSample = SamplePoint(pathState);
+    float brdfPDF = 0.0f;
+
+    Float3 throughput = 0.0f;
+    Float3 rayDirTS = 0.0f;
+
+    float selector = brdfSample.x;
+    if(enableSpecular == false)
+        selector = 0.0f;
+    else if(enableDiffuse == false)
+        selector = 1.0f;
+
+    if(selector < 0.5f)
+    {
+        // We're sampling the diffuse BRDF, so sample a cosine-weighted hemisphere
+        if(enableSpecular)
+            brdfSample.x *= 2.0f;
+        rayDirTS = SampleDirectionCosineHemisphere(brdfSample.x, brdfSample.y);
+
+        // The PDF of sampling a cosine hemisphere is NdotL / Pi, which cancels out those terms
+        // from the diffuse BRDF and the irradiance integral
+        throughput = diffuseAlbedo;
+        brdfPDF = diffuseSelectProbability * rayDirTS.z * InvPi;
+    }
+    else
+    {
+        // We're sampling the GGX specular BRDF by sampling the distribution of visible normals
+        if(enableDiffuse)
+            brdfSample.x = (brdfSample.x - 0.5f) * 2.0f;
+
+        Float3 incomingRayDirTS = Float3::Normalize(Float3::Transform(incomingRayDirWS, Float3x3::Transpose(tangentToWorld)));
+        Float3 microfacetNormalTS = SampleGGXVisibleNormal(-incomingRayDirTS, roughness, roughness, brdfSample.x, brdfSample.y);
+        Float3 sampleDirTS = Reflect(incomingRayDirTS, microfacetNormalTS);
+
+        Float3 normalTS = Float3(0.0f, 0.0f, 1.0f);
+
+        Float3 F = AppSettings::EnableWhiteFurnaceMode ? Float3(1.0f) : Fresnel(specularAlbedo, microfacetNormalTS, sampleDirTS);
+        float G1 = SmithGGXMasking(normalTS, sampleDirTS, -incomingRayDirTS, roughness * roughness);
+        float G2 = SmithGGXMaskingShadowing(normalTS, sampleDirTS, -incomingRayDirTS, roughness * roughness);
+
+        throughput = (F * (G2 / G1)) * specularCompensation;
+        rayDirTS = sampleDirTS;
+
+        const float nDotH = Saturate(microfacetNormalTS.z);
+        const float D = a2 / (Pi * Square(nDotH * nDotH * (a2 - 1.0f) + 1.0f));
+        brdfPDF = specularSelectProbability * G1 * D / (4.0f * Max(-incomingRayDirTS.z, 0.00001f));
+    }
+
+    const Float3 rayDirWS = Float3::Normalize(Float3::Transform(rayDirTS, tangentToWorld));
+
+    if(enableDiffuse && enableSpecular)
+        throughput *= 2.0f;
+
+    // Randomly end the path with a probability based on how much it can still contribute, and boost the
+    // paths that survive to make up for the ones that didn't
+    if(AppSettings::EnableRussianRoulette && int32(pathState.PathLength) >= AppSettings::RussianRouletteMinDepth &&
+       !AppSettings::EnableWhiteFurnaceMode)
+    {
+        const Float3 pathThroughput = pathState.Throughput * throughput;
+        const float continueProbability = Min(Max(pathThroughput.x, Max(pathThroughput.y, pathThroughput.z)), 1.0f);
+        const float rouletteSample = SamplePoint(pathState).x;
+        if(rouletteSample >= continueProbability)
+            return;
+
+        throughput /= continueProbability;
+    }
+
+    BVHRay ray;
+    ray.Origin = positionWS;
+    ray.Direction = rayDirWS;
+    ray.TMin = 0.00001f;
+    ray.TMax = FloatMax;
+
+    if(AppSettings::EnableIndirect && (int32(pathState.PathLength) + 1 < AppSettings::MaxPathLength) && !AppSettings::EnableWhiteFurnaceMode)
+    {
+        // Queue up another ray to get the next path
+        pathState.PathLength += 1;
+        pathState.IsDiffuse = (selector < 0.5f);
+        pathState.Roughness = roughness;
+        pathState.ConeWidth = coneWidth;
+        pathState.ConeSpread = BounceConeSpread(pathState.ConeSpread, selector < 0.5f, roughness);
+        pathState.Throughput *= throughput;
+        pathState.BRDFPDF = sampleSky ? brdfPDF : 0.0f;
+
+        nextRays.Add(ray, PathRayFlags(pathState.PathLength), pathIdx);
+    }
+    else if(AppSettings::EnableWhiteFurnaceMode)
+    {
+        pathState.Radiance += pathState.Throughput * throughput;
+    }
+    else if(AppSettings::EnableSky)
+    {
+        // Queue up a shadow ray to see if the sky is visible in the sampled direction
+        Float3 skyRadiance = Float3(SampleCubemap(rayDirWS, params->SkyCache->CubeMapData));
+        if(sampleSky)
+            skyRadiance *= PowerHeuristic(brdfPDF, params->SkyCache->CubeMapDirectionPDF(rayDirWS));
+        wavefront.ShadowRays.Add(ray, PathRayFlags(pathState.PathLength + 1), pathIdx, pathState.Throughput * skyRadiance * throughput);
+    }
+}
+
+// Traces all queued shadow rays, and adds the lighting for the ones that aren't occluded to their paths
+void CPUPathTracer::ConnectShadowRays(Wavefront& wavefront) const
+{
+    const BVH& bvh = bvhs[currBVH];
+    CPUPathTracer* anyHitContext = const_cast<CPUPathTracer*>(this);
+    const bool gatherStats = AppSettings::EnableCPURayStats;
+    uint64 numUnoccluded = 0;
+
+    RayQueue& shadowRays = wavefront.ShadowRays;
+    SortRays(shadowRays);
+
+    for(uint32 i = 0; i < shadowRays.Count; ++i)
+    {
+        const uint32 rayIdx = uint32(shadowRays.SortedRays[i]);
+        PathState& pathState = wavefront.Paths[shadowRays.PathIdx[rayIdx]];
+        if(bvh.TraceOcclusion(shadowRays.Ray(rayIdx), shadowRays.Flags[rayIdx], AnyHit, anyHitContext, gatherStats ? &pathState.Traversal : nullptr) == false)
+        {
+            pathState.Radiance += shadowRays.Contribution[rayIdx];
+            numUnoccluded += 1;
+        }
+    }
+
+    // Sun shadow rays all share the same direction, so they just end up sorted by origin
+    RayQueue& sunShadowRays = wavefront.SunShadowRays;
+    SortRays(sunShadowRays);
+
+    for(uint32 i = 0; i < sunShadowRays.Count; ++i)
+    {
+        const uint32 rayIdx = uint32(sunShadowRays.SortedRays[i]);
+        const BVHRay ray = sunShadowRays.Ray(rayIdx);
+        PathState& pathState = wavefront.Paths[sunShadowRays.PathIdx[rayIdx]];
+        if(bvh.TraceOcclusion(sunShadowBatch, ray.Origin, ray.TMin, ray.TMax, sunShadowRays.Flags[rayIdx], AnyHit, anyHitContext,
+                              gatherStats ? &pathState.Traversal : nullptr) == false)
+        {
+            pathState.Radiance += sunShadowRays.Contribution[rayIdx];
+            numUnoccluded += 1;
+        }
+    }
+
+    if(gatherStats)
+    {
+        wavefront.RayStats.NumShadowRays += shadowRays.Count + sunShadowRays.Count;
+        wavefront.RayStats.NumUnoccludedShadowRays += numUnoccluded;
+    }
+}
+
+// Sorts queued rays by the octant of their direction, and then by the Morton order of the grid cell
+// that contains their origin. Rays that start close together and head the same way visit mostly the
+// same BVH nodes, so tracing them back-to-back keeps those nodes and triangles in cache.
+void CPUPathTracer::SortRays(RayQueue& rays) const
+{
+    const float maxCell = float(SortGridSize - 1);
+    for(uint32 rayIdx = 0; rayIdx < rays.Count; ++rayIdx)
+    {
+        const uint32 octant = (rays.Direction[0][rayIdx] < 0.0f ? 1 : 0) |
+                              (rays.Direction[1][rayIdx] < 0.0f ? 2 : 0) |
+                              (rays.Direction[2][rayIdx] < 0.0f ? 4 : 0);
+
+        const uint32 cellX = uint32(Clamp((rays.Origin[0][rayIdx] - sortBoundsMin.x) * sortBoundsScale.x, 0.0f, maxCell));
+        const uint32 cellY = uint32(Clamp((rays.Origin[1][rayIdx] - sortBoundsMin.y) * sortBoundsScale.y, 0.0f, maxCell));
+        const uint32 cellZ = uint32(Clamp((rays.Origin[2][rayIdx] - sortBoundsMin.z) * sortBoundsScale.z, 0.0f, maxCell));
+
+        const uint32 sortKey = (octant << 27) | MortonCode3D(cellX, cellY, cellZ);
+        rays.SortedRays[rayIdx] = (uint64(sortKey) << 32) | rayIdx;
+    }
+
+    std::sort(rays.SortedRays.Data(), rays.SortedRays.Data() + rays.Count);
+}
+
+void CPUPathTracer::RayQueue::Reserve(uint64 maxRays)
+{
+    if(PathIdx.Size() >= maxRays)
+        return;
+
+    for(uint64 i = 0; i < 3; ++i)
+    {
+        Origin[i].Init(maxRays);
+        Direction[i].Init(maxRays);
+    }
+    TMin.Init(maxRays);
+    TMax.Init(maxRays);
+    Flags.Init(maxRays);
+    PathIdx.Init(maxRays);
+    Contribution.Init(maxRays);
+    SortedRays.Init(maxRays);
+    Count = 0;
+}
+
+void CPUPathTracer::RayQueue::Add(const BVHRay& ray, uint32 rayFlags, uint32 pathIdx, const Float3& contribution)
+{
+    Assert_(Count < PathIdx.Size());
+
+    Origin[0][Count] = ray.Origin.x;
+    Origin[1][Count] = ray.Origin.y;
+    Origin[2][Count] = ray.Origin.z;
+    Direction[0][Count] = ray.Direction.x;
+    Direction[1][Count] = ray.Direction.y;
+    Direction[2][Count] = ray.Direction.z;
+    TMin[Count] = ray.TMin;
+    TMax[Count] = ray.TMax;
+    Flags[Count] = rayFlags;
+    PathIdx[Count] = pathIdx;
+    Contribution[Count] = contribution;
+    Count += 1;
+}
+
+BVHRay CPUPathTracer::RayQueue::Ray(uint32 rayIdx) const
+{
+    BVHRay ray;
+    ray.Origin = Float3(Origin[0][rayIdx], Origin[1][rayIdx], Origin[2][rayIdx]);
+    ray.Direction = Float3(Direction[0][rayIdx], Direction[1][rayIdx], Direction[2][rayIdx]);
+    ray.TMin = TMin[rayIdx];
+    ray.TMax = TMax[rayIdx];
+    return ray;
+}
+
+Float3 CPUPathTracer::Miss(const Float3& rayDir, const PathState& pathState) const
+{
+    if(AppSettings::EnableWhiteFurnaceMode)
+        return Float3(1.0f);
+
+    Float3 radiance = AppSettings::EnableSky ? Float3(SampleCubemap(rayDir, params->SkyCache->CubeMapData)) : Float3(0.0f);
+
+    // The sky was also sampled directly at the previous vertex, so only part of it comes from this ray
+    if(pathState.BRDFPDF > 0.0f)
+        radiance *= PowerHeuristic(pathState.BRDFPDF, params->SkyCache->CubeMapDirectionPDF(rayDir));
+
+    if(pathState.PathLength == 1)
+    {
+        float cosSunAngle = Float3::Dot(rayDir, params->SunDirectionWS);
+        if(cosSunAngle >= params->CosSunAngularRadius)
+            radiance = params->SunRenderColor;
+    }
+
+    return radiance;
+}
+
+// Looks up the vertex data for the hit triangle and interpolates its attributes. Can also return the ratio
+// of the triangle's UV area to its world space area in log2 space, for ray cone texture LOD.
+MeshVertex CPUPathTracer::GetHitSurface(const BVHHit& hit, float* triangleLODConstant) const
+{
+    const Float3 barycentrics = Float3(1.0f - hit.Barycentrics.x - hit.Barycentrics.y, hit.Barycentrics.x, hit.Barycentrics.y);
+
+    const Mesh& mesh = model->Meshes()[hit.GeometryIdx];
+    const uint32 idxStart = mesh.IndexOffset() + hit.PrimitiveIdx * 3;
+    const bool indices32 = model->IndexBufferType() == IndexType::Index32Bit;
+
+    const MeshVertex* vtx[3] = { };
+    for(uint32 i = 0; i < 3; ++i)
+    {
+        const uint32 idx = indices32 ? model->Indices32()[idxStart + i] : model->Indices()[idxStart + i];
+        vtx[i] = &model->Vertices()[idx + mesh.VertexOffset()];
+    }
+
+    MeshVertex result;
+    result.Position = vtx[0]->Position * barycentrics.x + vtx[1]->Position * barycentrics.y + vtx[2]->Position * barycentrics.z;
+    result.Normal = Float3::Normalize(vtx[0]->Normal * barycentrics.x + vtx[1]->Normal * barycentrics.y + vtx[2]->Normal * barycentrics.z);
+    result.UV = vtx[0]->UV * barycentrics.x + vtx[1]->UV * barycentrics.y + vtx[2]->UV * barycentrics.z;
+    result.Tangent = Float3::Normalize(vtx[0]->Tangent * barycentrics.x + vtx[1]->Tangent * barycentrics.y + vtx[2]->Tangent * barycentrics.z);
+    result.Bitangent = Float3::Normalize(vtx[0]->Bitangent * barycentrics.x + vtx[1]->Bitangent * barycentrics.y + vtx[2]->Bitangent * barycentrics.z);
+
+    // Vertices are in object space, so transform to world space with the instance transform (same as the DXR shaders).
+    // The normal goes through the inverse-transpose so that it stays perpendicular to the surface under non-uniform scale.
+    const Float4x4& transform = model->Instances()[hit.InstanceIdx].Transform;
+    const Float3x3 normalTransform = Float3x3::Transpose(Float3x3::Invert(transform.To3x3()));
+    result.Position = Float3::Transform(result.Position, transform);
+    result.Normal = Float3::Normalize(Float3::Transform(result.Normal, normalTransform));
+    result.Tangent = Float3::Normalize(Float3::TransformDirection(result.Tangent, transform));
+    result.Bitangent = Float3::Normalize(Float3::TransformDirection(result.Bitangent, transform));
+
+    if(triangleLODConstant != nullptr)
+    {
+        const Float3 edge0 = Float3::TransformDirection(vtx[1]->Position - vtx[0]->Position, transform);
+        const Float3 edge1 = Float3::TransformDirection(vtx[2]->Position - vtx[0]->Position, transform);
+        const Float2 uvEdge0 = vtx[1]->UV - vtx[0]->UV;
+        const Float2 uvEdge1 = vtx[2]->UV - vtx[0]->UV;
+        const float worldArea = Float3::Length(Float3::Cross(edge0, edge1));
+        const float uvArea = std::abs(uvEdge0.x * uvEdge1.y - uvEdge1.x * uvEdge0.y);
+        *triangleLODConstant = 0.5f * std::log2(Max(uvArea, 1e-12f) / Max(worldArea, 1e-12f));
+    }
+
+    return result;
+}
+
+const MeshMaterial& CPUPathTracer::GetGeometryMaterial(uint32 geometryIdx) const
+{
+    const Mesh& mesh = model->Meshes()[geometryIdx];
+    return model->Materials()[mesh.MeshParts()[0].MaterialIdx];
+}
+
+// Samples the top mip, which is what the alpha test uses on both the CPU and the GPU
+Float4 CPUPathTracer::SampleMaterialTexture(const MeshMaterial& material, MaterialTextures texType, Float2 uv) const
+{
+    const uint32 texIdx = material.TextureIndices[uint64(texType)];
+    Assert_(texIdx < textureCache.NumTextures());
+    return textureCache.SampleLevel(texIdx, uv, 0);
+}
+
+// Picks the mip from the ray cone's footprint, which is in UV space until it's scaled by the size of
+// the texture. Must match TextureLOD() in RayTrace.hlsl.
+Float4 CPUPathTracer::SampleMaterialTexture(const MeshMaterial& material, MaterialTextures texType, Float2 uv, float coneLOD) const
+{
+    const uint32 texIdx = material.TextureIndices[uint64(texType)];
+    Assert_(texIdx < textureCache.NumTextures());
+    if(AppSettings::EnableRayConeLOD == false)
+        return textureCache.SampleLevel(texIdx, uv, 0);
+
+    return textureCache.Sample(texIdx, uv, coneLOD + textureCache.LODBias(texIdx));
+}
+
+// Standard alpha testing, used for both primary and shadow rays
+bool CPUPathTracer::AnyHit(const BVHHit& hit, void* context)
+{
+    const CPUPathTracer* pathTracer = reinterpret_cast<const CPUPathTracer*>(context);
+
+    const MeshVertex hitSurface = pathTracer->GetHitSurface(hit);
+    const MeshMaterial& material = pathTracer->GetGeometryMaterial(hit.GeometryIdx);
+
+    return pathTracer->SampleMaterialTexture(material, MaterialTextures::Opacity, hitSurface.UV).x >= AlphaTestThreshold;
+}
@@ -0,0 +1,226 @@
+//=================================================================================================
+//
+//  DXR Path Tracer
+//  by MJP
+//  http://mynameismjp.wordpress.com/
+//
+//  All code and content licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include <PCH.h>
+
+#include <thread>
+
+#include <Graphics/Model.h>
+#include <Graphics/Textures.h>
+#include <Graphics/BVH.h>
+#include <Graphics/OpacityMicromap.h>
+#include <Graphics/TextureCache.h>
+#include <Graphics/SobolSampler.h>
+#include <Graphics/Denoiser.h>
+#include <EnkiTS/TaskScheduler.h>
+
+#include "AppSettings.h"
+#include "SharedTypes.h"
+#include "LightBVH.h"
+
+using namespace SampleFramework12;
+
+namespace SampleFramework12
+{
+    struct SkyCache;
+}
+
+
+// Inputs for a CPU path tracer render, equivalent to RayTraceConstants and LightConstants on the GPU
+struct CPUPathTracerParams
+{
+    Float4x4 InvViewProjection;
+
+    Float3 SunDirectionWS;
+    float CosSunAngularRadius = 0.0f;
+    Float3 SunIrradiance;
+    float SinSunAngularRadius = 0.0f;
+    Float3 SunRenderColor;
+    Float3 CameraPosWS;
+    float PixelSpreadAngle = 0.0f;
+
+    uint32 Width = 0;
+    uint32 Height = 0;
+
+    const SkyCache* SkyCache = nullptr;
+    const SpotLight* Lights = nullptr;
+    uint32 NumLights = 0;
+    const LightBVH* LightBVH = nullptr;
+};
+
+// Ray counts and traversal work from a render with EnableCPURayStats, summed over all worker threads
+struct CPURayStats
+{
+    uint64 NumRays[AppSettings::MaxPathLengthSetting + 1] = { };    // Extension rays at each path length, starting with primary rays at 1
+    uint64 NumShadowRays = 0;
+    uint64 NumUnoccludedShadowRays = 0;
+    BVHTraversalStats Traversal;                                    // Extension and shadow rays combined
+};
+
+// Runs the same estimator as RayTrace.hlsl on the CPU, for generating reference
+// images without needing a GPU that supports DXR
+class CPUPathTracer
+{
+
+public:
+
+    void Initialize(const Model* sceneModel, enki::TaskScheduler* taskScheduler);
+    void Shutdown();
+
+    // Call after changing vertex positions or instance transforms in the scene model. The BVH gets refit,
+    // and once that degrades it too much a full rebuild is started in the background.
+    void UpdateGeometry();
+
+    // Renders all SqrtNumSamples x SqrtNumSamples samples for every pixel, and optionally the
+    // first-hit buffers and per-pixel variance for the denoiser
+    void Render(const CPUPathTracerParams& params, TextureData<Float4>& output, DenoiserAOVs* aovs = nullptr);
+
+    const Model* SceneModel() const { return model; }
+    const BVH& SceneBVH() const { return bvhs[currBVH]; }
+    const TextureCache& Textures() const { return textureCache; }
+
+    // Average number of surfaces that paths hit during the last Render(), including the ones cut short by Russian roulette
+    float AveragePathLength() const { return avgPathLength; }
+
+    // Only filled in when EnableCPURayStats was on for the last Render(). The heatmap has the BVH nodes
+    // visited, triangle tests, and any-hit calls for each pixel in XYZ, averaged over its samples.
+    const CPURayStats& RayStats() const { return rayStats; }
+    const TextureData<Float4>& RayStatsHeatmap() const { return rayStatsHeatmap; }
+
+protected:
+
+    struct PathState
+    {
+        Float3 Throughput = 1.0f;
+        Float3 Radiance;
+        float Roughness = 0.0f;
+        float ConeWidth = 0.0f;         // Ray cone for texture LOD, see RayTrace.hlsl
+        float ConeSpread = 0.0f;
+        uint32 PathLength = 1;
+        uint32 PixelIdx = 0;
+        uint32 SampleIdx = 0;
+        uint32 SampleSetIdx = 0;
+        float BRDFPDF = 0.0f;           // PDF of the BRDF sample for the current ray, or 0 if it doesn't need MIS with sky sampling
+        bool IsDiffuse = false;
+        Float3 FirstHitAlbedo = 1.0f;   // Denoiser AOVs, which stay at their miss values if the primary ray doesn't hit anything
+        Float3 FirstHitNormal;
+        float FirstHitDepth = 0.0f;
+        BVHTraversalStats Traversal;    // Work done by all of the path's rays, for the heatmap
+    };
+
+    // Rays from a wave of paths that are waiting to be traced, in SoA layout. Shadow rays also store
+    // the radiance that they add to their path if nothing is hit.
+    struct RayQueue
+    {
+        Array<float> Origin[3];
+        Array<float> Direction[3];
+        Array<float> TMin;
+        Array<float> TMax;
+        Array<uint32> Flags;
+        Array<uint32> PathIdx;
+        Array<Float3> Contribution;
+        Array<uint64> SortedRays;       // Sort key in the upper 32 bits, ray index in the lower 32 bits
+        uint32 Count = 0;
+
+        void Reserve(uint64 maxRays);
+        void Add(const BVHRay& ray, uint32 rayFlags, uint32 pathIdx, const Float3& contribution = Float3(0.0f));
+        BVHRay Ray(uint32 rayIdx) const;
+    };
+
+    // Closest hits for the extension rays, which get sorted by material before shading
+    struct HitQueue
+    {
+        Array<BVHHit> Hits;
+        Array<uint32> RayIdx;
+        Array<uint64> SortedHits;       // Material index in the upper 32 bits, hit index in the lower 32 bits
+        uint32 Count = 0;
+    };
+
+    // Paths and queues for pushing one wave of paths through the pipeline, which each worker thread reuses
+    struct Wavefront
+    {
+        Array<PathState> Paths;
+        RayQueue ExtensionRays[2];      // Current and next bounce
+        HitQueue Hits;
+        RayQueue ShadowRays;
+        RayQueue SunShadowRays;
+        Array<uint32> TilePixels;       // Pixels of the current tile in Morton order
+        uint64 PathLengthCounts[AppSettings::MaxPathLengthSetting + 1] = { };  // Number of finished paths at each length
+        CPURayStats RayStats;           // Per-thread counters, which get summed once the render is done
+    };
+
+    // Tiles that have been dealt out to one worker. Workers claim tiles from the front of their own
+    // queue, and then steal from the front of the other queues once theirs is empty.
+    struct alignas(64) TileQueue
+    {
+        std::atomic<uint32> NextTile = 0;
+        uint32 Start = 0;               // First entry in tileOrder
+        uint32 NumTiles = 0;
+    };
+
+    void SwapRebuiltBVH();
+    void BuildTileQueues(uint32 numTiles, uint32 numQueues);
+    void RenderTiles(uint32 queueIdx, Wavefront& wavefront);
+    void RenderTile(uint32 tileIdx, Wavefront& wavefront);
+    void ExtendPaths(Wavefront& wavefront, RayQueue& rays) const;
+    void ShadePaths(Wavefront& wavefront, const RayQueue& rays, RayQueue& nextRays) const;
+    void Shade(const MeshVertex& hitSurface, const MeshMaterial& material, const BVHRay& incomingRay, float hitDistance,
+               float triangleLODConstant, uint32 pathIdx, Wavefront& wavefront, RayQueue& nextRays) const;
+    void ConnectShadowRays(Wavefront& wavefront) const;
+    void SortRays(RayQueue& rays) const;
+    Float3 Miss(const Float3& rayDir, const PathState& pathState) const;
+    Float2 SamplePoint(PathState& pathState) const;
+
+    MeshVertex GetHitSurface(const BVHHit& hit, float* triangleLODConstant = nullptr) const;
+    const MeshMaterial& GetGeometryMaterial(uint32 geometryIdx) const;
+    Float4 SampleMaterialTexture(const MeshMaterial& material, MaterialTextures texType, Float2 uv) const;
+    Float4 SampleMaterialTexture(const MeshMaterial& material, MaterialTextures texType, Float2 uv, float coneLOD) const;
+
+    static bool AnyHit(const BVHHit& hit, void* context);
+
+    const Model* model = nullptr;
+    enki::TaskScheduler* scheduler = nullptr;
+
+    // Refits happen on the current BVH, while the other one can be rebuilding in the background. The rebuild
+    // gets its own thread instead of going through the task scheduler, since a thread that's waiting on a task
+    // set will run any other task from the pipe and a render could end up doing the whole rebuild inline.
+    BVH bvhs[2];
+    uint32 currBVH = 0;
+    std::thread rebuildThread;
+    std::atomic<bool> rebuildComplete = false;
+    bool rebuildPending = false;
+    float lastRenderTimeMS = 0.0f;      // From the last render that didn't overlap a rebuild
+
+    OpacityMicromap opacityMicromap;
+    BVHOcclusionBatch sunShadowBatch;
+    TextureCache textureCache;
+    SobolSampleTable sampleTable;
+    Array<Wavefront> wavefronts;
+
+    // Tiles are scheduled in order of their cost from previous renders, so that the slowest ones start first
+    Array<TileQueue> tileQueues;
+    Array<uint32> tileOrder;
+    Array<float> tileCosts;
+    uint32 tileCostsWidth = 0;
+    uint32 tileCostsHeight = 0;
+    Array<uint32> tilePixelOrder;
+    float avgPathLength = 0.0f;
+    CPURayStats rayStats;
+    TextureData<Float4> rayStatsHeatmap;
+
+    // Only valid during Render()
+    const CPUPathTracerParams* params = nullptr;
+    TextureData<Float4>* target = nullptr;
+    DenoiserAOVs* aovTarget = nullptr;
+    Float3 sortBoundsMin;
+    Float3 sortBoundsScale;
+};
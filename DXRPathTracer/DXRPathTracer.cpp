@@ -14,11 +14,13 @@
 #include <Window.h>
 #include <Input.h>
 #include <Utility.h>
+#include <FileIO.h>
 #include <Graphics/SwapChain.h>
 #include <Graphics/ShaderCompilation.h>
 #include <Graphics/Profiler.h>
 #include <Graphics/Textures.h>
 #include <Graphics/Sampling.h>
+#include <Graphics/SobolSampler.h>
 #include <Graphics/DX12.h>
 #include <Graphics/DX12_Helpers.h>
 #include <Graphics/DXRHelper.h>
@@ -41,6 +43,7 @@ static const wchar* ScenePaths[] =
     L"..\\Content\\Models\\WhiteFurnace\\WhiteFurnace.fbx",
 };
 
+static const char* SceneNames[] = { "Sponza", "SunTemple", "BoxTest", "WhiteFurnace" };
 static const wchar* SceneTextureDirs[] = { nullptr, L"Textures", nullptr, nullptr };
 static const float SceneScales[] = { 0.01f, 0.005f, 1.0f, 1.0f };
 static const Float3 SceneCameraPositions[] = { Float3(-11.5f, 1.85f, -0.45f), Float3(-1.0f, 5.5f, 12.0f), Float3(0.0f, 2.5f, -10.0f), Float3(0.0f, 0.0f, -3.0f) };
@@ -48,6 +51,7 @@ static const Float2 SceneCameraRotations[] = { Float2(0.0f, 1.544f), Float2(0.2f
 static const Float3 SceneSunDirections[] = { Float3(0.26f, 0.987f, -0.16f), Float3(-0.133022308f, 0.642787635f, 0.75440651f), Float3(0.26f, 0.987f, -0.16f), Float3(0.0f, 1.0f, 0.0f) };
 
 StaticAssert_(ArraySize_(ScenePaths) == uint64(Scenes::NumValues));
+StaticAssert_(ArraySize_(SceneNames) == uint64(Scenes::NumValues));
 StaticAssert_(ArraySize_(SceneTextureDirs) == uint64(Scenes::NumValues));
 StaticAssert_(ArraySize_(SceneScales) == uint64(Scenes::NumValues));
 StaticAssert_(ArraySize_(SceneCameraPositions) == uint64(Scenes::NumValues));
@@ -56,7 +60,14 @@ StaticAssert_(ArraySize_(SceneSunDirections) == uint64(Scenes::NumValues));
 
 static const uint64 NumConeSides = 16;
 
-static const bool Benchmark = false;
+// Benchmark mode renders every scene with a fixed sample count, so that timings and images can be compared between runs
+static const int32 BenchmarkSqrtNumSamples = 8;
+
+// Must match the RayTypes enum in RayTrace.hlsl, the hit table has one record per ray type for every mesh
+static const uint32 NumRayTypes = 2;
+
+// Must match PathStatsBuffer in RayTrace.hlsl: the active pixel count, followed by a path count for every path length
+static const uint32 NumPathStats = AppSettings::MaxPathLengthSetting + 1;
 
 struct HitGroupRecord
 {
@@ -110,6 +121,8 @@ struct RayTraceConstants
     uint32 MaterialBufferIdx = uint32(-1);
     uint32 SkyTextureIdx = uint32(-1);
     uint32 NumLights = 0;
+    uint32 LightBVHBufferIdx = uint32(-1);
+    float PixelSpreadAngle = 0.0f;
 };
 
 enum ClusterRootParams : uint32
@@ -175,6 +188,39 @@ DXRPathTracer::DXRPathTracer(const wchar* cmdLine) : App(L"DXR Path Tracer", cmd
     globalHelpText = "DXR Path Tracer\n\n"
                      "Controls:\n\n"
                      "Use W/S/A/D/Q/E to move the camera, and hold right-click while dragging the mouse to rotate.";
+
+    cxxopts::Options options("DXRPathTracer", "");
+    options.allow_unrecognised_options();
+    options.add_options()
+         ("cpu-reference", "Render the scene with the CPU path tracer, save it to this EXR file, and exit", cxxopts::value<std::string>())
+         ("benchmark", "Path trace every scene, compare against the reference images, write the results to this JSON file, and exit", cxxopts::value<std::string>())
+         ("benchmark-references", "Directory containing the benchmark reference images", cxxopts::value<std::string>())
+         ("update-benchmark-references", "Overwrite the benchmark reference images with the images from this run")
+         ("benchmark-max-rmse", "RMSE above which a benchmark image fails", cxxopts::value<float>())
+         ("benchmark-max-relmse", "Relative MSE above which a benchmark image fails", cxxopts::value<float>());
+
+    cxxopts::ParseResult parseResult = ParseCommandLineOptions(cmdLine, options);
+
+    if(parseResult.count("cpu-reference"))
+    {
+        cpuReferencePath = AnsiToWString(parseResult["cpu-reference"].as<std::string>().c_str());
+        showWindow = false;
+    }
+
+    if(parseResult.count("benchmark"))
+    {
+        benchmarkPath = AnsiToWString(parseResult["benchmark"].as<std::string>().c_str());
+        showWindow = false;
+    }
+
+    if(parseResult.count("benchmark-references"))
+        benchmarkReferenceDir = AnsiToWString(parseResult["benchmark-references"].as<std::string>().c_str());
+    if(parseResult.count("update-benchmark-references"))
+        updateBenchmarkReferences = true;
+    if(parseResult.count("benchmark-max-rmse"))
+        benchmarkMaxRMSE = parseResult["benchmark-max-rmse"].as<float>();
+    if(parseResult.count("benchmark-max-relmse"))
+        benchmarkMaxRelMSE = parseResult["benchmark-max-relmse"].as<float>();
 }
 
 void DXRPathTracer::BeforeReset()
@@ -191,12 +237,16 @@ void DXRPathTracer::AfterReset()
 
 void DXRPathTracer::Initialize()
 {
-    if(Benchmark)
+    if(benchmarkPath.length() > 0)
     {
         AppSettings::EnableVSync.SetValue(false);
         AppSettings::StablePowerState.SetValue(true);
-        AppSettings::AlwaysResetPathTrace.SetValue(true);
-        AppSettings::CurrentScene.SetValue(Scenes::SunTemple);
+        AppSettings::AlwaysResetPathTrace.SetValue(false);
+        AppSettings::EnableRayTracing.SetValue(true);
+        AppSettings::SqrtNumSamples.SetValue(BenchmarkSqrtNumSamples);
+        AppSettings::EnableAdaptiveSampling.SetValue(false);
+        AppSettings::SampleMode.SetValue(SampleModes::Sobol);
+        AppSettings::CurrentScene.SetValue(Scenes(0));
     }
 
     // Check if the device supports conservative rasterization
@@ -213,6 +263,8 @@ void DXRPathTracer::Initialize()
 
     ShadowHelper::Initialize(ShadowMapMode::DepthMap, ShadowMSAAMode::MSAA1x);
 
+    taskScheduler.Initialize();
+
     InitializeScene();
 
     skybox.Initialize();
@@ -397,13 +449,22 @@ void DXRPathTracer::Shutdown()
     DX12::Release(resolveRootSignature);
 
     rtTarget.Shutdown();
+    rtSampleStatsTarget.Shutdown();
+    rtPathStatsBuffer.Shutdown();
+    rtPathStatsReadback.Shutdown();
     DX12::Release(rtRootSignature);
     rtBottomLevelAccelStructure.Shutdown();
+    rtBottomLevelOffsets.Shutdown();
     rtTopLevelAccelStructure.Shutdown();
     rtRayGenTable.Shutdown();
     rtHitTable.Shutdown();
     rtMissTable.Shutdown();
     rtGeoInfoBuffer.Shutdown();
+    lightBVH.Shutdown();
+    lightBVHBuffer.Shutdown();
+
+    cpuPathTracer.Shutdown();
+    cpuDenoiser.Shutdown();
 }
 
 void DXRPathTracer::CreatePSOs()
@@ -589,6 +650,10 @@ void DXRPathTracer::CreateRenderTargets()
         rtInit.CreateUAV = true;
         rtInit.Name = L"RT Target";
         rtTarget.Initialize(rtInit);
+
+        rtInit.Format = DXGI_FORMAT_R32G32_FLOAT;
+        rtInit.Name = L"RT Sample Stats Target";
+        rtSampleStatsTarget.Initialize(rtInit);
     }
 
     rtShouldRestartPathTrace = true;
@@ -614,6 +679,8 @@ void DXRPathTracer::InitializeScene()
             settings.ForceSRGB = true;
             settings.SceneScale = SceneScales[currSceneIdx];
             settings.MergeMeshes = false;
+            settings.Scheduler = &taskScheduler;
+            settings.OptimizeVertexOrder = true;
             sceneModels[currSceneIdx].CreateWithAssimp(settings);
         }
     }
@@ -645,11 +712,28 @@ void DXRPathTracer::InitializeScene()
             spotLight.AngularAttenuationY = std::cos(srcLight.AngularAttenuation.y * 0.5f);
             spotLight.Range = AppSettings::SpotLightRange;
         }
+
+        lightBVHNumLights = uint32(-1);
     }
 
     buildAccelStructure = true;
 }
 
+// Moves an instance in the current scene, for anything that animates or edits the scene. Only the top-level
+// acceleration structure needs to be re-built, since the bottom-level ones are in object space.
+void DXRPathTracer::SetInstanceTransform(uint64 instanceIdx, const Float4x4& transform)
+{
+    currentModel->SetInstanceTransform(instanceIdx, transform);
+    meshRenderer.UpdateInstanceBounds();
+    buildTopLevelAccelStructure = true;
+
+    // The CPU path tracer's BVH is in world space, so it needs to be refit (or eventually rebuilt in the background)
+    if(cpuPathTracer.SceneModel() == currentModel)
+        cpuPathTracer.UpdateGeometry();
+
+    rtShouldRestartPathTrace = true;
+}
+
 void DXRPathTracer::InitRayTracing()
 {
     rayTraceLib = CompileFromFile(L"RayTrace.hlsl", nullptr, ShaderType::Library);
@@ -658,7 +742,7 @@ void DXRPathTracer::InitRayTracing()
         // RayTrace root signature
         D3D12_DESCRIPTOR_RANGE1 uavRanges[1] = {};
         uavRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
-        uavRanges[0].NumDescriptors = 1;
+        uavRanges[0].NumDescriptors = 3;
         uavRanges[0].BaseShaderRegister = 0;
         uavRanges[0].RegisterSpace = 0;
         uavRanges[0].OffsetInDescriptorsFromTableStart = 0;
@@ -718,6 +802,18 @@ void DXRPathTracer::InitRayTracing()
         DX12::CreateRootSignature(&rtRootSignature, rootSignatureDesc);
     }
 
+    {
+        // Counters for adaptive sampling and path lengths, with a readback slot for every frame in flight
+        RawBufferInit rbInit;
+        rbInit.NumElements = NumPathStats;
+        rbInit.CreateUAV = true;
+        rbInit.Name = L"RT Path Stats Buffer";
+        rtPathStatsBuffer.Initialize(rbInit);
+
+        rtPathStatsReadback.Initialize(DX12::RenderLatency * NumPathStats * sizeof(uint32));
+        rtPathStatsReadback.Resource->SetName(L"RT Path Stats Readback Buffer");
+    }
+
     rtCurrCamera = camera;
 }
 
@@ -774,7 +870,7 @@ void DXRPathTracer::CreateRayTracingPSOs()
     {
         D3D12_RAYTRACING_SHADER_CONFIG shaderConfig = { };
         shaderConfig.MaxAttributeSizeInBytes = 2 * sizeof(float);                      // float2 barycentrics;
-        shaderConfig.MaxPayloadSizeInBytes = 4 * sizeof(float) + 4 * sizeof(uint32);   // float3 radiance + float roughness + uint pathLength + uint pixelIdx + uint setIdx + bool IsDiffuse
+        shaderConfig.MaxPayloadSizeInBytes = 9 * sizeof(float) + 4 * sizeof(uint32);   // float3 radiance + float roughness + float3 throughput + float coneWidth + float coneSpread + uint pathLength + uint pixelIdx + uint setIdx + bool IsDiffuse
         builder.AddSubObject(shaderConfig);
     }
 
@@ -834,7 +930,7 @@ void DXRPathTracer::CreateRayTracingPSOs()
     {
         const uint32 numMeshes = uint32(currentModel->NumMeshes());
 
-        Array<HitGroupRecord> hitGroupRecords(numMeshes * 2);
+        Array<HitGroupRecord> hitGroupRecords(numMeshes * NumRayTypes);
         for(uint64 i = 0; i < numMeshes; ++i)
         {
             // Use the alpha test hit group (with an any hit shader) if the material has an opacity map
@@ -844,8 +940,8 @@ void DXRPathTracer::CreateRayTracingPSOs()
             const MeshMaterial& material = currentModel->Materials()[materialIdx];
             const bool alphaTest = material.Textures[uint32(MaterialTextures::Opacity)] != nullptr;
 
-            hitGroupRecords[i * 2 + 0].ID = alphaTest ? ShaderIdentifier(alphaTestHitGroupID) : ShaderIdentifier(hitGroupID);
-            hitGroupRecords[i * 2 + 1].ID = alphaTest ? ShaderIdentifier(shadowAlphaTestHitGroupID) : ShaderIdentifier(shadowHitGroupID);
+            hitGroupRecords[i * NumRayTypes + 0].ID = alphaTest ? ShaderIdentifier(alphaTestHitGroupID) : ShaderIdentifier(hitGroupID);
+            hitGroupRecords[i * NumRayTypes + 1].ID = alphaTest ? ShaderIdentifier(shadowAlphaTestHitGroupID) : ShaderIdentifier(shadowHitGroupID);
         }
 
         StructuredBufferInit sbInit;
@@ -866,6 +962,9 @@ void DXRPathTracer::Update(const Timer& timer)
 
     AppSettings::UpdateUI();
 
+    if(benchmarkPath.length() > 0)
+        UpdateBenchmark();
+
     MouseState mouseState = MouseState::GetMouseState(window);
     KeyboardState kbState = KeyboardState::GetKeyboardState(window);
 
@@ -941,6 +1040,7 @@ void DXRPathTracer::Update(const Timer& timer)
     const Setting* settingsToCheck[] =
     {
         &AppSettings::SqrtNumSamples,
+        &AppSettings::SampleMode,
         &AppSettings::MaxPathLength,
         &AppSettings::EnableAlbedoMaps,
         &AppSettings::EnableNormalMaps,
@@ -962,7 +1062,16 @@ void DXRPathTracer::Update(const Timer& timer)
         &AppSettings::MaxAnyHitPathLength,
         &AppSettings::AvoidCausticPaths,
         &AppSettings::ClampRoughness,
-        &AppSettings::ApplyMultiscatteringEnergyCompensation
+        &AppSettings::ApplyMultiscatteringEnergyCompensation,
+        &AppSettings::EnableAdaptiveSampling,
+        &AppSettings::AdaptiveErrorThreshold,
+        &AppSettings::AdaptiveMinSamples,
+        &AppSettings::AdaptiveMaxSampleScale,
+        &AppSettings::EnableLightBVH,
+        &AppSettings::NumLightSamples,
+        &AppSettings::EnableRussianRoulette,
+        &AppSettings::RussianRouletteMinDepth,
+        &AppSettings::EnableRayConeLOD
     };
 
     for(const Setting* setting : settingsToCheck)
@@ -984,12 +1093,32 @@ void DXRPathTracer::Update(const Timer& timer)
         rtCurrSampleIdx = 0;
         rtShouldRestartPathTrace = false;
     }
+
+    if(cpuReferencePath.length() > 0)
+    {
+        RenderCPUReference(cpuReferencePath.c_str());
+        Exit();
+    }
+    else if(AppSettings::RenderCPUReference)
+    {
+        RenderCPUReference(L"CPUReference.exr");
+    }
+
+    if(AppSettings::RunSamplerConvergenceTest)
+        RunSamplerConvergenceTest();
 }
 
 void DXRPathTracer::Render(const Timer& timer)
 {
     if(buildAccelStructure)
+    {
         BuildRTAccelerationStructure();
+    }
+    else if(buildTopLevelAccelStructure)
+    {
+        ProfileBlock profileBlock(DX12::CmdList, "Build Top Level Acceleration Structure");
+        BuildRTTopLevelAccelStructure();
+    }
     else if(lastBuildAccelStructureFrame + DX12::RenderLatency == DX12::CurrentCPUFrame)
         WriteLog("Acceleration structure build time: %.2f ms", Profiler::GlobalProfiler.GPUProfileTiming("Build Acceleration Structure"));
 
@@ -1121,6 +1250,27 @@ void DXRPathTracer::UpdateLights()
     for(uint64 spotLightIdx = 0; spotLightIdx < numSpotLights; ++spotLightIdx)
         if(intersectsCamera[spotLightIdx] == false)
             instanceData[offset++] = uint32(spotLightIdx);
+
+    if(numSpotLights != lightBVHNumLights)
+    {
+        // Rebuild the light BVH for the path tracers
+        lightBVH.Build(spotLights.Data(), uint32(numSpotLights));
+        lightBVHNumLights = uint32(numSpotLights);
+
+        if(lightBVH.NumNodes() > 0)
+        {
+            StructuredBufferInit sbInit;
+            sbInit.Stride = sizeof(LightBVHNode);
+            sbInit.NumElements = lightBVH.NumNodes();
+            sbInit.Name = L"Light BVH Buffer";
+            sbInit.InitData = lightBVH.Nodes();
+            lightBVHBuffer.Initialize(sbInit);
+        }
+        else
+        {
+            lightBVHBuffer.Shutdown();
+        }
+    }
 }
 
 void DXRPathTracer::RenderClusters()
@@ -1310,10 +1460,64 @@ void DXRPathTracer::RenderResolve()
     resolveTarget.MakeReadable(cmdList);
 }
 
+// Picks up the active pixel count and path length histogram from the dispatch that last used this frame's readback slot
+void DXRPathTracer::UpdatePathStats()
+{
+    if(rtCurrSampleIdx == 0)
+    {
+        // Results from before a restart are stale, so stop waiting for them
+        for(uint32& sampleIdx : rtReadbackSampleIdx)
+            sampleIdx = uint32(-1);
+
+        rtNumActivePixels = rtTarget.Width() * rtTarget.Height();
+        rtNumPixelSamples = 0;
+        rtAvgPathLength = 0.0f;
+        return;
+    }
+
+    uint32& readbackSampleIdx = rtReadbackSampleIdx[DX12::CurrFrameIdx];
+    if(readbackSampleIdx == uint32(-1))
+        return;
+
+    const uint32* readbackData = rtPathStatsReadback.Map<uint32>() + DX12::CurrFrameIdx * NumPathStats;
+    const uint32 numActivePixels = readbackData[0];
+
+    uint64 numPaths = 0;
+    uint64 totalPathLength = 0;
+    for(uint32 pathLength = 1; pathLength < NumPathStats; ++pathLength)
+    {
+        numPaths += readbackData[pathLength];
+        totalPathLength += uint64(readbackData[pathLength]) * pathLength;
+    }
+
+    rtPathStatsReadback.Unmap();
+
+    readbackSampleIdx = uint32(-1);
+    rtNumActivePixels = numActivePixels;
+    if(numPaths > 0)
+        rtAvgPathLength = float(double(totalPathLength) / double(numPaths));
+}
+
+// Adaptive sampling finishes once every pixel has converged, or once it has spent as many samples as
+// uniform sampling would. The active pixel count lags behind by a few frames, so the samples spent
+// are a slight overestimate.
+bool DXRPathTracer::PathTraceComplete() const
+{
+    const uint64 numSamples = uint64(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples);
+    if(AppSettings::EnableAdaptiveSampling == false)
+        return rtCurrSampleIdx >= numSamples;
+
+    const uint64 sampleBudget = rtTarget.Width() * rtTarget.Height() * numSamples;
+    return rtNumActivePixels == 0 || rtNumPixelSamples >= sampleBudget ||
+           rtCurrSampleIdx >= numSamples * uint64(AppSettings::AdaptiveMaxSampleScale);
+}
+
 void DXRPathTracer::RenderRayTracing()
 {
-    // Don't keep tracing rays if we've hit our maximum per-pixel sample count
-    if(rtCurrSampleIdx >= uint32(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples))
+    UpdatePathStats();
+
+    // Don't keep tracing rays if we've hit our maximum per-pixel sample count, or everything has converged
+    if(PathTraceComplete())
         return;
 
     ID3D12GraphicsCommandList4* cmdList = DX12::CmdList;
@@ -1322,7 +1526,8 @@ void DXRPathTracer::RenderRayTracing()
     DX12::BindGlobalSRVDescriptorTable(cmdList, RTParams_StandardDescriptors, CmdListMode::Compute);
 
     cmdList->SetComputeRootShaderResourceView(RTParams_SceneDescriptor, rtTopLevelAccelStructure.GPUAddress);
-    DX12::BindTempDescriptorTable(cmdList, &rtTarget.UAV, 1, RTParams_UAVDescriptor, CmdListMode::Compute);
+    D3D12_CPU_DESCRIPTOR_HANDLE uavs[] = { rtTarget.UAV, rtSampleStatsTarget.UAV, rtPathStatsBuffer.UAV };
+    DX12::BindTempDescriptorTable(cmdList, uavs, ArraySize_(uavs), RTParams_UAVDescriptor, CmdListMode::Compute);
 
     RayTraceConstants rtConstants;
     rtConstants.InvViewProjection = Float4x4::Invert(camera.ViewProjectionMatrix());
@@ -1342,6 +1547,8 @@ void DXRPathTracer::RenderRayTracing()
     rtConstants.MaterialBufferIdx = meshRenderer.MaterialBuffer().SRV;
     rtConstants.SkyTextureIdx = skyCache.CubeMap.SRV;
     rtConstants.NumLights = Min<uint32>(uint32(spotLights.Size()), AppSettings::MaxLightClamp);
+    rtConstants.LightBVHBufferIdx = lightBVHBuffer.SRV;
+    rtConstants.PixelSpreadAngle = std::atan(2.0f * std::tan(camera.FieldOfView() * 0.5f) / float(rtTarget.Height()));
 
     DX12::BindTempConstantBuffer(cmdList, rtConstants, RTParams_CBuffer, CmdListMode::Compute);
 
@@ -1350,6 +1557,18 @@ void DXRPathTracer::RenderRayTracing()
     AppSettings::BindCBufferCompute(cmdList, RTParams_AppSettings);
 
     rtTarget.MakeWritableUAV(cmdList);
+    rtSampleStatsTarget.MakeWritableUAV(cmdList);
+    rtPathStatsBuffer.MakeWritable(cmdList);
+
+    {
+        // Reset the active pixel count and path length histogram
+        D3D12_CPU_DESCRIPTOR_HANDLE cpuDescriptors[1] = { rtPathStatsBuffer.UAV };
+        D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = DX12::TempDescriptorTable(cpuDescriptors, ArraySize_(cpuDescriptors));
+
+        uint32 values[4] = { };
+        cmdList->ClearUnorderedAccessViewUint(gpuHandle, cpuDescriptors[0], rtPathStatsBuffer.InternalBuffer.Resource, values, 0, nullptr);
+        rtPathStatsBuffer.UAVBarrier(cmdList);
+    }
 
     cmdList->SetPipelineState1(rtPSO);
 
@@ -1364,6 +1583,15 @@ void DXRPathTracer::RenderRayTracing()
     DX12::CmdList->DispatchRays(&dispatchDesc);
 
     rtTarget.MakeReadableUAV(cmdList);
+    rtSampleStatsTarget.MakeReadableUAV(cmdList);
+    rtPathStatsBuffer.MakeReadable(cmdList);
+
+    cmdList->CopyBufferRegion(rtPathStatsReadback.Resource, DX12::CurrFrameIdx * NumPathStats * sizeof(uint32),
+                              rtPathStatsBuffer.InternalBuffer.Resource, 0, NumPathStats * sizeof(uint32));
+    rtReadbackSampleIdx[DX12::CurrFrameIdx] = rtCurrSampleIdx;
+
+    // Every pixel takes the first sample, and after that only the ones that haven't converged
+    rtNumPixelSamples += rtCurrSampleIdx == 0 ? rtTarget.Width() * rtTarget.Height() : rtNumActivePixels;
 
     rtCurrSampleIdx += 1;
 }
@@ -1385,8 +1613,7 @@ void DXRPathTracer::RenderHUD(const Timer& timer)
     spriteRenderer.End();
 
     // Draw the progress bar
-    const uint32 totalNumSamples = uint32(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples);
-    if(rtCurrSampleIdx < totalNumSamples && AppSettings::ShowProgressBar)
+    if(PathTraceComplete() == false && AppSettings::ShowProgressBar)
     {
         float width = float(swapChain.Width());
         float height = float(swapChain.Height());
@@ -1417,16 +1644,29 @@ void DXRPathTracer::RenderHUD(const Timer& timer)
 
         ImDrawList* drawList = ImGui::GetWindowDrawList();
 
-        const float progress = float(rtCurrSampleIdx) / totalNumSamples;
+        // With adaptive sampling, progress is measured against the sample budget of uniform sampling
+        const uint64 numPixels = rtTarget.Width() * rtTarget.Height();
+        const uint64 totalNumSamples = uint64(AppSettings::SqrtNumSamples * AppSettings::SqrtNumSamples);
+        float progress = float(rtCurrSampleIdx) / totalNumSamples;
+        uint64 numTracedPixels = numPixels;
+        if(AppSettings::EnableAdaptiveSampling)
+        {
+            progress = Min(float(double(rtNumPixelSamples) / double(numPixels * totalNumSamples)), 1.0f);
+            numTracedPixels = rtNumActivePixels;
+        }
 
         drawList->AddRectFilled(ToImVec2(barStart), ToImVec2(barEnd), barEmptyColor);
         drawList->AddRectFilled(ToImVec2(barStart), ImVec2(barStart.x + barSize.x * progress, barEnd.y), barFilledColor);
         drawList->AddRect(ToImVec2(barStart), ToImVec2(barEnd), barOutlineColor);
 
-        const uint64 raysPerFrame = rtTarget.Width() * rtTarget.Height() * (1 + (AppSettings::MaxPathLength - 1) * 2);
+        // Every hit along a path traces a shadow ray and an extension ray. Once the path length histogram
+        // has been read back that's used instead of assuming that every path runs to the max length.
+        const double avgPathLength = rtAvgPathLength > 0.0f ? rtAvgPathLength : AppSettings::MaxPathLength - 1.0;
+        const double raysPerFrame = numTracedPixels * (1.0 + avgPathLength * 2.0);
         const double mRaysPerSecond = raysPerFrame * (1.0 / timer.DeltaSecondsF()) / 1000000.0;
 
-        std::string progressText = MakeString("Progress: %.2f%% (%.2f Mrays per second)", progress * 100.0f, mRaysPerSecond);
+        std::string progressText = MakeString("Progress: %.2f%% (%.2f Mrays per second, %.2f avg path length)",
+                                              progress * 100.0f, mRaysPerSecond, avgPathLength);
         Float2 progressTextSize = ToFloat2(ImGui::CalcTextSize(progressText.c_str()));
         Float2 progressTextPos = barStart + (barSize * 0.5f) - (progressTextSize * 0.5f);
         drawList->AddText(ToImVec2(progressTextPos), textColor, progressText.c_str());
@@ -1437,6 +1677,280 @@ void DXRPathTracer::RenderHUD(const Timer& timer)
     }
 }
 
+// Renders the current view with the CPU path tracer, and saves the result to an EXR file
+void DXRPathTracer::RenderCPUReference(const wchar* outputPath)
+{
+    if(cpuPathTracer.SceneModel() != currentModel)
+        cpuPathTracer.Initialize(currentModel, &taskScheduler);
+
+    CPUPathTracerParams params;
+    params.InvViewProjection = Float4x4::Invert(camera.ViewProjectionMatrix());
+    params.SunDirectionWS = AppSettings::SunDirection;
+    params.SunIrradiance = skyCache.SunIrradiance;
+    params.CosSunAngularRadius = std::cos(DegToRad(AppSettings::SunSize));
+    params.SinSunAngularRadius = std::sin(DegToRad(AppSettings::SunSize));
+    params.SunRenderColor = skyCache.SunRenderColor;
+    params.CameraPosWS = camera.Position();
+    params.Width = uint32(rtTarget.Width());
+    params.Height = uint32(rtTarget.Height());
+    params.SkyCache = &skyCache;
+    params.Lights = spotLights.Data();
+    params.NumLights = Min<uint32>(uint32(spotLights.Size()), AppSettings::MaxLightClamp);
+    params.LightBVH = &lightBVH;
+    params.PixelSpreadAngle = std::atan(2.0f * std::tan(camera.FieldOfView() * 0.5f) / float(params.Height));
+
+    Timer timer;
+    TextureData<Float4> output;
+    DenoiserAOVs aovs;
+    cpuPathTracer.Render(params, output, AppSettings::EnableCPUDenoiser ? &aovs : nullptr);
+    timer.Update();
+
+    // Same ray count estimate as the progress bar in RenderHUD(), but for all samples at once. The
+    // actual count is used instead when the ray stats are enabled.
+    const uint64 numSamples = uint64(AppSettings::SqrtNumSamples) * uint64(AppSettings::SqrtNumSamples);
+    const double avgPathLength = cpuPathTracer.AveragePathLength();
+    const double raysPerFrame = double(params.Width) * params.Height * (1.0 + avgPathLength * 2.0);
+    double numRays = raysPerFrame * numSamples;
+
+    const CPURayStats& rayStats = cpuPathTracer.RayStats();
+    uint64 numExtensionRays = 0;
+    if(AppSettings::EnableCPURayStats)
+    {
+        for(uint64 rayCount : rayStats.NumRays)
+            numExtensionRays += rayCount;
+        numRays = double(numExtensionRays + rayStats.NumShadowRays);
+    }
+
+    const double mRaysPerSecond = numRays / timer.ElapsedSecondsF() / 1000000.0;
+
+    WriteLog(L"CPU reference render time: %.2f seconds (%.2f Mrays per second, %.2f avg path length)",
+             timer.ElapsedSecondsF(), mRaysPerSecond, avgPathLength);
+
+    const TextureCacheStats textureStats = cpuPathTracer.Textures().Stats();
+    const uint64 numTextureLookups = Max<uint64>(textureStats.NumHits + textureStats.NumMisses, 1);
+    WriteLog(L"CPU texture cache: %.2f%% hit rate, %llu tiles decoded, %llu evicted, %llu BC blocks decoded, "
+             L"%.2f MB tiled textures, %.2f MB BC textures, %.2f MB cache",
+             textureStats.NumHits * 100.0 / numTextureLookups, textureStats.NumMisses, textureStats.NumEvictions, textureStats.NumBlocksDecoded,
+             textureStats.SourceMemorySize / (1024.0 * 1024.0), textureStats.CompressedMemorySize / (1024.0 * 1024.0),
+             textureStats.CacheMemorySize / (1024.0 * 1024.0));
+
+    SaveTextureAsEXR(output, outputPath);
+
+    if(AppSettings::EnableCPURayStats)
+    {
+        const double numTracedRays = Max(numRays, 1.0);
+        WriteLog(L"CPU ray stats: %llu extension rays, %llu shadow rays (%.2f%% unoccluded), %.2f nodes, %.2f triangle tests, "
+                 L"%.3f any-hit calls per ray",
+                 numExtensionRays, rayStats.NumShadowRays, rayStats.NumUnoccludedShadowRays * 100.0 / Max<uint64>(rayStats.NumShadowRays, 1),
+                 rayStats.Traversal.NumNodesVisited / numTracedRays, rayStats.Traversal.NumTriangleTests / numTracedRays,
+                 rayStats.Traversal.NumAnyHitCalls / numTracedRays);
+
+        std::wstring pathLengthLine = L"CPU extension rays per path length:";
+        for(uint64 pathLength = 1; pathLength < ArraySize_(rayStats.NumRays); ++pathLength)
+        {
+            if(rayStats.NumRays[pathLength] > 0)
+                pathLengthLine += MakeString(L" %llu: %llu", pathLength, rayStats.NumRays[pathLength]);
+        }
+        WriteLog(L"%ls", pathLengthLine.c_str());
+
+        // Nodes visited, triangle tests, and any-hit calls per sample end up in RGB
+        std::wstring heatmapPath = GetFilePathWithoutExtension(outputPath);
+        if(heatmapPath.length() == 0)
+            heatmapPath = outputPath;
+        heatmapPath += L"_RayStats.exr";
+        SaveTextureAsEXR(cpuPathTracer.RayStatsHeatmap(), heatmapPath.c_str());
+    }
+
+    // The denoised version goes next to the noisy one, so that the two can be compared
+    if(AppSettings::EnableCPUDenoiser)
+    {
+        DenoiserSettings denoiserSettings;
+        denoiserSettings.NumIterations = uint32(AppSettings::CPUDenoiserIterations);
+
+        TextureData<Float4> denoised;
+        cpuDenoiser.Denoise(output, aovs, denoiserSettings, denoised, &taskScheduler);
+        WriteLog(L"CPU denoiser: %u iterations, %.2f ms", denoiserSettings.NumIterations, cpuDenoiser.DenoiseTimeMS());
+
+        std::wstring denoisedPath = GetFilePathWithoutExtension(outputPath);
+        if(denoisedPath.length() == 0)
+            denoisedPath = outputPath;
+        denoisedPath += L"_Denoised.exr";
+        SaveTextureAsEXR(denoised, denoisedPath.c_str());
+    }
+}
+
+// Logs the RMS error of CMJ and Sobol samples at increasing sample counts, for comparing how fast they converge
+void DXRPathTracer::RunSamplerConvergenceTest()
+{
+    Timer timer;
+    Array<SamplerConvergenceResult> results;
+    TestSamplerConvergence(32, 1024, results);
+    timer.Update();
+
+    WriteLog("Sampler convergence test (RMS error over 1024 patterns, CMJ / Sobol), %.2f ms:", timer.ElapsedMillisecondsF());
+    for(const SamplerConvergenceResult& result : results)
+    {
+        std::string line = MakeString("%5u spp:", result.NumSamples);
+        for(uint32 i = 0; i < SamplerConvergenceResult::NumFunctions; ++i)
+            line += MakeString("  %s %.2e / %.2e", SamplerConvergenceFunctionName(i), result.CMJError[i], result.SobolError[i]);
+        WriteLog("%s", line.c_str());
+    }
+}
+
+// Steps benchmark mode through the scenes, moving on to the next one once the path tracer has finished
+void DXRPathTracer::UpdateBenchmark()
+{
+    if(benchmarkSceneStarted == false)
+    {
+        benchmarkSceneStarted = true;
+        benchmarkTimer = Timer();
+    }
+
+    IDXGIAdapter3Ptr adapter;
+    if(SUCCEEDED(DX12::Adapter->QueryInterface(IID_PPV_ARGS(&adapter))))
+    {
+        DXGI_QUERY_VIDEO_MEMORY_INFO memoryInfo = { };
+        if(SUCCEEDED(adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &memoryInfo)))
+            benchmarkPeakGPUMemory = Max<uint64>(benchmarkPeakGPUMemory, memoryInfo.CurrentUsage);
+    }
+
+    if(PathTraceComplete() == false)
+        return;
+
+    FinishBenchmarkScene();
+
+    benchmarkSceneIdx += 1;
+    if(benchmarkSceneIdx < uint64(Scenes::NumValues))
+    {
+        // Switch scenes directly, since the UI won't notice the setting change until the next frame
+        AppSettings::CurrentScene.SetValue(Scenes(benchmarkSceneIdx));
+        currentModel = &sceneModels[benchmarkSceneIdx];
+        DestroyPSOs();
+        InitializeScene();
+        CreatePSOs();
+
+        rtShouldRestartPathTrace = true;
+        benchmarkPeakGPUMemory = 0;
+        benchmarkTimer = Timer();
+        return;
+    }
+
+    std::string json = "{\n";
+    json += MakeString("    \"width\": %llu,\n", rtTarget.Width());
+    json += MakeString("    \"height\": %llu,\n", rtTarget.Height());
+    json += MakeString("    \"sqrt_num_samples\": %d,\n", BenchmarkSqrtNumSamples);
+    json += MakeString("    \"max_rmse\": %g,\n", benchmarkMaxRMSE);
+    json += MakeString("    \"max_rel_mse\": %g,\n", benchmarkMaxRelMSE);
+    json += MakeString("    \"passed\": %s,\n", benchmarkPassed ? "true" : "false");
+    json += "    \"scenes\":\n    [\n" + benchmarkResults + "\n    ]\n}\n";
+    WriteStringAsFile(benchmarkPath.c_str(), json);
+
+    WriteLog("Benchmark %s", benchmarkPassed ? "passed" : "failed");
+
+    returnCode = benchmarkPassed ? 0 : 1;
+    Exit();
+}
+
+// Records the timings for the current benchmark scene, and compares its image with the reference
+void DXRPathTracer::FinishBenchmarkScene()
+{
+    DX12::FlushGPU();
+    benchmarkTimer.Update();
+
+    const char* sceneName = SceneNames[benchmarkSceneIdx];
+    const std::wstring sceneNameW = AnsiToWString(sceneName);
+
+    TextureData<Float4> image;
+    GetTextureData(rtTarget.Texture, image);
+
+    const std::wstring outputPath = GetDirectoryFromFilePath(benchmarkPath.c_str()) + sceneNameW + L".exr";
+    SaveTextureAsEXR(image, outputPath.c_str());
+
+    // Missing references and NaNs both count as failures
+    const std::wstring referencePath = benchmarkReferenceDir + L"\\" + sceneNameW + L".exr";
+    const char* status = "pass";
+    double rmse = -1.0;
+    double relMSE = -1.0;
+    if(updateBenchmarkReferences)
+    {
+        CreateDirectoryW(benchmarkReferenceDir.c_str(), nullptr);
+        SaveTextureAsEXR(image, referencePath.c_str());
+        status = "updated";
+    }
+    else if(FileExists(referencePath.c_str()) == false)
+    {
+        status = "missing_reference";
+    }
+    else
+    {
+        TextureData<Float4> reference;
+        LoadTextureData(referencePath.c_str(), reference);
+        if(reference.Width != image.Width || reference.Height != image.Height)
+        {
+            status = "size_mismatch";
+        }
+        else
+        {
+            double squaredErrorSum = 0.0;
+            double relSquaredErrorSum = 0.0;
+            for(uint64 i = 0; i < image.Texels.Size(); ++i)
+            {
+                const Float4& texel = image.Texels[i];
+                const Float4& refTexel = reference.Texels[i];
+                const double diffs[3] = { texel.x - refTexel.x, texel.y - refTexel.y, texel.z - refTexel.z };
+                const double refs[3] = { refTexel.x, refTexel.y, refTexel.z };
+                for(uint64 c = 0; c < 3; ++c)
+                {
+                    squaredErrorSum += diffs[c] * diffs[c];
+                    relSquaredErrorSum += diffs[c] * diffs[c] / (refs[c] * refs[c] + 0.01);
+                }
+            }
+
+            const double numValues = double(image.Texels.Size()) * 3.0;
+            rmse = std::sqrt(squaredErrorSum / numValues);
+            relMSE = relSquaredErrorSum / numValues;
+            if(std::isfinite(rmse) == false || std::isfinite(relMSE) == false)
+                rmse = relMSE = -1.0;
+
+            if(rmse < 0.0 || rmse > benchmarkMaxRMSE || relMSE > benchmarkMaxRelMSE)
+                status = "fail";
+        }
+    }
+
+    if(strcmp(status, "pass") != 0 && strcmp(status, "updated") != 0)
+        benchmarkPassed = false;
+
+    // Same ray count estimate as the progress bar in RenderHUD()
+    const uint64 numSamples = uint64(BenchmarkSqrtNumSamples) * BenchmarkSqrtNumSamples;
+    const double seconds = benchmarkTimer.ElapsedSecondsD();
+    const double avgPathLength = rtAvgPathLength > 0.0f ? rtAvgPathLength : AppSettings::MaxPathLength - 1.0;
+    const double numRays = double(rtTarget.Width()) * rtTarget.Height() * numSamples * (1.0 + avgPathLength * 2.0);
+    const double mRaysPerSecond = numRays / seconds / 1000000.0;
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = { };
+    memoryCounters.cb = sizeof(memoryCounters);
+    GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters));
+    const double peakWorkingSetMB = memoryCounters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    const double peakGPUMemoryMB = benchmarkPeakGPUMemory / (1024.0 * 1024.0);
+
+    if(benchmarkResults.length() > 0)
+        benchmarkResults += ",\n";
+    benchmarkResults += "        {\n";
+    benchmarkResults += MakeString("            \"name\": \"%s\",\n", sceneName);
+    benchmarkResults += MakeString("            \"wall_time_seconds\": %.4f,\n", seconds);
+    benchmarkResults += MakeString("            \"mrays_per_second\": %.2f,\n", mRaysPerSecond);
+    benchmarkResults += MakeString("            \"avg_path_length\": %.4f,\n", avgPathLength);
+    benchmarkResults += MakeString("            \"peak_working_set_mb\": %.2f,\n", peakWorkingSetMB);
+    benchmarkResults += MakeString("            \"peak_gpu_memory_mb\": %.2f,\n", peakGPUMemoryMB);
+    benchmarkResults += MakeString("            \"rmse\": %g,\n", rmse);
+    benchmarkResults += MakeString("            \"rel_mse\": %g,\n", relMSE);
+    benchmarkResults += MakeString("            \"status\": \"%s\"\n", status);
+    benchmarkResults += "        }";
+
+    WriteLog("Benchmark %s: %.2f seconds (%.2f Mrays per second), RMSE %g, relative MSE %g, %s",
+             sceneName, seconds, mRaysPerSecond, rmse, relMSE, status);
+}
+
 void DXRPathTracer::BuildRTAccelerationStructure()
 {
     const FormattedBuffer& idxBuffer = currentModel->IndexBuffer();
@@ -1444,9 +1958,12 @@ void DXRPathTracer::BuildRTAccelerationStructure()
 
     const uint64 numMeshes = currentModel->NumMeshes();
     Array<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs(numMeshes);
+    Array<GeometryInfo> geoInfoBufferData(numMeshes);
 
-    const uint32 numGeometries = uint32(geometryDescs.Size());
-    Array<GeometryInfo> geoInfoBufferData(numGeometries);
+    // The vertex positions are quantized to the bounds of their mesh, so every BLAS gets a 3x4 transform
+    // that scales and offsets them back to object space
+    const uint64 transformSize = sizeof(float) * 12;
+    TempBuffer transformBuffer = DX12::TempStructuredBuffer(numMeshes, transformSize, false);
 
     for(uint64 meshIdx = 0; meshIdx < numMeshes; ++meshIdx)
     {
@@ -1462,123 +1979,97 @@ void DXRPathTracer::BuildRTAccelerationStructure()
         geometryDesc.Triangles.IndexBuffer = idxBuffer.GPUAddress + mesh.IndexOffset() * idxBuffer.Stride;
         geometryDesc.Triangles.IndexCount = uint32(mesh.NumIndices());
         geometryDesc.Triangles.IndexFormat = idxBuffer.Format;
-        geometryDesc.Triangles.Transform3x4 = 0;
-        geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+        geometryDesc.Triangles.Transform3x4 = transformBuffer.GPUAddress + meshIdx * transformSize;
+        geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R16G16B16A16_SNORM;
         geometryDesc.Triangles.VertexCount = uint32(mesh.NumVertices());
         geometryDesc.Triangles.VertexBuffer.StartAddress = vtxBuffer.GPUAddress + mesh.VertexOffset() * vtxBuffer.Stride;
         geometryDesc.Triangles.VertexBuffer.StrideInBytes = vtxBuffer.Stride;
         geometryDesc.Flags = opaque ? D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE : D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
 
+        const Float3& scale = mesh.PositionScale();
+        const Float3& offset = mesh.PositionOffset();
+        const float transform[12] =
+        {
+            scale.x, 0.0f, 0.0f, offset.x,
+            0.0f, scale.y, 0.0f, offset.y,
+            0.0f, 0.0f, scale.z, offset.z,
+        };
+        memcpy(reinterpret_cast<uint8*>(transformBuffer.CPUAddress) + meshIdx * transformSize, transform, transformSize);
+
         GeometryInfo& geoInfo = geoInfoBufferData[meshIdx];
         geoInfo = { };
         geoInfo.VtxOffset = uint32(mesh.VertexOffset());
         geoInfo.IdxOffset = uint32(mesh.IndexOffset());
         geoInfo.MaterialIdx = mesh.MeshParts()[0].MaterialIdx;
-
-        Assert_(mesh.NumMeshParts() == 1);
+        geoInfo.PositionScale = mesh.PositionScale();
+        geoInfo.PositionOffset = mesh.PositionOffset();
     }
 
-    // Get required sizes for an acceleration structure
+    // Every mesh gets its own bottom-level acceleration structure, so that all instances of a mesh can share it.
+    // They're sub-allocated from a single buffer, and each build gets its own section of the scratch buffer
+    // so that they can all run without any barriers in between.
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
 
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO topLevelPrebuildInfo = {};
-
-    {
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS prebuildInfoDesc = {};
-        prebuildInfoDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        prebuildInfoDesc.Flags = buildFlags;
-        prebuildInfoDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-        prebuildInfoDesc.pGeometryDescs = nullptr;
-        prebuildInfoDesc.NumDescs = 1;
-        DX12::Device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildInfoDesc, &topLevelPrebuildInfo);
-    }
-
-    Assert_(topLevelPrebuildInfo.ResultDataMaxSizeInBytes > 0);
-
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO bottomLevelPrebuildInfo = {};
+    Array<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC> bottomLevelBuildDescs(numMeshes);
+    Array<uint64> scratchOffsets(numMeshes);
+    rtBottomLevelOffsets.Init(numMeshes);
+    uint64 bottomLevelSize = 0;
+    uint64 scratchSize = 0;
 
+    for(uint64 meshIdx = 0; meshIdx < numMeshes; ++meshIdx)
     {
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS prebuildInfoDesc = {};
-        prebuildInfoDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        prebuildInfoDesc.Flags = buildFlags;
-        prebuildInfoDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-        prebuildInfoDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        prebuildInfoDesc.pGeometryDescs = geometryDescs.Data();
-        prebuildInfoDesc.NumDescs = numGeometries;
-        DX12::Device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildInfoDesc, &bottomLevelPrebuildInfo);
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC& buildDesc = bottomLevelBuildDescs[meshIdx];
+        buildDesc = { };
+        buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        buildDesc.Inputs.Flags = buildFlags;
+        buildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        buildDesc.Inputs.NumDescs = 1;
+        buildDesc.Inputs.pGeometryDescs = &geometryDescs[meshIdx];
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+        DX12::Device->GetRaytracingAccelerationStructurePrebuildInfo(&buildDesc.Inputs, &prebuildInfo);
+        Assert_(prebuildInfo.ResultDataMaxSizeInBytes > 0);
+
+        rtBottomLevelOffsets[meshIdx] = bottomLevelSize;
+        scratchOffsets[meshIdx] = scratchSize;
+        bottomLevelSize += AlignTo(prebuildInfo.ResultDataMaxSizeInBytes, uint64(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT));
+        scratchSize += AlignTo(prebuildInfo.ScratchDataSizeInBytes, uint64(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT));
     }
 
-    Assert_(bottomLevelPrebuildInfo.ResultDataMaxSizeInBytes > 0);
-
     RawBuffer scratchBuffer;
 
     {
         RawBufferInit bufferInit;
-        bufferInit.NumElements = Max(topLevelPrebuildInfo.ScratchDataSizeInBytes, bottomLevelPrebuildInfo.ScratchDataSizeInBytes) / RawBuffer::Stride;
+        bufferInit.NumElements = scratchSize / RawBuffer::Stride;
         bufferInit.CreateUAV = true;
         bufferInit.InitialState = D3D12_RESOURCE_STATE_COMMON;
-        bufferInit.Name = L"RT Scratch Buffer";
+        bufferInit.Name = L"RT Bottom Level Scratch Buffer";
         scratchBuffer.Initialize(bufferInit);
     }
 
     {
         RawBufferInit bufferInit;
-        bufferInit.NumElements = bottomLevelPrebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
+        bufferInit.NumElements = bottomLevelSize / RawBuffer::Stride;
         bufferInit.CreateUAV = true;
         bufferInit.InitialState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
-        bufferInit.Name = L"RT Bottom Level Accel Structure";
+        bufferInit.Name = L"RT Bottom Level Accel Structures";
         rtBottomLevelAccelStructure.Initialize(bufferInit);
     }
 
-    {
-        RawBufferInit bufferInit;
-        bufferInit.NumElements = topLevelPrebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
-        bufferInit.CreateUAV = true;
-        bufferInit.InitialState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
-        bufferInit.Name = L"RT Top Level Accel Structure";
-        rtTopLevelAccelStructure.Initialize(bufferInit);
-    }
-
-    // Create an instance desc for the bottom-level acceleration structure.
-    D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
-    instanceDesc.Transform[0][0] = instanceDesc.Transform[1][1] = instanceDesc.Transform[2][2] = 1.0f;
-    instanceDesc.InstanceMask = 1;
-    instanceDesc.AccelerationStructure = rtBottomLevelAccelStructure.GPUAddress;
-
-    TempBuffer instanceBuffer = DX12::TempStructuredBuffer(1, sizeof(D3D12_RAYTRACING_INSTANCE_DESC), false);
-    memcpy(instanceBuffer.CPUAddress, &instanceDesc, sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
-
-    // Bottom Level Acceleration Structure desc
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomLevelBuildDesc = {};
-    {
-        bottomLevelBuildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        bottomLevelBuildDesc.Inputs.Flags = buildFlags;
-        bottomLevelBuildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-        bottomLevelBuildDesc.Inputs.NumDescs = numGeometries;
-        bottomLevelBuildDesc.Inputs.pGeometryDescs = geometryDescs.Data();
-        bottomLevelBuildDesc.ScratchAccelerationStructureData = scratchBuffer.GPUAddress;
-        bottomLevelBuildDesc.DestAccelerationStructureData = rtBottomLevelAccelStructure.GPUAddress;
-    }
-
-    // Top Level Acceleration Structure desc
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelBuildDesc = bottomLevelBuildDesc;
-    {
-        topLevelBuildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-        topLevelBuildDesc.Inputs.NumDescs = 1;
-        topLevelBuildDesc.Inputs.pGeometryDescs = nullptr;
-        topLevelBuildDesc.Inputs.InstanceDescs = instanceBuffer.GPUAddress;
-        topLevelBuildDesc.DestAccelerationStructureData = rtTopLevelAccelStructure.GPUAddress;;
-        topLevelBuildDesc.ScratchAccelerationStructureData = scratchBuffer.GPUAddress;
-    }
-
     {
         ProfileBlock profileBlock(DX12::CmdList, "Build Acceleration Structure");
 
-        DX12::CmdList->BuildRaytracingAccelerationStructure(&bottomLevelBuildDesc, 0, nullptr);
+        for(uint64 meshIdx = 0; meshIdx < numMeshes; ++meshIdx)
+        {
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC& buildDesc = bottomLevelBuildDescs[meshIdx];
+            buildDesc.DestAccelerationStructureData = rtBottomLevelAccelStructure.GPUAddress + rtBottomLevelOffsets[meshIdx];
+            buildDesc.ScratchAccelerationStructureData = scratchBuffer.GPUAddress + scratchOffsets[meshIdx];
+            DX12::CmdList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+        }
+
         rtBottomLevelAccelStructure.UAVBarrier(DX12::CmdList);
 
-        DX12::CmdList->BuildRaytracingAccelerationStructure(&topLevelBuildDesc, 0, nullptr);
-        rtTopLevelAccelStructure.UAVBarrier(DX12::CmdList);
+        BuildRTTopLevelAccelStructure();
     }
 
     scratchBuffer.Shutdown();
@@ -1586,7 +2077,7 @@ void DXRPathTracer::BuildRTAccelerationStructure()
     {
         StructuredBufferInit sbInit;
         sbInit.Stride = sizeof(GeometryInfo);
-        sbInit.NumElements = numGeometries;
+        sbInit.NumElements = numMeshes;
         sbInit.Name = L"Geometry Info Buffer";
         sbInit.InitData = geoInfoBufferData.Data();
         rtGeoInfoBuffer.Initialize(sbInit);
@@ -1596,6 +2087,79 @@ void DXRPathTracer::BuildRTAccelerationStructure()
     lastBuildAccelStructureFrame = DX12::CurrentCPUFrame;
 }
 
+// Builds the top-level acceleration structure from the model's instances. This is all that needs
+// to be re-built when instances are moved, since the bottom-level structures are in object space.
+void DXRPathTracer::BuildRTTopLevelAccelStructure()
+{
+    const Array<MeshInstance>& instances = currentModel->Instances();
+    const uint64 numInstances = instances.Size();
+    Assert_(numInstances > 0);
+
+    TempBuffer instanceBuffer = DX12::TempStructuredBuffer(numInstances, sizeof(D3D12_RAYTRACING_INSTANCE_DESC), false);
+    D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs = reinterpret_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(instanceBuffer.CPUAddress);
+
+    for(uint64 instanceIdx = 0; instanceIdx < numInstances; ++instanceIdx)
+    {
+        const MeshInstance& instance = instances[instanceIdx];
+        Assert_(instance.MeshIdx < (1 << 24));
+
+        // DXR wants a 3x4 matrix that transforms column vectors, which is the transpose of our convention
+        const Float4x4 transform = Float4x4::Transpose(instance.Transform);
+
+        D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
+        memcpy(instanceDesc.Transform, &transform, sizeof(instanceDesc.Transform));
+        instanceDesc.InstanceID = instance.MeshIdx;
+        instanceDesc.InstanceMask = 1;
+        instanceDesc.InstanceContributionToHitGroupIndex = instance.MeshIdx * NumRayTypes;
+        instanceDesc.AccelerationStructure = rtBottomLevelAccelStructure.GPUAddress + rtBottomLevelOffsets[instance.MeshIdx];
+        instanceDescs[instanceIdx] = instanceDesc;
+    }
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelBuildDesc = {};
+    topLevelBuildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    topLevelBuildDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    topLevelBuildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+    topLevelBuildDesc.Inputs.NumDescs = uint32(numInstances);
+    topLevelBuildDesc.Inputs.InstanceDescs = instanceBuffer.GPUAddress;
+
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO topLevelPrebuildInfo = {};
+    DX12::Device->GetRaytracingAccelerationStructurePrebuildInfo(&topLevelBuildDesc.Inputs, &topLevelPrebuildInfo);
+    Assert_(topLevelPrebuildInfo.ResultDataMaxSizeInBytes > 0);
+
+    RawBuffer scratchBuffer;
+
+    {
+        RawBufferInit bufferInit;
+        bufferInit.NumElements = Max<uint64>(topLevelPrebuildInfo.ScratchDataSizeInBytes / RawBuffer::Stride, 1);
+        bufferInit.CreateUAV = true;
+        bufferInit.InitialState = D3D12_RESOURCE_STATE_COMMON;
+        bufferInit.Name = L"RT Top Level Scratch Buffer";
+        scratchBuffer.Initialize(bufferInit);
+    }
+
+    // The old top-level structure can be re-used if it's big enough
+    const uint64 topLevelNumElements = topLevelPrebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
+    if(rtTopLevelAccelStructure.NumElements < topLevelNumElements)
+    {
+        RawBufferInit bufferInit;
+        bufferInit.NumElements = topLevelNumElements;
+        bufferInit.CreateUAV = true;
+        bufferInit.InitialState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
+        bufferInit.Name = L"RT Top Level Accel Structure";
+        rtTopLevelAccelStructure.Initialize(bufferInit);
+    }
+
+    topLevelBuildDesc.DestAccelerationStructureData = rtTopLevelAccelStructure.GPUAddress;
+    topLevelBuildDesc.ScratchAccelerationStructureData = scratchBuffer.GPUAddress;
+
+    DX12::CmdList->BuildRaytracingAccelerationStructure(&topLevelBuildDesc, 0, nullptr);
+    rtTopLevelAccelStructure.UAVBarrier(DX12::CmdList);
+
+    scratchBuffer.Shutdown();
+
+    buildTopLevelAccelStructure = false;
+}
+
 int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
 {
     DXRPathTracer app(lpCmdLine);
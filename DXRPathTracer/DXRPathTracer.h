@@ -19,9 +19,12 @@
 #include <Graphics/Model.h>
 #include <Graphics/Skybox.h>
 #include <Graphics/GraphicsTypes.h>
+#include <EnkiTS/TaskScheduler.h>
 
 #include "PostProcessor.h"
 #include "MeshRenderer.h"
+#include "CPUPathTracer.h"
+#include "LightBVH.h"
 
 using namespace SampleFramework12;
 
@@ -39,7 +42,7 @@ protected:
 
     // Model
     Model sceneModels[uint64(Scenes::NumValues)];
-    const Model* currentModel = nullptr;
+    Model* currentModel = nullptr;
     MeshRenderer meshRenderer;
 
     RenderTexture mainTarget;
@@ -81,8 +84,10 @@ protected:
     ID3D12RootSignature* rtRootSignature = nullptr;
     ID3D12StateObject* rtPSO = nullptr;
     bool buildAccelStructure = true;
+    bool buildTopLevelAccelStructure = false;
     uint64 lastBuildAccelStructureFrame = uint64(-1);
     RawBuffer rtBottomLevelAccelStructure;
+    Array<uint64> rtBottomLevelOffsets;
     RawBuffer rtTopLevelAccelStructure;
     StructuredBuffer rtRayGenTable;
     StructuredBuffer rtHitTable;
@@ -92,6 +97,40 @@ protected:
     bool rtShouldRestartPathTrace = false;
     uint32 rtCurrSampleIdx = 0;
 
+    // Adaptive sampling state and path length statistics. The number of pixels that are still sampling
+    // and the histogram of path lengths get read back RenderLatency frames after each dispatch.
+    RenderTexture rtSampleStatsTarget;
+    RawBuffer rtPathStatsBuffer;
+    ReadbackBuffer rtPathStatsReadback;
+    uint32 rtReadbackSampleIdx[DX12::RenderLatency] = { };
+    uint64 rtNumActivePixels = 0;
+    uint64 rtNumPixelSamples = 0;
+    float rtAvgPathLength = 0.0f;
+
+    // Light hierarchy for picking spot lights in the path tracers, rebuilt whenever the set of lights changes
+    LightBVH lightBVH;
+    StructuredBuffer lightBVHBuffer;
+    uint32 lightBVHNumLights = uint32(-1);
+
+    // CPU reference path tracer
+    enki::TaskScheduler taskScheduler;
+    CPUPathTracer cpuPathTracer;
+    AtrousDenoiser cpuDenoiser;
+    std::wstring cpuReferencePath;
+
+    // Benchmark mode, which path traces every scene and checks the results against reference images
+    std::wstring benchmarkPath;
+    std::wstring benchmarkReferenceDir = L"..\\Content\\BenchmarkReferences";
+    bool updateBenchmarkReferences = false;
+    float benchmarkMaxRMSE = 0.01f;
+    float benchmarkMaxRelMSE = 0.001f;
+    uint64 benchmarkSceneIdx = 0;
+    bool benchmarkSceneStarted = false;
+    Timer benchmarkTimer;
+    uint64 benchmarkPeakGPUMemory = 0;
+    std::string benchmarkResults;
+    bool benchmarkPassed = true;
+
 
     virtual void Initialize() override;
     virtual void Shutdown() override;
@@ -112,14 +151,22 @@ protected:
     void CreateRayTracingPSOs();
 
     void UpdateLights();
+    void SetInstanceTransform(uint64 instanceIdx, const Float4x4& transform);
 
     void RenderClusters();
     void RenderForward();
     void RenderResolve();
     void RenderRayTracing();
+    void UpdatePathStats();
+    bool PathTraceComplete() const;
     void RenderHUD(const Timer& timer);
+    void RenderCPUReference(const wchar* outputPath);
+    void RunSamplerConvergenceTest();
+    void UpdateBenchmark();
+    void FinishBenchmarkScene();
 
     void BuildRTAccelerationStructure();
+    void BuildRTTopLevelAccelStructure();
 
 public:
 
@@ -8,6 +8,11 @@
 //
 //=================================================================================================
 
+// ================================================================================================
+// Includes
+// ================================================================================================
+#include <VertexPacking.hlsl>
+
 // ================================================================================================
 // Constant buffers
 // ================================================================================================
@@ -16,6 +21,10 @@ cbuffer VSConstants : register(b0)
     float4x4 World;
 	float4x4 View;
     float4x4 WorldViewProjection;
+    float NearClip;
+    float FarClip;
+    float3 PositionScale;
+    float3 PositionOffset;
 }
 
 // ================================================================================================
@@ -39,7 +48,8 @@ VSOutput VS(in VSInput input)
     VSOutput output;
 
     // Calc the clip-space position
-    output.PositionCS = mul(input.PositionOS, WorldViewProjection);
+    const float3 positionOS = DequantizePosition(input.PositionOS.xyz, PositionScale, PositionOffset);
+    output.PositionCS = mul(float4(positionOS, 1.0f), WorldViewProjection);
 
     return output;
 }
\ No newline at end of file
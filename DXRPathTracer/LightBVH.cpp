@@ -0,0 +1,262 @@
+//=================================================================================================
+//
+//  DXR Path Tracer
+//  by MJP
+//  http://mynameismjp.wordpress.com/
+//
+//  All code and content licensed under the MIT license
+//
+//=================================================================================================
+
+#include <PCH.h>
+
+#include "LightBVH.h"
+
+// Largest float below 1, for keeping remapped random numbers in [0, 1)
+static const float OneMinusEpsilon = 0.99999994f;
+
+static float SafeSqrt(float x)
+{
+    return std::sqrt(Max(x, 0.0f));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)), from the sines and cosines of a and b
+static float CosSubClamped(float sinThetaA, float cosThetaA, float sinThetaB, float cosThetaB)
+{
+    if(cosThetaA > cosThetaB)
+        return 1.0f;
+    return cosThetaA * cosThetaB + sinThetaA * sinThetaB;
+}
+
+static float SinSubClamped(float sinThetaA, float cosThetaA, float sinThetaB, float cosThetaB)
+{
+    if(cosThetaA > cosThetaB)
+        return 0.0f;
+    return sinThetaA * cosThetaB - cosThetaA * sinThetaB;
+}
+
+// Rotates v around a unit-length axis using Rodrigues' formula
+static Float3 RotateAroundAxis(const Float3& v, const Float3& axis, float angle)
+{
+    const float cosAngle = std::cos(angle);
+    const float sinAngle = std::sin(angle);
+    return v * cosAngle + Float3::Cross(axis, v) * sinAngle + axis * (Float3::Dot(axis, v) * (1.0f - cosAngle));
+}
+
+// Merges the emission cones of two nodes into the smallest cone that contains both
+static void MergeCones(const LightBVHNode& a, const LightBVHNode& b, LightBVHNode& merged)
+{
+    merged.CosThetaE = Min(a.CosThetaE, b.CosThetaE);
+
+    const float thetaA = std::acos(Clamp(a.CosThetaO, -1.0f, 1.0f));
+    const float thetaB = std::acos(Clamp(b.CosThetaO, -1.0f, 1.0f));
+    const float thetaD = std::acos(Clamp(Float3::Dot(a.Axis, b.Axis), -1.0f, 1.0f));
+
+    if(Min(thetaD + thetaB, Pi) <= thetaA)
+    {
+        merged.Axis = a.Axis;
+        merged.CosThetaO = a.CosThetaO;
+        return;
+    }
+
+    if(Min(thetaD + thetaA, Pi) <= thetaB)
+    {
+        merged.Axis = b.Axis;
+        merged.CosThetaO = b.CosThetaO;
+        return;
+    }
+
+    const float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+    const Float3 rotationAxis = Float3::Cross(a.Axis, b.Axis);
+    const float rotationAxisLength = Float3::Length(rotationAxis);
+    if(thetaO >= Pi || rotationAxisLength == 0.0f)
+    {
+        // The cone covers the whole sphere
+        merged.Axis = a.Axis;
+        merged.CosThetaO = -1.0f;
+        return;
+    }
+
+    merged.Axis = Float3::Normalize(RotateAroundAxis(a.Axis, rotationAxis / rotationAxisLength, thetaO - thetaA));
+    merged.CosThetaO = std::cos(thetaO);
+}
+
+void LightBVH::Build(const SpotLight* srcLights, uint32 srcNumLights)
+{
+    Shutdown();
+
+    lights = srcLights;
+    numLights = srcNumLights;
+    if(numLights == 0)
+        return;
+
+    Array<uint32> lightIndices(numLights);
+    for(uint32 i = 0; i < numLights; ++i)
+        lightIndices[i] = i;
+
+    nodes.Init(numLights * 2 - 1);
+
+    uint32 nextNodeIdx = 0;
+    BuildNode(lightIndices.Data(), numLights, nextNodeIdx);
+    Assert_(nextNodeIdx == nodes.Size());
+}
+
+void LightBVH::Shutdown()
+{
+    nodes.Shutdown();
+    lights = nullptr;
+    numLights = 0;
+}
+
+// Builds a subtree top-down by splitting the lights at the median of the longest axis of their positions,
+// and returns the index of its root node
+uint32 LightBVH::BuildNode(uint32* lightIndices, uint32 count, uint32& nextNodeIdx)
+{
+    const uint32 nodeIdx = nextNodeIdx++;
+
+    if(count == 1)
+    {
+        const SpotLight& light = lights[lightIndices[0]];
+
+        // The light shines away from its direction, and only within the outer cone angle
+        LightBVHNode& node = nodes[nodeIdx];
+        node.BoundsMin = light.Position;
+        node.BoundsMax = light.Position;
+        node.Power = ComputeLuminance(light.Intensity) * Pi2 * (1.0f - light.AngularAttenuationY);
+        node.Range = light.Range;
+        node.Axis = -light.Direction;
+        node.CosThetaO = 1.0f;
+        node.CosThetaE = light.AngularAttenuationY;
+        node.ChildOrLightIdx = lightIndices[0];
+        node.IsLeaf = 1;
+        node.PadTo64Bytes = 0;
+        return nodeIdx;
+    }
+
+    Float3 centroidMin = FloatMax;
+    Float3 centroidMax = -FloatMax;
+    for(uint32 i = 0; i < count; ++i)
+    {
+        const Float3& position = lights[lightIndices[i]].Position;
+        centroidMin = Float3(Min(centroidMin.x, position.x), Min(centroidMin.y, position.y), Min(centroidMin.z, position.z));
+        centroidMax = Float3(Max(centroidMax.x, position.x), Max(centroidMax.y, position.y), Max(centroidMax.z, position.z));
+    }
+
+    const Float3 extents = centroidMax - centroidMin;
+    uint32 splitAxis = 0;
+    if(extents.y > extents.x && extents.y >= extents.z)
+        splitAxis = 1;
+    else if(extents.z > extents.x && extents.z > extents.y)
+        splitAxis = 2;
+
+    const uint32 numLeft = count / 2;
+    std::nth_element(lightIndices, lightIndices + numLeft, lightIndices + count, [&](uint32 a, uint32 b)
+    {
+        return lights[a].Position[splitAxis] < lights[b].Position[splitAxis];
+    });
+
+    const uint32 leftIdx = BuildNode(lightIndices, numLeft, nextNodeIdx);
+    const uint32 rightIdx = BuildNode(lightIndices + numLeft, count - numLeft, nextNodeIdx);
+    Assert_(leftIdx == nodeIdx + 1);
+
+    const LightBVHNode& left = nodes[leftIdx];
+    const LightBVHNode& right = nodes[rightIdx];
+
+    LightBVHNode& node = nodes[nodeIdx];
+    node.BoundsMin = Float3(Min(left.BoundsMin.x, right.BoundsMin.x), Min(left.BoundsMin.y, right.BoundsMin.y), Min(left.BoundsMin.z, right.BoundsMin.z));
+    node.BoundsMax = Float3(Max(left.BoundsMax.x, right.BoundsMax.x), Max(left.BoundsMax.y, right.BoundsMax.y), Max(left.BoundsMax.z, right.BoundsMax.z));
+    node.Power = left.Power + right.Power;
+    node.Range = Max(left.Range, right.Range);
+    MergeCones(left, right, node);
+    node.ChildOrLightIdx = rightIdx;
+    node.IsLeaf = 0;
+    node.PadTo64Bytes = 0;
+
+    return nodeIdx;
+}
+
+// Conservative estimate of how much the lights under a node can contribute to a shading point. It's only zero
+// when none of the lights can reach the point, so that sampling with it stays unbiased. Must match
+// LightImportance() in RayTrace.hlsl.
+float LightBVH::Importance(const LightBVHNode& node, const Float3& position, const Float3& normal)
+{
+    // Spot lights have no contribution past their range
+    const Float3 closestPoint = Float3::Clamp(position, node.BoundsMin, node.BoundsMax);
+    if(Float3::Length(position - closestPoint) >= node.Range)
+        return 0.0f;
+
+    const Float3 center = (node.BoundsMin + node.BoundsMax) * 0.5f;
+    const float radius = Float3::Length(node.BoundsMax - node.BoundsMin) * 0.5f;
+    const Float3 centerToPoint = position - center;
+    const float distanceSq = Float3::Dot(centerToPoint, centerToPoint);
+    if(distanceSq == 0.0f)
+        return node.Power;
+
+    const Float3 wi = centerToPoint / std::sqrt(distanceSq);
+
+    // Angle subtended by the bounds, which covers everything when the point is inside of them
+    float cosThetaB = -1.0f;
+    if(distanceSq > radius * radius)
+        cosThetaB = SafeSqrt(1.0f - radius * radius / distanceSq);
+    const float sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+
+    // Smallest possible angle between the emission cone and the direction to the point
+    const float cosThetaW = Float3::Dot(node.Axis, wi);
+    const float sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+    const float sinThetaO = SafeSqrt(1.0f - node.CosThetaO * node.CosThetaO);
+    const float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.CosThetaO);
+    const float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.CosThetaO);
+    const float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if(cosThetaP <= node.CosThetaE)
+        return 0.0f;
+
+    // Smallest possible angle between the normal and the direction to the lights, which
+    // rejects nodes that are entirely behind the surface
+    const float cosThetaI = Float3::Dot(normal, -wi);
+    const float sinThetaI = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+    const float cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    if(cosThetaPI <= 0.0f)
+        return 0.0f;
+
+    return node.Power * cosThetaP * cosThetaPI / Max(distanceSq, radius);
+}
+
+bool LightBVH::SampleLight(const Float3& position, const Float3& normal, float u, uint32& lightIdx, float& pdf) const
+{
+    if(nodes.Size() == 0)
+        return false;
+
+    uint32 nodeIdx = 0;
+    pdf = 1.0f;
+
+    if(nodes[0].IsLeaf && Importance(nodes[0], position, normal) <= 0.0f)
+        return false;
+
+    while(nodes[nodeIdx].IsLeaf == 0)
+    {
+        const uint32 leftIdx = nodeIdx + 1;
+        const uint32 rightIdx = nodes[nodeIdx].ChildOrLightIdx;
+        const float leftImportance = Importance(nodes[leftIdx], position, normal);
+        const float rightImportance = Importance(nodes[rightIdx], position, normal);
+        if(leftImportance <= 0.0f && rightImportance <= 0.0f)
+            return false;
+
+        // Pick a child in proportion to its importance, and re-use the random number for the next level
+        const float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if(u < leftProbability)
+        {
+            nodeIdx = leftIdx;
+            u = Min(u / leftProbability, OneMinusEpsilon);
+            pdf *= leftProbability;
+        }
+        else
+        {
+            nodeIdx = rightIdx;
+            u = Min((u - leftProbability) / (1.0f - leftProbability), OneMinusEpsilon);
+            pdf *= 1.0f - leftProbability;
+        }
+    }
+
+    lightIdx = nodes[nodeIdx].ChildOrLightIdx;
+    return true;
+}
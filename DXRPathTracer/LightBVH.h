@@ -0,0 +1,51 @@
+//=================================================================================================
+//
+//  DXR Path Tracer
+//  by MJP
+//  http://mynameismjp.wordpress.com/
+//
+//  All code and content licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include <PCH.h>
+
+#include <Containers.h>
+#include <SF12_Math.h>
+
+#include "SharedTypes.h"
+
+using namespace SampleFramework12;
+
+// Bounding volume hierarchy over the spot lights, where every node also bounds the power and emission
+// directions of its lights. Shading points walk down the tree and pick a child based on how much it
+// could contribute, which picks a single light with a known probability in O(log N) steps instead
+// of evaluating every light in the scene. Based on the light BVH from pbrt-v4 [Conty18].
+class LightBVH
+{
+
+public:
+
+    void Build(const SpotLight* lights, uint32 numLights);
+    void Shutdown();
+
+    // Picks a light for a shading point using a random number in [0, 1). Returns false if no light
+    // can contribute to the point.
+    bool SampleLight(const Float3& position, const Float3& normal, float u, uint32& lightIdx, float& pdf) const;
+
+    const LightBVHNode* Nodes() const { return nodes.Data(); }
+    uint32 NumNodes() const { return uint32(nodes.Size()); }
+    uint32 NumLights() const { return numLights; }
+
+    static float Importance(const LightBVHNode& node, const Float3& position, const Float3& normal);
+
+protected:
+
+    uint32 BuildNode(uint32* lightIndices, uint32 count, uint32& nextNodeIdx);
+
+    Array<LightBVHNode> nodes;
+    const SpotLight* lights = nullptr;
+    uint32 numLights = 0;
+};
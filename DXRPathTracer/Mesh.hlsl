@@ -13,6 +13,7 @@
 //=================================================================================================
 // Includes
 //=================================================================================================
+#include <VertexPacking.hlsl>
 #include "Shading.hlsl"
 
 //=================================================================================================
@@ -25,6 +26,8 @@ struct VSConstants
     row_major float4x4 WorldViewProjection;
     float NearClip;
     float FarClip;
+    float3 PositionScale;
+    float3 PositionOffset;
 };
 
 struct MatIndexConstants
@@ -59,11 +62,10 @@ SamplerComparisonState PCFSampler : register(s2);
 //=================================================================================================
 struct VSInput
 {
-    float3 PositionOS           : POSITION;
-    float3 NormalOS             : NORMAL;
+    float4 PositionOS           : POSITION;     // Quantized, with the bitangent sign in w
+    float2 NormalOS             : NORMAL;       // Octahedral-encoded
+    float2 TangentOS            : TANGENT;      // Octahedral-encoded
     float2 UV                   : UV;
-    float3 TangentOS            : TANGENT;
-    float3 BitangentOS          : BITANGENT;
 };
 
 struct VSOutput
@@ -103,7 +105,10 @@ VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID)
 {
     VSOutput output;
 
-    float3 positionOS = input.PositionOS;
+    float3 positionOS = DequantizePosition(input.PositionOS.xyz, VSCBuffer.PositionScale, VSCBuffer.PositionOffset);
+
+    float3 normalOS, tangentOS, bitangentOS;
+    DecodeTangentFrame(input.NormalOS, input.TangentOS, input.PositionOS.w, normalOS, tangentOS, bitangentOS);
 
     // Calc the world-space position
     output.PositionWS = mul(float4(positionOS, 1.0f), VSCBuffer.World).xyz;
@@ -113,11 +118,11 @@ VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID)
     output.DepthVS = output.PositionCS.w;
 
     // Rotate the normal into world space
-    output.NormalWS = normalize(mul(float4(input.NormalOS, 0.0f), VSCBuffer.World)).xyz;
+    output.NormalWS = normalize(mul(float4(normalOS, 0.0f), VSCBuffer.World)).xyz;
 
     // Rotate the rest of the tangent frame into world space
-    output.TangentWS = normalize(mul(float4(input.TangentOS, 0.0f), VSCBuffer.World)).xyz;
-    output.BitangentWS = normalize(mul(float4(input.BitangentOS, 0.0f), VSCBuffer.World)).xyz;
+    output.TangentWS = normalize(mul(float4(tangentOS, 0.0f), VSCBuffer.World)).xyz;
+    output.BitangentWS = normalize(mul(float4(bitangentOS, 0.0f), VSCBuffer.World)).xyz;
 
     // Pass along the texture coordinates
     output.UV = input.UV;
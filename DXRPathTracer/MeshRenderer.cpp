@@ -45,27 +45,42 @@ struct MeshVSConstants
     Float4Align Float4x4 WorldViewProjection;
     float NearClip = 0.0f;
     float FarClip = 0.0f;
+    Float4Align Float3 PositionScale;
+    Float4Align Float3 PositionOffset;
 };
 
-// Frustum culls meshes, and produces a buffer of visible mesh indices
-static uint64 CullMeshes(const Camera& camera, const Array<DirectX::BoundingBox>& boundingBoxes, Array<uint32>& drawIndices)
+// Binds the vertex shader constants for an instance. Instances of the same mesh with the same transform
+// as the previous one (such as repeated draws of a merged mesh) re-use the previous constants. Each mesh
+// has its own position quantization, so switching meshes always needs new constants.
+static void BindInstanceConstants(ID3D12GraphicsCommandList* cmdList, const Camera& camera, const MeshInstance& instance,
+                                  const Mesh& mesh, uint32 rootParameter, MeshVSConstants& vsConstants,
+                                  const Float4x4*& currWorld, const Mesh*& currMesh)
 {
-    DirectX::BoundingFrustum frustum(camera.ProjectionMatrix().ToSIMD());
-    frustum.Transform(frustum, 1.0f, camera.Orientation().ToSIMD(), camera.Position().ToSIMD());
+    if(currWorld != nullptr && currMesh == &mesh && memcmp(currWorld, &instance.Transform, sizeof(Float4x4)) == 0)
+        return;
 
-    uint64 numVisible = 0;
-    const uint64 numMeshes = boundingBoxes.Size();
-    for(uint64 i = 0; i < numMeshes; ++i)
-    {
-        if(frustum.Intersects(boundingBoxes[i]))
-            drawIndices[numVisible++] = uint32(i);
-    }
+    vsConstants.World = instance.Transform;
+    vsConstants.WorldViewProjection = instance.Transform * camera.ViewProjectionMatrix();
+    vsConstants.PositionScale = mesh.PositionScale();
+    vsConstants.PositionOffset = mesh.PositionOffset();
+    DX12::BindTempConstantBuffer(cmdList, vsConstants, rootParameter, CmdListMode::Graphics);
+    currWorld = &instance.Transform;
+    currMesh = &mesh;
+}
 
-    return numVisible;
+// Perspective cameras cull against their frustum, with backfaces relative to the camera position
+static CullView MakeCullView(const Camera& camera)
+{
+    CullView view;
+    view.Frustum = DirectX::BoundingFrustum(camera.ProjectionMatrix().ToSIMD());
+    view.Frustum.Transform(view.Frustum, 1.0f, camera.Orientation().ToSIMD(), camera.Position().ToSIMD());
+    view.Position = camera.Position();
+    view.Direction = camera.Forward();
+    return view;
 }
 
-// Frustum culls meshes for an orthographic projection, and produces a buffer of visible mesh indices
-static uint64 CullMeshesOrthographic(const OrthographicCamera& camera, bool ignoreNearZ, const Array<DirectX::BoundingBox>& boundingBoxes, Array<uint32>& drawIndices)
+// Orthographic cameras cull against a box, with backfaces relative to the direction that the camera looks in
+static CullView MakeOrthographicCullView(const OrthographicCamera& camera, bool ignoreNearZ)
 {
     Float3 mins = Float3(camera.MinX(), camera.MinY(), camera.NearClip());
     Float3 maxes = Float3(camera.MaxX(), camera.MaxY(), camera.FarClip());
@@ -77,22 +92,84 @@ static uint64 CullMeshesOrthographic(const OrthographicCamera& camera, bool igno
     center = Float3::Transform(center, camera.Orientation());
     center += camera.Position();
 
-    DirectX::BoundingOrientedBox obb;
-    obb.Extents = extents.ToXMFLOAT3();
-    obb.Center = center.ToXMFLOAT3();
-    obb.Orientation = camera.Orientation().ToXMFLOAT4();
+    CullView view;
+    view.Box.Extents = extents.ToXMFLOAT3();
+    view.Box.Center = center.ToXMFLOAT3();
+    view.Box.Orientation = camera.Orientation().ToXMFLOAT4();
+    view.Position = camera.Position();
+    view.Direction = camera.Forward();
+    view.Orthographic = true;
+    return view;
+}
 
+// Frustum culls mesh instances, and produces a buffer of visible instance indices
+static uint64 CullMeshes(const CullView& view, const Array<DirectX::BoundingBox>& boundingBoxes, Array<uint32>& drawIndices)
+{
     uint64 numVisible = 0;
     const uint64 numMeshes = boundingBoxes.Size();
     for(uint64 i = 0; i < numMeshes; ++i)
     {
-        if(obb.Intersects(boundingBoxes[i]))
+        const bool visible = view.Orthographic ? view.Box.Intersects(boundingBoxes[i]) : view.Frustum.Intersects(boundingBoxes[i]);
+        if(visible)
             drawIndices[numVisible++] = uint32(i);
     }
 
     return numVisible;
 }
 
+// Culls the meshlets of a visible instance against the view bounds and with their normal cones, and produces
+// draws that each cover a run of visible meshlets in the same mesh part. The cone test happens in the object
+// space of the instance, where it still works with non-uniform scales. Mirrored instances flip the winding
+// order of their triangles, so those only get the bounds test.
+static uint64 CullMeshlets(const CullView& view, const MeshInstance& instance, const Mesh& mesh, MeshletDraw* draws)
+{
+    const Float4x4& world = instance.Transform;
+    const bool mirrored = Float3::Dot(Float3::Cross(world.Right(), world.Up()), world.Forward()) < 0.0f;
+
+    const Float4x4 worldToObject = Float4x4::Invert(world);
+    const Float3 positionOS = Float3::Transform(view.Position, worldToObject);
+    const Float3 directionOS = Float3::Normalize(Float3::TransformDirection(view.Direction, worldToObject));
+    const DirectX::XMMATRIX worldSIMD = world.ToSIMD();
+
+    uint64 numDraws = 0;
+    const Array<Meshlet>& meshlets = mesh.Meshlets();
+    for(uint64 meshletIdx = 0; meshletIdx < meshlets.Size(); ++meshletIdx)
+    {
+        const Meshlet& meshlet = meshlets[meshletIdx];
+
+        if(mirrored == false)
+        {
+            const bool backFacing = view.Orthographic ? meshlet.BackFacingOrthographic(directionOS) : meshlet.BackFacing(positionOS);
+            if(backFacing)
+                continue;
+        }
+
+        DirectX::BoundingSphere sphere(meshlet.Center.ToXMFLOAT3(), meshlet.Radius);
+        sphere.Transform(sphere, worldSIMD);
+        const bool visible = view.Orthographic ? view.Box.Intersects(sphere) : view.Frustum.Intersects(sphere);
+        if(visible == false)
+            continue;
+
+        const uint32 indexCount = meshlet.NumTriangles * 3;
+        if(numDraws > 0)
+        {
+            MeshletDraw& prevDraw = draws[numDraws - 1];
+            if(prevDraw.PartIdx == meshlet.PartIdx && prevDraw.IndexStart + prevDraw.IndexCount == meshlet.IndexStart)
+            {
+                prevDraw.IndexCount += indexCount;
+                continue;
+            }
+        }
+
+        MeshletDraw& draw = draws[numDraws++];
+        draw.PartIdx = meshlet.PartIdx;
+        draw.IndexStart = meshlet.IndexStart;
+        draw.IndexCount = indexCount;
+    }
+
+    return numDraws;
+}
+
 MeshRenderer::MeshRenderer()
 {
 }
@@ -115,19 +192,17 @@ void MeshRenderer::Initialize(const Model* model_)
 {
     model = model_;
 
-    const uint64 numMeshes = model->Meshes().Size();
-    meshBoundingBoxes.Init(numMeshes);
-    frustumCulledIndices.Init(numMeshes, uint32(-1));
-    meshZDepths.Init(numMeshes, FloatMax);
-    for(uint64 i = 0; i < numMeshes; ++i)
-    {
-        const Mesh& mesh = model->Meshes()[i];
-        DirectX::BoundingBox& boundingBox = meshBoundingBoxes[i];
-        Float3 extents = (mesh.AABBMax() - mesh.AABBMin()) / 2.0f;
-        Float3 center = mesh.AABBMin() + extents;
-        boundingBox.Center = center.ToXMFLOAT3();
-        boundingBox.Extents = extents.ToXMFLOAT3();
-    }
+    const uint64 numInstances = model->Instances().Size();
+    instanceBoundingBoxes.Init(numInstances);
+    frustumCulledIndices.Init(numInstances, uint32(-1));
+    meshZDepths.Init(numInstances, FloatMax);
+
+    uint64 maxMeshlets = 0;
+    for(uint64 i = 0; i < model->NumMeshes(); ++i)
+        maxMeshlets = Max(maxMeshlets, model->Meshes()[i].NumMeshlets());
+    meshletDraws.Init(maxMeshlets);
+
+    UpdateInstanceBounds();
 
     LoadShaders();
 
@@ -290,6 +365,21 @@ void MeshRenderer::Shutdown()
     DX12::Release(depthRootSignature);
 }
 
+void MeshRenderer::UpdateInstanceBounds()
+{
+    for(uint64 i = 0; i < model->Instances().Size(); ++i)
+    {
+        const MeshInstance& instance = model->Instances()[i];
+        const Mesh& mesh = model->Meshes()[instance.MeshIdx];
+        DirectX::BoundingBox meshBoundingBox;
+        Float3 extents = (mesh.AABBMax() - mesh.AABBMin()) / 2.0f;
+        Float3 center = mesh.AABBMin() + extents;
+        meshBoundingBox.Center = center.ToXMFLOAT3();
+        meshBoundingBox.Extents = extents.ToXMFLOAT3();
+        meshBoundingBox.Transform(instanceBoundingBoxes[i], instance.Transform.ToSIMD());
+    }
+}
+
 void MeshRenderer::CreatePSOs(DXGI_FORMAT mainRTFormat, DXGI_FORMAT depthFormat, uint32 numMSAASamples)
 {
     if(model == nullptr)
@@ -370,8 +460,9 @@ void MeshRenderer::RenderMainPass(ID3D12GraphicsCommandList* cmdList, const Came
 {
     PIXMarker marker(cmdList, "Mesh Rendering");
 
-    const uint64 numVisible = CullMeshes(camera, meshBoundingBoxes, frustumCulledIndices);
-    const uint32* meshDrawIndices = frustumCulledIndices.Data();
+    const CullView cullView = MakeCullView(camera);
+    const uint64 numVisible = CullMeshes(cullView, instanceBoundingBoxes, frustumCulledIndices);
+    const uint32* instanceDrawIndices = frustumCulledIndices.Data();
 
     cmdList->SetGraphicsRootSignature(mainPassRootSignature);
     cmdList->SetPipelineState(mainPassPSO);
@@ -381,14 +472,11 @@ void MeshRenderer::RenderMainPass(ID3D12GraphicsCommandList* cmdList, const Came
 
     DX12::BindGlobalSRVDescriptorTable(cmdList, MainPass_StandardDescriptors, CmdListMode::Graphics);
 
-    Float4x4 world;
-
     // Set constant buffers
     MeshVSConstants vsConstants;
-    vsConstants.World = world;
     vsConstants.View = camera.ViewMatrix();
-    vsConstants.WorldViewProjection = world * camera.ViewProjectionMatrix();
-    DX12::BindTempConstantBuffer(cmdList, vsConstants, MainPass_VSCBuffer, CmdListMode::Graphics);
+    const Float4x4* currWorld = nullptr;
+    const Mesh* currMesh = nullptr;
 
     ShadingConstants psConstants;
     psConstants.SunDirectionWS = AppSettings::SunDirection;
@@ -427,17 +515,23 @@ void MeshRenderer::RenderMainPass(ID3D12GraphicsCommandList* cmdList, const Came
     cmdList->IASetVertexBuffers(0, 1, &vbView);
     cmdList->IASetIndexBuffer(&ibView);
 
-    // Draw all visible meshes
+    // Draw all visible instances
     uint32 currMaterial = uint32(-1);
     for(uint64 i = 0; i < numVisible; ++i)
     {
-        uint64 meshIdx = meshDrawIndices[i];
-        const Mesh& mesh = model->Meshes()[meshIdx];
+        const MeshInstance& instance = model->Instances()[instanceDrawIndices[i]];
+        const Mesh& mesh = model->Meshes()[instance.MeshIdx];
+        const uint64 numDraws = CullMeshlets(cullView, instance, mesh, meshletDraws.Data());
+        if(numDraws == 0)
+            continue;
+
+        BindInstanceConstants(cmdList, camera, instance, mesh, MainPass_VSCBuffer, vsConstants, currWorld, currMesh);
 
-        // Draw all parts
-        for(uint64 partIdx = 0; partIdx < mesh.NumMeshParts(); ++partIdx)
+        // Draw the visible meshlets of each part
+        for(uint64 drawIdx = 0; drawIdx < numDraws; ++drawIdx)
         {
-            const MeshPart& part = mesh.MeshParts()[partIdx];
+            const MeshletDraw& draw = meshletDraws[drawIdx];
+            const MeshPart& part = mesh.MeshParts()[draw.PartIdx];
             if(part.MaterialIdx != currMaterial)
             {
                 cmdList->SetGraphicsRoot32BitConstant(MainPass_MatIndexCBuffer, part.MaterialIdx, 0);
@@ -455,26 +549,24 @@ void MeshRenderer::RenderMainPass(ID3D12GraphicsCommandList* cmdList, const Came
                 currPSO = newPSO;
             }
 
-            cmdList->DrawIndexedInstanced(part.IndexCount, 1, mesh.IndexOffset() + part.IndexStart, mesh.VertexOffset(), 0);
+            cmdList->DrawIndexedInstanced(draw.IndexCount, 1, mesh.IndexOffset() + draw.IndexStart, mesh.VertexOffset(), 0);
         }
     }
 }
 
 // Renders all meshes using depth-only rendering
-void MeshRenderer::RenderDepth(ID3D12GraphicsCommandList* cmdList, const Camera& camera, ID3D12PipelineState* pso, uint64 numVisible, const uint32* meshDrawIndices)
+void MeshRenderer::RenderDepth(ID3D12GraphicsCommandList* cmdList, const Camera& camera, const CullView& cullView, ID3D12PipelineState* pso,
+                               uint64 numVisible, const uint32* instanceDrawIndices)
 {
     cmdList->SetGraphicsRootSignature(depthRootSignature);
     cmdList->SetPipelineState(pso);
     cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    Float4x4 world;
-
     // Set constant buffers
     MeshVSConstants vsConstants;
-    vsConstants.World = world;
     vsConstants.View = camera.ViewMatrix();
-    vsConstants.WorldViewProjection = world * camera.ViewProjectionMatrix();
-    DX12::BindTempConstantBuffer(cmdList, vsConstants, 0, CmdListMode::Graphics);
+    const Float4x4* currWorld = nullptr;
+    const Mesh* currMesh = nullptr;
 
     // Bind vertices and indices
     D3D12_VERTEX_BUFFER_VIEW vbView = model->VertexBuffer().VBView();
@@ -482,28 +574,39 @@ void MeshRenderer::RenderDepth(ID3D12GraphicsCommandList* cmdList, const Camera&
     cmdList->IASetVertexBuffers(0, 1, &vbView);
     cmdList->IASetIndexBuffer(&ibView);
 
-    // Draw all meshes
+    // Draw all instances
     for(uint64 i = 0; i < numVisible; ++i)
     {
-        uint64 meshIdx = meshDrawIndices[i];
-        const Mesh& mesh = model->Meshes()[meshIdx];
+        const MeshInstance& instance = model->Instances()[instanceDrawIndices[i]];
+        const Mesh& mesh = model->Meshes()[instance.MeshIdx];
+        const uint64 numDraws = CullMeshlets(cullView, instance, mesh, meshletDraws.Data());
+        if(numDraws == 0)
+            continue;
 
-        // Draw the whole mesh
-        cmdList->DrawIndexedInstanced(mesh.NumIndices(), 1, mesh.IndexOffset(), mesh.VertexOffset(), 0);
+        BindInstanceConstants(cmdList, camera, instance, mesh, 0, vsConstants, currWorld, currMesh);
+
+        // Draw the meshlets that can cast a shadow into the view
+        for(uint64 drawIdx = 0; drawIdx < numDraws; ++drawIdx)
+        {
+            const MeshletDraw& draw = meshletDraws[drawIdx];
+            cmdList->DrawIndexedInstanced(draw.IndexCount, 1, mesh.IndexOffset() + draw.IndexStart, mesh.VertexOffset(), 0);
+        }
     }
 }
 
 // Renders all meshes using depth-only rendering for a sun shadow map
 void MeshRenderer::RenderSunShadowDepth(ID3D12GraphicsCommandList* cmdList, const OrthographicCamera& camera)
 {
-    const uint64 numVisible = CullMeshesOrthographic(camera, true, meshBoundingBoxes, frustumCulledIndices);
-    RenderDepth(cmdList, camera, sunShadowPSO, numVisible, frustumCulledIndices.Data());
+    const CullView cullView = MakeOrthographicCullView(camera, true);
+    const uint64 numVisible = CullMeshes(cullView, instanceBoundingBoxes, frustumCulledIndices);
+    RenderDepth(cmdList, camera, cullView, sunShadowPSO, numVisible, frustumCulledIndices.Data());
 }
 
 void MeshRenderer::RenderSpotLightShadowDepth(ID3D12GraphicsCommandList* cmdList, const Camera& camera)
 {
-    const uint64 numVisible = CullMeshes(camera, meshBoundingBoxes, frustumCulledIndices);
-    RenderDepth(cmdList, camera, spotLightShadowPSO, numVisible, frustumCulledIndices.Data());
+    const CullView cullView = MakeCullView(camera);
+    const uint64 numVisible = CullMeshes(cullView, instanceBoundingBoxes, frustumCulledIndices);
+    RenderDepth(cmdList, camera, cullView, spotLightShadowPSO, numVisible, frustumCulledIndices.Data());
 }
 
 // Renders meshes using cascaded shadow mapping
@@ -37,6 +37,25 @@ struct MainPassData
     const RawBuffer* SpotLightClusterBuffer = nullptr;
 };
 
+// What meshes and meshlets get culled against: either a perspective frustum along with the position
+// of the viewer, or an orthographic box along with the direction that it looks in
+struct CullView
+{
+    DirectX::BoundingFrustum Frustum;
+    DirectX::BoundingOrientedBox Box;
+    Float3 Position;
+    Float3 Direction;
+    bool Orthographic = false;
+};
+
+// A range of adjacent meshlets that survived culling, which can be drawn with one call
+struct MeshletDraw
+{
+    uint32 PartIdx = 0;
+    uint32 IndexStart = 0;      // Relative to the start of the mesh's indices
+    uint32 IndexCount = 0;
+};
+
 struct ShadingConstants
 {
     Float4Align Float3 SunDirectionWS;
@@ -64,6 +83,9 @@ public:
     void Initialize(const Model* sceneModel);
     void Shutdown();
 
+    // Call after moving instances in the scene model, so that culling uses their new bounds
+    void UpdateInstanceBounds();
+
     void CreatePSOs(DXGI_FORMAT mainRTFormat, DXGI_FORMAT depthFormat, uint32 numMSAASamples);
     void DestroyPSOs();
 
@@ -81,7 +103,8 @@ public:
 protected:
 
     void LoadShaders();
-    void RenderDepth(ID3D12GraphicsCommandList* cmdList, const Camera& camera, ID3D12PipelineState* pso, uint64 numVisible, const uint32* meshDrawIndices);
+    void RenderDepth(ID3D12GraphicsCommandList* cmdList, const Camera& camera, const CullView& cullView, ID3D12PipelineState* pso,
+                     uint64 numVisible, const uint32* instanceDrawIndices);
 
     const Model* model = nullptr;
 
@@ -104,8 +127,9 @@ protected:
     ID3D12PipelineState* spotLightShadowPSO = nullptr;
     ID3D12RootSignature* depthRootSignature = nullptr;
 
-    Array<DirectX::BoundingBox> meshBoundingBoxes;
+    Array<DirectX::BoundingBox> instanceBoundingBoxes;
     Array<uint32> frustumCulledIndices;
+    Array<MeshletDraw> meshletDraws;
     Array<float> meshZDepths;
 
     SunShadowConstantsDepthMap sunShadowConstants;
@@ -41,6 +41,8 @@ struct RayTraceConstants
     uint MaterialBufferIdx;
     uint SkyTextureIdx;
     uint NumLights;
+    uint LightBVHBufferIdx;
+    float PixelSpreadAngle;
 };
 
 struct LightConstants
@@ -51,6 +53,8 @@ struct LightConstants
 
 RaytracingAccelerationStructure Scene : register(t0, space200);
 RWTexture2D<float4> RenderTarget : register(u0);
+RWTexture2D<float2> SampleStatsTarget : register(u1);       // Luminance M2, converged flag
+RWByteAddressBuffer PathStatsBuffer : register(u2);          // Active pixel count, then the number of paths ending at each length
 
 ConstantBuffer<RayTraceConstants> RayTraceCB : register(b0);
 
@@ -64,6 +68,9 @@ struct PrimaryPayload
 {
     float3 Radiance;
     float Roughness;
+    float3 Throughput;
+    float ConeWidth;
+    float ConeSpread;
     uint PathLength;
     uint PixelIdx;
     uint SampleSetIdx;
@@ -84,9 +91,133 @@ enum RayTypes {
 
 static float2 SamplePoint(in uint pixelIdx, inout uint setIdx)
 {
-    const uint permutation = setIdx * RayTraceCB.TotalNumPixels + pixelIdx;
+    // Sobol samples are progressive, so they can keep going past SqrtNumSamples^2 without needing new
+    // permutations. The CPU-only precomputed tiles use the same samples generated on the fly.
+    if(AppSettings.SampleMode != SampleModes_CMJ)
+    {
+        const uint seed = SobolSeed(pixelIdx, setIdx);
+        setIdx += 1;
+        return SampleSobol2D(RayTraceCB.CurrSampleIdx, seed);
+    }
+
+    // Adaptive sampling can take more than SqrtNumSamples^2 samples, in which case every
+    // extra pass through the pattern uses a new set of permutations. Every bounce takes one
+    // sample per picked light, one for the BRDF, and one for Russian roulette.
+    const uint numSamples = uint(AppSettings.SqrtNumSamples * AppSettings.SqrtNumSamples);
+    const uint samplePass = RayTraceCB.CurrSampleIdx / numSamples;
+    const uint sampleIdx = RayTraceCB.CurrSampleIdx % numSamples;
+    const uint numSampleSets = (MaxPathLengthSetting + 1) * (MaxLightSamples + 2);
+
+    const uint permutation = (samplePass * numSampleSets + setIdx) * RayTraceCB.TotalNumPixels + pixelIdx;
     setIdx += 1;
-    return SampleCMJ2D(RayTraceCB.CurrSampleIdx, AppSettings.SqrtNumSamples, AppSettings.SqrtNumSamples, permutation);
+    return SampleCMJ2D(sampleIdx, AppSettings.SqrtNumSamples, AppSettings.SqrtNumSamples, permutation);
+}
+
+static float Luminance(in float3 clr)
+{
+    return dot(clr, float3(0.299f, 0.587f, 0.114f));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)), from the sines and cosines of a and b
+static float CosSubClamped(in float sinThetaA, in float cosThetaA, in float sinThetaB, in float cosThetaB)
+{
+    return cosThetaA > cosThetaB ? 1.0f : cosThetaA * cosThetaB + sinThetaA * sinThetaB;
+}
+
+static float SinSubClamped(in float sinThetaA, in float cosThetaA, in float sinThetaB, in float cosThetaB)
+{
+    return cosThetaA > cosThetaB ? 0.0f : sinThetaA * cosThetaB - cosThetaA * sinThetaB;
+}
+
+// Conservative estimate of how much the lights under a light BVH node can contribute to a shading point.
+// Must match LightBVH::Importance().
+static float LightImportance(in LightBVHNode node, in float3 positionWS, in float3 normalWS)
+{
+    // Spot lights have no contribution past their range
+    const float3 closestPoint = clamp(positionWS, node.BoundsMin, node.BoundsMax);
+    if(length(positionWS - closestPoint) >= node.Range)
+        return 0.0f;
+
+    const float3 center = (node.BoundsMin + node.BoundsMax) * 0.5f;
+    const float radius = length(node.BoundsMax - node.BoundsMin) * 0.5f;
+    const float3 centerToPoint = positionWS - center;
+    const float distanceSq = dot(centerToPoint, centerToPoint);
+    if(distanceSq == 0.0f)
+        return node.Power;
+
+    const float3 wi = centerToPoint * rsqrt(distanceSq);
+
+    // Angle subtended by the bounds, which covers everything when the point is inside of them
+    const float cosThetaB = distanceSq > radius * radius ? sqrt(max(1.0f - radius * radius / distanceSq, 0.0f)) : -1.0f;
+    const float sinThetaB = sqrt(max(1.0f - cosThetaB * cosThetaB, 0.0f));
+
+    // Smallest possible angle between the emission cone and the direction to the point
+    const float cosThetaW = dot(node.Axis, wi);
+    const float sinThetaW = sqrt(max(1.0f - cosThetaW * cosThetaW, 0.0f));
+    const float sinThetaO = sqrt(max(1.0f - node.CosThetaO * node.CosThetaO, 0.0f));
+    const float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.CosThetaO);
+    const float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.CosThetaO);
+    const float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if(cosThetaP <= node.CosThetaE)
+        return 0.0f;
+
+    // Smallest possible angle between the normal and the direction to the lights
+    const float cosThetaI = dot(normalWS, -wi);
+    const float sinThetaI = sqrt(max(1.0f - cosThetaI * cosThetaI, 0.0f));
+    const float cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    if(cosThetaPI <= 0.0f)
+        return 0.0f;
+
+    return node.Power * cosThetaP * cosThetaPI / max(distanceSq, radius);
+}
+
+// Walks down the light BVH to pick a spot light in proportion to its importance. Must match LightBVH::SampleLight().
+static bool SampleLightBVH(in float3 positionWS, in float3 normalWS, in float u, out uint lightIdx, out float pdf)
+{
+    lightIdx = 0;
+    pdf = 1.0f;
+
+    if(RayTraceCB.NumLights == 0)
+        return false;
+
+    StructuredBuffer<LightBVHNode> lightBVH = ResourceDescriptorHeap[RayTraceCB.LightBVHBufferIdx];
+
+    LightBVHNode node = lightBVH[0];
+    if(node.IsLeaf && LightImportance(node, positionWS, normalWS) <= 0.0f)
+        return false;
+
+    uint nodeIdx = 0;
+    while(node.IsLeaf == 0)
+    {
+        const uint leftIdx = nodeIdx + 1;
+        const uint rightIdx = node.ChildOrLightIdx;
+        const LightBVHNode left = lightBVH[leftIdx];
+        const LightBVHNode right = lightBVH[rightIdx];
+        const float leftImportance = LightImportance(left, positionWS, normalWS);
+        const float rightImportance = LightImportance(right, positionWS, normalWS);
+        if(leftImportance <= 0.0f && rightImportance <= 0.0f)
+            return false;
+
+        // Pick a child in proportion to its importance, and re-use the random number for the next level
+        const float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if(u < leftProbability)
+        {
+            nodeIdx = leftIdx;
+            node = left;
+            u = min(u / leftProbability, 0.99999994f);
+            pdf *= leftProbability;
+        }
+        else
+        {
+            nodeIdx = rightIdx;
+            node = right;
+            u = min((u - leftProbability) / (1.0f - leftProbability), 0.99999994f);
+            pdf *= 1.0f - leftProbability;
+        }
+    }
+
+    lightIdx = node.ChildOrLightIdx;
+    return true;
 }
 
 [shader("raygeneration")]
@@ -95,6 +226,10 @@ void RaygenShader()
     const uint2 pixelCoord = DispatchRaysIndex().xy;
     const uint pixelIdx = pixelCoord.y * DispatchRaysDimensions().x + pixelCoord.x;
 
+    // Pixels that have converged don't take any more samples
+    if(AppSettings.EnableAdaptiveSampling && RayTraceCB.CurrSampleIdx > 0 && SampleStatsTarget[pixelCoord].y > 0.0f)
+        return;
+
     uint sampleSetIdx = 0;
 
     // Form a primary ray by un-projecting the pixel coordinate using the inverse view * projection matrix
@@ -121,6 +256,9 @@ void RaygenShader()
     PrimaryPayload payload;
     payload.Radiance = 0.0f;
     payload.Roughness = 0.0f;
+    payload.Throughput = 1.0f;
+    payload.ConeWidth = 0.0f;
+    payload.ConeSpread = RayTraceCB.PixelSpreadAngle;
     payload.PathLength = 1;
     payload.PixelIdx = pixelIdx;
     payload.SampleSetIdx = sampleSetIdx;
@@ -146,9 +284,109 @@ void RaygenShader()
     float3 newValue = lerp(newSample, currValue, lerpFactor);
 
     RenderTarget[pixelCoord] = float4(newValue, 1.0f);
+
+    // Build a histogram of the final path lengths, so that the CPU can see how deep paths actually go
+    for(uint pathLength = 1; pathLength <= uint(AppSettings.MaxPathLength); ++pathLength)
+    {
+        const uint numPaths = WaveActiveCountBits(payload.PathLength == pathLength);
+        if(WaveIsFirstLane() && numPaths > 0)
+            PathStatsBuffer.InterlockedAdd(pathLength * 4, numPaths);
+    }
+
+    if(AppSettings.EnableAdaptiveSampling)
+    {
+        // Track the variance of the luminance using Welford's algorithm, where the progressive result is the running mean
+        const uint sampleCount = RayTraceCB.CurrSampleIdx + 1;
+        const float sampleLuminance = Luminance(newSample);
+        const float prevMean = RayTraceCB.CurrSampleIdx > 0 ? Luminance(currValue) : 0.0f;
+        const float newMean = Luminance(newValue);
+        const float prevM2 = RayTraceCB.CurrSampleIdx > 0 ? SampleStatsTarget[pixelCoord].x : 0.0f;
+        const float M2 = prevM2 + (sampleLuminance - prevMean) * (sampleLuminance - newMean);
+
+        // Retire the pixel once the standard error of the mean is small relative to the mean
+        const float variance = M2 / max(sampleCount - 1, 1);
+        const float standardError = sqrt(variance / sampleCount);
+        const bool converged = sampleCount >= uint(AppSettings.AdaptiveMinSamples) &&
+                               standardError <= AppSettings.AdaptiveErrorThreshold * newMean;
+
+        SampleStatsTarget[pixelCoord] = float2(M2, converged ? 1.0f : 0.0f);
+
+        // Count the pixels that will keep sampling, so that the CPU knows when to stop dispatching
+        const uint numActivePixels = WaveActiveCountBits(!converged);
+        if(WaveIsFirstLane() && numActivePixels > 0)
+            PathStatsBuffer.InterlockedAdd(0, numActivePixels);
+    }
 }
 
-static float3 PathTrace(in MeshVertex hitSurface, in Material material, in PrimaryPayload inPayload)
+// Computes the lighting from a single spot light, using a shadow ray for visibility
+static float3 SpotLightLighting(in uint spotLightIdx, in float3 positionWS, in float3 normalWS, in float3 diffuseAlbedo,
+                                in float3 specularAlbedo, in float roughness, in float3 incomingRayOriginWS,
+                                in float3 msEnergyCompensation, in uint pathLength)
+{
+    SpotLight spotLight = LightCBuffer.Lights[spotLightIdx];
+
+    float3 surfaceToLight = spotLight.Position - positionWS;
+    float distanceToLight = length(surfaceToLight);
+    surfaceToLight /= distanceToLight;
+    float angleFactor = saturate(dot(surfaceToLight, spotLight.Direction));
+    float angularAttenuation = smoothstep(spotLight.AngularAttenuationY, spotLight.AngularAttenuationX, angleFactor);
+
+    float d = distanceToLight / spotLight.Range;
+    float falloff = saturate(1.0f - (d * d * d * d));
+    falloff = (falloff * falloff) / (distanceToLight * distanceToLight + 1.0f);
+
+    angularAttenuation *= falloff;
+
+    if(angularAttenuation <= 0.0f)
+        return 0.0f;
+
+    // Shoot a shadow ray to see if the light is occluded
+    RayDesc ray;
+    ray.Origin = positionWS + normalWS * 0.01f;
+    ray.Direction = surfaceToLight;
+    ray.TMin = SpotShadowNearClip;
+    ray.TMax = distanceToLight - SpotShadowNearClip;
+
+    ShadowPayload payload;
+    payload.Visibility = 1.0f;
+
+    uint traceRayFlags = RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH;
+
+    // Stop using the any-hit shader once we've hit the max path length, since it's *really* expensive
+    if(pathLength > AppSettings.MaxAnyHitPathLength)
+        traceRayFlags = RAY_FLAG_FORCE_OPAQUE;
+
+    const uint hitGroupOffset = RayTypeShadow;
+    const uint hitGroupGeoMultiplier = NumRayTypes;
+    const uint missShaderIdx = RayTypeShadow;
+    TraceRay(Scene, traceRayFlags, 0xFFFFFFFF, hitGroupOffset, hitGroupGeoMultiplier, missShaderIdx, ray, payload);
+
+    float3 intensity = spotLight.Intensity * angularAttenuation;
+
+    return CalcLighting(normalWS, surfaceToLight, intensity, diffuseAlbedo, specularAlbedo,
+                        roughness, positionWS, incomingRayOriginWS, msEnergyCompensation) * payload.Visibility;
+}
+
+// Picks a mip level for a texture from the ray cone's footprint, which is in UV space until it's scaled
+// by the size of the texture. Must match CPUPathTracer::SampleMaterialTexture().
+static float TextureLOD(in Texture2D tex, in float coneLOD)
+{
+    if(!AppSettings.EnableRayConeLOD)
+        return 0.0f;
+
+    uint width, height, numLevels;
+    tex.GetDimensions(0, width, height, numLevels);
+    return coneLOD + 0.5f * log2(float(width) * float(height));
+}
+
+// Widens the ray cone after a bounce by roughly the angular width of the sampled lobe, since the
+// lobe blurs whatever is at the next hit at least that much
+static float BounceConeSpread(in float coneSpread, in bool diffuse, in float roughness)
+{
+    return coneSpread + 2.0f * (diffuse ? 1.0f : roughness);
+}
+
+static float3 PathTrace(in MeshVertex hitSurface, in Material material, in float triangleLODConstant, inout PrimaryPayload inPayload)
 {
     if((!AppSettings.EnableDiffuse && !AppSettings.EnableSpecular) ||
         (!AppSettings.EnableDirect && !AppSettings.EnableIndirect))
@@ -164,6 +402,10 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     const float3 incomingRayOriginWS = WorldRayOrigin();
     const float3 incomingRayDirWS = WorldRayDirection();
 
+    // Grow the ray cone out to the hit point, and project its width onto the triangle's UV space [AkenineMoller21]
+    const float coneWidth = max(inPayload.ConeWidth + inPayload.ConeSpread * RayTCurrent(), 0.00001f);
+    const float coneLOD = triangleLODConstant + log2(coneWidth / max(abs(dot(hitSurface.Normal, incomingRayDirWS)), 0.0001f));
+
     float3 normalWS = hitSurface.Normal;
     if(AppSettings.EnableNormalMaps)
     {
@@ -171,7 +413,7 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
         Texture2D normalMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Normal)];
 
         float3 normalTS;
-        normalTS.xy = normalMap.SampleLevel(MeshSampler, hitSurface.UV, 0.0f).xy * 2.0f - 1.0f;
+        normalTS.xy = normalMap.SampleLevel(MeshSampler, hitSurface.UV, TextureLOD(normalMap, coneLOD)).xy * 2.0f - 1.0f;
         normalTS.z = sqrt(1.0f - saturate(normalTS.x * normalTS.x + normalTS.y * normalTS.y));
         normalWS = normalize(mul(normalTS, tangentToWorld));
 
@@ -182,11 +424,11 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     if(AppSettings.EnableAlbedoMaps && !AppSettings.EnableWhiteFurnaceMode)
     {
         Texture2D albedoMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Albedo)];
-        baseColor = albedoMap.SampleLevel(MeshSampler, hitSurface.UV, 0.0f).xyz;
+        baseColor = albedoMap.SampleLevel(MeshSampler, hitSurface.UV, TextureLOD(albedoMap, coneLOD)).xyz;
     }
 
     Texture2D metallicMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Metallic)];
-    const float metallic = saturate((AppSettings.EnableWhiteFurnaceMode ? 1.0f : metallicMap.SampleLevel(MeshSampler, hitSurface.UV, 0.0f).x) * AppSettings.MetallicScale);
+    const float metallic = saturate((AppSettings.EnableWhiteFurnaceMode ? 1.0f : metallicMap.SampleLevel(MeshSampler, hitSurface.UV, TextureLOD(metallicMap, coneLOD)).x) * AppSettings.MetallicScale);
 
     const bool enableDiffuse = (AppSettings.EnableDiffuse && metallic < 1.0f) || AppSettings.EnableWhiteFurnaceMode;
     const bool enableSpecular = (AppSettings.EnableSpecular && (AppSettings.EnableIndirectSpecular ? !(AppSettings.AvoidCausticPaths && inPayload.IsDiffuse) : (inPayload.PathLength == 1)));
@@ -195,7 +437,7 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
         return 0.0f;
 
     Texture2D roughnessMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Roughness)];
-    const float sqrtRoughness = saturate((AppSettings.EnableWhiteFurnaceMode ? 1.0f : roughnessMap.SampleLevel(MeshSampler, hitSurface.UV, 0.0f).x) * AppSettings.RoughnessScale);
+    const float sqrtRoughness = saturate((AppSettings.EnableWhiteFurnaceMode ? 1.0f : roughnessMap.SampleLevel(MeshSampler, hitSurface.UV, TextureLOD(roughnessMap, coneLOD)).x) * AppSettings.RoughnessScale);
 
     const float3 diffuseAlbedo = lerp(baseColor, 0.0f, metallic) * (enableDiffuse ? 1.0f : 0.0f);
     const float3 specularAlbedo = lerp(0.03f, baseColor, metallic) * (enableSpecular ? 1.0f : 0.0f);
@@ -218,7 +460,7 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     }
 
     Texture2D emissiveMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Emissive)];
-    float3 radiance = AppSettings.EnableWhiteFurnaceMode ? 0.0.xxx : emissiveMap.SampleLevel(MeshSampler, hitSurface.UV, 0.0f).xyz;
+    float3 radiance = AppSettings.EnableWhiteFurnaceMode ? 0.0.xxx : emissiveMap.SampleLevel(MeshSampler, hitSurface.UV, TextureLOD(emissiveMap, coneLOD)).xyz;
 
     //Apply sun light
     if(AppSettings.EnableSun && !AppSettings.EnableWhiteFurnaceMode)
@@ -262,54 +504,31 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     }
 
     // Apply spot lights
-    if (AppSettings.RenderLights)
+    if(AppSettings.RenderLights)
     {
-        //iterate all lights
-        for (uint spotLightIdx = 0; spotLightIdx < RayTraceCB.NumLights; spotLightIdx++)
+        if(AppSettings.EnableLightBVH)
         {
-            SpotLight spotLight = LightCBuffer.Lights[spotLightIdx];
-
-            float3 surfaceToLight = spotLight.Position - positionWS;
-            float distanceToLight = length(surfaceToLight);
-            surfaceToLight /= distanceToLight;
-            float angleFactor = saturate(dot(surfaceToLight, spotLight.Direction));
-            float angularAttenuation = smoothstep(spotLight.AngularAttenuationY, spotLight.AngularAttenuationX, angleFactor);
-
-            float d = distanceToLight / spotLight.Range;
-            float falloff = saturate(1.0f - (d * d * d * d));
-            falloff = (falloff * falloff) / (distanceToLight * distanceToLight + 1.0f);
-
-            angularAttenuation *= falloff;
-
-            if (angularAttenuation > 0.0f)
+            // Pick a few lights from the light BVH in proportion to how much they can contribute, which keeps
+            // the cost per hit the same no matter how many lights there are
+            const uint numLightSamples = uint(AppSettings.NumLightSamples);
+            for(uint lightSampleIdx = 0; lightSampleIdx < numLightSamples; ++lightSampleIdx)
             {
-                // Shoot a shadow ray to see if the sun is occluded
-                RayDesc ray;
-                ray.Origin = positionWS + normalWS * 0.01f;
-                ray.Direction = surfaceToLight;
-                ray.TMin = SpotShadowNearClip;
-                ray.TMax = distanceToLight - SpotShadowNearClip;
-
-                ShadowPayload payload;
-                payload.Visibility = 1.0f;
-
-                uint traceRayFlags = RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH;
-
-                // Stop using the any-hit shader once we've hit the max path length, since it's *really* expensive
-                if (inPayload.PathLength > AppSettings.MaxAnyHitPathLength)
-                    traceRayFlags = RAY_FLAG_FORCE_OPAQUE;
-
-                const uint hitGroupOffset = RayTypeShadow;
-                const uint hitGroupGeoMultiplier = NumRayTypes;
-                const uint missShaderIdx = RayTypeShadow;
-                TraceRay(Scene, traceRayFlags, 0xFFFFFFFF, hitGroupOffset, hitGroupGeoMultiplier, missShaderIdx, ray, payload);
+                const float lightSample = SamplePoint(inPayload.PixelIdx, inPayload.SampleSetIdx).x;
 
-                float3 intensity = spotLight.Intensity * angularAttenuation;
-
-                radiance += CalcLighting(normalWS, surfaceToLight, intensity, diffuseAlbedo, specularAlbedo,
-                                         roughness, positionWS, incomingRayOriginWS, msEnergyCompensation) * payload.Visibility;
+                uint spotLightIdx = 0;
+                float lightPDF = 0.0f;
+                if(SampleLightBVH(positionWS, normalWS, lightSample, spotLightIdx, lightPDF))
+                    radiance += SpotLightLighting(spotLightIdx, positionWS, normalWS, diffuseAlbedo, specularAlbedo, roughness,
+                                                  incomingRayOriginWS, msEnergyCompensation, inPayload.PathLength) / (lightPDF * numLightSamples);
             }
         }
+        else
+        {
+            //iterate all lights
+            for(uint spotLightIdx = 0; spotLightIdx < RayTraceCB.NumLights; spotLightIdx++)
+                radiance += SpotLightLighting(spotLightIdx, positionWS, normalWS, diffuseAlbedo, specularAlbedo, roughness,
+                                              incomingRayOriginWS, msEnergyCompensation, inPayload.PathLength);
+        }
     }
 
     // Choose our next path by importance sampling our BRDFs
@@ -385,10 +604,27 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     if(inPayload.PathLength == 1 && !AppSettings.EnableDirect)
         radiance = 0.0.xxx;
 
+    // Randomly end the path with a probability based on how much it can still contribute, and boost the
+    // paths that survive to make up for the ones that didn't
+    if(AppSettings.EnableRussianRoulette && inPayload.PathLength >= uint(AppSettings.RussianRouletteMinDepth) &&
+       !AppSettings.EnableWhiteFurnaceMode)
+    {
+        const float3 pathThroughput = inPayload.Throughput * throughput;
+        const float continueProbability = min(max(pathThroughput.x, max(pathThroughput.y, pathThroughput.z)), 1.0f);
+        const float rouletteSample = SamplePoint(inPayload.PixelIdx, inPayload.SampleSetIdx).x;
+        if(rouletteSample >= continueProbability)
+            return radiance;
+
+        throughput /= continueProbability;
+    }
+
     if(AppSettings.EnableIndirect && (inPayload.PathLength + 1 < AppSettings.MaxPathLength) && !AppSettings.EnableWhiteFurnaceMode)
     {
         PrimaryPayload payload;
         payload.Radiance = 0.0f;
+        payload.Throughput = inPayload.Throughput * throughput;
+        payload.ConeWidth = coneWidth;
+        payload.ConeSpread = BounceConeSpread(inPayload.ConeSpread, selector < 0.5f, roughness);
         payload.PathLength = inPayload.PathLength + 1;
         payload.PixelIdx = inPayload.PixelIdx;
         payload.SampleSetIdx = inPayload.SampleSetIdx;
@@ -407,6 +643,9 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
         TraceRay(Scene, traceRayFlags, 0xFFFFFFFF, hitGroupOffset, hitGroupGeoMultiplier, missShaderIdx, ray, payload);
 
         radiance += payload.Radiance * throughput;
+
+        // Pass back how far the path went
+        inPayload.PathLength = payload.PathLength;
     }
     else
     {
@@ -440,15 +679,16 @@ static float3 PathTrace(in MeshVertex hitSurface, in Material material, in Prima
     return radiance;
 }
 
-// Loops up the vertex data for the hit triangle and interpolates its attributes
-MeshVertex GetHitSurface(in HitAttributes attr, in uint geometryIdx)
+// Loops up the vertex data for the hit triangle and interpolates its attributes. Also returns the ratio
+// of the triangle's UV area to its world space area in log2 space, for ray cone texture LOD.
+MeshVertex GetHitSurface(in HitAttributes attr, in uint meshIdx, out float triangleLODConstant)
 {
     float3 barycentrics = float3(1 - attr.barycentrics.x - attr.barycentrics.y, attr.barycentrics.x, attr.barycentrics.y);
 
     StructuredBuffer<GeometryInfo> geoInfoBuffer = ResourceDescriptorHeap[RayTraceCB.GeometryInfoBufferIdx];
-    const GeometryInfo geoInfo = geoInfoBuffer[geometryIdx];
+    const GeometryInfo geoInfo = geoInfoBuffer[meshIdx];
 
-    StructuredBuffer<MeshVertex> vtxBuffer = ResourceDescriptorHeap[RayTraceCB.VtxBufferIdx];
+    StructuredBuffer<PackedMeshVertex> vtxBuffer = ResourceDescriptorHeap[RayTraceCB.VtxBufferIdx];
     Buffer<uint> idxBuffer = ResourceDescriptorHeap[RayTraceCB.IdxBufferIdx];
 
     const uint primIdx = PrimitiveIndex();
@@ -456,18 +696,42 @@ MeshVertex GetHitSurface(in HitAttributes attr, in uint geometryIdx)
     const uint idx1 = idxBuffer[primIdx * 3 + geoInfo.IdxOffset + 1];
     const uint idx2 = idxBuffer[primIdx * 3 + geoInfo.IdxOffset + 2];
 
-    const MeshVertex vtx0 = vtxBuffer[idx0 + geoInfo.VtxOffset];
-    const MeshVertex vtx1 = vtxBuffer[idx1 + geoInfo.VtxOffset];
-    const MeshVertex vtx2 = vtxBuffer[idx2 + geoInfo.VtxOffset];
+    const MeshVertex vtx0 = UnpackMeshVertex(vtxBuffer[idx0 + geoInfo.VtxOffset], geoInfo.PositionScale, geoInfo.PositionOffset);
+    const MeshVertex vtx1 = UnpackMeshVertex(vtxBuffer[idx1 + geoInfo.VtxOffset], geoInfo.PositionScale, geoInfo.PositionOffset);
+    const MeshVertex vtx2 = UnpackMeshVertex(vtxBuffer[idx2 + geoInfo.VtxOffset], geoInfo.PositionScale, geoInfo.PositionOffset);
+
+    MeshVertex hitSurface = BarycentricLerp(vtx0, vtx1, vtx2, barycentrics);
+
+    // The mesh vertices are in object space, so use the instance transform to get to world space. The normal
+    // goes through the inverse-transpose so that it stays perpendicular to the surface under non-uniform scale.
+    const float3x4 objectToWorld = ObjectToWorld3x4();
+    hitSurface.Position = mul(objectToWorld, float4(hitSurface.Position, 1.0f));
+    hitSurface.Normal = normalize(mul(hitSurface.Normal, (float3x3)WorldToObject3x4()));
+    hitSurface.Tangent = normalize(mul((float3x3)objectToWorld, hitSurface.Tangent));
+    hitSurface.Bitangent = normalize(mul((float3x3)objectToWorld, hitSurface.Bitangent));
+
+    const float3 edge0 = mul((float3x3)objectToWorld, vtx1.Position - vtx0.Position);
+    const float3 edge1 = mul((float3x3)objectToWorld, vtx2.Position - vtx0.Position);
+    const float2 uvEdge0 = vtx1.UV - vtx0.UV;
+    const float2 uvEdge1 = vtx2.UV - vtx0.UV;
+    const float worldArea = length(cross(edge0, edge1));
+    const float uvArea = abs(uvEdge0.x * uvEdge1.y - uvEdge1.x * uvEdge0.y);
+    triangleLODConstant = 0.5f * log2(max(uvArea, 1e-12f) / max(worldArea, 1e-12f));
+
+    return hitSurface;
+}
 
-    return BarycentricLerp(vtx0, vtx1, vtx2, barycentrics);
+MeshVertex GetHitSurface(in HitAttributes attr, in uint meshIdx)
+{
+    float triangleLODConstant = 0.0f;
+    return GetHitSurface(attr, meshIdx, triangleLODConstant);
 }
 
-// Gets the material assigned to a geometry in the acceleration structure
-Material GetGeometryMaterial(in uint geometryIdx)
+// Gets the material assigned to a mesh in the acceleration structure
+Material GetGeometryMaterial(in uint meshIdx)
 {
     StructuredBuffer<GeometryInfo> geoInfoBuffer = ResourceDescriptorHeap[RayTraceCB.GeometryInfoBufferIdx];
-    const GeometryInfo geoInfo = geoInfoBuffer[geometryIdx];
+    const GeometryInfo geoInfo = geoInfoBuffer[meshIdx];
 
     StructuredBuffer<Material> materialBuffer = ResourceDescriptorHeap[RayTraceCB.MaterialBufferIdx];
     return materialBuffer[geoInfo.MaterialIdx];
@@ -476,17 +740,18 @@ Material GetGeometryMaterial(in uint geometryIdx)
 [shader("closesthit")]
 void ClosestHitShader(inout PrimaryPayload payload, in HitAttributes attr)
 {
-    const MeshVertex hitSurface = GetHitSurface(attr, GeometryIndex());
-    const Material material = GetGeometryMaterial(GeometryIndex());
+    float triangleLODConstant = 0.0f;
+    const MeshVertex hitSurface = GetHitSurface(attr, InstanceID(), triangleLODConstant);
+    const Material material = GetGeometryMaterial(InstanceID());
 
-    payload.Radiance = PathTrace(hitSurface, material, payload);
+    payload.Radiance = PathTrace(hitSurface, material, triangleLODConstant, payload);
 }
 
 [shader("anyhit")]
 void AnyHitShader(inout PrimaryPayload payload, in HitAttributes attr)
 {
-    const MeshVertex hitSurface = GetHitSurface(attr, GeometryIndex());
-    const Material material = GetGeometryMaterial(GeometryIndex());
+    const MeshVertex hitSurface = GetHitSurface(attr, InstanceID());
+    const Material material = GetGeometryMaterial(InstanceID());
 
     // Standard alpha testing
     Texture2D opacityMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Opacity)];
@@ -497,8 +762,8 @@ void AnyHitShader(inout PrimaryPayload payload, in HitAttributes attr)
 [shader("anyhit")]
 void ShadowAnyHitShader(inout ShadowPayload payload, in HitAttributes attr)
 {
-    const MeshVertex hitSurface = GetHitSurface(attr, GeometryIndex());
-    const Material material = GetGeometryMaterial(GeometryIndex());
+    const MeshVertex hitSurface = GetHitSurface(attr, InstanceID());
+    const Material material = GetGeometryMaterial(InstanceID());
 
     // Standard alpha testing
     Texture2D opacityMap = ResourceDescriptorHeap[NonUniformResourceIndex(material.Opacity)];
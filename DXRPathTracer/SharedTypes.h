@@ -55,10 +55,30 @@ struct ClusterBounds
     uint2 ZBounds;
 };
 
+// Node in the light hierarchy that the path tracer uses for picking spot lights. Nodes are stored depth-first,
+// so the first child of an interior node directly follows it.
+struct LightBVHNode
+{
+    float3 BoundsMin;
+    float Power;
+    float3 BoundsMax;
+    float Range;
+    float3 Axis;                // Emission cone that bounds all lights under the node
+    float CosThetaO;
+    float CosThetaE;
+    uint ChildOrLightIdx;       // Second child for interior nodes, spot light index for leaves
+    uint IsLeaf;
+    uint PadTo64Bytes;
+};
+
 struct GeometryInfo
 {
     uint VtxOffset;
     uint IdxOffset;
     uint MaterialIdx;
     uint PadTo16Bytes;
+    float3 PositionScale;       // Dequantizes the packed vertex positions, see Mesh::PositionScale()
+    uint PadTo32Bytes;
+    float3 PositionOffset;
+    uint PadTo48Bytes;
 };
@@ -135,19 +135,28 @@ void App::BeforeFlush()
 
 void App::ParseCommandLine(const wchar* cmdLine)
 {
-    if(cmdLine == nullptr)
-        return;
+    cxxopts::Options options("App", "");
+    options.allow_unrecognised_options();
+    options.add_options()
+         ("a,adapter", "GPU adapter index", cxxopts::value<int32>());
+
+    cxxopts::ParseResult parseResult = ParseCommandLineOptions(cmdLine, options);
 
-    std::string cmdLineA = WStringToAnsi(cmdLine);
+    if(parseResult.count("adapter"))
+        adapterIdx = parseResult["adapter"].as<int32>();
+}
+
+// Splits up the command line and parses it with the provided options. Apps can use this
+// to add their own options, as long as they allow unrecognised options.
+cxxopts::ParseResult App::ParseCommandLineOptions(const wchar* cmdLine, cxxopts::Options& options)
+{
+    std::string cmdLineA = cmdLine != nullptr ? WStringToAnsi(cmdLine) : "";
     GrowableList<std::string> parts;
     Split(cmdLineA, parts, " ");
 
-    uint64 numParts = parts.Count();
-    if(numParts == 0)
-        return;
-
     char appString[4] = "App";
 
+    uint64 numParts = parts.Count();
     Array<char*> partStrings(numParts + 1);
     partStrings[0] = appString;
     for(uint64 i = 0; i < numParts; ++i)
@@ -156,15 +165,7 @@ void App::ParseCommandLine(const wchar* cmdLine)
     int32 argc = int32(numParts + 1);
     char** argv = partStrings.Data();
 
-    cxxopts::Options options("App", "");
-    options.allow_unrecognised_options();
-    options.add_options()
-         ("a,adapter", "GPU adapter index", cxxopts::value<int32>());
-
-    cxxopts::ParseResult parseResult = options.parse(argc, argv);
-
-    if(parseResult.count("adapter"))
-        adapterIdx = parseResult["adapter"].as<int32>();
+    return options.parse(argc, argv);
 }
 
 void App::Initialize_Internal()
@@ -47,6 +47,7 @@ protected:
     virtual void BeforeFlush();
 
     void Exit();
+    static cxxopts::ParseResult ParseCommandLineOptions(const wchar* cmdLine, cxxopts::Options& options);
     void ToggleFullScreen(bool fullScreen);
     void CalculateFPS();
 
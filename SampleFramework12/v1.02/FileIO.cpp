@@ -240,4 +240,88 @@ uint64 File::Size() const
     return fileSize.QuadPart;
 }
 
+// == MappedFile ==================================================================================
+
+MappedFile::MappedFile() : fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL), data(nullptr), size(0),
+                           mapMode(FileMapMode::Read)
+{
+}
+
+MappedFile::MappedFile(const wchar* filePath, FileMapMode mapMode) : fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL),
+                                                                     data(nullptr), size(0), mapMode(FileMapMode::Read)
+{
+    Open(filePath, mapMode);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+    Assert_(fileHandle == INVALID_HANDLE_VALUE);
+}
+
+void MappedFile::Open(const wchar* filePath, FileMapMode mapMode_)
+{
+    Assert_(fileHandle == INVALID_HANDLE_VALUE);
+    Assert_(FileExists(filePath));
+    mapMode = mapMode_;
+
+    fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fileHandle == INVALID_HANDLE_VALUE)
+    {
+        std::wstring errPrefix = std::wstring(L"Failed to open file ") + filePath + L":\n";
+        throw Win32Exception(GetLastError(), errPrefix.c_str());
+    }
+
+    LARGE_INTEGER fileSize;
+    Win32Call(GetFileSizeEx(fileHandle, &fileSize));
+    size = fileSize.QuadPart;
+
+    // Empty files can't be mapped, so they just end up with a null pointer
+    if(size == 0)
+        return;
+
+    const DWORD protection = mapMode == FileMapMode::CopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY;
+    mappingHandle = CreateFileMapping(fileHandle, NULL, protection, 0, 0, NULL);
+    if(mappingHandle == NULL)
+    {
+        const DWORD error = GetLastError();
+        std::wstring errPrefix = std::wstring(L"Failed to map file ") + filePath + L":\n";
+        Close();
+        throw Win32Exception(error, errPrefix.c_str());
+    }
+
+    const DWORD access = mapMode == FileMapMode::CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ;
+    data = reinterpret_cast<uint8*>(MapViewOfFile(mappingHandle, access, 0, 0, 0));
+    if(data == nullptr)
+    {
+        const DWORD error = GetLastError();
+        std::wstring errPrefix = std::wstring(L"Failed to map file ") + filePath + L":\n";
+        Close();
+        throw Win32Exception(error, errPrefix.c_str());
+    }
+}
+
+void MappedFile::Close()
+{
+    if(data != nullptr)
+    {
+        Win32Call(UnmapViewOfFile(data));
+        data = nullptr;
+    }
+
+    if(mappingHandle != NULL)
+    {
+        Win32Call(CloseHandle(mappingHandle));
+        mappingHandle = NULL;
+    }
+
+    if(fileHandle != INVALID_HANDLE_VALUE)
+    {
+        Win32Call(CloseHandle(fileHandle));
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    size = 0;
+}
+
 }
\ No newline at end of file
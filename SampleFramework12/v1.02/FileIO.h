@@ -70,6 +70,42 @@ public:
     uint64 Size() const;
 };
 
+enum class FileMapMode
+{
+    Read = 0,
+    CopyOnWrite = 1,    // Writes go to private copies of the pages, and never make it back to the file
+};
+
+// Maps an entire file into the address space, so that it gets paged in on demand instead of read up front
+class MappedFile
+{
+
+private:
+
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+    uint8* data;
+    uint64 size;
+    FileMapMode mapMode;
+
+public:
+
+    // Lifetime
+    MappedFile();
+    MappedFile(const wchar* filePath, FileMapMode mapMode);
+    ~MappedFile();
+
+    // Explicit Open and close
+    void Open(const wchar* filePath, FileMapMode mapMode);
+    void Close();
+
+    // Accessors
+    const uint8* Data() const { return data; }
+    uint8* WritableData() const { Assert_(mapMode == FileMapMode::CopyOnWrite); return data; }
+    uint64 Size() const { return size; }
+    bool IsOpen() const { return fileHandle != INVALID_HANDLE_VALUE; }
+};
+
 // == File ========================================================================================
 
 template<typename T> void File::Read(T& data) const
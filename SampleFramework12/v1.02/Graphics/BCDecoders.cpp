@@ -0,0 +1,432 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "BCDecoders.h"
+
+#include <immintrin.h>
+
+using namespace DirectX;
+
+namespace SampleFramework12
+{
+
+// Expands an R5G6B5 endpoint to [0, 1], replicating the high bits the same way the hardware does
+static XMVECTOR DecodeRGB565(uint16 color)
+{
+    const uint32 r = (color >> 11) & 0x1F;
+    const uint32 g = (color >> 5) & 0x3F;
+    const uint32 b = color & 0x1F;
+    const XMVECTORI32 expanded = { { { int32((r << 3) | (r >> 2)), int32((g << 2) | (g >> 4)), int32((b << 3) | (b >> 2)), 255 } } };
+    return XMVectorScale(XMConvertVectorIntToFloat(expanded, 0), 1.0f / 255.0f);
+}
+
+// Color block shared by BC1 and BC3, where BC3 always uses the 4 color palette
+static void DecodeColorBlock(const uint8* block, Float4* texels, bool allowPunchThroughAlpha)
+{
+    uint16 color0 = 0;
+    uint16 color1 = 0;
+    uint32 indices = 0;
+    memcpy(&color0, block, sizeof(uint16));
+    memcpy(&color1, block + 2, sizeof(uint16));
+    memcpy(&indices, block + 4, sizeof(uint32));
+
+    XMVECTOR palette[4];
+    palette[0] = DecodeRGB565(color0);
+    palette[1] = DecodeRGB565(color1);
+    if(color0 > color1 || allowPunchThroughAlpha == false)
+    {
+        palette[2] = XMVectorLerp(palette[0], palette[1], 1.0f / 3.0f);
+        palette[3] = XMVectorLerp(palette[0], palette[1], 2.0f / 3.0f);
+    }
+    else
+    {
+        palette[2] = XMVectorLerp(palette[0], palette[1], 0.5f);
+        palette[3] = XMVectorZero();
+    }
+
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+        XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&texels[i]), palette[(indices >> (i * 2)) & 0x3]);
+}
+
+// Builds the 8 entry palette for a BC4 channel block, returned as two vectors of 4 values
+static void DecodeChannelPalette(const uint8* block, XMVECTOR& palette0, XMVECTOR& palette1)
+{
+    const float endpoint0 = block[0] / 255.0f;
+    const float endpoint1 = block[1] / 255.0f;
+    const XMVECTOR e0 = XMVectorReplicate(endpoint0);
+    const XMVECTOR e1 = XMVectorReplicate(endpoint1);
+
+    if(block[0] > block[1])
+    {
+        // 6 interpolated values
+        palette0 = XMVectorLerpV(e0, e1, XMVectorSet(0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f));
+        palette1 = XMVectorLerpV(e0, e1, XMVectorSet(3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f));
+    }
+    else
+    {
+        // 4 interpolated values, followed by 0 and 1
+        palette0 = XMVectorLerpV(e0, e1, XMVectorSet(0.0f, 1.0f, 1.0f / 5.0f, 2.0f / 5.0f));
+        palette1 = XMVectorSelect(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+                                  XMVectorLerpV(e0, e1, XMVectorSet(3.0f / 5.0f, 4.0f / 5.0f, 0.0f, 0.0f)), g_XMSelect1100);
+    }
+}
+
+// Decodes a BC4 channel block into one component of every texel
+static void DecodeChannelBlock(const uint8* block, Float4* texels, uint32 component)
+{
+    XMFLOAT4 palette[2];
+    XMVECTOR palette0;
+    XMVECTOR palette1;
+    DecodeChannelPalette(block, palette0, palette1);
+    XMStoreFloat4(&palette[0], palette0);
+    XMStoreFloat4(&palette[1], palette1);
+    const float* paletteValues = &palette[0].x;
+
+    uint64 indices = 0;
+    memcpy(&indices, block + 2, 6);
+
+    float* dst = &texels[0].x + component;
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+        dst[i * 4] = paletteValues[(indices >> (i * 3)) & 0x7];
+}
+
+void DecodeBC1(const uint8* block, Float4* texels)
+{
+    DecodeColorBlock(block, texels, true);
+}
+
+void DecodeBC3(const uint8* block, Float4* texels)
+{
+    DecodeColorBlock(block + 8, texels, false);
+    DecodeChannelBlock(block, texels, 3);
+}
+
+void DecodeBC4(const uint8* block, Float4* texels)
+{
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+        texels[i] = Float4(0.0f, 0.0f, 0.0f, 1.0f);
+    DecodeChannelBlock(block, texels, 0);
+}
+
+void DecodeBC5(const uint8* block, Float4* texels)
+{
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+        texels[i] = Float4(0.0f, 0.0f, 0.0f, 1.0f);
+    DecodeChannelBlock(block, texels, 0);
+    DecodeChannelBlock(block + 8, texels, 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// BC7
+// ------------------------------------------------------------------------------------------------
+
+struct BC7ModeInfo
+{
+    uint32 NumSubsets;
+    uint32 PartitionBits;
+    uint32 RotationBits;
+    uint32 IndexSelectionBits;
+    uint32 ColorBits;
+    uint32 AlphaBits;
+    uint32 EndpointPBits;
+    uint32 SharedPBits;
+    uint32 IndexBits;
+    uint32 SecondaryIndexBits;
+};
+
+static const BC7ModeInfo BC7Modes[8] =
+{
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// Subset of every texel for each partition, with 2 bits per texel
+static const uint32 BC7Partitions2[64] =
+{
+    0x50505050, 0x40404040, 0x54545454, 0x54505040, 0x50404000, 0x55545450, 0x55545040, 0x54504000,
+    0x50400000, 0x55555450, 0x55544000, 0x54400000, 0x55555440, 0x55550000, 0x55555500, 0x55000000,
+    0x55150100, 0x00004054, 0x15010000, 0x00405054, 0x00004050, 0x15050100, 0x05010000, 0x40505054,
+    0x00404050, 0x05010100, 0x14141414, 0x05141450, 0x01155440, 0x00555500, 0x15014054, 0x05414150,
+    0x44444444, 0x55005500, 0x11441144, 0x05055050, 0x05500550, 0x11114444, 0x41144114, 0x44111144,
+    0x15055054, 0x01055040, 0x05041050, 0x05455150, 0x14414114, 0x50050550, 0x41411414, 0x00141400,
+    0x00041504, 0x00105410, 0x10541000, 0x04150400, 0x50410514, 0x41051450, 0x05415014, 0x14054150,
+    0x41050514, 0x41505014, 0x40011554, 0x54150140, 0x50505500, 0x00555050, 0x15151010, 0x54540404,
+};
+
+static const uint32 BC7Partitions3[64] =
+{
+    0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+    0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+    0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+    0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+    0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+    0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+    0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+    0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+};
+
+// Texels that store their index with one less bit, for the second subset of 2 subset partitions and
+// the second and third subsets of 3 subset partitions. The first subset's anchor is always texel 0.
+static const uint8 BC7Anchors2[64] =
+{
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+static const uint8 BC7Anchors3a[64] =
+{
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+};
+
+static const uint8 BC7Anchors3b[64] =
+{
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+};
+
+static const int32 BC7Weights2[4] = { 0, 21, 43, 64 };
+static const int32 BC7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int32 BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static const int32* BC7Weights(uint32 numIndexBits)
+{
+    if(numIndexBits == 2)
+        return BC7Weights2;
+    else if(numIndexBits == 3)
+        return BC7Weights3;
+    return BC7Weights4;
+}
+
+// Reads a 128-bit block from the lowest bit up
+struct BC7BitReader
+{
+    uint64 Lo = 0;
+    uint64 Hi = 0;
+    uint32 Pos = 0;
+
+    uint32 Read(uint32 numBits)
+    {
+        uint64 bits = 0;
+        if(Pos >= 64)
+            bits = Hi >> (Pos - 64);
+        else if(Pos == 0)
+            bits = Lo;
+        else
+            bits = (Lo >> Pos) | (Hi << (64 - Pos));
+        Pos += numBits;
+        return uint32(bits & ((1ull << numBits) - 1));
+    }
+};
+
+// Adds the p-bit to a quantized endpoint component and replicates the high bits down to 8 bits
+static uint32 UnquantizeBC7(uint32 value, uint32 numBits, uint32 pBit, bool hasPBit)
+{
+    if(hasPBit)
+    {
+        value = (value << 1) | pBit;
+        numBits += 1;
+    }
+
+    value <<= 8 - numBits;
+    return value | (value >> numBits);
+}
+
+void DecodeBC7(const uint8* block, Float4* texels)
+{
+    BC7BitReader reader;
+    memcpy(&reader.Lo, block, sizeof(uint64));
+    memcpy(&reader.Hi, block + 8, sizeof(uint64));
+
+    // The mode is the number of zero bits before the first set bit
+    uint32 modeIdx = 0;
+    while(modeIdx < 8 && reader.Read(1) == 0)
+        ++modeIdx;
+
+    if(modeIdx >= 8)
+    {
+        // Reserved modes decode to transparent black
+        for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+            texels[i] = Float4(0.0f, 0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    const BC7ModeInfo& mode = BC7Modes[modeIdx];
+    const uint32 partition = reader.Read(mode.PartitionBits);
+    const uint32 rotation = reader.Read(mode.RotationBits);
+    const uint32 indexSelection = reader.Read(mode.IndexSelectionBits);
+
+    // Endpoints are stored one component at a time, for every endpoint of every subset
+    uint32 endpoints[3][2][4] = { };
+    for(uint32 component = 0; component < 3; ++component)
+        for(uint32 subset = 0; subset < mode.NumSubsets; ++subset)
+            for(uint32 e = 0; e < 2; ++e)
+                endpoints[subset][e][component] = reader.Read(mode.ColorBits);
+
+    for(uint32 subset = 0; subset < mode.NumSubsets; ++subset)
+        for(uint32 e = 0; e < 2; ++e)
+            endpoints[subset][e][3] = reader.Read(mode.AlphaBits);
+
+    uint32 pBits[3][2] = { };
+    for(uint32 subset = 0; subset < mode.NumSubsets; ++subset)
+    {
+        if(mode.EndpointPBits)
+        {
+            pBits[subset][0] = reader.Read(1);
+            pBits[subset][1] = reader.Read(1);
+        }
+        else if(mode.SharedPBits)
+        {
+            pBits[subset][0] = pBits[subset][1] = reader.Read(1);
+        }
+    }
+
+    const bool hasPBits = mode.EndpointPBits || mode.SharedPBits;
+    __m128i endpointVectors[3][2];
+    for(uint32 subset = 0; subset < mode.NumSubsets; ++subset)
+    {
+        for(uint32 e = 0; e < 2; ++e)
+        {
+            uint32* endpoint = endpoints[subset][e];
+            for(uint32 component = 0; component < 3; ++component)
+                endpoint[component] = UnquantizeBC7(endpoint[component], mode.ColorBits, pBits[subset][e], hasPBits);
+            endpoint[3] = mode.AlphaBits > 0 ? UnquantizeBC7(endpoint[3], mode.AlphaBits, pBits[subset][e], hasPBits) : 255;
+            endpointVectors[subset][e] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(endpoint));
+        }
+    }
+
+    uint32 subsets = 0;
+    uint32 anchor1 = uint32(-1);
+    uint32 anchor2 = uint32(-1);
+    if(mode.NumSubsets == 2)
+    {
+        subsets = BC7Partitions2[partition];
+        anchor1 = BC7Anchors2[partition];
+    }
+    else if(mode.NumSubsets == 3)
+    {
+        subsets = BC7Partitions3[partition];
+        anchor1 = BC7Anchors3a[partition];
+        anchor2 = BC7Anchors3b[partition];
+    }
+
+    uint32 indices[BCBlockNumTexels] = { };
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+    {
+        const bool isAnchor = i == 0 || i == anchor1 || i == anchor2;
+        indices[i] = reader.Read(isAnchor ? mode.IndexBits - 1 : mode.IndexBits);
+    }
+
+    // Modes 4 and 5 have a second set of indices, and mode 4 can swap which one is used for alpha
+    uint32 secondaryIndices[BCBlockNumTexels] = { };
+    if(mode.SecondaryIndexBits > 0)
+    {
+        for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+            secondaryIndices[i] = reader.Read(i == 0 ? mode.SecondaryIndexBits - 1 : mode.SecondaryIndexBits);
+    }
+
+    const uint32* colorIndices = indices;
+    const uint32* alphaIndices = mode.SecondaryIndexBits > 0 ? secondaryIndices : indices;
+    uint32 colorIndexBits = mode.IndexBits;
+    uint32 alphaIndexBits = mode.SecondaryIndexBits > 0 ? mode.SecondaryIndexBits : mode.IndexBits;
+    if(indexSelection)
+    {
+        std::swap(colorIndices, alphaIndices);
+        std::swap(colorIndexBits, alphaIndexBits);
+    }
+
+    const int32* colorWeights = BC7Weights(colorIndexBits);
+    const int32* alphaWeights = BC7Weights(alphaIndexBits);
+    const __m128i weightMax = _mm_set1_epi32(64);
+    const __m128i rounding = _mm_set1_epi32(32);
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+    for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+    {
+        // ((64 - w) * e0 + w * e1 + 32) >> 6, for all 4 components at once
+        const uint32 subset = (subsets >> (i * 2)) & 0x3;
+        const int32 colorWeight = colorWeights[colorIndices[i]];
+        const __m128i weight = _mm_setr_epi32(colorWeight, colorWeight, colorWeight, alphaWeights[alphaIndices[i]]);
+        __m128i value = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(weightMax, weight), endpointVectors[subset][0]),
+                                      _mm_mullo_epi32(weight, endpointVectors[subset][1]));
+        value = _mm_srli_epi32(_mm_add_epi32(value, rounding), 6);
+
+        // Rotation swaps alpha with one of the color components
+        if(rotation == 1)
+            value = _mm_shuffle_epi32(value, _MM_SHUFFLE(0, 2, 1, 3));
+        else if(rotation == 2)
+            value = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 2, 3, 0));
+        else if(rotation == 3)
+            value = _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 1, 0));
+
+        _mm_storeu_ps(&texels[i].x, _mm_mul_ps(_mm_cvtepi32_ps(value), scale));
+    }
+}
+
+uint32 BCBlockSize(DXGI_FORMAT format)
+{
+    switch(format)
+    {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB:
+        case DXGI_FORMAT_BC4_UNORM:
+            return 8;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:
+        case DXGI_FORMAT_BC5_UNORM:
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+void DecodeBCBlock(DXGI_FORMAT format, const uint8* block, Float4* texels)
+{
+    switch(format)
+    {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB:
+            DecodeBC1(block, texels);
+            break;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:
+            DecodeBC3(block, texels);
+            break;
+        case DXGI_FORMAT_BC4_UNORM:
+            DecodeBC4(block, texels);
+            break;
+        case DXGI_FORMAT_BC5_UNORM:
+            DecodeBC5(block, texels);
+            break;
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB:
+            DecodeBC7(block, texels);
+            break;
+        default:
+            AssertFail_("Unsupported BC format %u", uint32(format));
+    }
+}
+
+}
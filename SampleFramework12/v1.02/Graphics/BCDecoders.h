@@ -0,0 +1,36 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\SF12_Math.h"
+
+namespace SampleFramework12
+{
+
+// CPU decoders for block-compressed formats, which each expand one 4x4 block into 16 texels in
+// row-major order. Results match what D3D returns when sampling the UNORM version of the format,
+// which means that sRGB formats still need their RGB converted to linear afterwards.
+static const uint32 BCBlockDim = 4;
+static const uint32 BCBlockNumTexels = BCBlockDim * BCBlockDim;
+
+void DecodeBC1(const uint8* block, Float4* texels);
+void DecodeBC3(const uint8* block, Float4* texels);
+void DecodeBC4(const uint8* block, Float4* texels);
+void DecodeBC5(const uint8* block, Float4* texels);
+void DecodeBC7(const uint8* block, Float4* texels);
+
+// Size of a block in bytes, or 0 if the format isn't one that DecodeBCBlock() supports
+uint32 BCBlockSize(DXGI_FORMAT format);
+
+void DecodeBCBlock(DXGI_FORMAT format, const uint8* block, Float4* texels);
+
+}
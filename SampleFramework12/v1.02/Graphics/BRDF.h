@@ -52,6 +52,27 @@ inline float GGX_PDF(const Float3& n, const Float3& h, const Float3& v, float ro
     return pM / (4 * hDotV);
 }
 
+// Smith G1 masking term for GGX, where a2 is the squared roughness
+inline float SmithGGXMasking(const Float3& n, const Float3& l, const Float3& v, float a2)
+{
+    float dotNV = Saturate(Float3::Dot(n, v));
+    float denomC = std::sqrt(a2 + (1.0f - a2) * dotNV * dotNV) + dotNV;
+
+    return 2.0f * dotNV / denomC;
+}
+
+// Height-correlated Smith G2 masking-shadowing term for GGX, where a2 is the squared roughness
+inline float SmithGGXMaskingShadowing(const Float3& n, const Float3& l, const Float3& v, float a2)
+{
+    float dotNL = Saturate(Float3::Dot(n, l));
+    float dotNV = Saturate(Float3::Dot(n, v));
+
+    float denomA = dotNV * std::sqrt(a2 + (1.0f - a2) * dotNL * dotNL);
+    float denomB = dotNL * std::sqrt(a2 + (1.0f - a2) * dotNV * dotNV);
+
+    return 2.0f * dotNL * dotNV / (denomA + denomB);
+}
+
 // Computes the specular term using a GGX microfacet distribution, with a matching
 // geometry factor and visibility term. Based on "Microfacet Models for Refraction Through
 // Rough Surfaces" [Walter 07]. m is roughness, n is the surface normal, h is the half vector,
@@ -74,6 +95,27 @@ inline float GGX_Specular(float m, const Float3& n, const Float3& h, const Float
 
     return d * vis;
 }
+
+// Returns scale and bias values for environment specular reflections that represents the
+// integral of the geometry/visibility + fresnel terms for a GGX BRDF given a particular
+// viewing angle and roughness value. Matches GGXEnvironmentBRDFScaleBias() in BRDF.hlsl.
+inline Float2 GGXEnvironmentBRDFScaleBias(float nDotV, float sqrtRoughness)
+{
+    const float nDotV2 = nDotV * nDotV;
+    const float sqrtRoughness2 = sqrtRoughness * sqrtRoughness;
+    const float sqrtRoughness3 = sqrtRoughness2 * sqrtRoughness;
+
+    const float delta = 0.991086418474895f + (0.412367709802119f * sqrtRoughness * nDotV2) -
+                        (0.363848256078895f * sqrtRoughness2) -
+                        (0.758634385642633f * nDotV * sqrtRoughness2);
+    const float bias = Saturate((0.0306613448029984f * sqrtRoughness) + 0.0238299731830387f /
+                                (0.0272458171384516f + sqrtRoughness3 + nDotV2) -
+                                0.0454747751719356f);
+
+    const float scale = Saturate(delta - bias);
+    return Float2(scale, bias);
+}
+
 // Computes the radiance reflected off a surface towards the eye given
 // the differential irradiance from a given direction
 inline Float3 CalcLighting(const Float3& normal, const Float3& lightIrradiance,
@@ -97,4 +139,27 @@ inline Float3 CalcLighting(const Float3& normal, const Float3& lightIrradiance,
     return lighting * lightIrradiance;
 }
 
+// Calculates the lighting result for an analytical light source, matching CalcLighting() in
+// BRDF.hlsl (including the N dot L term)
+inline Float3 CalcLighting(const Float3& normal, const Float3& lightDir, const Float3& peakIrradiance,
+                           const Float3& diffuseAlbedo, const Float3& specularAlbedo, float roughness,
+                           const Float3& positionWS, const Float3& cameraPosWS, const Float3& msEnergyCompensation)
+{
+    Float3 lighting = diffuseAlbedo * (1.0f / 3.14159f);
+
+    Float3 view = Float3::Normalize(cameraPosWS - positionWS);
+    const float nDotL = Saturate(Float3::Dot(normal, lightDir));
+    if(nDotL > 0.0f)
+    {
+        Float3 h = Float3::Normalize(view + lightDir);
+
+        Float3 fresnel = Fresnel(specularAlbedo, h, lightDir);
+
+        float specular = GGX_Specular(roughness, normal, h, view, lightDir);
+        lighting += specular * fresnel * msEnergyCompensation;
+    }
+
+    return lighting * nDotL * peakIrradiance;
+}
+
 }
\ No newline at end of file
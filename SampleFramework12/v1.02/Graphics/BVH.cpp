@@ -0,0 +1,1564 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "BVH.h"
+#include "Model.h"
+#include "OpacityMicromap.h"
+#include "..\\Utility.h"
+#include "..\\Timer.h"
+#include "..\\FileIO.h"
+#include "..\\MurmurHash.h"
+#include "..\\EnkiTS\\TaskScheduler.h"
+
+#include <immintrin.h>
+
+namespace SampleFramework12
+{
+
+// Relative costs of visiting a node and intersecting a triangle, used for the surface area heuristic
+static const float SAHTraversalCost = 1.0f;
+static const float SAHIntersectionCost = 1.0f;
+
+// Nodes with at least this many triangles get their children built as separate tasks
+static const uint32 ParallelBuildThreshold = 4096;
+
+// Nodes with at least this many triangles get binned in parallel
+static const uint32 ParallelBinningThreshold = 64 * 1024;
+static const uint32 BinningChunkSize = 16 * 1024;
+
+// Nodes above this depth get their children refit as separate tasks
+static const uint32 ParallelRefitDepth = 10;
+
+// Increment this whenever the build or the blob layout changes, to invalidate old cache files
+static const uint32 BlobVersion = 1;
+static const char BlobMagic[8] = "SF12BVH";
+
+// Every section in a blob starts on a cache line, which also satisfies the SIMD alignment requirements
+static const uint64 BlobAlignment = sizeof(BVHBlobBlock);
+
+static Float3 ComponentMin(const Float3& a, const Float3& b)
+{
+    return Float3(Min(a.x, b.x), Min(a.y, b.y), Min(a.z, b.z));
+}
+
+static Float3 ComponentMax(const Float3& a, const Float3& b)
+{
+    return Float3(Max(a.x, b.x), Max(a.y, b.y), Max(a.z, b.z));
+}
+
+struct BuildAABB
+{
+    Float3 Min = FloatMax;
+    Float3 Max = -FloatMax;
+
+    void Grow(const Float3& p)
+    {
+        Min = ComponentMin(Min, p);
+        Max = ComponentMax(Max, p);
+    }
+
+    void Grow(const BuildAABB& other)
+    {
+        Min = ComponentMin(Min, other.Min);
+        Max = ComponentMax(Max, other.Max);
+    }
+
+    float SurfaceArea() const
+    {
+        if(Min.x > Max.x)
+            return 0.0f;
+
+        const Float3 size = Max - Min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+};
+
+// Per-triangle data that's only needed while building
+struct BuildTriangle
+{
+    BuildAABB Bounds;
+    Float3 Centroid;
+    uint32 TriangleIdx = 0;
+};
+
+struct BuildBin
+{
+    BuildAABB Bounds;
+    uint32 Count = 0;
+};
+
+// Bins for all 3 axes, for one range of triangles
+struct BuildBins
+{
+    BuildBin Bins[3][BVH::NumSAHBins];
+    BuildAABB Bounds;
+    BuildAABB CentroidBounds;
+};
+
+struct BuildContext
+{
+    BVHNode* Nodes = nullptr;
+    BuildTriangle* Triangles = nullptr;
+    std::atomic<uint32> NumNodes = 0;
+    enki::TaskScheduler* Scheduler = nullptr;
+};
+
+struct RefitContext
+{
+    BVHNode* Nodes = nullptr;
+    const BVHTriangle* Triangles = nullptr;
+    enki::TaskScheduler* Scheduler = nullptr;
+};
+
+// Byte offset and element count for one of the arrays in a blob
+struct BVHBlobSection
+{
+    uint64 Offset = 0;
+    uint64 Count = 0;
+};
+
+// Start of every BVH blob, which is followed by the sections that it lists. Blobs are laid out the same way
+// in memory and in cache files, so a cache file can be used directly after it's been mapped.
+struct BVHBlobHeader
+{
+    char Magic[8] = { };
+    uint32 Version = 0;
+    uint32 HeaderSize = 0;
+    Hash Key;
+    uint64 TotalSize = 0;
+    BVHBlobSection Nodes;
+    BVHBlobSection Triangles;
+    BVHBlobSection WideNodes;
+    BVHBlobSection WideChildNodes;
+    BVHBlobSection TrianglePackets;
+    BVHBlobSection GeometryOpaque;
+    BVHBuildStats BuildStats;
+};
+
+static bool ValidSection(const BVHBlobSection& section, uint64 elemSize, uint64 blobSize)
+{
+    if(section.Offset % BlobAlignment != 0 || section.Offset > blobSize)
+        return false;
+
+    return section.Count <= (blobSize - section.Offset) / elemSize;
+}
+
+static void ComputeBounds(const BuildTriangle* triangles, uint32 start, uint32 end, BuildAABB& bounds, BuildAABB& centroidBounds)
+{
+    for(uint32 i = start; i < end; ++i)
+    {
+        bounds.Grow(triangles[i].Bounds);
+        centroidBounds.Grow(triangles[i].Centroid);
+    }
+}
+
+static void BinTriangles(const BuildTriangle* triangles, uint32 start, uint32 end, const BuildAABB& centroidBounds, BuildBins& bins)
+{
+    const Float3 extents = centroidBounds.Max - centroidBounds.Min;
+    for(uint32 axis = 0; axis < 3; ++axis)
+    {
+        if(extents[axis] <= 0.0f)
+            continue;
+
+        const float binScale = BVH::NumSAHBins / extents[axis];
+        for(uint32 i = start; i < end; ++i)
+        {
+            const BuildTriangle& tri = triangles[i];
+            const uint32 binIdx = Min(uint32((tri.Centroid[axis] - centroidBounds.Min[axis]) * binScale), BVH::NumSAHBins - 1);
+            BuildBin& bin = bins.Bins[axis][binIdx];
+            bin.Bounds.Grow(tri.Bounds);
+            bin.Count += 1;
+        }
+    }
+}
+
+// Computes the node bounds and the SAH bins, splitting the work into tasks for large nodes
+static void ComputeBoundsAndBins(BuildContext& context, uint32 start, uint32 end, BuildBins& bins)
+{
+    const uint32 count = end - start;
+    if(context.Scheduler == nullptr || count < ParallelBinningThreshold)
+    {
+        ComputeBounds(context.Triangles, start, end, bins.Bounds, bins.CentroidBounds);
+        BinTriangles(context.Triangles, start, end, bins.CentroidBounds, bins);
+        return;
+    }
+
+    const uint32 numChunks = (count + BinningChunkSize - 1) / BinningChunkSize;
+    Array<BuildBins> chunkBins(numChunks);
+
+    enki::TaskSet boundsTask(numChunks, [&](enki::TaskSetPartition range, uint32_t threadNum)
+    {
+        for(uint32 chunkIdx = range.start; chunkIdx < range.end; ++chunkIdx)
+        {
+            const uint32 chunkStart = start + chunkIdx * BinningChunkSize;
+            const uint32 chunkEnd = Min(chunkStart + BinningChunkSize, end);
+            ComputeBounds(context.Triangles, chunkStart, chunkEnd, chunkBins[chunkIdx].Bounds, chunkBins[chunkIdx].CentroidBounds);
+        }
+    });
+
+    context.Scheduler->AddTaskSetToPipe(&boundsTask);
+    context.Scheduler->WaitforTaskSet(&boundsTask);
+
+    for(uint32 chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+    {
+        bins.Bounds.Grow(chunkBins[chunkIdx].Bounds);
+        bins.CentroidBounds.Grow(chunkBins[chunkIdx].CentroidBounds);
+    }
+
+    enki::TaskSet binTask(numChunks, [&](enki::TaskSetPartition range, uint32_t threadNum)
+    {
+        for(uint32 chunkIdx = range.start; chunkIdx < range.end; ++chunkIdx)
+        {
+            const uint32 chunkStart = start + chunkIdx * BinningChunkSize;
+            const uint32 chunkEnd = Min(chunkStart + BinningChunkSize, end);
+            BinTriangles(context.Triangles, chunkStart, chunkEnd, bins.CentroidBounds, chunkBins[chunkIdx]);
+        }
+    });
+
+    context.Scheduler->AddTaskSetToPipe(&binTask);
+    context.Scheduler->WaitforTaskSet(&binTask);
+
+    for(uint32 chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+    {
+        for(uint32 axis = 0; axis < 3; ++axis)
+        {
+            for(uint32 binIdx = 0; binIdx < BVH::NumSAHBins; ++binIdx)
+            {
+                bins.Bins[axis][binIdx].Bounds.Grow(chunkBins[chunkIdx].Bins[axis][binIdx].Bounds);
+                bins.Bins[axis][binIdx].Count += chunkBins[chunkIdx].Bins[axis][binIdx].Count;
+            }
+        }
+    }
+}
+
+static void BuildNode(BuildContext& context, uint32 nodeIdx, uint32 start, uint32 end, uint32 depth)
+{
+    BuildBins bins;
+    ComputeBoundsAndBins(context, start, end, bins);
+
+    BVHNode& node = context.Nodes[nodeIdx];
+    node.AABBMin = bins.Bounds.Min;
+    node.AABBMax = bins.Bounds.Max;
+
+    const uint32 count = end - start;
+    if(count == 1 || depth >= BVH::MaxDepth)
+    {
+        node.Offset = start;
+        node.NumTriangles = count;
+        return;
+    }
+
+    // Evaluate the SAH for every bin boundary on every axis, sweeping from both sides
+    float bestCost = FloatMax;
+    uint32 bestAxis = uint32(-1);
+    uint32 bestSplit = 0;
+    for(uint32 axis = 0; axis < 3; ++axis)
+    {
+        const BuildBin* axisBins = bins.Bins[axis];
+
+        float rightCosts[BVH::NumSAHBins] = { };
+        BuildAABB rightBounds;
+        uint32 rightCount = 0;
+        for(uint32 binIdx = BVH::NumSAHBins - 1; binIdx > 0; --binIdx)
+        {
+            rightBounds.Grow(axisBins[binIdx].Bounds);
+            rightCount += axisBins[binIdx].Count;
+            rightCosts[binIdx] = rightBounds.SurfaceArea() * rightCount;
+        }
+
+        BuildAABB leftBounds;
+        uint32 leftCount = 0;
+        for(uint32 binIdx = 0; binIdx < BVH::NumSAHBins - 1; ++binIdx)
+        {
+            leftBounds.Grow(axisBins[binIdx].Bounds);
+            leftCount += axisBins[binIdx].Count;
+            if(leftCount == 0 || leftCount == count)
+                continue;
+
+            const float cost = leftBounds.SurfaceArea() * leftCount + rightCosts[binIdx + 1];
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = binIdx + 1;
+            }
+        }
+    }
+
+    const float nodeArea = bins.Bounds.SurfaceArea();
+    const float leafCost = SAHIntersectionCost * count;
+    const float splitCost = nodeArea > 0.0f ? SAHTraversalCost + SAHIntersectionCost * bestCost / nodeArea : FloatMax;
+
+    if(count <= BVH::MaxLeafTriangles && (bestAxis == uint32(-1) || leafCost <= splitCost))
+    {
+        node.Offset = start;
+        node.NumTriangles = count;
+        return;
+    }
+
+    BuildTriangle* first = context.Triangles + start;
+    BuildTriangle* last = context.Triangles + end;
+    BuildTriangle* middle = nullptr;
+    if(bestAxis != uint32(-1))
+    {
+        const float binScale = BVH::NumSAHBins / (bins.CentroidBounds.Max[bestAxis] - bins.CentroidBounds.Min[bestAxis]);
+        const float centroidMin = bins.CentroidBounds.Min[bestAxis];
+        middle = std::partition(first, last, [=](const BuildTriangle& tri)
+        {
+            const uint32 binIdx = Min(uint32((tri.Centroid[bestAxis] - centroidMin) * binScale), BVH::NumSAHBins - 1);
+            return binIdx < bestSplit;
+        });
+    }
+    else
+    {
+        // All centroids are in the same spot, so just split the list in half
+        middle = first + count / 2;
+    }
+
+    const uint32 mid = start + uint32(middle - first);
+    Assert_(mid > start && mid < end);
+
+    const uint32 childIdx = context.NumNodes.fetch_add(2);
+    node.Offset = childIdx;
+    node.NumTriangles = 0;
+
+    if(context.Scheduler != nullptr && count >= ParallelBuildThreshold)
+    {
+        enki::TaskSet leftTask(1, [&](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            BuildNode(context, childIdx, start, mid, depth + 1);
+        });
+
+        context.Scheduler->AddTaskSetToPipe(&leftTask);
+        BuildNode(context, childIdx + 1, mid, end, depth + 1);
+        context.Scheduler->WaitforTaskSet(&leftTask);
+    }
+    else
+    {
+        BuildNode(context, childIdx, start, mid, depth + 1);
+        BuildNode(context, childIdx + 1, mid, end, depth + 1);
+    }
+}
+
+// Runs func(idx) for every index in [0, count), using the task scheduler if one is available
+template<typename T> static void ParallelFor(enki::TaskScheduler* scheduler, uint32 count, const T& func)
+{
+    if(scheduler == nullptr)
+    {
+        for(uint32 i = 0; i < count; ++i)
+            func(i);
+        return;
+    }
+
+    enki::TaskSet taskSet(count, [&](enki::TaskSetPartition range, uint32_t threadNum)
+    {
+        for(uint32 i = range.start; i < range.end; ++i)
+            func(i);
+    });
+
+    scheduler->AddTaskSetToPipe(&taskSet);
+    scheduler->WaitforTaskSet(&taskSet);
+}
+
+static float NodeSurfaceArea(const BVHNode& node)
+{
+    BuildAABB bounds;
+    bounds.Min = node.AABBMin;
+    bounds.Max = node.AABBMax;
+    return bounds.SurfaceArea();
+}
+
+// Copies a range of leaf triangles into SoA packets of 4. The last one is padded with NaN positions,
+// which fail every comparison in the intersection test.
+static void PackTriangles(const BVHTriangle* srcTriangles, uint32 numTriangles, BVHTriangle4* packets)
+{
+    const uint32 numPackets = (numTriangles + 3) / 4;
+    for(uint32 packetIdx = 0; packetIdx < numPackets; ++packetIdx)
+    {
+        BVHTriangle4& packet = packets[packetIdx];
+        for(uint32 lane = 0; lane < 4; ++lane)
+        {
+            const uint32 triIdx = packetIdx * 4 + lane;
+            if(triIdx >= numTriangles)
+            {
+                for(uint32 vtx = 0; vtx < 3; ++vtx)
+                    for(uint32 axis = 0; axis < 3; ++axis)
+                        packet.Vertices[vtx][axis][lane] = std::numeric_limits<float>::quiet_NaN();
+
+                packet.GeometryIdx[lane] = uint32(-1);
+                packet.PrimitiveIdx[lane] = uint32(-1);
+                packet.InstanceIdx[lane] = uint32(-1);
+                continue;
+            }
+
+            const BVHTriangle& tri = srcTriangles[triIdx];
+            const Float3* positions[3] = { &tri.V0, &tri.V1, &tri.V2 };
+            for(uint32 vtx = 0; vtx < 3; ++vtx)
+                for(uint32 axis = 0; axis < 3; ++axis)
+                    packet.Vertices[vtx][axis][lane] = (*positions[vtx])[axis];
+
+            packet.GeometryIdx[lane] = tri.GeometryIdx;
+            packet.PrimitiveIdx[lane] = tri.PrimitiveIdx;
+            packet.InstanceIdx[lane] = tri.InstanceIdx;
+        }
+    }
+}
+
+// Copies the bounds of a binary node into one of the child slots of a wide node
+static void SetWideChildBounds(BVH8Node& wideNode, uint32 childSlot, const BVHNode& child)
+{
+    for(uint32 axis = 0; axis < 3; ++axis)
+    {
+        wideNode.Bounds[axis][childSlot] = child.AABBMin[axis];
+        wideNode.Bounds[axis + 3][childSlot] = child.AABBMax[axis];
+    }
+}
+
+// Returns the world-space positions of a mesh triangle, as placed by one of the model's instances
+static void GetTrianglePositions(const Model& model, const MeshInstance& instance, uint32 primIdx, Float3 positions[3])
+{
+    const Mesh& mesh = model.Meshes()[instance.MeshIdx];
+    const bool indices32 = model.IndexBufferType() == IndexType::Index32Bit;
+    for(uint32 i = 0; i < 3; ++i)
+    {
+        const uint32 globalIdx = mesh.IndexOffset() + primIdx * 3 + i;
+        const uint32 vtxIdx = (indices32 ? model.Indices32()[globalIdx] : model.Indices()[globalIdx]) + mesh.VertexOffset();
+        positions[i] = Float3::Transform(model.Vertices()[vtxIdx].Position, instance.Transform);
+    }
+}
+
+// Same logic that's used for D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE
+static bool IsGeometryOpaque(const Model& model, uint32 meshIdx)
+{
+    const Mesh& mesh = model.Meshes()[meshIdx];
+    Assert_(mesh.NumMeshParts() == 1);
+    const uint32 materialIdx = mesh.MeshParts()[0].MaterialIdx;
+    const MeshMaterial& material = model.Materials()[materialIdx];
+    return material.Textures[uint64(MaterialTextures::Opacity)] == nullptr;
+}
+
+// Hashes everything that can affect the tree, so that stale cache files get rebuilt
+static Hash MakeCacheKey(const Model& model)
+{
+    const uint64 keyData[] = { BlobVersion, BVH::MaxLeafTriangles, BVH::MaxDepth, BVH::NumSAHBins, uint64(model.IndexBufferType()) };
+    const float costs[] = { SAHTraversalCost, SAHIntersectionCost };
+    Hash key = GenerateHash(keyData, int32(sizeof(keyData)));
+    key = CombineHashes(key, GenerateHash(costs, int32(sizeof(costs))));
+
+    uint64 numVertices = 0;
+    uint64 numIndices = 0;
+    for(uint32 meshIdx = 0; meshIdx < model.NumMeshes(); ++meshIdx)
+    {
+        const Mesh& mesh = model.Meshes()[meshIdx];
+        numVertices = Max<uint64>(numVertices, mesh.VertexOffset() + mesh.NumVertices());
+        numIndices = Max<uint64>(numIndices, mesh.IndexOffset() + mesh.NumIndices());
+
+        const uint32 meshKey[] = { mesh.VertexOffset(), mesh.IndexOffset(), mesh.NumIndices(), IsGeometryOpaque(model, meshIdx) ? 1u : 0u };
+        key = CombineHashes(key, GenerateHash(meshKey, int32(sizeof(meshKey))));
+    }
+
+    const void* indices = model.IndexBufferType() == IndexType::Index32Bit ? (const void*)model.Indices32() : (const void*)model.Indices();
+    key = CombineHashes(key, GenerateLargeHash(model.Vertices(), numVertices * sizeof(MeshVertex)));
+    key = CombineHashes(key, GenerateLargeHash(indices, numIndices * model.IndexSize()));
+
+    // Instances get hashed member by member, since the struct can have padding
+    for(const MeshInstance& instance : model.Instances())
+    {
+        key = CombineHashes(key, GenerateHash(&instance.Transform, int32(sizeof(Float4x4))));
+        key = CombineHashes(key, GenerateHash(&instance.MeshIdx, int32(sizeof(instance.MeshIdx))));
+    }
+
+    return key;
+}
+
+void BVH::Build(const Model& model, enki::TaskScheduler* scheduler)
+{
+    Shutdown();
+
+    Timer timer;
+
+    const Array<Mesh>& meshes = model.Meshes();
+    const uint32 numMeshes = uint32(meshes.Size());
+
+    Array<uint8> srcGeometryOpaque(numMeshes);
+    for(uint32 meshIdx = 0; meshIdx < numMeshes; ++meshIdx)
+        srcGeometryOpaque[meshIdx] = IsGeometryOpaque(model, meshIdx) ? 1 : 0;
+
+    // Instances are flattened into the tree, so each one gets its own copy of the mesh triangles
+    const Array<MeshInstance>& instances = model.Instances();
+    const uint32 numInstances = uint32(instances.Size());
+    uint64 totalNumTriangles = 0;
+    Array<uint32> instanceTriangleOffsets(numInstances);
+    for(uint32 instanceIdx = 0; instanceIdx < numInstances; ++instanceIdx)
+    {
+        instanceTriangleOffsets[instanceIdx] = uint32(totalNumTriangles);
+        totalNumTriangles += meshes[instances[instanceIdx].MeshIdx].NumIndices() / 3;
+    }
+
+    Assert_(totalNumTriangles < uint32(-1));
+    const uint32 numSrcTriangles = uint32(totalNumTriangles);
+    if(numSrcTriangles == 0)
+        return;
+
+    // Gather all triangles from the model instances, in world space
+    Array<BVHTriangle> srcTriangles(numSrcTriangles);
+    ParallelFor(scheduler, numInstances, [&](uint32 instanceIdx)
+    {
+        const MeshInstance& instance = instances[instanceIdx];
+        const uint32 numMeshTriangles = meshes[instance.MeshIdx].NumIndices() / 3;
+        for(uint32 primIdx = 0; primIdx < numMeshTriangles; ++primIdx)
+        {
+            Float3 positions[3];
+            GetTrianglePositions(model, instance, primIdx, positions);
+
+            BVHTriangle& tri = srcTriangles[instanceTriangleOffsets[instanceIdx] + primIdx];
+            tri.V0 = positions[0];
+            tri.V1 = positions[1];
+            tri.V2 = positions[2];
+            tri.GeometryIdx = instance.MeshIdx;
+            tri.PrimitiveIdx = primIdx;
+            tri.InstanceIdx = instanceIdx;
+        }
+    });
+
+    BuildTree(srcTriangles, srcGeometryOpaque, scheduler);
+
+    timer.Update();
+    buildStats.BuildTimeMS = timer.ElapsedMillisecondsF();
+}
+
+void BVH::CopyTriangles(const BVH& source)
+{
+    Shutdown();
+
+    // Only the triangle and geometry sections are filled out, until Rebuild() is called
+    triangles = source.triangles;
+    numTriangles = source.numTriangles;
+    geometryOpaque = source.geometryOpaque;
+    numGeometries = source.numGeometries;
+    CreateBlob();
+}
+
+void BVH::Rebuild(enki::TaskScheduler* scheduler)
+{
+    if(numTriangles == 0)
+        return;
+
+    Timer timer;
+
+    // The blob gets replaced, so the inputs need to be copied out of it first
+    Array<BVHTriangle> srcTriangles(numTriangles);
+    memcpy(srcTriangles.Data(), triangles, numTriangles * sizeof(BVHTriangle));
+
+    Array<uint8> srcGeometryOpaque(numGeometries);
+    if(numGeometries > 0)
+        memcpy(srcGeometryOpaque.Data(), geometryOpaque, numGeometries);
+
+    BuildTree(srcTriangles, srcGeometryOpaque, scheduler);
+
+    timer.Update();
+    buildStats.BuildTimeMS = timer.ElapsedMillisecondsF();
+}
+
+// Builds the binary and wide trees for a list of triangles, and then packs everything into a new blob
+void BVH::BuildTree(const Array<BVHTriangle>& srcTriangles, const Array<uint8>& srcGeometryOpaque, enki::TaskScheduler* scheduler)
+{
+    const uint32 numSrcTriangles = uint32(srcTriangles.Size());
+    Assert_(numSrcTriangles > 0);
+
+    Array<BuildTriangle> buildTriangles(numSrcTriangles);
+    ParallelFor(scheduler, numSrcTriangles, [&](uint32 triIdx)
+    {
+        const BVHTriangle& tri = srcTriangles[triIdx];
+        BuildTriangle& buildTri = buildTriangles[triIdx];
+        buildTri.Bounds.Grow(tri.V0);
+        buildTri.Bounds.Grow(tri.V1);
+        buildTri.Bounds.Grow(tri.V2);
+        buildTri.Centroid = (buildTri.Bounds.Min + buildTri.Bounds.Max) * 0.5f;
+        buildTri.TriangleIdx = triIdx;
+    });
+
+    // A binary tree with N leaves has at most 2N - 1 nodes
+    Array<BVHNode> nodeScratch(uint64(numSrcTriangles) * 2 - 1);
+
+    BuildContext context;
+    context.Nodes = nodeScratch.Data();
+    context.Triangles = buildTriangles.Data();
+    context.NumNodes = 1;
+    context.Scheduler = scheduler;
+
+    if(scheduler != nullptr)
+    {
+        enki::TaskSet rootTask(1, [&](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            BuildNode(context, 0, 0, numSrcTriangles, 0);
+        });
+
+        scheduler->AddTaskSetToPipe(&rootTask);
+        scheduler->WaitforTaskSet(&rootTask);
+    }
+    else
+    {
+        BuildNode(context, 0, 0, numSrcTriangles, 0);
+    }
+
+    // Store the triangles in leaf order so that leaves can reference a contiguous range
+    Array<BVHTriangle> triangleScratch(numSrcTriangles);
+    ParallelFor(scheduler, numSrcTriangles, [&](uint32 triIdx)
+    {
+        triangleScratch[triIdx] = srcTriangles[buildTriangles[triIdx].TriangleIdx];
+    });
+
+    nodes = nodeScratch.Data();
+    numNodes = context.NumNodes;
+    triangles = triangleScratch.Data();
+    numTriangles = numSrcTriangles;
+    geometryOpaque = srcGeometryOpaque.Data();
+    numGeometries = srcGeometryOpaque.Size();
+
+    // Collapse into the 8-wide tree, and pack the leaf triangles into groups of 4
+    uint64 numPackets = 0;
+    for(uint64 nodeIdx = 0; nodeIdx < numNodes; ++nodeIdx)
+    {
+        if(nodes[nodeIdx].IsLeaf())
+            numPackets += (nodes[nodeIdx].NumTriangles + 3) / 4;
+    }
+
+    // Every wide node consumes at least one binary interior node, except for when the root is a leaf
+    const uint64 numInteriorNodes = (numNodes - 1) / 2;
+    Array<BVH8Node> wideNodeScratch(Max<uint64>(numInteriorNodes, 1));
+    Array<uint32> wideChildNodeScratch(wideNodeScratch.Size() * 8, uint32(-1));
+    Array<BVHTriangle4> packetScratch(numPackets);
+
+    wideNodes = wideNodeScratch.Data();
+    wideChildNodes = wideChildNodeScratch.Data();
+    numWideNodes = 0;
+    trianglePackets = packetScratch.Data();
+    numTrianglePackets = 0;
+
+    CollapseNode(0);
+
+    Assert_(numWideNodes <= wideNodeScratch.Size());
+    Assert_(numTrianglePackets == packetScratch.Size());
+
+    ComputeBuildStats();
+    refitStats = BVHRefitStats();
+
+    // Everything gets copied out of the scratch arrays before they go away
+    CreateBlob();
+}
+
+// Lays out all of the tree data in a single allocation, in the same format that's used for cache files
+void BVH::CreateBlob()
+{
+    BVHBlobHeader header;
+    memcpy(header.Magic, BlobMagic, sizeof(BlobMagic));
+    header.Version = BlobVersion;
+    header.HeaderSize = sizeof(BVHBlobHeader);
+
+    uint64 blobSize = AlignTo(sizeof(BVHBlobHeader), BlobAlignment);
+    auto addSection = [&](BVHBlobSection& section, uint64 count, uint64 elemSize)
+    {
+        section.Offset = blobSize;
+        section.Count = count;
+        blobSize = AlignTo(blobSize + count * elemSize, BlobAlignment);
+    };
+
+    addSection(header.Nodes, numNodes, sizeof(BVHNode));
+    addSection(header.Triangles, numTriangles, sizeof(BVHTriangle));
+    addSection(header.WideNodes, numWideNodes, sizeof(BVH8Node));
+    addSection(header.WideChildNodes, numWideNodes * 8, sizeof(uint32));
+    addSection(header.TrianglePackets, numTrianglePackets, sizeof(BVHTriangle4));
+    addSection(header.GeometryOpaque, numGeometries, sizeof(uint8));
+    header.TotalSize = blobSize;
+
+    // The old blob might be a mapped cache file, but nothing can point into it at this point
+    blobFile.Close();
+    blobMemory.Init(blobSize / sizeof(BVHBlobBlock));
+    uint8* blob = reinterpret_cast<uint8*>(blobMemory.Data());
+    memcpy(blob, &header, sizeof(header));
+
+    auto copySection = [&](const BVHBlobSection& section, const void* src, uint64 elemSize)
+    {
+        if(section.Count > 0)
+            memcpy(blob + section.Offset, src, section.Count * elemSize);
+        return blob + section.Offset;
+    };
+
+    nodes = reinterpret_cast<BVHNode*>(copySection(header.Nodes, nodes, sizeof(BVHNode)));
+    triangles = reinterpret_cast<BVHTriangle*>(copySection(header.Triangles, triangles, sizeof(BVHTriangle)));
+    wideNodes = reinterpret_cast<BVH8Node*>(copySection(header.WideNodes, wideNodes, sizeof(BVH8Node)));
+    wideChildNodes = reinterpret_cast<uint32*>(copySection(header.WideChildNodes, wideChildNodes, sizeof(uint32)));
+    trianglePackets = reinterpret_cast<BVHTriangle4*>(copySection(header.TrianglePackets, trianglePackets, sizeof(BVHTriangle4)));
+    geometryOpaque = copySection(header.GeometryOpaque, geometryOpaque, sizeof(uint8));
+}
+
+// Sets up all of the section pointers for a mapped cache file, after checking that it's intact
+bool BVH::MapBlob(const wchar* filePath, const Hash& key)
+{
+    blobFile.Open(filePath, FileMapMode::CopyOnWrite);
+
+    const uint64 fileSize = blobFile.Size();
+    if(fileSize < sizeof(BVHBlobHeader))
+    {
+        blobFile.Close();
+        return false;
+    }
+
+    uint8* blob = blobFile.WritableData();
+    const BVHBlobHeader& header = *reinterpret_cast<const BVHBlobHeader*>(blob);
+    bool valid = memcmp(header.Magic, BlobMagic, sizeof(BlobMagic)) == 0;
+    valid = valid && header.Version == BlobVersion && header.HeaderSize == sizeof(BVHBlobHeader);
+    valid = valid && header.Key == key && header.TotalSize == fileSize;
+    valid = valid && ValidSection(header.Nodes, sizeof(BVHNode), fileSize);
+    valid = valid && ValidSection(header.Triangles, sizeof(BVHTriangle), fileSize);
+    valid = valid && ValidSection(header.WideNodes, sizeof(BVH8Node), fileSize);
+    valid = valid && ValidSection(header.WideChildNodes, sizeof(uint32), fileSize);
+    valid = valid && ValidSection(header.TrianglePackets, sizeof(BVHTriangle4), fileSize);
+    valid = valid && ValidSection(header.GeometryOpaque, sizeof(uint8), fileSize);
+    valid = valid && header.WideChildNodes.Count == header.WideNodes.Count * 8;
+    if(valid == false)
+    {
+        blobFile.Close();
+        return false;
+    }
+
+    nodes = reinterpret_cast<BVHNode*>(blob + header.Nodes.Offset);
+    numNodes = header.Nodes.Count;
+    triangles = reinterpret_cast<BVHTriangle*>(blob + header.Triangles.Offset);
+    numTriangles = header.Triangles.Count;
+    wideNodes = reinterpret_cast<BVH8Node*>(blob + header.WideNodes.Offset);
+    wideChildNodes = reinterpret_cast<uint32*>(blob + header.WideChildNodes.Offset);
+    numWideNodes = header.WideNodes.Count;
+    trianglePackets = reinterpret_cast<BVHTriangle4*>(blob + header.TrianglePackets.Offset);
+    numTrianglePackets = header.TrianglePackets.Count;
+    geometryOpaque = blob + header.GeometryOpaque.Offset;
+    numGeometries = header.GeometryOpaque.Count;
+    buildStats = header.BuildStats;
+
+    return true;
+}
+
+void BVH::WriteBlob(const wchar* filePath, const Hash& key) const
+{
+    Assert_(blobMemory.Size() > 0);
+
+    // The key and stats are only needed in the file
+    BVHBlobHeader header = *reinterpret_cast<const BVHBlobHeader*>(blobMemory.Data());
+    header.Key = key;
+    header.BuildStats = buildStats;
+
+    File file(filePath, FileOpenMode::Write);
+    file.Write(header);
+
+    // File::Write is limited to 32-bit sizes, so big trees get written in pieces
+    const uint8* blob = reinterpret_cast<const uint8*>(blobMemory.Data());
+    const uint64 chunkSize = 1024 * 1024 * 1024;
+    for(uint64 offset = sizeof(header); offset < header.TotalSize; offset += chunkSize)
+        file.Write(Min(chunkSize, header.TotalSize - offset), blob + offset);
+}
+
+void BVH::Initialize(const Model& model, enki::TaskScheduler* scheduler)
+{
+    Shutdown();
+
+    Timer timer;
+
+    const Hash key = MakeCacheKey(model);
+    const std::wstring cachePath = model.FilePath().length() > 0 ? GetFilePathWithoutExtension(model.FilePath().c_str()) + L".bvh" : L"";
+
+    if(cachePath.length() > 0 && FileExists(cachePath.c_str()) && MapBlob(cachePath.c_str(), key))
+    {
+        timer.Update();
+        buildStats.LoadedFromCache = true;
+        buildStats.BuildTimeMS = timer.ElapsedMillisecondsF();
+        return;
+    }
+
+    Build(model, scheduler);
+
+    if(cachePath.length() > 0 && numNodes > 0)
+        WriteBlob(cachePath.c_str(), key);
+}
+
+// Recomputes the bounds of a node and everything below it from the leaf triangles, and returns the
+// SAH cost of the subtree (not yet divided by the root surface area)
+static double RefitNode(const RefitContext& context, uint32 nodeIdx, uint32 depth)
+{
+    BVHNode& node = context.Nodes[nodeIdx];
+    BuildAABB bounds;
+    double cost = 0.0;
+
+    if(node.IsLeaf())
+    {
+        for(uint32 triIdx = node.Offset; triIdx < node.Offset + node.NumTriangles; ++triIdx)
+        {
+            const BVHTriangle& tri = context.Triangles[triIdx];
+            bounds.Grow(tri.V0);
+            bounds.Grow(tri.V1);
+            bounds.Grow(tri.V2);
+        }
+
+        cost = double(bounds.SurfaceArea()) * SAHIntersectionCost * node.NumTriangles;
+    }
+    else
+    {
+        double leftCost = 0.0;
+        double rightCost = 0.0;
+        if(context.Scheduler != nullptr && depth < ParallelRefitDepth)
+        {
+            enki::TaskSet leftTask(1, [&](enki::TaskSetPartition range, uint32_t threadNum)
+            {
+                leftCost = RefitNode(context, node.Offset, depth + 1);
+            });
+
+            context.Scheduler->AddTaskSetToPipe(&leftTask);
+            rightCost = RefitNode(context, node.Offset + 1, depth + 1);
+            context.Scheduler->WaitforTaskSet(&leftTask);
+        }
+        else
+        {
+            leftCost = RefitNode(context, node.Offset, depth + 1);
+            rightCost = RefitNode(context, node.Offset + 1, depth + 1);
+        }
+
+        const BVHNode& left = context.Nodes[node.Offset];
+        const BVHNode& right = context.Nodes[node.Offset + 1];
+        bounds.Min = ComponentMin(left.AABBMin, right.AABBMin);
+        bounds.Max = ComponentMax(left.AABBMax, right.AABBMax);
+
+        cost = leftCost + rightCost + double(bounds.SurfaceArea()) * SAHTraversalCost;
+    }
+
+    node.AABBMin = bounds.Min;
+    node.AABBMax = bounds.Max;
+    return cost;
+}
+
+void BVH::Refit(const Model& model, enki::TaskScheduler* scheduler)
+{
+    if(numNodes == 0)
+        return;
+
+    Timer timer;
+
+    // The triangles are still in leaf order, and just need their positions refreshed
+    const Array<MeshInstance>& instances = model.Instances();
+    ParallelFor(scheduler, uint32(numTriangles), [&](uint32 triIdx)
+    {
+        BVHTriangle& tri = triangles[triIdx];
+        const MeshInstance& instance = instances[tri.InstanceIdx];
+        Assert_(instance.MeshIdx == tri.GeometryIdx);
+        Assert_(tri.PrimitiveIdx < model.Meshes()[instance.MeshIdx].NumIndices() / 3);
+
+        Float3 positions[3];
+        GetTrianglePositions(model, instance, tri.PrimitiveIdx, positions);
+        tri.V0 = positions[0];
+        tri.V1 = positions[1];
+        tri.V2 = positions[2];
+    });
+
+    RefitContext context;
+    context.Nodes = nodes;
+    context.Triangles = triangles;
+    context.Scheduler = scheduler;
+
+    double sahCost = 0.0;
+    if(scheduler != nullptr)
+    {
+        enki::TaskSet rootTask(1, [&](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            sahCost = RefitNode(context, 0, 0);
+        });
+
+        scheduler->AddTaskSetToPipe(&rootTask);
+        scheduler->WaitforTaskSet(&rootTask);
+    }
+    else
+    {
+        sahCost = RefitNode(context, 0, 0);
+    }
+
+    // Every wide node child is a copy of a binary node, so they can all be updated independently
+    ParallelFor(scheduler, uint32(numWideNodes), [&](uint32 wideNodeIdx)
+    {
+        BVH8Node& wideNode = wideNodes[wideNodeIdx];
+        for(uint32 i = 0; i < 8; ++i)
+        {
+            const uint32 nodeIdx = wideChildNodes[wideNodeIdx * 8 + i];
+            if(nodeIdx == uint32(-1))
+                continue;
+
+            const BVHNode& child = nodes[nodeIdx];
+            SetWideChildBounds(wideNode, i, child);
+            if(child.IsLeaf())
+                PackTriangles(&triangles[child.Offset], child.NumTriangles, &trianglePackets[wideNode.Children[i]]);
+        }
+    });
+
+    timer.Update();
+
+    const float rootArea = NodeSurfaceArea(nodes[0]);
+    refitStats.NumRefits += 1;
+    refitStats.SAHCost = rootArea > 0.0f ? float(sahCost / rootArea) : 0.0f;
+    refitStats.SAHRatio = buildStats.SAHCost > 0.0f ? refitStats.SAHCost / buildStats.SAHCost : 1.0f;
+    refitStats.RefitTimeMS = timer.ElapsedMillisecondsF();
+}
+
+// Gathers node counts, and computes the SAH cost of the whole tree
+void BVH::ComputeBuildStats()
+{
+    buildStats = BVHBuildStats();
+    buildStats.NumTriangles = uint32(numTriangles);
+    buildStats.NumNodes = uint32(numNodes);
+    buildStats.NumWideNodes = uint32(numWideNodes);
+    buildStats.NumTrianglePackets = uint32(numTrianglePackets);
+    if(numNodes == 0)
+        return;
+
+    BuildAABB rootBounds;
+    rootBounds.Min = nodes[0].AABBMin;
+    rootBounds.Max = nodes[0].AABBMax;
+    const float rootArea = rootBounds.SurfaceArea();
+    const float invRootArea = rootArea > 0.0f ? 1.0f / rootArea : 0.0f;
+
+    struct StackEntry
+    {
+        uint32 NodeIdx;
+        uint32 Depth;
+    };
+
+    StackEntry stack[MaxDepth + 1];
+    uint32 stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+
+    double sahCost = 0.0;
+    while(stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        const BVHNode& node = nodes[entry.NodeIdx];
+
+        BuildAABB bounds;
+        bounds.Min = node.AABBMin;
+        bounds.Max = node.AABBMax;
+        const float relativeArea = bounds.SurfaceArea() * invRootArea;
+
+        buildStats.MaxDepth = Max(buildStats.MaxDepth, entry.Depth);
+
+        if(node.IsLeaf())
+        {
+            buildStats.NumLeaves += 1;
+            buildStats.MaxLeafTriangles = Max(buildStats.MaxLeafTriangles, node.NumTriangles);
+            sahCost += relativeArea * SAHIntersectionCost * node.NumTriangles;
+        }
+        else
+        {
+            buildStats.NumInteriorNodes += 1;
+            sahCost += relativeArea * SAHTraversalCost;
+            stack[stackSize++] = { node.Offset, entry.Depth + 1 };
+            stack[stackSize++] = { node.Offset + 1, entry.Depth + 1 };
+        }
+    }
+
+    buildStats.SAHCost = float(sahCost);
+}
+
+void BVH::Shutdown()
+{
+    nodes = nullptr;
+    numNodes = 0;
+    triangles = nullptr;
+    numTriangles = 0;
+    wideNodes = nullptr;
+    wideChildNodes = nullptr;
+    numWideNodes = 0;
+    trianglePackets = nullptr;
+    numTrianglePackets = 0;
+    geometryOpaque = nullptr;
+    numGeometries = 0;
+    blobMemory.Shutdown();
+    blobFile.Close();
+    buildStats = BVHBuildStats();
+    refitStats = BVHRefitStats();
+}
+
+// Decides whether a candidate hit on non-opaque geometry should be accepted. The opacity micromap
+// resolves most hits without running the alpha test, and only unknown regions call the any-hit function.
+bool BVH::AcceptNonOpaqueHit(const BVHHit& candidate, BVHAnyHitFunction anyHitFunc, void* anyHitContext, BVHTraversalStats& stats) const
+{
+    if(opacityMicromap != nullptr)
+    {
+        const OpacityState state = opacityMicromap->Lookup(candidate.GeometryIdx, candidate.PrimitiveIdx, candidate.Barycentrics);
+        if(state != OpacityState::Unknown)
+            return state == OpacityState::Opaque;
+    }
+
+    if(anyHitFunc == nullptr)
+        return true;
+
+    stats.NumAnyHitCalls += 1;
+    return anyHitFunc(candidate, anyHitContext);
+}
+
+// Converts a binary node and everything below it into wide nodes, and returns the wide node index
+uint32 BVH::CollapseNode(uint32 nodeIdx)
+{
+    const uint32 wideNodeIdx = uint32(numWideNodes++);
+
+    uint32 children[8] = { };
+    uint32 numChildren = 0;
+    const BVHNode& node = nodes[nodeIdx];
+    if(node.IsLeaf())
+    {
+        children[numChildren++] = nodeIdx;
+    }
+    else
+    {
+        children[numChildren++] = node.Offset;
+        children[numChildren++] = node.Offset + 1;
+    }
+
+    // Keep replacing the interior child with the largest surface area with its own two children
+    while(numChildren < 8)
+    {
+        uint32 bestChild = uint32(-1);
+        float bestArea = -1.0f;
+        for(uint32 i = 0; i < numChildren; ++i)
+        {
+            const BVHNode& child = nodes[children[i]];
+            if(child.IsLeaf())
+                continue;
+
+            const float area = NodeSurfaceArea(child);
+            if(area > bestArea)
+            {
+                bestArea = area;
+                bestChild = i;
+            }
+        }
+
+        if(bestChild == uint32(-1))
+            break;
+
+        const BVHNode& child = nodes[children[bestChild]];
+        children[bestChild] = child.Offset;
+        children[numChildren++] = child.Offset + 1;
+    }
+
+    BVH8Node& wideNode = wideNodes[wideNodeIdx];
+    for(uint32 i = 0; i < 8; ++i)
+    {
+        for(uint32 axis = 0; axis < 3; ++axis)
+        {
+            wideNode.Bounds[axis][i] = FloatMax;
+            wideNode.Bounds[axis + 3][i] = -FloatMax;
+        }
+
+        wideNode.Children[i] = uint32(-1);
+        wideNode.NumPackets[i] = 0;
+    }
+
+    for(uint32 i = 0; i < numChildren; ++i)
+    {
+        const BVHNode& child = nodes[children[i]];
+        SetWideChildBounds(wideNode, i, child);
+        wideChildNodes[wideNodeIdx * 8 + i] = children[i];
+
+        if(child.IsLeaf())
+        {
+            const uint32 numPackets = (child.NumTriangles + 3) / 4;
+            wideNode.Children[i] = uint32(numTrianglePackets);
+            wideNode.NumPackets[i] = numPackets;
+            PackTriangles(&triangles[child.Offset], child.NumTriangles, &trianglePackets[numTrianglePackets]);
+            numTrianglePackets += numPackets;
+        }
+        else
+        {
+            wideNode.Children[i] = CollapseNode(children[i]);
+        }
+    }
+
+    return wideNodeIdx;
+}
+
+// Every level of the wide tree can leave up to 7 siblings on the stack
+static const uint32 TraversalStackSize = BVH::MaxDepth * 7 + 1;
+
+static void SetupRayDirection(const Float3& direction, BVHRayDirection& result)
+{
+    result.Direction = direction;
+
+    float invDir[3] = { };
+    for(uint32 axis = 0; axis < 3; ++axis)
+    {
+        // Avoid infinities/NaN's in the slab test for axis-aligned rays
+        const float dir = direction[axis];
+        invDir[axis] = std::abs(dir) > 1e-20f ? 1.0f / dir : std::copysign(1e20f, dir);
+
+        // Picking the planes up front based on the direction sign saves a min/max per axis
+        result.NearPlanes[axis] = invDir[axis] >= 0.0f ? axis : axis + 3;
+        result.FarPlanes[axis] = invDir[axis] >= 0.0f ? axis + 3 : axis;
+    }
+
+    result.InvDirection = Float3(invDir[0], invDir[1], invDir[2]);
+
+    // Make the dominant axis of the ray direction Z, and swap X/Y if needed to preserve the winding
+    const float absX = std::abs(direction.x);
+    const float absY = std::abs(direction.y);
+    const float absZ = std::abs(direction.z);
+    result.Kz = absX > absY ? (absX > absZ ? 0 : 2) : (absY > absZ ? 1 : 2);
+    result.Kx = (result.Kz + 1) % 3;
+    result.Ky = (result.Kx + 1) % 3;
+    if(direction[result.Kz] < 0.0f)
+        std::swap(result.Kx, result.Ky);
+
+    result.Sx = direction[result.Kx] / direction[result.Kz];
+    result.Sy = direction[result.Ky] / direction[result.Kz];
+    result.Sz = 1.0f / direction[result.Kz];
+}
+
+// Per-ray data for the box and triangle tests
+struct BVHTraversalRay
+{
+    __m256 InvDir[3];
+    __m256 OriginTimesInvDir[3];
+    const BVHRayDirection* Direction = nullptr;
+    Float3 Origin;
+    float TMin = 0.0f;
+};
+
+static BVHTraversalRay SetupTraversalRay(const BVHRayDirection& direction, const Float3& origin, float tMin)
+{
+    BVHTraversalRay result;
+    for(uint32 axis = 0; axis < 3; ++axis)
+    {
+        result.InvDir[axis] = _mm256_set1_ps(direction.InvDirection[axis]);
+        result.OriginTimesInvDir[axis] = _mm256_set1_ps(origin[axis] * direction.InvDirection[axis]);
+    }
+
+    result.Direction = &direction;
+    result.Origin = origin;
+    result.TMin = tMin;
+
+    return result;
+}
+
+// Tests all 8 child boxes against the ray, and returns a bit for each one that was hit
+static uint32 IntersectChildBounds(const BVH8Node& node, const BVHTraversalRay& ray, float tMax, float* entryDistances)
+{
+    const uint32* nearPlanes = ray.Direction->NearPlanes;
+    const uint32* farPlanes = ray.Direction->FarPlanes;
+    const __m256 nearX = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[nearPlanes[0]]), ray.InvDir[0], ray.OriginTimesInvDir[0]);
+    const __m256 nearY = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[nearPlanes[1]]), ray.InvDir[1], ray.OriginTimesInvDir[1]);
+    const __m256 nearZ = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[nearPlanes[2]]), ray.InvDir[2], ray.OriginTimesInvDir[2]);
+    const __m256 farX = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[farPlanes[0]]), ray.InvDir[0], ray.OriginTimesInvDir[0]);
+    const __m256 farY = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[farPlanes[1]]), ray.InvDir[1], ray.OriginTimesInvDir[1]);
+    const __m256 farZ = _mm256_fmsub_ps(_mm256_load_ps(node.Bounds[farPlanes[2]]), ray.InvDir[2], ray.OriginTimesInvDir[2]);
+
+    const __m256 entry = _mm256_max_ps(_mm256_max_ps(nearX, nearY), _mm256_max_ps(nearZ, _mm256_set1_ps(ray.TMin)));
+    const __m256 exit = _mm256_min_ps(_mm256_min_ps(farX, farY), _mm256_min_ps(farZ, _mm256_set1_ps(tMax)));
+
+    _mm256_store_ps(entryDistances, entry);
+    return uint32(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+}
+
+// Minimal float vector wrappers, so that the triangle kernel can be shared between SSE and AVX
+struct SIMD4
+{
+    __m128 V;
+
+    SIMD4(__m128 v) : V(v) { }
+
+    static SIMD4 Replicate(float x) { return _mm_set1_ps(x); }
+    static SIMD4 Load(const BVHTriangle4* packets, uint32 vtx, uint32 axis) { return _mm_load_ps(packets[0].Vertices[vtx][axis]); }
+    void Store(float* dst) const { _mm_store_ps(dst, V); }
+    uint32 Mask() const { return uint32(_mm_movemask_ps(V)); }
+};
+
+static SIMD4 operator+(SIMD4 a, SIMD4 b) { return _mm_add_ps(a.V, b.V); }
+static SIMD4 operator-(SIMD4 a, SIMD4 b) { return _mm_sub_ps(a.V, b.V); }
+static SIMD4 operator*(SIMD4 a, SIMD4 b) { return _mm_mul_ps(a.V, b.V); }
+static SIMD4 operator/(SIMD4 a, SIMD4 b) { return _mm_div_ps(a.V, b.V); }
+static SIMD4 operator&(SIMD4 a, SIMD4 b) { return _mm_and_ps(a.V, b.V); }
+static SIMD4 operator|(SIMD4 a, SIMD4 b) { return _mm_or_ps(a.V, b.V); }
+static SIMD4 operator^(SIMD4 a, SIMD4 b) { return _mm_xor_ps(a.V, b.V); }
+static SIMD4 operator<(SIMD4 a, SIMD4 b) { return _mm_cmplt_ps(a.V, b.V); }
+static SIMD4 operator>(SIMD4 a, SIMD4 b) { return _mm_cmpgt_ps(a.V, b.V); }
+static SIMD4 operator>=(SIMD4 a, SIMD4 b) { return _mm_cmpge_ps(a.V, b.V); }
+static SIMD4 operator!=(SIMD4 a, SIMD4 b) { return _mm_cmpneq_ps(a.V, b.V); }
+static SIMD4 AndNot(SIMD4 a, SIMD4 b) { return _mm_andnot_ps(a.V, b.V); }
+
+// Tests 2 packets at once, with the second one in the upper half
+struct SIMD8
+{
+    __m256 V;
+
+    SIMD8(__m256 v) : V(v) { }
+
+    static SIMD8 Replicate(float x) { return _mm256_set1_ps(x); }
+    static SIMD8 Load(const BVHTriangle4* packets, uint32 vtx, uint32 axis)
+    {
+        const __m128 lo = _mm_load_ps(packets[0].Vertices[vtx][axis]);
+        const __m128 hi = _mm_load_ps(packets[1].Vertices[vtx][axis]);
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+    }
+
+    void Store(float* dst) const { _mm256_store_ps(dst, V); }
+    uint32 Mask() const { return uint32(_mm256_movemask_ps(V)); }
+};
+
+static SIMD8 operator+(SIMD8 a, SIMD8 b) { return _mm256_add_ps(a.V, b.V); }
+static SIMD8 operator-(SIMD8 a, SIMD8 b) { return _mm256_sub_ps(a.V, b.V); }
+static SIMD8 operator*(SIMD8 a, SIMD8 b) { return _mm256_mul_ps(a.V, b.V); }
+static SIMD8 operator/(SIMD8 a, SIMD8 b) { return _mm256_div_ps(a.V, b.V); }
+static SIMD8 operator&(SIMD8 a, SIMD8 b) { return _mm256_and_ps(a.V, b.V); }
+static SIMD8 operator|(SIMD8 a, SIMD8 b) { return _mm256_or_ps(a.V, b.V); }
+static SIMD8 operator^(SIMD8 a, SIMD8 b) { return _mm256_xor_ps(a.V, b.V); }
+static SIMD8 operator<(SIMD8 a, SIMD8 b) { return _mm256_cmp_ps(a.V, b.V, _CMP_LT_OQ); }
+static SIMD8 operator>(SIMD8 a, SIMD8 b) { return _mm256_cmp_ps(a.V, b.V, _CMP_GT_OQ); }
+static SIMD8 operator>=(SIMD8 a, SIMD8 b) { return _mm256_cmp_ps(a.V, b.V, _CMP_GE_OQ); }
+static SIMD8 operator!=(SIMD8 a, SIMD8 b) { return _mm256_cmp_ps(a.V, b.V, _CMP_NEQ_OQ); }
+static SIMD8 AndNot(SIMD8 a, SIMD8 b) { return _mm256_andnot_ps(a.V, b.V); }
+
+// Watertight ray/triangle intersection from "Watertight Ray/Triangle Intersection" [Woop et al. 2013],
+// without backface culling to match DXR. Returns a bit for every lane with a hit in [TMin, tMax), and
+// stores distances and DXR-style barycentrics for those lanes.
+template<typename SIMD> static uint32 IntersectTriangles(const BVHTraversalRay& ray, const BVHTriangle4* packets, float tMax,
+                                                         float* hitT, float* hitU, float* hitV)
+{
+    const BVHRayDirection& dir = *ray.Direction;
+    const SIMD ox = SIMD::Replicate(ray.Origin[dir.Kx]);
+    const SIMD oy = SIMD::Replicate(ray.Origin[dir.Ky]);
+    const SIMD oz = SIMD::Replicate(ray.Origin[dir.Kz]);
+    const SIMD sx = SIMD::Replicate(dir.Sx);
+    const SIMD sy = SIMD::Replicate(dir.Sy);
+    const SIMD sz = SIMD::Replicate(dir.Sz);
+
+    // Translate the vertices relative to the ray origin, then shear them so that the ray points down +Z
+    const SIMD az = SIMD::Load(packets, 0, dir.Kz) - oz;
+    const SIMD bz = SIMD::Load(packets, 1, dir.Kz) - oz;
+    const SIMD cz = SIMD::Load(packets, 2, dir.Kz) - oz;
+    const SIMD ax = (SIMD::Load(packets, 0, dir.Kx) - ox) - sx * az;
+    const SIMD ay = (SIMD::Load(packets, 0, dir.Ky) - oy) - sy * az;
+    const SIMD bx = (SIMD::Load(packets, 1, dir.Kx) - ox) - sx * bz;
+    const SIMD by = (SIMD::Load(packets, 1, dir.Ky) - oy) - sy * bz;
+    const SIMD cx = (SIMD::Load(packets, 2, dir.Kx) - ox) - sx * cz;
+    const SIMD cy = (SIMD::Load(packets, 2, dir.Ky) - oy) - sy * cz;
+
+    // Scaled edge functions. These are deliberately not fused so that an edge shared by two triangles
+    // evaluates to exactly the negated value, which is what makes the test watertight.
+    const SIMD e0 = cx * by - cy * bx;
+    const SIMD e1 = ax * cy - ay * cx;
+    const SIMD e2 = bx * ay - by * ax;
+
+    const SIMD zero = SIMD::Replicate(0.0f);
+    const SIMD anyNegative = (e0 < zero) | (e1 < zero) | (e2 < zero);
+    const SIMD anyPositive = (e0 > zero) | (e1 > zero) | (e2 > zero);
+
+    const SIMD det = e0 + e1 + e2;
+    const SIMD t = e0 * (sz * az) + e1 * (sz * bz) + e2 * (sz * cz);
+
+    // Check the distance range before dividing, accounting for the sign of the determinant
+    const SIMD detSign = det & SIMD::Replicate(-0.0f);
+    const SIMD absDet = det ^ detSign;
+    const SIMD signedT = t ^ detSign;
+    const SIMD inRange = (signedT >= SIMD::Replicate(ray.TMin) * absDet) & (signedT < SIMD::Replicate(tMax) * absDet);
+    const SIMD valid = AndNot(anyNegative & anyPositive, (det != zero) & inRange);
+
+    const uint32 hitMask = valid.Mask();
+    if(hitMask == 0)
+        return 0;
+
+    const SIMD invDet = SIMD::Replicate(1.0f) / det;
+    (t * invDet).Store(hitT);
+    (e1 * invDet).Store(hitU);
+    (e2 * invDet).Store(hitV);
+
+    return hitMask;
+}
+
+// Tests the next packets in a leaf, 8 triangles at a time with AVX and using SSE for a leftover packet
+static uint32 IntersectLeafPackets(const BVHTraversalRay& ray, const BVHTriangle4* packets, uint32 numPackets, float tMax,
+                                   float* hitT, float* hitU, float* hitV, uint32& packetIdx, BVHTraversalStats& stats)
+{
+    if(numPackets >= 2)
+    {
+        packetIdx += 2;
+        stats.NumTriangleTests += 8;
+        return IntersectTriangles<SIMD8>(ray, packets, tMax, hitT, hitU, hitV);
+    }
+
+    packetIdx += 1;
+    stats.NumTriangleTests += 4;
+    return IntersectTriangles<SIMD4>(ray, packets, tMax, hitT, hitU, hitV);
+}
+
+bool BVH::TraceRay(const BVHRay& ray, uint32 rayFlags, BVHHit& hit, BVHAnyHitFunction anyHitFunc, void* anyHitContext,
+                   BVHTraversalStats* stats) const
+{
+    hit = BVHHit();
+    if(numWideNodes == 0)
+        return false;
+
+    // Counting into a local when nobody asked for stats keeps the traversal loop free of extra branches
+    BVHTraversalStats localStats;
+    BVHTraversalStats& traversalStats = stats != nullptr ? *stats : localStats;
+
+    const bool forceOpaque = (rayFlags & BVHRayFlag_ForceOpaque) != 0;
+    const bool acceptFirstHit = (rayFlags & BVHRayFlag_AcceptFirstHitAndEndSearch) != 0;
+
+    BVHRayDirection direction;
+    SetupRayDirection(ray.Direction, direction);
+    const BVHTraversalRay traversalRay = SetupTraversalRay(direction, ray.Origin, ray.TMin);
+
+    struct StackEntry
+    {
+        uint32 Child;
+        uint32 NumPackets;
+        float Distance;
+    };
+
+    StackEntry stack[TraversalStackSize];
+    uint32 stackSize = 0;
+    stack[stackSize++] = { 0, 0, ray.TMin };
+
+    float closestT = ray.TMax;
+    while(stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+
+        // The closest hit may have moved in front of this since it was pushed
+        if(entry.Distance > closestT)
+            continue;
+
+        if(entry.NumPackets > 0)
+        {
+            const BVHTriangle4* packets = &trianglePackets[entry.Child];
+            for(uint32 packetIdx = 0; packetIdx < entry.NumPackets;)
+            {
+                alignas(32) float hitT[8];
+                alignas(32) float hitU[8];
+                alignas(32) float hitV[8];
+
+                const BVHTriangle4* currPackets = packets + packetIdx;
+                uint32 hitMask = IntersectLeafPackets(traversalRay, currPackets, entry.NumPackets - packetIdx, closestT,
+                                                      hitT, hitU, hitV, packetIdx, traversalStats);
+
+                // Visit the candidates from front to back, so that the first one that's accepted is the closest
+                while(hitMask != 0)
+                {
+                    uint32 lane = 0;
+                    float laneT = FloatMax;
+                    for(uint32 bits = hitMask; bits != 0; bits &= bits - 1)
+                    {
+                        const uint32 bitIdx = _tzcnt_u32(bits);
+                        if(hitT[bitIdx] < laneT)
+                        {
+                            laneT = hitT[bitIdx];
+                            lane = bitIdx;
+                        }
+                    }
+
+                    hitMask &= ~(1u << lane);
+
+                    const BVHTriangle4& packet = currPackets[lane / 4];
+                    BVHHit candidate;
+                    candidate.T = hitT[lane];
+                    candidate.Barycentrics = Float2(hitU[lane], hitV[lane]);
+                    candidate.GeometryIdx = packet.GeometryIdx[lane % 4];
+                    candidate.PrimitiveIdx = packet.PrimitiveIdx[lane % 4];
+                    candidate.InstanceIdx = packet.InstanceIdx[lane % 4];
+
+                    const bool opaque = forceOpaque || geometryOpaque[candidate.GeometryIdx] != 0;
+                    if(opaque == false && AcceptNonOpaqueHit(candidate, anyHitFunc, anyHitContext, traversalStats) == false)
+                        continue;
+
+                    hit = candidate;
+                    closestT = candidate.T;
+                    if(acceptFirstHit)
+                        return true;
+
+                    break;
+                }
+            }
+
+            continue;
+        }
+
+        const BVH8Node& node = wideNodes[entry.Child];
+        alignas(32) float entryDistances[8];
+        uint32 childMask = IntersectChildBounds(node, traversalRay, closestT, entryDistances);
+        traversalStats.NumNodesVisited += 1;
+
+        // Insert the children sorted so that the nearest one ends up on top of the stack
+        const uint32 firstEntry = stackSize;
+        for(; childMask != 0; childMask &= childMask - 1)
+        {
+            const uint32 childIdx = _tzcnt_u32(childMask);
+            const StackEntry childEntry = { node.Children[childIdx], node.NumPackets[childIdx], entryDistances[childIdx] };
+
+            uint32 insertIdx = stackSize++;
+            while(insertIdx > firstEntry && stack[insertIdx - 1].Distance < childEntry.Distance)
+            {
+                stack[insertIdx] = stack[insertIdx - 1];
+                --insertIdx;
+            }
+
+            stack[insertIdx] = childEntry;
+        }
+
+        Assert_(stackSize <= TraversalStackSize);
+    }
+
+    return hit.Valid();
+}
+
+void BVH::PrepareOcclusionBatch(const Float3& direction, BVHOcclusionBatch& batch) const
+{
+    SetupRayDirection(direction, batch.Direction);
+    batch.ChildOrders.Init(numWideNodes);
+
+    // Distance along the ray to the near corner of a box only depends on the direction, which means
+    // that the front-to-back order of a node's children is the same for every ray in the batch
+    for(uint64 nodeIdx = 0; nodeIdx < numWideNodes; ++nodeIdx)
+    {
+        const BVH8Node& node = wideNodes[nodeIdx];
+
+        float keys[8] = { };
+        uint32 order[8] = { };
+        for(uint32 i = 0; i < 8; ++i)
+        {
+            order[i] = i;
+            for(uint32 axis = 0; axis < 3; ++axis)
+                keys[i] += node.Bounds[batch.Direction.NearPlanes[axis]][i] * direction[axis];
+        }
+
+        std::sort(order, order + 8, [&](uint32 a, uint32 b) { return keys[a] < keys[b]; });
+
+        uint32 childOrder = 0;
+        for(uint32 i = 0; i < 8; ++i)
+            childOrder |= order[i] << (i * 4);
+        batch.ChildOrders[nodeIdx] = childOrder;
+    }
+}
+
+bool BVH::TraceOcclusion(const BVHRay& ray, uint32 rayFlags, BVHAnyHitFunction anyHitFunc, void* anyHitContext,
+                         BVHTraversalStats* stats) const
+{
+    BVHRayDirection direction;
+    SetupRayDirection(ray.Direction, direction);
+    const BVHTraversalRay traversalRay = SetupTraversalRay(direction, ray.Origin, ray.TMin);
+
+    BVHTraversalStats localStats;
+    return TraceOcclusion(traversalRay, ray.TMax, nullptr, rayFlags, anyHitFunc, anyHitContext, stats != nullptr ? *stats : localStats);
+}
+
+bool BVH::TraceOcclusion(const BVHOcclusionBatch& batch, const Float3& origin, float tMin, float tMax, uint32 rayFlags,
+                         BVHAnyHitFunction anyHitFunc, void* anyHitContext, BVHTraversalStats* stats) const
+{
+    Assert_(batch.ChildOrders.Size() == numWideNodes);
+    const BVHTraversalRay traversalRay = SetupTraversalRay(batch.Direction, origin, tMin);
+
+    BVHTraversalStats localStats;
+    return TraceOcclusion(traversalRay, tMax, batch.ChildOrders.Data(), rayFlags, anyHitFunc, anyHitContext,
+                          stats != nullptr ? *stats : localStats);
+}
+
+bool BVH::TraceOcclusion(const BVHTraversalRay& ray, float tMax, const uint32* childOrders, uint32 rayFlags,
+                         BVHAnyHitFunction anyHitFunc, void* anyHitContext, BVHTraversalStats& stats) const
+{
+    if(numWideNodes == 0)
+        return false;
+
+    const bool forceOpaque = (rayFlags & BVHRayFlag_ForceOpaque) != 0;
+
+    struct StackEntry
+    {
+        uint32 Child;
+        uint32 NumPackets;
+    };
+
+    StackEntry stack[TraversalStackSize];
+    uint32 stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+
+    while(stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+
+        if(entry.NumPackets > 0)
+        {
+            const BVHTriangle4* packets = &trianglePackets[entry.Child];
+            for(uint32 packetIdx = 0; packetIdx < entry.NumPackets;)
+            {
+                alignas(32) float hitT[8];
+                alignas(32) float hitU[8];
+                alignas(32) float hitV[8];
+
+                const BVHTriangle4* currPackets = packets + packetIdx;
+                uint32 hitMask = IntersectLeafPackets(ray, currPackets, entry.NumPackets - packetIdx, tMax,
+                                                      hitT, hitU, hitV, packetIdx, stats);
+
+                // Any hit will do, so there's no need to visit the candidates in order
+                for(; hitMask != 0; hitMask &= hitMask - 1)
+                {
+                    const uint32 lane = _tzcnt_u32(hitMask);
+                    const BVHTriangle4& packet = currPackets[lane / 4];
+                    const uint32 geometryIdx = packet.GeometryIdx[lane % 4];
+                    if(forceOpaque || geometryOpaque[geometryIdx] != 0 || (anyHitFunc == nullptr && opacityMicromap == nullptr))
+                        return true;
+
+                    BVHHit candidate;
+                    candidate.T = hitT[lane];
+                    candidate.Barycentrics = Float2(hitU[lane], hitV[lane]);
+                    candidate.GeometryIdx = geometryIdx;
+                    candidate.PrimitiveIdx = packet.PrimitiveIdx[lane % 4];
+                    candidate.InstanceIdx = packet.InstanceIdx[lane % 4];
+                    if(AcceptNonOpaqueHit(candidate, anyHitFunc, anyHitContext, stats))
+                        return true;
+                }
+            }
+
+            continue;
+        }
+
+        const BVH8Node& node = wideNodes[entry.Child];
+        alignas(32) float entryDistances[8];
+        const uint32 childMask = IntersectChildBounds(node, ray, tMax, entryDistances);
+        stats.NumNodesVisited += 1;
+
+        if(childOrders != nullptr)
+        {
+            // Push back-to-front using the pre-sorted order, so that the nearest child is visited first
+            const uint32 childOrder = childOrders[entry.Child];
+            for(int32 slot = 7; slot >= 0; --slot)
+            {
+                const uint32 childIdx = (childOrder >> (slot * 4)) & 0xF;
+                if(childMask & (1u << childIdx))
+                    stack[stackSize++] = { node.Children[childIdx], node.NumPackets[childIdx] };
+            }
+        }
+        else
+        {
+            for(uint32 bits = childMask; bits != 0; bits &= bits - 1)
+            {
+                const uint32 childIdx = _tzcnt_u32(bits);
+                stack[stackSize++] = { node.Children[childIdx], node.NumPackets[childIdx] };
+            }
+        }
+
+        Assert_(stackSize <= TraversalStackSize);
+    }
+
+    return false;
+}
+
+}
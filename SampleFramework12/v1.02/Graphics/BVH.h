@@ -0,0 +1,279 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\Containers.h"
+#include "..\\SF12_Math.h"
+#include "..\\FileIO.h"
+
+namespace enki
+{
+    class TaskScheduler;
+}
+
+namespace SampleFramework12
+{
+
+class Model;
+class OpacityMicromap;
+struct Hash;
+
+// Ray used for CPU ray tracing, with the same conventions as RayDesc in HLSL
+struct BVHRay
+{
+    Float3 Origin;
+    float TMin = 0.0f;
+    Float3 Direction;
+    float TMax = FloatMax;
+};
+
+// Intersection result. Barycentrics match BuiltInTriangleIntersectionAttributes, the geometry
+// index corresponds to the mesh index in the model (equivalent to InstanceID() in a DXR shader),
+// and the instance index corresponds to the model's instance list (equivalent to InstanceIndex())
+struct BVHHit
+{
+    float T = FloatMax;
+    Float2 Barycentrics;
+    uint32 GeometryIdx = uint32(-1);
+    uint32 PrimitiveIdx = uint32(-1);
+    uint32 InstanceIdx = uint32(-1);
+
+    bool Valid() const { return GeometryIdx != uint32(-1); }
+};
+
+// Subset of the DXR ray flags that's supported by the CPU traversal
+enum BVHRayFlags : uint32
+{
+    BVHRayFlag_None = 0,
+    BVHRayFlag_ForceOpaque = 0x1,
+    BVHRayFlag_AcceptFirstHitAndEndSearch = 0x4,
+};
+
+// Called for candidate hits on non-opaque geometry, return false to ignore the hit (like IgnoreHit()).
+// When an opacity micromap is set, this is only called for hits in regions that it can't classify.
+typedef bool (*BVHAnyHitFunction)(const BVHHit& candidateHit, void* context);
+
+struct BVHNode
+{
+    Float3 AABBMin;
+    uint32 Offset = 0;          // Index of the first child for interior nodes, or the first triangle for leaves
+    Float3 AABBMax;
+    uint32 NumTriangles = 0;    // Zero for interior nodes
+
+    bool IsLeaf() const { return NumTriangles > 0; }
+};
+
+// Triangle data stored in leaf order
+struct BVHTriangle
+{
+    Float3 V0;
+    Float3 V1;
+    Float3 V2;
+    uint32 GeometryIdx = 0;
+    uint32 PrimitiveIdx = 0;
+    uint32 InstanceIdx = 0;
+};
+
+// Node in the collapsed 8-wide BVH that's used for traversal. Child bounds are stored as SoA so that
+// all 8 boxes can be tested at once, and unused slots have empty bounds so that they're never hit.
+struct alignas(32) BVH8Node
+{
+    float Bounds[6][8];             // Min XYZ followed by max XYZ, for each child
+    uint32 Children[8];             // Wide node index for interior children, first triangle packet for leaves
+    uint32 NumPackets[8];           // Number of triangle packets for leaf children, zero for interior children
+};
+
+// 4 triangles from a leaf in SoA layout, for the SIMD intersection kernels. Unused lanes contain
+// NaN positions so that they can never be hit.
+struct alignas(16) BVHTriangle4
+{
+    float Vertices[3][3][4];        // [vertex][axis][lane]
+    uint32 GeometryIdx[4];
+    uint32 PrimitiveIdx[4];
+    uint32 InstanceIdx[4];
+};
+
+// Direction-dependent traversal constants, which can be shared by all rays with the same direction
+struct BVHRayDirection
+{
+    Float3 Direction;
+    Float3 InvDirection;
+    uint32 NearPlanes[3] = { };
+    uint32 FarPlanes[3] = { };
+
+    // Axis permutation and shear constants for the watertight triangle test
+    uint32 Kx = 0;
+    uint32 Ky = 0;
+    uint32 Kz = 0;
+    float Sx = 0.0f;
+    float Sy = 0.0f;
+    float Sz = 0.0f;
+};
+
+// Occlusion rays that all share a single direction, such as shadow rays for the sun. The children
+// of every wide node are pre-sorted front-to-back along the direction, so that tracing the rays
+// doesn't need to sort anything.
+struct BVHOcclusionBatch
+{
+    BVHRayDirection Direction;
+    Array<uint32> ChildOrders;      // 4 bits per child index, with the nearest child in the low bits
+};
+
+struct BVHTraversalRay;
+
+// Work done by traversals, for callers that pass in somewhere to accumulate it. Nodes are wide nodes
+// whose child boxes were tested, and triangle tests include the unused lanes of partially filled packets.
+struct BVHTraversalStats
+{
+    uint64 NumNodesVisited = 0;
+    uint64 NumTriangleTests = 0;
+    uint64 NumAnyHitCalls = 0;
+};
+
+// Statistics gathered after a build. The SAH cost is relative to the root node's surface area,
+// so it can be compared across scenes and builds.
+struct BVHBuildStats
+{
+    uint32 NumTriangles = 0;
+    uint32 NumNodes = 0;
+    uint32 NumInteriorNodes = 0;
+    uint32 NumLeaves = 0;
+    uint32 MaxDepth = 0;
+    uint32 MaxLeafTriangles = 0;
+    uint32 NumWideNodes = 0;
+    uint32 NumTrianglePackets = 0;
+    float SAHCost = 0.0f;
+    float BuildTimeMS = 0.0f;       // Time spent mapping the file when loaded from a cache
+    bool LoadedFromCache = false;
+};
+
+// Unit of allocation for the blob that holds all of the tree data
+struct alignas(64) BVHBlobBlock
+{
+    uint8 Bytes[64];
+};
+
+// Statistics for the most recent refit. The SAH ratio is the refit tree's cost divided by the cost
+// right after the last full build, which grows as triangles move away from where they were built.
+struct BVHRefitStats
+{
+    uint32 NumRefits = 0;
+    float SAHCost = 0.0f;
+    float SAHRatio = 1.0f;
+    float RefitTimeMS = 0.0f;
+};
+
+// Bounding volume hierarchy over all of the triangles in a Model, with instances flattened into
+// world space. A binary tree is built using a binned surface area heuristic (in parallel when given
+// a task scheduler), and then collapsed into an 8-wide tree that's traversed with AVX box tests
+// and SIMD watertight triangle tests. When only vertex positions or instance transforms change, the
+// tree can be refit in place instead of rebuilt. All of the tree data lives in a single blob with the
+// same layout as the cache files, so a cached tree can be traversed straight out of the mapped file.
+class BVH
+{
+
+public:
+
+    ~BVH()
+    {
+        Assert_(numNodes == 0);
+    }
+
+    // Maps the tree from a cache file next to the model if there's one that matches its geometry and
+    // the build settings, otherwise builds it and writes out a new cache file
+    void Initialize(const Model& model, enki::TaskScheduler* scheduler = nullptr);
+
+    void Build(const Model& model, enki::TaskScheduler* scheduler = nullptr);
+    void Shutdown();
+
+    // Updates all node bounds bottom-up for new positions in the model, keeping the tree topology.
+    // The model must have the same meshes, instances, and triangles as it had for Build().
+    // Occlusion batches need to be prepared again afterwards.
+    void Refit(const Model& model, enki::TaskScheduler* scheduler = nullptr);
+
+    // Full rebuild from the current (possibly refit) triangles, without touching the model. Copying
+    // the triangles from another BVH first lets the rebuild run while that one is still being used.
+    void CopyTriangles(const BVH& source);
+    void Rebuild(enki::TaskScheduler* scheduler = nullptr);
+
+    // Optional, must outlive the BVH or be cleared with nullptr
+    void SetOpacityMicromap(const OpacityMicromap* micromap) { opacityMicromap = micromap; }
+
+    bool TraceRay(const BVHRay& ray, uint32 rayFlags, BVHHit& hit,
+                  BVHAnyHitFunction anyHitFunc = nullptr, void* anyHitContext = nullptr, BVHTraversalStats* stats = nullptr) const;
+
+    // Returns true if anything is hit between TMin and TMax, stopping at the first hit that's accepted.
+    // This is cheaper than TraceRay with BVHRayFlag_AcceptFirstHitAndEndSearch, since it doesn't
+    // track the closest hit or sort children by distance.
+    bool TraceOcclusion(const BVHRay& ray, uint32 rayFlags,
+                        BVHAnyHitFunction anyHitFunc = nullptr, void* anyHitContext = nullptr, BVHTraversalStats* stats = nullptr) const;
+
+    // Same as above, but for rays with the direction of a prepared batch
+    void PrepareOcclusionBatch(const Float3& direction, BVHOcclusionBatch& batch) const;
+    bool TraceOcclusion(const BVHOcclusionBatch& batch, const Float3& origin, float tMin, float tMax, uint32 rayFlags,
+                        BVHAnyHitFunction anyHitFunc = nullptr, void* anyHitContext = nullptr, BVHTraversalStats* stats = nullptr) const;
+
+    // Accessors
+    const BVHNode* Nodes() const { return nodes; }
+    uint64 NumNodes() const { return numNodes; }
+    const BVHTriangle* Triangles() const { return triangles; }
+    uint64 NumTriangles() const { return numTriangles; }
+    const BVH8Node* WideNodes() const { return wideNodes; }
+    uint64 NumWideNodes() const { return numWideNodes; }
+    const BVHTriangle4* TrianglePackets() const { return trianglePackets; }
+    uint64 NumTrianglePackets() const { return numTrianglePackets; }
+    bool GeometryOpaque(uint32 geometryIdx) const { return geometryOpaque[geometryIdx] != 0; }
+    const BVHBuildStats& BuildStats() const { return buildStats; }
+    const BVHRefitStats& RefitStats() const { return refitStats; }
+
+    static const uint32 MaxLeafTriangles = 4;
+    static const uint32 MaxDepth = 64;
+    static const uint32 NumSAHBins = 16;
+
+protected:
+
+    void BuildTree(const Array<BVHTriangle>& srcTriangles, const Array<uint8>& srcGeometryOpaque, enki::TaskScheduler* scheduler);
+    uint32 CollapseNode(uint32 nodeIdx);
+    void ComputeBuildStats();
+
+    void CreateBlob();
+    bool MapBlob(const wchar* filePath, const Hash& key);
+    void WriteBlob(const wchar* filePath, const Hash& key) const;
+
+    bool TraceOcclusion(const BVHTraversalRay& ray, float tMax, const uint32* childOrders, uint32 rayFlags,
+                        BVHAnyHitFunction anyHitFunc, void* anyHitContext, BVHTraversalStats& stats) const;
+    bool AcceptNonOpaqueHit(const BVHHit& candidate, BVHAnyHitFunction anyHitFunc, void* anyHitContext, BVHTraversalStats& stats) const;
+
+    // Sections of the blob
+    BVHNode* nodes = nullptr;
+    uint64 numNodes = 0;
+    BVHTriangle* triangles = nullptr;
+    uint64 numTriangles = 0;
+    BVH8Node* wideNodes = nullptr;
+    uint32* wideChildNodes = nullptr;   // Binary node index for each wide node child, used for refitting
+    uint64 numWideNodes = 0;
+    BVHTriangle4* trianglePackets = nullptr;
+    uint64 numTrianglePackets = 0;
+    const uint8* geometryOpaque = nullptr;
+    uint64 numGeometries = 0;
+
+    // Backing memory for the blob, which is either allocated after a build or mapped from a cache file.
+    // Cache files are mapped copy-on-write so that refitting them doesn't touch the file.
+    Array<BVHBlobBlock> blobMemory;
+    MappedFile blobFile;
+
+    const OpacityMicromap* opacityMicromap = nullptr;
+    BVHBuildStats buildStats;
+    BVHRefitStats refitStats;
+};
+
+}
@@ -0,0 +1,246 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "Denoiser.h"
+#include "..\\Timer.h"
+#include "..\\EnkiTS\\TaskScheduler.h"
+
+using namespace DirectX;
+
+namespace SampleFramework12
+{
+
+// 1D weights of the B3-spline kernel, indexed by distance from the center tap
+static const float KernelWeights[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+// Keeps black texels from blowing up the demodulated lighting
+static const float MinAlbedo = 0.01f;
+
+template<typename T> static void ParallelForRows(uint32 numRows, enki::TaskScheduler* scheduler, const T& processRow)
+{
+    if(scheduler != nullptr)
+    {
+        enki::TaskSet taskSet(numRows, [&](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            for(uint32 y = range.start; y < range.end; ++y)
+                processRow(y);
+        });
+
+        scheduler->AddTaskSetToPipe(&taskSet);
+        scheduler->WaitforTaskSet(&taskSet);
+    }
+    else
+    {
+        for(uint32 y = 0; y < numRows; ++y)
+            processRow(y);
+    }
+}
+
+static XMVECTOR ClampedAlbedo(const Float4& albedo)
+{
+    return XMVectorMax(albedo.ToSIMD(), XMVectorReplicate(MinAlbedo));
+}
+
+void DenoiserAOVs::Init(uint32 width, uint32 height)
+{
+    Albedo.Init(width, height, 1);
+    Normal.Init(width, height, 1);
+    Depth.Init(width, height, 1);
+    Variance.Init(width, height, 1);
+}
+
+void AtrousDenoiser::Shutdown()
+{
+    buffers[0].Shutdown();
+    buffers[1].Shutdown();
+    filteredVariance.Shutdown();
+    depthGradients.Shutdown();
+}
+
+void AtrousDenoiser::Denoise(const TextureData<Float4>& color, const DenoiserAOVs& aovs, const DenoiserSettings& settings,
+                             TextureData<Float4>& output, enki::TaskScheduler* scheduler)
+{
+    const uint32 width = color.Width;
+    const uint32 height = color.Height;
+    const uint64 numPixels = uint64(width) * height;
+    Assert_(aovs.Albedo.Texels.Size() == numPixels && aovs.Normal.Texels.Size() == numPixels);
+    Assert_(aovs.Depth.Texels.Size() == numPixels && aovs.Variance.Texels.Size() == numPixels);
+
+    Timer timer;
+
+    if(buffers[0].Size() != numPixels)
+    {
+        buffers[0].Init(numPixels);
+        buffers[1].Init(numPixels);
+        filteredVariance.Init(numPixels);
+        depthGradients.Init(numPixels);
+    }
+
+    const Float4* albedo = aovs.Albedo.Texels.Data();
+    const Float4* normals = aovs.Normal.Texels.Data();
+    const float* depths = aovs.Depth.Texels.Data();
+
+    // Divide out the albedo, and find how quickly the depth changes around each pixel so that the depth
+    // weights work the same for surfaces that are facing the camera and ones at a grazing angle
+    ParallelForRows(height, scheduler, [&](uint32 y)
+    {
+        for(uint32 x = 0; x < width; ++x)
+        {
+            const uint32 pixelIdx = y * width + x;
+            const XMVECTOR pixelAlbedo = ClampedAlbedo(albedo[pixelIdx]);
+            const float albedoLuminance = Max(ComputeLuminance(albedo[pixelIdx].To3D()), MinAlbedo);
+
+            Float4 demodulated = Float4(XMVectorDivide(color.Texels[pixelIdx].ToSIMD(), pixelAlbedo));
+            demodulated.w = aovs.Variance.Texels[pixelIdx] / (albedoLuminance * albedoLuminance);
+            buffers[0][pixelIdx] = demodulated;
+
+            const float depth = depths[pixelIdx];
+            float gradient = 0.0f;
+            if(depth > 0.0f)
+            {
+                const float neighbors[4] =
+                {
+                    x > 0 ? depths[pixelIdx - 1] : 0.0f,
+                    x + 1 < width ? depths[pixelIdx + 1] : 0.0f,
+                    y > 0 ? depths[pixelIdx - width] : 0.0f,
+                    y + 1 < height ? depths[pixelIdx + width] : 0.0f,
+                };
+
+                for(float neighbor : neighbors)
+                    if(neighbor > 0.0f)
+                        gradient = Max(gradient, std::abs(neighbor - depth));
+            }
+
+            depthGradients[pixelIdx] = Max(gradient, depth * 0.001f);
+        }
+    });
+
+    uint32 src = 0;
+    for(uint32 iteration = 0; iteration < settings.NumIterations; ++iteration)
+    {
+        const int32 stepSize = 1 << iteration;
+        const Float4* srcTexels = buffers[src].Data();
+        Float4* dstTexels = buffers[src ^ 1].Data();
+
+        // The luminance threshold uses a slightly blurred variance, since the estimate from a handful of
+        // samples is noisy itself
+        ParallelForRows(height, scheduler, [&](uint32 y)
+        {
+            for(uint32 x = 0; x < width; ++x)
+            {
+                float varianceSum = 0.0f;
+                float weightSum = 0.0f;
+                for(int32 dy = -1; dy <= 1; ++dy)
+                {
+                    const int32 sampleY = int32(y) + dy;
+                    if(sampleY < 0 || sampleY >= int32(height))
+                        continue;
+
+                    for(int32 dx = -1; dx <= 1; ++dx)
+                    {
+                        const int32 sampleX = int32(x) + dx;
+                        if(sampleX < 0 || sampleX >= int32(width))
+                            continue;
+
+                        const float weight = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+                        varianceSum += srcTexels[sampleY * width + sampleX].w * weight;
+                        weightSum += weight;
+                    }
+                }
+
+                filteredVariance[y * width + x] = varianceSum / weightSum;
+            }
+        });
+
+        ParallelForRows(height, scheduler, [&](uint32 y)
+        {
+            for(uint32 x = 0; x < width; ++x)
+            {
+                const uint32 pixelIdx = y * width + x;
+                const Float4 center = srcTexels[pixelIdx];
+                const float depth = depths[pixelIdx];
+                if(depth <= 0.0f)
+                {
+                    dstTexels[pixelIdx] = center;
+                    continue;
+                }
+
+                const float luminance = ComputeLuminance(center.To3D());
+                const float luminanceScale = -1.0f / (settings.ColorSigma * std::sqrt(Max(filteredVariance[pixelIdx], 0.0f)) + 0.0001f);
+                const float depthScale = -1.0f / (settings.DepthSigma * depthGradients[pixelIdx] * stepSize);
+                const XMVECTOR normal = normals[pixelIdx].ToSIMD();
+
+                // Color and variance are accumulated together, with the variance weighted by the squared weight
+                XMVECTOR sum = XMVectorZero();
+                float weightSum = 0.0f;
+                for(int32 dy = -2; dy <= 2; ++dy)
+                {
+                    const int32 sampleY = int32(y) + dy * stepSize;
+                    if(sampleY < 0 || sampleY >= int32(height))
+                        continue;
+
+                    for(int32 dx = -2; dx <= 2; ++dx)
+                    {
+                        const int32 sampleX = int32(x) + dx * stepSize;
+                        if(sampleX < 0 || sampleX >= int32(width))
+                            continue;
+
+                        const uint32 sampleIdx = sampleY * width + sampleX;
+                        const float sampleDepth = depths[sampleIdx];
+                        if(sampleDepth <= 0.0f)
+                            continue;
+
+                        const Float4 sample = srcTexels[sampleIdx];
+                        const float nDotN = XMVectorGetX(XMVector3Dot(normal, normals[sampleIdx].ToSIMD()));
+                        if(nDotN <= 0.0f)
+                            continue;
+
+                        const float pixelDistance = std::sqrt(float(dx * dx + dy * dy));
+                        const float luminanceWeight = std::exp(std::abs(luminance - ComputeLuminance(sample.To3D())) * luminanceScale);
+                        const float depthWeight = std::exp(std::abs(depth - sampleDepth) * depthScale / Max(pixelDistance, 1.0f));
+                        const float normalWeight = std::pow(nDotN, settings.NormalPower);
+
+                        const float weight = KernelWeights[std::abs(dx)] * KernelWeights[std::abs(dy)] * luminanceWeight * depthWeight * normalWeight;
+                        sum = XMVectorMultiplyAdd(sample.ToSIMD(), XMVectorSet(weight, weight, weight, weight * weight), sum);
+                        weightSum += weight;
+                    }
+                }
+
+                // The center tap always has a weight of at least the kernel weight, unless its normal is 0
+                if(weightSum > 0.0f)
+                    dstTexels[pixelIdx] = Float4(XMVectorDivide(sum, XMVectorSet(weightSum, weightSum, weightSum, weightSum * weightSum)));
+                else
+                    dstTexels[pixelIdx] = center;
+            }
+        });
+
+        src ^= 1;
+    }
+
+    // Put the albedo back in
+    output.Init(width, height, 1);
+    const Float4* filtered = buffers[src].Data();
+    ParallelForRows(height, scheduler, [&](uint32 y)
+    {
+        for(uint32 x = 0; x < width; ++x)
+        {
+            const uint32 pixelIdx = y * width + x;
+            Float4 result = Float4(XMVectorMultiply(filtered[pixelIdx].ToSIMD(), ClampedAlbedo(albedo[pixelIdx])));
+            result.w = color.Texels[pixelIdx].w;
+            output.Texels[pixelIdx] = result;
+        }
+    });
+
+    timer.Update();
+    denoiseTimeMS = timer.ElapsedMillisecondsF();
+}
+
+}
@@ -0,0 +1,72 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\Containers.h"
+#include "..\\SF12_Math.h"
+#include "Textures.h"
+
+namespace enki
+{
+    class TaskScheduler;
+}
+
+namespace SampleFramework12
+{
+
+// Auxiliary buffers from the first surface that each pixel's paths hit, averaged over all of
+// the pixel's samples. These all need to be the same size as the color buffer being denoised.
+struct DenoiserAOVs
+{
+    TextureData<Float4> Albedo;         // Diffuse + specular albedo, or 1 where every path missed
+    TextureData<Float4> Normal;         // World-space shading normal, or 0 where every path missed
+    TextureData<float> Depth;           // Distance from the camera, or 0 where every path missed
+    TextureData<float> Variance;        // Variance of the pixel's mean luminance
+
+    void Init(uint32 width, uint32 height);
+};
+
+struct DenoiserSettings
+{
+    uint32 NumIterations = 5;
+    float ColorSigma = 4.0f;            // Luminance edge-stopping, in standard deviations
+    float NormalPower = 128.0f;
+    float DepthSigma = 1.0f;            // Depth edge-stopping, relative to the local depth gradient
+};
+
+// Edge-avoiding a-trous wavelet filter with variance guidance [Dammertz10] [Schied17]. Lighting is
+// demodulated by the albedo so that texture detail doesn't get blurred, and then filtered with a 5x5
+// B3-spline kernel whose taps spread out by a factor of 2 every iteration. Taps are weighted by how
+// closely they match the center pixel's normal, depth, and luminance, where the luminance threshold
+// comes from the center pixel's variance. The variance gets filtered along with the color, so the
+// threshold shrinks as the noise goes away.
+class AtrousDenoiser
+{
+
+public:
+
+    void Shutdown();
+
+    void Denoise(const TextureData<Float4>& color, const DenoiserAOVs& aovs, const DenoiserSettings& settings,
+                 TextureData<Float4>& output, enki::TaskScheduler* scheduler = nullptr);
+
+    float DenoiseTimeMS() const { return denoiseTimeMS; }
+
+protected:
+
+    Array<Float4> buffers[2];           // Demodulated color in xyz, variance in w
+    Array<float> filteredVariance;
+    Array<float> depthGradients;
+    float denoiseTimeMS = 0.0f;
+};
+
+}
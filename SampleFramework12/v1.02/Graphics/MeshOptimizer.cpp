@@ -0,0 +1,256 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "MeshOptimizer.h"
+#include "..\\Containers.h"
+#include "..\\Utility.h"
+
+namespace SampleFramework12
+{
+
+// Scoring parameters from Forsyth's article
+static const uint32 MaxCacheSize = 32;
+static const float CacheDecayPower = 1.5f;
+static const float LastTriScore = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+// Vertices with more triangles than this get the same valence score
+static const uint32 MaxValence = 64;
+
+VertexCacheStats AnalyzeVertexCache(const uint32* indices, uint64 numIndices, uint64 numVertices, uint32 cacheSize)
+{
+    Assert_(numIndices % 3 == 0);
+    Assert_(cacheSize > 0);
+
+    VertexCacheStats stats;
+    stats.NumTriangles = numIndices / 3;
+
+    // A vertex is in the FIFO cache if it was transformed fewer than cacheSize transforms ago, and a
+    // timestamp of 0 means that it hasn't been used yet
+    Array<uint32> timestamps(numVertices, 0);
+    uint32 timestamp = cacheSize + 1;
+    for(uint64 i = 0; i < numIndices; ++i)
+    {
+        const uint32 vtxIdx = indices[i];
+        Assert_(vtxIdx < numVertices);
+
+        if(timestamps[vtxIdx] == 0)
+            stats.NumVertices += 1;
+
+        if(timestamp - timestamps[vtxIdx] > cacheSize)
+        {
+            timestamps[vtxIdx] = timestamp++;
+            stats.NumTransforms += 1;
+        }
+    }
+
+    return stats;
+}
+
+void OptimizeVertexCache(uint32* indices, uint64 numIndices, uint64 numVertices)
+{
+    Assert_(numIndices % 3 == 0);
+    const uint64 numTriangles = numIndices / 3;
+    if(numTriangles == 0)
+        return;
+
+    Assert_(numIndices <= UINT32_MAX);
+
+    // Scores are tabulated by cache position (with index 0 meaning "not cached") and by valence
+    float cacheScores[MaxCacheSize + 1] = { };
+    for(uint32 cachePos = 0; cachePos < MaxCacheSize; ++cachePos)
+    {
+        // The last triangle's vertices get a fixed score, so that the next triangle doesn't just
+        // go back and forth along a strip
+        if(cachePos < 3)
+            cacheScores[cachePos + 1] = LastTriScore;
+        else
+            cacheScores[cachePos + 1] = std::pow(1.0f - float(cachePos - 3) / (MaxCacheSize - 3), CacheDecayPower);
+    }
+
+    // Vertices with only a few triangles left get a boost, so that they get finished off
+    float valenceScores[MaxValence + 1] = { };
+    for(uint32 valence = 1; valence <= MaxValence; ++valence)
+        valenceScores[valence] = ValenceBoostScale * std::pow(float(valence), -ValenceBoostPower);
+
+    Array<uint32> numActiveTris(numVertices, 0);
+    Array<int32> cachePositions(numVertices, -1);
+    Array<float> vertexScores(numVertices, 0.0f);
+
+    auto scoreVertex = [&](uint64 vtxIdx)
+    {
+        const uint32 valence = numActiveTris[vtxIdx];
+        if(valence == 0)
+            return -1.0f;
+
+        return cacheScores[cachePositions[vtxIdx] + 1] + valenceScores[Min(valence, MaxValence)];
+    };
+
+    // Build the list of triangles that use each vertex
+    for(uint64 i = 0; i < numIndices; ++i)
+    {
+        Assert_(indices[i] < numVertices);
+        numActiveTris[indices[i]] += 1;
+    }
+
+    Array<uint32> triListOffsets(numVertices + 1, 0);
+    for(uint64 vtxIdx = 0; vtxIdx < numVertices; ++vtxIdx)
+        triListOffsets[vtxIdx + 1] = triListOffsets[vtxIdx] + numActiveTris[vtxIdx];
+
+    Array<uint32> triLists(numIndices);
+    {
+        Array<uint32> triListCounts(numVertices, 0);
+        for(uint64 i = 0; i < numIndices; ++i)
+        {
+            const uint32 vtxIdx = indices[i];
+            triLists[triListOffsets[vtxIdx] + triListCounts[vtxIdx]++] = uint32(i / 3);
+        }
+    }
+
+    for(uint64 vtxIdx = 0; vtxIdx < numVertices; ++vtxIdx)
+        vertexScores[vtxIdx] = scoreVertex(vtxIdx);
+
+    Array<float> triScores(numTriangles);
+    Array<uint8> triAdded(numTriangles, 0);
+    uint64 bestTri = 0;
+    for(uint64 triIdx = 0; triIdx < numTriangles; ++triIdx)
+    {
+        const uint32* tri = indices + triIdx * 3;
+        triScores[triIdx] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+        if(triScores[triIdx] > triScores[bestTri])
+            bestTri = triIdx;
+    }
+
+    Array<uint32> newIndices(numIndices);
+    uint32 cache[MaxCacheSize + 3] = { };
+    uint32 cacheSize = 0;
+    uint64 nextUnaddedTri = 0;
+
+    for(uint64 outTriIdx = 0; outTriIdx < numTriangles; ++outTriIdx)
+    {
+        // When none of the cached vertices have triangles left, carry on from wherever the input order got to
+        if(bestTri == uint64(-1))
+        {
+            while(triAdded[nextUnaddedTri])
+                ++nextUnaddedTri;
+            bestTri = nextUnaddedTri;
+        }
+
+        Assert_(triAdded[bestTri] == 0);
+        triAdded[bestTri] = 1;
+
+        const uint32* tri = indices + bestTri * 3;
+        newIndices[outTriIdx * 3 + 0] = tri[0];
+        newIndices[outTriIdx * 3 + 1] = tri[1];
+        newIndices[outTriIdx * 3 + 2] = tri[2];
+
+        // Take the triangle out of the active lists of its vertices. Degenerate triangles can list the
+        // same vertex twice, but only get removed once.
+        for(uint64 i = 0; i < 3; ++i)
+        {
+            const uint32 vtxIdx = tri[i];
+            uint32* triList = &triLists[triListOffsets[vtxIdx]];
+            const uint32 numTris = numActiveTris[vtxIdx];
+            for(uint32 j = 0; j < numTris; ++j)
+            {
+                if(triList[j] == bestTri)
+                {
+                    triList[j] = triList[numTris - 1];
+                    numActiveTris[vtxIdx] = numTris - 1;
+                    break;
+                }
+            }
+        }
+
+        // Move the triangle's vertices to the front of the LRU cache, which can push up to 3 vertices out the back
+        uint32 newCache[MaxCacheSize + 3] = { };
+        uint32 newCacheSize = 0;
+        auto addToCache = [&](uint32 vtxIdx)
+        {
+            for(uint32 j = 0; j < newCacheSize; ++j)
+                if(newCache[j] == vtxIdx)
+                    return;
+            newCache[newCacheSize++] = vtxIdx;
+        };
+
+        addToCache(tri[0]);
+        addToCache(tri[1]);
+        addToCache(tri[2]);
+        for(uint32 i = 0; i < cacheSize; ++i)
+            addToCache(cache[i]);
+
+        // Rescore everything that moved, including the vertices that fell out, and pass the change on
+        // to their remaining triangles
+        for(uint32 i = 0; i < newCacheSize; ++i)
+        {
+            const uint32 vtxIdx = newCache[i];
+            cachePositions[vtxIdx] = i < MaxCacheSize ? int32(i) : -1;
+
+            const float newScore = scoreVertex(vtxIdx);
+            const float scoreDelta = newScore - vertexScores[vtxIdx];
+            vertexScores[vtxIdx] = newScore;
+
+            const uint32* triList = &triLists[triListOffsets[vtxIdx]];
+            for(uint32 j = 0; j < numActiveTris[vtxIdx]; ++j)
+                triScores[triList[j]] += scoreDelta;
+        }
+
+        cacheSize = Min(newCacheSize, MaxCacheSize);
+        memcpy(cache, newCache, cacheSize * sizeof(uint32));
+
+        // Only triangles that use a cached vertex are candidates for the next one
+        bestTri = uint64(-1);
+        float bestScore = -FloatMax;
+        for(uint32 i = 0; i < cacheSize; ++i)
+        {
+            const uint32 vtxIdx = cache[i];
+            const uint32* triList = &triLists[triListOffsets[vtxIdx]];
+            for(uint32 j = 0; j < numActiveTris[vtxIdx]; ++j)
+            {
+                if(triScores[triList[j]] > bestScore)
+                {
+                    bestTri = triList[j];
+                    bestScore = triScores[triList[j]];
+                }
+            }
+        }
+    }
+
+    memcpy(indices, newIndices.Data(), numIndices * sizeof(uint32));
+}
+
+uint64 OptimizeVertexFetch(uint32* indices, uint64 numIndices, uint64 numVertices, uint32* remap)
+{
+    for(uint64 vtxIdx = 0; vtxIdx < numVertices; ++vtxIdx)
+        remap[vtxIdx] = uint32(-1);
+
+    uint32 nextVtxIdx = 0;
+    for(uint64 i = 0; i < numIndices; ++i)
+    {
+        const uint32 vtxIdx = indices[i];
+        Assert_(vtxIdx < numVertices);
+
+        if(remap[vtxIdx] == uint32(-1))
+            remap[vtxIdx] = nextVtxIdx++;
+
+        indices[i] = remap[vtxIdx];
+    }
+
+    const uint64 numReferenced = nextVtxIdx;
+    for(uint64 vtxIdx = 0; vtxIdx < numVertices; ++vtxIdx)
+        if(remap[vtxIdx] == uint32(-1))
+            remap[vtxIdx] = nextVtxIdx++;
+
+    return numReferenced;
+}
+
+}
@@ -0,0 +1,55 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+namespace SampleFramework12
+{
+
+// Size of the FIFO cache that AnalyzeVertexCache() simulates by default
+static const uint32 DefaultVertexCacheSize = 16;
+
+// How well an index buffer uses the post-transform vertex cache
+struct VertexCacheStats
+{
+    uint64 NumTriangles = 0;
+    uint64 NumVertices = 0;         // Unique vertices referenced by the indices
+    uint64 NumTransforms = 0;       // Cache misses, which each run the vertex shader
+
+    // Average cache miss ratio, which is the number of transforms per triangle
+    float ACMR() const { return NumTriangles > 0 ? float(NumTransforms) / NumTriangles : 0.0f; }
+
+    // Average transform to vertex ratio, which is 1 when every vertex only gets transformed once
+    float ATVR() const { return NumVertices > 0 ? float(NumTransforms) / NumVertices : 0.0f; }
+
+    void Add(const VertexCacheStats& other)
+    {
+        NumTriangles += other.NumTriangles;
+        NumVertices += other.NumVertices;
+        NumTransforms += other.NumTransforms;
+    }
+};
+
+VertexCacheStats AnalyzeVertexCache(const uint32* indices, uint64 numIndices, uint64 numVertices,
+                                    uint32 cacheSize = DefaultVertexCacheSize);
+
+// Reorders triangles in place so that they reuse recently transformed vertices, using Forsyth's
+// "Linear-Speed Vertex Cache Optimisation". Vertices are scored by their position in a simulated LRU
+// cache and by how many triangles still need them, and the next triangle is always the best scoring
+// one that uses a cached vertex.
+void OptimizeVertexCache(uint32* indices, uint64 numIndices, uint64 numVertices);
+
+// Renumbers vertices in the order that the indices first reference them, so that vertex fetches walk
+// through memory linearly. The indices are rewritten in place, and remap[oldIdx] gives the new index
+// of every vertex. Vertices that aren't referenced go at the end. Returns the number of referenced vertices.
+uint64 OptimizeVertexFetch(uint32* indices, uint64 numIndices, uint64 numVertices, uint32* remap);
+
+}
@@ -0,0 +1,168 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "Meshlets.h"
+#include "Model.h"
+#include "..\\Utility.h"
+
+namespace SampleFramework12
+{
+
+// Meshlets with triangles that are more than ~84 degrees away from the average normal aren't worth
+// cone culling, and their cone apex would end up very far away
+static const float MinConeDot = 0.1f;
+
+// Computes the bounding sphere and normal cone of a finished meshlet
+static void ComputeMeshletBounds(Meshlet& meshlet, const uint32* indices, const MeshVertex* vertices, const uint32* meshletVertices)
+{
+    Float3 minPosition = FloatMax;
+    Float3 maxPosition = -FloatMax;
+    for(uint32 i = 0; i < meshlet.NumVertices; ++i)
+    {
+        const Float3& position = vertices[meshletVertices[meshlet.VertexStart + i]].Position;
+        minPosition.x = Min(minPosition.x, position.x);
+        minPosition.y = Min(minPosition.y, position.y);
+        minPosition.z = Min(minPosition.z, position.z);
+
+        maxPosition.x = Max(maxPosition.x, position.x);
+        maxPosition.y = Max(maxPosition.y, position.y);
+        maxPosition.z = Max(maxPosition.z, position.z);
+    }
+
+    meshlet.Center = (minPosition + maxPosition) * 0.5f;
+    meshlet.Radius = 0.0f;
+    for(uint32 i = 0; i < meshlet.NumVertices; ++i)
+    {
+        const Float3& position = vertices[meshletVertices[meshlet.VertexStart + i]].Position;
+        meshlet.Radius = Max(meshlet.Radius, Float3::Length(position - meshlet.Center));
+    }
+
+    // The cone axis is the average of the triangle normals, and the cutoff is the sine of the widest
+    // angle between the axis and one of the normals. Degenerate triangles don't face any direction.
+    const uint32* meshletIndices = indices + meshlet.IndexStart;
+    Float3 normalSum;
+    for(uint32 triIdx = 0; triIdx < meshlet.NumTriangles; ++triIdx)
+    {
+        const Float3& p0 = vertices[meshletIndices[triIdx * 3 + 0]].Position;
+        const Float3& p1 = vertices[meshletIndices[triIdx * 3 + 1]].Position;
+        const Float3& p2 = vertices[meshletIndices[triIdx * 3 + 2]].Position;
+        const Float3 normal = Float3::Cross(p1 - p0, p2 - p0);
+        const float area = Float3::Length(normal);
+        if(area > 0.0f)
+            normalSum += normal / area;
+    }
+
+    meshlet.ConeApex = meshlet.Center;
+    meshlet.ConeAxis = Float3(0.0f, 0.0f, 1.0f);
+    meshlet.ConeCutoff = 1.0f;
+
+    const float normalSumLength = Float3::Length(normalSum);
+    if(normalSumLength == 0.0f)
+        return;
+
+    const Float3 axis = normalSum / normalSumLength;
+    float minDot = 1.0f;
+    for(uint32 triIdx = 0; triIdx < meshlet.NumTriangles; ++triIdx)
+    {
+        const Float3& p0 = vertices[meshletIndices[triIdx * 3 + 0]].Position;
+        const Float3& p1 = vertices[meshletIndices[triIdx * 3 + 1]].Position;
+        const Float3& p2 = vertices[meshletIndices[triIdx * 3 + 2]].Position;
+        const Float3 normal = Float3::Cross(p1 - p0, p2 - p0);
+        const float area = Float3::Length(normal);
+        if(area > 0.0f)
+            minDot = Min(minDot, Float3::Dot(normal / area, axis));
+    }
+
+    if(minDot <= MinConeDot)
+        return;
+
+    // Slide the apex back along the axis until every triangle's plane is in front of it, so that any
+    // viewer that's inside the cone is behind all of the triangles
+    float maxT = 0.0f;
+    for(uint32 triIdx = 0; triIdx < meshlet.NumTriangles; ++triIdx)
+    {
+        const Float3& p0 = vertices[meshletIndices[triIdx * 3 + 0]].Position;
+        const Float3& p1 = vertices[meshletIndices[triIdx * 3 + 1]].Position;
+        const Float3& p2 = vertices[meshletIndices[triIdx * 3 + 2]].Position;
+        const Float3 normal = Float3::Cross(p1 - p0, p2 - p0);
+        const float area = Float3::Length(normal);
+        if(area == 0.0f)
+            continue;
+
+        const Float3 unitNormal = normal / area;
+        const float t = Float3::Dot(meshlet.Center - p0, unitNormal) / Float3::Dot(axis, unitNormal);
+        maxT = Max(maxT, t);
+    }
+
+    meshlet.ConeApex = meshlet.Center - axis * maxT;
+    meshlet.ConeAxis = axis;
+    meshlet.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+void BuildMeshlets(const uint32* indices, uint64 numIndices, const MeshVertex* vertices, uint64 numVertices,
+                   GrowableList<Meshlet>& meshlets, GrowableList<uint32>& meshletVertices)
+{
+    Assert_(numIndices % 3 == 0);
+    Assert_(numIndices <= UINT32_MAX);
+    const uint64 numTriangles = numIndices / 3;
+    if(numTriangles == 0)
+        return;
+
+    // Vertices are marked with the meshlet that they were last added to
+    Array<uint32> vertexMeshlets(numVertices, uint32(-1));
+
+    Meshlet meshlet;
+    meshlet.VertexStart = uint32(meshletVertices.Count());
+    uint32 meshletIdx = uint32(meshlets.Count());
+
+    for(uint64 triIdx = 0; triIdx < numTriangles; ++triIdx)
+    {
+        const uint32* tri = indices + triIdx * 3;
+        Assert_(tri[0] < numVertices && tri[1] < numVertices && tri[2] < numVertices);
+
+        uint32 numNewVertices = 0;
+        for(uint64 i = 0; i < 3; ++i)
+        {
+            // Degenerate triangles can list a vertex more than once, but it only needs one slot
+            const bool duplicate = (i > 0 && tri[i] == tri[0]) || (i > 1 && tri[i] == tri[1]);
+            if(vertexMeshlets[tri[i]] != meshletIdx && duplicate == false)
+                numNewVertices += 1;
+        }
+
+        if(meshlet.NumVertices + numNewVertices > MaxMeshletVertices || meshlet.NumTriangles + 1 > MaxMeshletTriangles)
+        {
+            ComputeMeshletBounds(meshlet, indices, vertices, meshletVertices.Data());
+            meshlets.Add(meshlet);
+
+            meshlet = Meshlet();
+            meshlet.IndexStart = uint32(triIdx * 3);
+            meshlet.VertexStart = uint32(meshletVertices.Count());
+            meshletIdx += 1;
+        }
+
+        for(uint64 i = 0; i < 3; ++i)
+        {
+            if(vertexMeshlets[tri[i]] != meshletIdx)
+            {
+                vertexMeshlets[tri[i]] = meshletIdx;
+                meshletVertices.Add(tri[i]);
+                meshlet.NumVertices += 1;
+            }
+        }
+
+        meshlet.NumTriangles += 1;
+    }
+
+    ComputeMeshletBounds(meshlet, indices, vertices, meshletVertices.Data());
+    meshlets.Add(meshlet);
+}
+
+}
@@ -0,0 +1,66 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\SF12_Math.h"
+#include "..\\Containers.h"
+
+namespace SampleFramework12
+{
+
+struct MeshVertex;
+
+static const uint32 MaxMeshletVertices = 64;
+static const uint32 MaxMeshletTriangles = 124;
+
+// A cluster of triangles that are adjacent in a mesh's index buffer, with bounds for culling it as a whole.
+// Meshlets never span mesh parts, so the triangles of a meshlet can be drawn with a single sub-range of the
+// index buffer. All positions are in the object space of the mesh.
+struct Meshlet
+{
+    uint32 IndexStart = 0;          // Relative to the start of the mesh's indices
+    uint32 NumTriangles = 0;
+    uint32 VertexStart = 0;         // Into the mesh's list of meshlet vertices
+    uint32 NumVertices = 0;
+    uint32 PartIdx = 0;
+
+    // Bounding sphere
+    Float3 Center;
+    float Radius = 0.0f;
+
+    // Normal cone, which lets a meshlet be culled when all of its triangles face away from the viewer
+    Float3 ConeApex;
+    Float3 ConeAxis;
+    float ConeCutoff = 1.0f;
+
+    // True when every triangle faces away from a viewer at the given position
+    bool BackFacing(const Float3& viewerPos) const
+    {
+        return Float3::Dot(Float3::Normalize(ConeApex - viewerPos), ConeAxis) >= ConeCutoff;
+    }
+
+    // True when every triangle faces away from a viewer looking along the given direction
+    bool BackFacingOrthographic(const Float3& viewDir) const
+    {
+        return Float3::Dot(viewDir, ConeAxis) >= ConeCutoff;
+    }
+};
+
+// Splits a list of triangles into meshlets with at most MaxMeshletVertices unique vertices and
+// MaxMeshletTriangles triangles, keeping the triangles in order so that each meshlet is a contiguous
+// range of the indices. Triangles that were sorted with OptimizeVertexCache() share enough vertices
+// for this to fill up most meshlets. The new meshlets get appended to meshlets with IndexStart
+// relative to indices, and their unique vertices get appended to meshletVertices.
+void BuildMeshlets(const uint32* indices, uint64 numIndices, const MeshVertex* vertices, uint64 numVertices,
+                   GrowableList<Meshlet>& meshlets, GrowableList<uint32>& meshletVertices);
+
+}
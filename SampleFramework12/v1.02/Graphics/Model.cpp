@@ -16,6 +16,7 @@
 #include "GraphicsTypes.h"
 #include "..\\Serialization.h"
 #include "..\\FileIO.h"
+#include "..\\MurmurHash.h"
 #include "Textures.h"
 
 using std::string;
@@ -27,22 +28,21 @@ using std::wifstream;
 namespace SampleFramework12
 {
 
-static const InputElementType StandardInputElementTypes[5] =
+// Matches PackedMeshVertex, with the bitangent sign in the w component of the position
+static const InputElementType StandardInputElementTypes[4] =
 {
     InputElementType::Position,
     InputElementType::Normal,
-    InputElementType::UV,
     InputElementType::Tangent,
-    InputElementType::Bitangent,
+    InputElementType::UV,
 };
 
-static const D3D12_INPUT_ELEMENT_DESC StandardInputElements[5] =
+static const D3D12_INPUT_ELEMENT_DESC StandardInputElements[4] =
 {
-    { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    { "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    { "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 44, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    { "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    { "UV", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 };
 
 static const wchar* DefaultTextures[] =
@@ -57,6 +57,107 @@ static const wchar* DefaultTextures[] =
 
 StaticAssert_(ArraySize_(DefaultTextures) == uint64(MaterialTextures::Count));
 
+// Increment this whenever the import or the scene cache layout changes, to invalidate old cache files
+static const uint32 SceneCacheVersion = 2;
+static const char SceneCacheMagic[8] = "SF12SCN";
+
+// Every section in a scene cache file starts on a page, so that the vertex and index data can be
+// used directly from the mapped file
+static const uint64 SceneCacheAlignment = 4096;
+
+// Byte offset and element count for one of the arrays in a scene cache file
+struct SceneCacheSection
+{
+    uint64 Offset = 0;
+    uint64 Count = 0;
+};
+
+// Location of a string in the string section, with the length in characters
+struct SceneCacheString
+{
+    uint32 Offset = 0;
+    uint32 Length = 0;
+};
+
+// Meshes reference ranges of the mesh part, meshlet, and meshlet vertex sections, and use their vertices
+// and indices in order
+struct SceneCacheMesh
+{
+    uint32 NumVertices = 0;
+    uint32 NumIndices = 0;
+    uint32 FirstPart = 0;
+    uint32 NumParts = 0;
+    Float3 AABBMin;
+    Float3 AABBMax;
+    uint32 FirstMeshlet = 0;
+    uint32 NumMeshlets = 0;
+    uint32 FirstMeshletVertex = 0;
+    uint32 NumMeshletVertices = 0;
+};
+
+struct SceneCacheMaterial
+{
+    SceneCacheString Name;                                              // char
+    SceneCacheString TextureNames[uint64(MaterialTextures::Count)];     // wchar
+};
+
+// Start of every scene cache file, which is followed by the sections that it lists
+struct SceneCacheHeader
+{
+    char Magic[8] = { };
+    uint32 Version = 0;
+    uint32 HeaderSize = 0;
+    Hash Key;
+    uint64 TotalSize = 0;
+    uint32 IndexFormat = 0;
+    uint32 Padding = 0;
+    SceneCacheSection Meshes;
+    SceneCacheSection MeshParts;
+    SceneCacheSection Meshlets;
+    SceneCacheSection MeshletVertices;
+    SceneCacheSection Instances;
+    SceneCacheSection Materials;
+    SceneCacheSection SpotLights;
+    SceneCacheSection PointLights;
+    SceneCacheSection Vertices;
+    SceneCacheSection Indices;          // Count is in bytes
+    SceneCacheSection Strings;          // Count is in bytes
+};
+
+StaticAssert_(sizeof(SceneCacheHeader) <= SceneCacheAlignment);
+
+static bool ValidSection(const SceneCacheSection& section, uint64 elemSize, uint64 fileSize)
+{
+    if(section.Offset % SceneCacheAlignment != 0 || section.Offset > fileSize)
+        return false;
+
+    return section.Count <= (fileSize - section.Offset) / elemSize;
+}
+
+static bool ValidString(const SceneCacheString& str, uint64 charSize, const SceneCacheSection& strings)
+{
+    return str.Offset % charSize == 0 && uint64(str.Offset) + uint64(str.Length) * charSize <= strings.Count;
+}
+
+template<typename T> static void ReadSceneCacheSection(const uint8* data, const SceneCacheSection& section, Array<T>& dst)
+{
+    dst.Init(section.Count);
+    if(section.Count > 0)
+        memcpy(dst.Data(), data + section.Offset, section.Count * sizeof(T));
+}
+
+// Hashes the source file along with the settings that affect the import, so that stale cache files
+// get replaced. Files that the source file references (like an .mtl file) aren't part of the key.
+static Hash MakeSceneCacheKey(const ModelLoadSettings& settings)
+{
+    const uint64 keyData[] = { SceneCacheVersion, sizeof(MeshVertex), settings.MergeMeshes ? 1ull : 0ull, settings.OptimizeVertexOrder ? 1ull : 0ull };
+    Hash key = GenerateHash(keyData, int32(sizeof(keyData)));
+    key = CombineHashes(key, GenerateHash(&settings.SceneScale, int32(sizeof(settings.SceneScale))));
+
+    MappedFile sourceFile(settings.FilePath, FileMapMode::Read);
+    return CombineHashes(key, GenerateLargeHash(sourceFile.Data(), sourceFile.Size()));
+}
+
 static Float3 ConvertVector(const aiVector3D& vec)
 {
     return Float3(vec.x, vec.y, vec.z);
@@ -75,9 +176,37 @@ static Float4x4 ConvertMatrix(const aiMatrix4x4& mat)
                     Float4(mat.d1, mat.d2, mat.d3, mat.d4));
 }
 
+// Adds an instance for every mesh referenced by a node and its children
+static void GatherNodeInstances(const aiNode& node, const Float4x4& parentTransform, float sceneScale,
+                                GrowableList<MeshInstance>& instances)
+{
+    const Float4x4 transform = Float4x4::Transpose(ConvertMatrix(node.mTransformation)) * parentTransform;
+
+    for(uint64 i = 0; i < node.mNumMeshes; ++i)
+    {
+        // Mesh vertices are already scaled, so only the translation needs to be scaled here
+        MeshInstance instance;
+        instance.Transform = transform;
+        instance.Transform.SetTranslation(transform.Translation() * sceneScale);
+        instance.MeshIdx = node.mMeshes[i];
+        instances.Add(instance);
+    }
+
+    for(uint64 i = 0; i < node.mNumChildren; ++i)
+        GatherNodeInstances(*node.mChildren[i], transform, sceneScale, instances);
+}
+
+// Textures that are shared by several materials get loaded once. The set of unique files gets gathered
+// up front, so that they can all be decoded in parallel and uploaded together.
 void LoadMaterialResources(Array<MeshMaterial>& materials, const wstring& directory, bool32 forceSRGB,
-                           GrowableList<MaterialTexture*>& materialTextures)
+                           GrowableList<MaterialTexture*>& materialTextures, enki::TaskScheduler* scheduler)
 {
+    std::unordered_map<std::wstring, uint64> textureIndices;
+    for(uint64 i = 0; i < materialTextures.Count(); ++i)
+        textureIndices[materialTextures[i]->Name] = i;
+
+    GrowableList<TextureLoadDesc> loadDescs;
+
     const uint64 numMaterials = materials.Size();
     for(uint64 matIdx = 0; matIdx < numMaterials; ++matIdx)
     {
@@ -96,30 +225,28 @@ void LoadMaterialResources(Array<MeshMaterial>& materials, const wstring& direct
                 continue;
             }
 
-            const uint64 numLoaded = materialTextures.Count();
-            for(uint64 i = 0; i < numLoaded; ++i)
-            {
-                if(materialTextures[i]->Name == path)
-                {
-                    material.Textures[texType] = &materialTextures[i]->Texture;
-                    material.TextureIndices[texType] = uint32(i);
-                    break;
-                }
-            }
-
-            if(material.Textures[texType] == nullptr)
+            auto existing = textureIndices.find(path);
+            if(existing == textureIndices.end())
             {
                 MaterialTexture* newMatTexture = new MaterialTexture();
                 newMatTexture->Name = path;
-                bool useSRGB = forceSRGB && texType == uint64(MaterialTextures::Albedo);
-                LoadTexture(newMatTexture->Texture, path.c_str(), useSRGB ? true : false);
                 uint64 idx = materialTextures.Add(newMatTexture);
-
-                material.Textures[texType] = &newMatTexture->Texture;
-                material.TextureIndices[texType] = uint32(idx);
+                existing = textureIndices.emplace(path, idx).first;
+
+                // The first material that uses a texture decides whether it gets loaded as sRGB
+                TextureLoadDesc loadDesc;
+                loadDesc.Texture = &newMatTexture->Texture;
+                loadDesc.FilePath = newMatTexture->Name.c_str();
+                loadDesc.ForceSRGB = forceSRGB && texType == uint64(MaterialTextures::Albedo);
+                loadDescs.Add(loadDesc);
             }
+
+            material.Textures[texType] = &materialTextures[existing->second]->Texture;
+            material.TextureIndices[texType] = uint32(existing->second);
         }
     }
+
+    LoadTextures(loadDescs.Data(), loadDescs.Count(), scheduler);
 }
 
 void Mesh::InitFromAssimpMesh(const aiMesh& assimpMesh, float sceneScale, MeshVertex* dstVertices, uint8* dstIndices, IndexType indexType_)
@@ -202,6 +329,89 @@ void Mesh::InitFromAssimpMesh(const aiMesh& assimpMesh, float sceneScale, MeshVe
     part.MaterialIdx = assimpMesh.mMaterialIndex;
 }
 
+// Triangles get reordered within each part, since parts are drawn separately. The vertex order is
+// shared by all of the parts, so it's only done for meshes whose parts all use the full vertex range.
+void Mesh::OptimizeVertexOrder(MeshVertex* meshVertices, uint8* meshIndices, VertexCacheStats& statsBefore, VertexCacheStats& statsAfter)
+{
+    Array<uint32> indices32(numIndices);
+    if(indexType == IndexType::Index16Bit)
+    {
+        const uint16* indices16 = reinterpret_cast<const uint16*>(meshIndices);
+        for(uint64 i = 0; i < numIndices; ++i)
+            indices32[i] = indices16[i];
+    }
+    else
+    {
+        memcpy(indices32.Data(), meshIndices, numIndices * sizeof(uint32));
+    }
+
+    bool reorderVertices = true;
+    for(uint64 partIdx = 0; partIdx < meshParts.Size(); ++partIdx)
+    {
+        const MeshPart& part = meshParts[partIdx];
+        uint32* partIndices = &indices32[part.IndexStart];
+
+        statsBefore.Add(AnalyzeVertexCache(partIndices, part.IndexCount, numVertices));
+        OptimizeVertexCache(partIndices, part.IndexCount, numVertices);
+        statsAfter.Add(AnalyzeVertexCache(partIndices, part.IndexCount, numVertices));
+
+        reorderVertices = reorderVertices && part.VertexStart == 0 && part.VertexCount == numVertices;
+    }
+
+    if(reorderVertices)
+    {
+        Array<uint32> remap(numVertices);
+        OptimizeVertexFetch(indices32.Data(), numIndices, numVertices, remap.Data());
+
+        Array<MeshVertex> oldVertices(numVertices);
+        memcpy(oldVertices.Data(), meshVertices, numVertices * sizeof(MeshVertex));
+        for(uint64 vtxIdx = 0; vtxIdx < numVertices; ++vtxIdx)
+            meshVertices[remap[vtxIdx]] = oldVertices[vtxIdx];
+    }
+
+    if(indexType == IndexType::Index16Bit)
+    {
+        uint16* indices16 = reinterpret_cast<uint16*>(meshIndices);
+        for(uint64 i = 0; i < numIndices; ++i)
+            indices16[i] = uint16(indices32[i]);
+    }
+    else
+    {
+        memcpy(meshIndices, indices32.Data(), numIndices * sizeof(uint32));
+    }
+}
+
+void Mesh::BuildMeshlets(const MeshVertex* meshVertices, const uint8* meshIndices)
+{
+    Array<uint32> indices32(numIndices);
+    for(uint64 i = 0; i < numIndices; ++i)
+        indices32[i] = indexType == IndexType::Index16Bit ? reinterpret_cast<const uint16*>(meshIndices)[i]
+                                                          : reinterpret_cast<const uint32*>(meshIndices)[i];
+
+    GrowableList<Meshlet> newMeshlets;
+    GrowableList<uint32> newMeshletVertices;
+    for(uint64 partIdx = 0; partIdx < meshParts.Size(); ++partIdx)
+    {
+        const MeshPart& part = meshParts[partIdx];
+        const uint64 firstMeshlet = newMeshlets.Count();
+        SampleFramework12::BuildMeshlets(&indices32[part.IndexStart], part.IndexCount, meshVertices, numVertices, newMeshlets, newMeshletVertices);
+
+        for(uint64 i = firstMeshlet; i < newMeshlets.Count(); ++i)
+        {
+            newMeshlets[i].IndexStart += part.IndexStart;
+            newMeshlets[i].PartIdx = uint32(partIdx);
+        }
+    }
+
+    meshlets.Init(newMeshlets.Count());
+    if(newMeshlets.Count() > 0)
+        memcpy(meshlets.Data(), newMeshlets.Data(), newMeshlets.Count() * sizeof(Meshlet));
+
+    meshletVertices.Init(newMeshletVertices.Count());
+    if(newMeshletVertices.Count() > 0)
+        memcpy(meshletVertices.Data(), newMeshletVertices.Data(), newMeshletVertices.Count() * sizeof(uint32));
+}
+
 static const uint64 NumBoxVerts = 24;
 static const uint64 NumBoxIndices = 36;
 
@@ -368,8 +578,8 @@ void Mesh::InitCommon(const MeshVertex* vertices_, const uint8* indices_, uint64
     idxOffset = uint32(idxOffset_);
 
     vbView.BufferLocation = vbAddress;
-    vbView.SizeInBytes = sizeof(MeshVertex) * numVertices;
-    vbView.StrideInBytes = sizeof(MeshVertex);
+    vbView.SizeInBytes = sizeof(PackedMeshVertex) * numVertices;
+    vbView.StrideInBytes = sizeof(PackedMeshVertex);
 
     ibView.Format = IndexBufferFormat();
     ibView.SizeInBytes = IndexSize() * numIndices;
@@ -382,6 +592,8 @@ void Mesh::Shutdown()
     numVertices = 0;
     numIndices = 0;
     meshParts.Shutdown();
+    meshlets.Shutdown();
+    meshletVertices.Shutdown();
     vertices = nullptr;
     indices = nullptr;
 }
@@ -403,6 +615,88 @@ const char* Mesh::InputElementTypeString(InputElementType elemType)
     return ElemStrings[uint64(elemType)];
 }
 
+// == Vertex packing ==============================================================================
+
+static int16 PackSNorm16(float x)
+{
+    return int16(std::round(Clamp(x, -1.0f, 1.0f) * 32767.0f));
+}
+
+static float UnpackSNorm16(int16 x)
+{
+    return Max(x / 32767.0f, -1.0f);
+}
+
+// Projects a unit vector onto an octahedron, and unfolds the bottom half so that it fits in [-1, 1]^2
+static Float2 OctEncode(const Float3& n)
+{
+    const float l1Norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if(l1Norm == 0.0f)
+        return Float2(0.0f, 0.0f);
+
+    Float2 e = Float2(n.x, n.y) / l1Norm;
+    if(n.z < 0.0f)
+    {
+        const Float2 folded = e;
+        e.x = (1.0f - std::abs(folded.y)) * (folded.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::abs(folded.x)) * (folded.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return e;
+}
+
+static Float3 OctDecode(const Float2& e)
+{
+    Float3 n = Float3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if(n.z < 0.0f)
+    {
+        n.x = (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return Float3::Normalize(n);
+}
+
+PackedMeshVertex PackMeshVertex(const MeshVertex& vertex, const Float3& positionScale, const Float3& positionOffset)
+{
+    PackedMeshVertex packed;
+
+    const Float3 position = (vertex.Position - positionOffset) / positionScale;
+    packed.Position[0] = PackSNorm16(position.x);
+    packed.Position[1] = PackSNorm16(position.y);
+    packed.Position[2] = PackSNorm16(position.z);
+
+    // Mirrored UVs give a left-handed tangent frame
+    const float handedness = Float3::Dot(Float3::Cross(vertex.Normal, vertex.Tangent), vertex.Bitangent);
+    packed.Position[3] = handedness < 0.0f ? -32767 : 32767;
+
+    const Float2 normal = OctEncode(vertex.Normal);
+    packed.Normal[0] = PackSNorm16(normal.x);
+    packed.Normal[1] = PackSNorm16(normal.y);
+
+    const Float2 tangent = OctEncode(vertex.Tangent);
+    packed.Tangent[0] = PackSNorm16(tangent.x);
+    packed.Tangent[1] = PackSNorm16(tangent.y);
+
+    packed.UV = Half2(vertex.UV);
+
+    return packed;
+}
+
+MeshVertex UnpackMeshVertex(const PackedMeshVertex& packed, const Float3& positionScale, const Float3& positionOffset)
+{
+    MeshVertex vertex;
+
+    const Float3 position = Float3(UnpackSNorm16(packed.Position[0]), UnpackSNorm16(packed.Position[1]), UnpackSNorm16(packed.Position[2]));
+    vertex.Position = position * positionScale + positionOffset;
+    vertex.Normal = OctDecode(Float2(UnpackSNorm16(packed.Normal[0]), UnpackSNorm16(packed.Normal[1])));
+    vertex.Tangent = OctDecode(Float2(UnpackSNorm16(packed.Tangent[0]), UnpackSNorm16(packed.Tangent[1])));
+    vertex.Bitangent = Float3::Cross(vertex.Normal, vertex.Tangent) * (packed.Position[3] < 0 ? -1.0f : 1.0f);
+    vertex.UV = packed.UV.ToFloat2();
+
+    return vertex;
+}
+
 // == Model =======================================================================================
 
 void Model::CreateWithAssimp(const ModelLoadSettings& settings)
@@ -412,6 +706,40 @@ void Model::CreateWithAssimp(const ModelLoadSettings& settings)
     if(FileExists(filePath) == false)
         throw Exception(MakeString(L"Model file with path '%ls' does not exist", filePath));
 
+    this->filePath = filePath;
+    fileDirectory = GetDirectoryFromFilePath(filePath);
+    forceSRGB = settings.ForceSRGB;
+
+    const std::wstring cachePath = GetFilePathWithoutExtension(filePath) + L".scene";
+    const Hash cacheKey = settings.UseSceneCache ? MakeSceneCacheKey(settings) : Hash();
+
+    if(settings.UseSceneCache && FileExists(cachePath.c_str()) && MapSceneCache(cachePath.c_str(), cacheKey))
+    {
+        WriteLog("Loaded scene '%ls' from scene cache '%ls'", filePath, cachePath.c_str());
+    }
+    else
+    {
+        ImportWithAssimp(settings);
+
+        if(settings.UseSceneCache)
+            WriteSceneCache(cachePath.c_str(), cacheKey);
+    }
+
+    std::wstring textureDir = settings.TextureDir ? fileDirectory + L"\\" + settings.TextureDir + L"\\" : fileDirectory;
+    LoadMaterialResources(meshMaterials, textureDir, settings.ForceSRGB, materialTextures, settings.Scheduler);
+
+    ComputeBounds();
+
+    CreateBuffers();
+
+    WriteLog("Finished loading scene '%ls'", filePath);
+}
+
+// Loads the meshes, materials, lights, and instances from the source file, without creating any resources
+void Model::ImportWithAssimp(const ModelLoadSettings& settings)
+{
+    const wchar* filePath = settings.FilePath;
+
     WriteLog("Loading scene '%ls' with Assimp...", filePath);
 
     std::string fileNameAnsi = WStringToAnsi(filePath);
@@ -429,9 +757,6 @@ void Model::CreateWithAssimp(const ModelLoadSettings& settings)
     if(scene->mNumMaterials == 0)
         throw Exception(L"Scene " + std::wstring(filePath) + L" has no materials");
 
-    fileDirectory = GetDirectoryFromFilePath(filePath);
-    forceSRGB = settings.ForceSRGB;
-
     // Grab the lights before we process the scene
     spotLights.Init(scene->mNumLights);
     pointLights.Init(scene->mNumLights);
@@ -530,24 +855,18 @@ void Model::CreateWithAssimp(const ModelLoadSettings& settings)
             material.TextureNames[uint64(MaterialTextures::Emissive)] = GetFileName(AnsiToWString(emissiveMapPath.C_Str()).c_str());
     }
 
-    std::wstring textureDir = settings.TextureDir ? fileDirectory + L"\\" + settings.TextureDir + L"\\" : fileDirectory;
-    LoadMaterialResources(meshMaterials, textureDir, settings.ForceSRGB, materialTextures);
-
-    aabbMin = FloatMax;
-    aabbMax = -FloatMax;
-
     indexType = IndexType::Index16Bit;
 
     // Initialize the meshes
     const uint64 numMeshes = scene->mNumMeshes;
-    uint64 numVertices = 0;
-    uint64 numIndices = 0;
+    uint64 totalNumVertices = 0;
+    uint64 totalNumIndices = 0;
     for(uint64 i = 0; i < numMeshes; ++i)
     {
         const aiMesh& assimpMesh = *scene->mMeshes[i];
 
-        numVertices += assimpMesh.mNumVertices;
-        numIndices += assimpMesh.mNumFaces * 3;
+        totalNumVertices += assimpMesh.mNumVertices;
+        totalNumIndices += assimpMesh.mNumFaces * 3;
 
         if(assimpMesh.mNumFaces * 3 > 0xFFFF)
             indexType = IndexType::Index32Bit;
@@ -556,31 +875,316 @@ void Model::CreateWithAssimp(const ModelLoadSettings& settings)
 
     const uint64 indexSize = indexType == IndexType::Index32Bit ? 4 : 2;
 
-    vertices.Init(numVertices);
-    indices.Init(numIndices * indexSize);
+    vertices.Init(totalNumVertices);
+    indices.Init(totalNumIndices * indexSize);
 
     meshes.Init(numMeshes);
     uint64 vtxOffset = 0;
     uint64 idxOffset = 0;
+    VertexCacheStats statsBefore;
+    VertexCacheStats statsAfter;
     for(uint64 i = 0; i < numMeshes; ++i)
     {
         meshes[i].InitFromAssimpMesh(*scene->mMeshes[i], settings.SceneScale, &vertices[vtxOffset], &indices[idxOffset], indexType);
-
-        aabbMin.x = Min(aabbMin.x, meshes[i].AABBMin().x);
-        aabbMin.y = Min(aabbMin.y, meshes[i].AABBMin().y);
-        aabbMin.z = Min(aabbMin.z, meshes[i].AABBMin().z);
-
-        aabbMax.x = Max(aabbMax.x, meshes[i].AABBMax().x);
-        aabbMax.y = Max(aabbMax.y, meshes[i].AABBMax().y);
-        aabbMax.z = Max(aabbMax.z, meshes[i].AABBMax().z);
+        if(settings.OptimizeVertexOrder)
+            meshes[i].OptimizeVertexOrder(&vertices[vtxOffset], &indices[idxOffset], statsBefore, statsAfter);
+        meshes[i].BuildMeshlets(&vertices[vtxOffset], &indices[idxOffset]);
 
         vtxOffset += meshes[i].NumVertices();
         idxOffset += meshes[i].NumIndices() * indexSize;
     }
 
-    CreateBuffers();
+    if(settings.OptimizeVertexOrder)
+        WriteLog("Optimized vertex order: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u-entry FIFO cache)",
+                 statsBefore.ACMR(), statsAfter.ACMR(), statsBefore.ATVR(), statsAfter.ATVR(), DefaultVertexCacheSize);
 
-    WriteLog("Finished loading scene '%ls'", filePath);
+    // Merged meshes have their node transforms baked into the vertices, otherwise we walk
+    // the node hierarchy so that repeated meshes are stored once and instanced
+    if(settings.MergeMeshes)
+    {
+        CreateDefaultInstances();
+    }
+    else
+    {
+        GrowableList<MeshInstance> instances;
+        GatherNodeInstances(*scene->mRootNode, Float4x4(), settings.SceneScale, instances);
+
+        meshInstances.Init(instances.Count());
+        for(uint64 i = 0; i < instances.Count(); ++i)
+            meshInstances[i] = instances[i];
+    }
+}
+
+// Decodes the small tables from a mapped scene cache file after checking that it's intact, and points
+// the vertex and index data into the mapping so that they never get copied
+bool Model::MapSceneCache(const wchar* cachePath, const Hash& key)
+{
+    sceneCacheFile.Open(cachePath, FileMapMode::Read);
+
+    const uint64 fileSize = sceneCacheFile.Size();
+    if(fileSize < sizeof(SceneCacheHeader))
+    {
+        sceneCacheFile.Close();
+        return false;
+    }
+
+    const uint8* data = sceneCacheFile.Data();
+    const SceneCacheHeader& header = *reinterpret_cast<const SceneCacheHeader*>(data);
+    bool valid = memcmp(header.Magic, SceneCacheMagic, sizeof(SceneCacheMagic)) == 0;
+    valid = valid && header.Version == SceneCacheVersion && header.HeaderSize == sizeof(SceneCacheHeader);
+    valid = valid && header.Key == key && header.TotalSize == fileSize;
+    valid = valid && header.IndexFormat <= uint32(IndexType::Index32Bit);
+    valid = valid && ValidSection(header.Meshes, sizeof(SceneCacheMesh), fileSize) && header.Meshes.Count > 0;
+    valid = valid && ValidSection(header.MeshParts, sizeof(MeshPart), fileSize);
+    valid = valid && ValidSection(header.Meshlets, sizeof(Meshlet), fileSize);
+    valid = valid && ValidSection(header.MeshletVertices, sizeof(uint32), fileSize);
+    valid = valid && ValidSection(header.Instances, sizeof(MeshInstance), fileSize);
+    valid = valid && ValidSection(header.Materials, sizeof(SceneCacheMaterial), fileSize);
+    valid = valid && ValidSection(header.SpotLights, sizeof(ModelSpotLight), fileSize);
+    valid = valid && ValidSection(header.PointLights, sizeof(PointLight), fileSize);
+    valid = valid && ValidSection(header.Vertices, sizeof(MeshVertex), fileSize);
+    valid = valid && ValidSection(header.Indices, sizeof(uint8), fileSize);
+    valid = valid && ValidSection(header.Strings, sizeof(uint8), fileSize);
+
+    const SceneCacheMesh* srcMeshes = reinterpret_cast<const SceneCacheMesh*>(data + header.Meshes.Offset);
+    const MeshPart* srcParts = reinterpret_cast<const MeshPart*>(data + header.MeshParts.Offset);
+    const Meshlet* srcMeshlets = reinterpret_cast<const Meshlet*>(data + header.Meshlets.Offset);
+    const uint32* srcMeshletVertices = reinterpret_cast<const uint32*>(data + header.MeshletVertices.Offset);
+    const MeshInstance* srcInstances = reinterpret_cast<const MeshInstance*>(data + header.Instances.Offset);
+    const SceneCacheMaterial* srcMaterials = reinterpret_cast<const SceneCacheMaterial*>(data + header.Materials.Offset);
+    const uint8* strings = data + header.Strings.Offset;
+
+    // The tables index into each other, so those indices need to be checked before anything uses them
+    if(valid)
+    {
+        const uint64 indexSize = header.IndexFormat == uint32(IndexType::Index32Bit) ? 4 : 2;
+        uint64 totalNumVertices = 0;
+        uint64 totalNumIndices = 0;
+        for(uint64 meshIdx = 0; meshIdx < header.Meshes.Count; ++meshIdx)
+        {
+            const SceneCacheMesh& srcMesh = srcMeshes[meshIdx];
+            valid = valid && srcMesh.NumParts > 0 && uint64(srcMesh.FirstPart) + srcMesh.NumParts <= header.MeshParts.Count;
+            valid = valid && uint64(srcMesh.FirstMeshlet) + srcMesh.NumMeshlets <= header.Meshlets.Count;
+            valid = valid && uint64(srcMesh.FirstMeshletVertex) + srcMesh.NumMeshletVertices <= header.MeshletVertices.Count;
+            totalNumVertices += srcMesh.NumVertices;
+            totalNumIndices += srcMesh.NumIndices;
+
+            // Meshlets get drawn as index ranges by part, so they have to stay inside their mesh
+            for(uint64 i = 0; valid && i < srcMesh.NumMeshlets; ++i)
+            {
+                const Meshlet& meshlet = srcMeshlets[srcMesh.FirstMeshlet + i];
+                valid = valid && meshlet.PartIdx < srcMesh.NumParts;
+                valid = valid && uint64(meshlet.IndexStart) + uint64(meshlet.NumTriangles) * 3 <= srcMesh.NumIndices;
+                valid = valid && uint64(meshlet.VertexStart) + meshlet.NumVertices <= srcMesh.NumMeshletVertices;
+            }
+
+            for(uint64 i = 0; valid && i < srcMesh.NumMeshletVertices; ++i)
+                valid = valid && srcMeshletVertices[srcMesh.FirstMeshletVertex + i] < srcMesh.NumVertices;
+        }
+
+        valid = valid && totalNumVertices == header.Vertices.Count && totalNumIndices * indexSize == header.Indices.Count;
+
+        for(uint64 partIdx = 0; partIdx < header.MeshParts.Count; ++partIdx)
+            valid = valid && srcParts[partIdx].MaterialIdx < header.Materials.Count;
+
+        for(uint64 instanceIdx = 0; instanceIdx < header.Instances.Count; ++instanceIdx)
+            valid = valid && srcInstances[instanceIdx].MeshIdx < header.Meshes.Count;
+
+        for(uint64 matIdx = 0; matIdx < header.Materials.Count; ++matIdx)
+        {
+            const SceneCacheMaterial& srcMaterial = srcMaterials[matIdx];
+            valid = valid && ValidString(srcMaterial.Name, sizeof(char), header.Strings);
+            for(uint64 texType = 0; texType < uint64(MaterialTextures::Count); ++texType)
+                valid = valid && ValidString(srcMaterial.TextureNames[texType], sizeof(wchar), header.Strings);
+        }
+    }
+
+    if(valid == false)
+    {
+        sceneCacheFile.Close();
+        return false;
+    }
+
+    indexType = IndexType(header.IndexFormat);
+
+    meshes.Init(header.Meshes.Count);
+    for(uint64 meshIdx = 0; meshIdx < header.Meshes.Count; ++meshIdx)
+    {
+        const SceneCacheMesh& srcMesh = srcMeshes[meshIdx];
+        Mesh& mesh = meshes[meshIdx];
+        mesh.numVertices = srcMesh.NumVertices;
+        mesh.numIndices = srcMesh.NumIndices;
+        mesh.indexType = indexType;
+        mesh.aabbMin = srcMesh.AABBMin;
+        mesh.aabbMax = srcMesh.AABBMax;
+        mesh.meshParts.Init(srcMesh.NumParts);
+        memcpy(mesh.meshParts.Data(), srcParts + srcMesh.FirstPart, srcMesh.NumParts * sizeof(MeshPart));
+        mesh.meshlets.Init(srcMesh.NumMeshlets);
+        if(srcMesh.NumMeshlets > 0)
+            memcpy(mesh.meshlets.Data(), srcMeshlets + srcMesh.FirstMeshlet, srcMesh.NumMeshlets * sizeof(Meshlet));
+        mesh.meshletVertices.Init(srcMesh.NumMeshletVertices);
+        if(srcMesh.NumMeshletVertices > 0)
+            memcpy(mesh.meshletVertices.Data(), srcMeshletVertices + srcMesh.FirstMeshletVertex, srcMesh.NumMeshletVertices * sizeof(uint32));
+    }
+
+    ReadSceneCacheSection(data, header.Instances, meshInstances);
+    ReadSceneCacheSection(data, header.SpotLights, spotLights);
+    ReadSceneCacheSection(data, header.PointLights, pointLights);
+
+    meshMaterials.Init(header.Materials.Count);
+    for(uint64 matIdx = 0; matIdx < header.Materials.Count; ++matIdx)
+    {
+        const SceneCacheMaterial& srcMaterial = srcMaterials[matIdx];
+        MeshMaterial& material = meshMaterials[matIdx];
+        material.Name = std::string(reinterpret_cast<const char*>(strings + srcMaterial.Name.Offset), srcMaterial.Name.Length);
+        for(uint64 texType = 0; texType < uint64(MaterialTextures::Count); ++texType)
+        {
+            const SceneCacheString& texName = srcMaterial.TextureNames[texType];
+            material.TextureNames[texType] = std::wstring(reinterpret_cast<const wchar*>(strings + texName.Offset), texName.Length);
+        }
+    }
+
+    vertexData = reinterpret_cast<const MeshVertex*>(data + header.Vertices.Offset);
+    numVertices = header.Vertices.Count;
+    indexData = data + header.Indices.Offset;
+    indexDataSize = header.Indices.Count;
+
+    return true;
+}
+
+void Model::WriteSceneCache(const wchar* cachePath, const Hash& key) const
+{
+    Assert_(sceneCacheFile.IsOpen() == false);
+
+    // Mesh parts and meshlets get flattened into single sections, and strings get packed together
+    uint64 numMeshParts = 0;
+    uint64 numMeshlets = 0;
+    uint64 numMeshletVertices = 0;
+    for(uint64 meshIdx = 0; meshIdx < meshes.Size(); ++meshIdx)
+    {
+        numMeshParts += meshes[meshIdx].meshParts.Size();
+        numMeshlets += meshes[meshIdx].meshlets.Size();
+        numMeshletVertices += meshes[meshIdx].meshletVertices.Size();
+    }
+
+    Array<SceneCacheMesh> cacheMeshes(meshes.Size());
+    Array<MeshPart> cacheParts(numMeshParts);
+    Array<Meshlet> cacheMeshlets(numMeshlets);
+    Array<uint32> cacheMeshletVertices(numMeshletVertices);
+    numMeshParts = 0;
+    numMeshlets = 0;
+    numMeshletVertices = 0;
+    for(uint64 meshIdx = 0; meshIdx < meshes.Size(); ++meshIdx)
+    {
+        const Mesh& mesh = meshes[meshIdx];
+        SceneCacheMesh& cacheMesh = cacheMeshes[meshIdx];
+        cacheMesh.NumVertices = mesh.numVertices;
+        cacheMesh.NumIndices = mesh.numIndices;
+        cacheMesh.FirstPart = uint32(numMeshParts);
+        cacheMesh.NumParts = uint32(mesh.meshParts.Size());
+        cacheMesh.AABBMin = mesh.aabbMin;
+        cacheMesh.AABBMax = mesh.aabbMax;
+        cacheMesh.FirstMeshlet = uint32(numMeshlets);
+        cacheMesh.NumMeshlets = uint32(mesh.meshlets.Size());
+        cacheMesh.FirstMeshletVertex = uint32(numMeshletVertices);
+        cacheMesh.NumMeshletVertices = uint32(mesh.meshletVertices.Size());
+
+        for(uint64 partIdx = 0; partIdx < mesh.meshParts.Size(); ++partIdx)
+            cacheParts[numMeshParts++] = mesh.meshParts[partIdx];
+        for(uint64 i = 0; i < mesh.meshlets.Size(); ++i)
+            cacheMeshlets[numMeshlets++] = mesh.meshlets[i];
+        for(uint64 i = 0; i < mesh.meshletVertices.Size(); ++i)
+            cacheMeshletVertices[numMeshletVertices++] = mesh.meshletVertices[i];
+    }
+
+    std::string strings;
+    auto addString = [&](const void* str, uint64 length, uint64 charSize)
+    {
+        strings.resize(AlignTo(uint64(strings.size()), charSize));
+
+        SceneCacheString cacheString;
+        cacheString.Offset = uint32(strings.size());
+        cacheString.Length = uint32(length);
+        strings.append(reinterpret_cast<const char*>(str), length * charSize);
+        return cacheString;
+    };
+
+    Array<SceneCacheMaterial> cacheMaterials(meshMaterials.Size());
+    for(uint64 matIdx = 0; matIdx < meshMaterials.Size(); ++matIdx)
+    {
+        const MeshMaterial& material = meshMaterials[matIdx];
+        cacheMaterials[matIdx].Name = addString(material.Name.c_str(), material.Name.length(), sizeof(char));
+        for(uint64 texType = 0; texType < uint64(MaterialTextures::Count); ++texType)
+        {
+            const std::wstring& texName = material.TextureNames[texType];
+            cacheMaterials[matIdx].TextureNames[texType] = addString(texName.c_str(), texName.length(), sizeof(wchar));
+        }
+    }
+
+    SceneCacheHeader header;
+    memcpy(header.Magic, SceneCacheMagic, sizeof(SceneCacheMagic));
+    header.Version = SceneCacheVersion;
+    header.HeaderSize = sizeof(SceneCacheHeader);
+    header.Key = key;
+    header.IndexFormat = uint32(indexType);
+
+    uint64 fileSize = AlignTo(sizeof(SceneCacheHeader), SceneCacheAlignment);
+    auto addSection = [&](SceneCacheSection& section, uint64 count, uint64 elemSize)
+    {
+        section.Offset = fileSize;
+        section.Count = count;
+        fileSize = AlignTo(fileSize + count * elemSize, SceneCacheAlignment);
+    };
+
+    addSection(header.Meshes, cacheMeshes.Size(), sizeof(SceneCacheMesh));
+    addSection(header.MeshParts, cacheParts.Size(), sizeof(MeshPart));
+    addSection(header.Meshlets, cacheMeshlets.Size(), sizeof(Meshlet));
+    addSection(header.MeshletVertices, cacheMeshletVertices.Size(), sizeof(uint32));
+    addSection(header.Instances, meshInstances.Size(), sizeof(MeshInstance));
+    addSection(header.Materials, cacheMaterials.Size(), sizeof(SceneCacheMaterial));
+    addSection(header.SpotLights, spotLights.Size(), sizeof(ModelSpotLight));
+    addSection(header.PointLights, pointLights.Size(), sizeof(PointLight));
+    addSection(header.Vertices, vertices.Size(), sizeof(MeshVertex));
+    addSection(header.Indices, indices.Size(), sizeof(uint8));
+    addSection(header.Strings, strings.size(), sizeof(uint8));
+    header.TotalSize = fileSize;
+
+    File file(cachePath, FileOpenMode::Write);
+    file.Write(header);
+
+    // Sections get written straight from where they live, with zeros in between to keep them on pages.
+    // File::Write is limited to 32-bit sizes, so big sections get written in pieces.
+    static const uint8 Padding[SceneCacheAlignment] = { };
+    uint64 filePos = sizeof(header);
+    auto writeSection = [&](const SceneCacheSection& section, const void* src, uint64 elemSize)
+    {
+        Assert_(section.Offset >= filePos && section.Offset - filePos <= SceneCacheAlignment);
+        if(section.Offset > filePos)
+            file.Write(section.Offset - filePos, Padding);
+
+        const uint8* bytes = reinterpret_cast<const uint8*>(src);
+        const uint64 sectionSize = section.Count * elemSize;
+        const uint64 chunkSize = 1024 * 1024 * 1024;
+        for(uint64 offset = 0; offset < sectionSize; offset += chunkSize)
+            file.Write(Min(chunkSize, sectionSize - offset), bytes + offset);
+
+        filePos = section.Offset + sectionSize;
+    };
+
+    writeSection(header.Meshes, cacheMeshes.Data(), sizeof(SceneCacheMesh));
+    writeSection(header.MeshParts, cacheParts.Data(), sizeof(MeshPart));
+    writeSection(header.Meshlets, cacheMeshlets.Data(), sizeof(Meshlet));
+    writeSection(header.MeshletVertices, cacheMeshletVertices.Data(), sizeof(uint32));
+    writeSection(header.Instances, meshInstances.Data(), sizeof(MeshInstance));
+    writeSection(header.Materials, cacheMaterials.Data(), sizeof(SceneCacheMaterial));
+    writeSection(header.SpotLights, spotLights.Data(), sizeof(ModelSpotLight));
+    writeSection(header.PointLights, pointLights.Data(), sizeof(PointLight));
+    writeSection(header.Vertices, vertices.Data(), sizeof(MeshVertex));
+    writeSection(header.Indices, indices.Data(), sizeof(uint8));
+    writeSection(header.Strings, strings.data(), sizeof(uint8));
+
+    if(header.TotalSize > filePos)
+        file.Write(header.TotalSize - filePos, Padding);
 }
 
 void Model::CreateFromMeshData(const wchar* filePath)
@@ -588,14 +1192,19 @@ void Model::CreateFromMeshData(const wchar* filePath)
     if(FileExists(filePath) == false)
         throw Exception(MakeString(L"Model file with path '%ls' does not exist", filePath));
 
+    this->filePath = filePath;
     fileDirectory = GetDirectoryFromFilePath(filePath);
 
     FileReadSerializer serializer(filePath);
     Serialize(serializer);
 
+    // Instances and bounds are derived from the meshes when the file doesn't place them
+    if(meshInstances.Size() == 0)
+        CreateDefaultInstances();
+    ComputeBounds();
     CreateBuffers();
 
-    LoadMaterialResources(meshMaterials, fileDirectory, forceSRGB, materialTextures);
+    LoadMaterialResources(meshMaterials, fileDirectory, forceSRGB, materialTextures, nullptr);
 }
 
 void Model::GenerateBoxScene(const Float3& dimensions, const Float3& position,
@@ -617,6 +1226,8 @@ void Model::GenerateBoxScene(const Float3& dimensions, const Float3& position,
     meshes.Init(1);
     meshes[0].InitBox(dimensions, position, orientation, 0, vertices.Data(), (uint16*)indices.Data());
 
+    CreateDefaultInstances();
+    ComputeBounds();
     CreateBuffers();
 }
 
@@ -638,6 +1249,8 @@ void Model::GenerateBoxTestScene()
     meshes[0].InitBox(Float3(2.0f), Float3(0.0f, 1.5f, 0.0f), Quaternion(), 0, vertices.Data(), (uint16*)indices.Data());
     meshes[1].InitBox(Float3(10.0f, 0.25f, 10.0f), Float3(0.0f), Quaternion(), 0, &vertices[NumBoxVerts], (uint16*)&indices[NumBoxIndices * sizeof(uint16)]);
 
+    CreateDefaultInstances();
+    ComputeBounds();
     CreateBuffers();
 }
 
@@ -660,6 +1273,8 @@ void Model::GeneratePlaneScene(const Float2& dimensions, const Float3& position,
     meshes.Init(1);
     meshes[0].InitPlane(dimensions, position, orientation, 0, vertices.Data(), (uint16*)indices.Data());
 
+    CreateDefaultInstances();
+    ComputeBounds();
     CreateBuffers();
 }
 
@@ -668,6 +1283,7 @@ void Model::Shutdown()
     for(uint64 i = 0; i < meshes.Size(); ++i)
         meshes[i].Shutdown();
     meshes.Shutdown();
+    meshInstances.Shutdown();
     meshMaterials.Shutdown();
     for(uint64 i = 0; i < materialTextures.Count(); ++i)
     {
@@ -676,6 +1292,7 @@ void Model::Shutdown()
         materialTextures[i] = nullptr;
     }
     materialTextures.Shutdown();
+    filePath = L"";
     fileDirectory = L"";
     forceSRGB = false;
 
@@ -683,6 +1300,11 @@ void Model::Shutdown()
     indexBuffer.Shutdown();
     vertices.Shutdown();
     indices.Shutdown();
+    vertexData = nullptr;
+    numVertices = 0;
+    indexData = nullptr;
+    indexDataSize = 0;
+    sceneCacheFile.Close();
 }
 
 const D3D12_INPUT_ELEMENT_DESC* Model::InputElements()
@@ -700,22 +1322,150 @@ uint64 Model::NumInputElements()
     return ArraySize_(StandardInputElements);
 }
 
+void Model::CreateDefaultInstances()
+{
+    meshInstances.Init(meshes.Size());
+    for(uint64 i = 0; i < meshes.Size(); ++i)
+        meshInstances[i].MeshIdx = uint32(i);
+}
+
+// Replaces the transform of a single instance, and updates the model bounds to match
+void Model::SetInstanceTransform(uint64 instanceIdx, const Float4x4& transform)
+{
+    meshInstances[instanceIdx].Transform = transform;
+    ComputeBounds();
+}
+
+// Computes the world-space bounds of all instances
+void Model::ComputeBounds()
+{
+    aabbMin = FloatMax;
+    aabbMax = -FloatMax;
+
+    for(uint64 instanceIdx = 0; instanceIdx < meshInstances.Size(); ++instanceIdx)
+    {
+        const MeshInstance& instance = meshInstances[instanceIdx];
+        const Mesh& mesh = meshes[instance.MeshIdx];
+        for(uint64 i = 0; i < 8; ++i)
+        {
+            Float3 corner;
+            corner.x = (i & 1) ? mesh.AABBMax().x : mesh.AABBMin().x;
+            corner.y = (i & 2) ? mesh.AABBMax().y : mesh.AABBMin().y;
+            corner.z = (i & 4) ? mesh.AABBMax().z : mesh.AABBMin().z;
+            corner = Float3::Transform(corner, instance.Transform);
+
+            aabbMin.x = Min(aabbMin.x, corner.x);
+            aabbMin.y = Min(aabbMin.y, corner.y);
+            aabbMin.z = Min(aabbMin.z, corner.z);
+
+            aabbMax.x = Max(aabbMax.x, corner.x);
+            aabbMax.y = Max(aabbMax.y, corner.y);
+            aabbMax.z = Max(aabbMax.z, corner.z);
+        }
+    }
+}
+
 void Model::CreateBuffers()
 {
     Assert_(meshes.Size() > 0);
 
+    // Models that were mapped from a scene cache already point at their vertices and indices
+    if(sceneCacheFile.IsOpen() == false)
+    {
+        vertexData = vertices.Data();
+        numVertices = vertices.Size();
+        indexData = indices.Data();
+        indexDataSize = indices.Size();
+    }
+
+    // Imported meshes come with their meshlets, but the procedural ones still need them
+    for(uint64 meshIdx = 0, vtxOffset = 0, idxOffset = 0; meshIdx < meshes.Size(); ++meshIdx)
+    {
+        Mesh& mesh = meshes[meshIdx];
+        if(mesh.meshlets.Size() == 0)
+            mesh.BuildMeshlets(vertexData + vtxOffset, indexData + idxOffset * IndexSize());
+
+        vtxOffset += mesh.numVertices;
+        idxOffset += mesh.numIndices;
+    }
+
+    // The CPU side keeps the full precision vertices, and the GPU gets packed vertices with the positions
+    // quantized to the bounds of each mesh. The mesh AABBs can't be used for this, since the procedural
+    // meshes don't include their offset in them.
+    Array<PackedMeshVertex> packedVertices(numVertices);
+    float maxPositionError = 0.0f;
+    float maxNormalError = 0.0f;
+    float maxTangentError = 0.0f;
+    float maxBitangentError = 0.0f;
+    float maxUVError = 0.0f;
+
+    auto angleError = [](const Float3& original, const Float3& unpacked)
+    {
+        if(Float3::Length(original) < 0.0001f)
+            return 0.0f;
+        return RadToDeg(std::acos(Clamp(Float3::Dot(Float3::Normalize(original), unpacked), -1.0f, 1.0f)));
+    };
+
+    for(uint64 meshIdx = 0, vtxOffset = 0; meshIdx < meshes.Size(); ++meshIdx)
+    {
+        Mesh& mesh = meshes[meshIdx];
+        const MeshVertex* meshVertices = vertexData + vtxOffset;
+        if(mesh.numVertices == 0)
+            continue;
+
+        Float3 minPosition = FloatMax;
+        Float3 maxPosition = -FloatMax;
+        for(uint64 i = 0; i < mesh.numVertices; ++i)
+        {
+            const Float3& position = meshVertices[i].Position;
+            minPosition.x = Min(minPosition.x, position.x);
+            minPosition.y = Min(minPosition.y, position.y);
+            minPosition.z = Min(minPosition.z, position.z);
+
+            maxPosition.x = Max(maxPosition.x, position.x);
+            maxPosition.y = Max(maxPosition.y, position.y);
+            maxPosition.z = Max(maxPosition.z, position.z);
+        }
+
+        const Float3 halfExtent = (maxPosition - minPosition) * 0.5f;
+        mesh.positionOffset = (maxPosition + minPosition) * 0.5f;
+        mesh.positionScale.x = halfExtent.x > 0.0f ? halfExtent.x : 1.0f;
+        mesh.positionScale.y = halfExtent.y > 0.0f ? halfExtent.y : 1.0f;
+        mesh.positionScale.z = halfExtent.z > 0.0f ? halfExtent.z : 1.0f;
+
+        for(uint64 i = 0; i < mesh.numVertices; ++i)
+        {
+            const MeshVertex& original = meshVertices[i];
+            PackedMeshVertex& packed = packedVertices[vtxOffset + i];
+            packed = PackMeshVertex(original, mesh.positionScale, mesh.positionOffset);
+
+            const MeshVertex unpacked = UnpackMeshVertex(packed, mesh.positionScale, mesh.positionOffset);
+            maxPositionError = Max(maxPositionError, Float3::Length(unpacked.Position - original.Position));
+            maxNormalError = Max(maxNormalError, angleError(original.Normal, unpacked.Normal));
+            maxTangentError = Max(maxTangentError, angleError(original.Tangent, unpacked.Tangent));
+            maxBitangentError = Max(maxBitangentError, angleError(original.Bitangent, unpacked.Bitangent));
+            maxUVError = Max(maxUVError, Float2::Length(unpacked.UV - original.UV));
+        }
+
+        vtxOffset += mesh.numVertices;
+    }
+
+    WriteLog("Packed %llu vertices from %.2f MB to %.2f MB. Max error: position %f, normal %.4f deg, tangent %.4f deg, bitangent %.4f deg, UV %f",
+             numVertices, numVertices * sizeof(MeshVertex) / (1024.0f * 1024.0f), numVertices * sizeof(PackedMeshVertex) / (1024.0f * 1024.0f),
+             maxPositionError, maxNormalError, maxTangentError, maxBitangentError, maxUVError);
+
     StructuredBufferInit sbInit;
-    sbInit.Stride = sizeof(MeshVertex);
-    sbInit.NumElements = vertices.Size();;
-    sbInit.InitData = vertices.Data();
+    sbInit.Stride = sizeof(PackedMeshVertex);
+    sbInit.NumElements = numVertices;
+    sbInit.InitData = packedVertices.Data();
     vertexBuffer.Initialize(sbInit);
 
     const uint32 indexSize = IndexSize();
 
     FormattedBufferInit fbInit;
     fbInit.Format = IndexBufferFormat();
-    fbInit.NumElements = indices.Size() / indexSize;
-    fbInit.InitData = indices.Data();
+    fbInit.NumElements = indexDataSize / indexSize;
+    fbInit.InitData = indexData;
     indexBuffer.Initialize(fbInit);
 
     uint64 vtxOffset = 0;
@@ -723,9 +1473,9 @@ void Model::CreateBuffers()
     const uint64 numMeshes = meshes.Size();
     for(uint64 i = 0; i < numMeshes; ++i)
     {
-        uint64 vbOffset = vtxOffset * sizeof(MeshVertex);
+        uint64 vbOffset = vtxOffset * sizeof(PackedMeshVertex);
         uint64 ibOffset = idxOffset * indexSize;
-        meshes[i].InitCommon(&vertices[vtxOffset], &indices[ibOffset], vertexBuffer.GPUAddress + vbOffset, indexBuffer.GPUAddress + ibOffset, vtxOffset, idxOffset);
+        meshes[i].InitCommon(vertexData + vtxOffset, indexData + ibOffset, vertexBuffer.GPUAddress + vbOffset, indexBuffer.GPUAddress + ibOffset, vtxOffset, idxOffset);
 
         vtxOffset += meshes[i].NumVertices();
         idxOffset += meshes[i].NumIndices();
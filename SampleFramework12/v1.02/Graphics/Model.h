@@ -15,13 +15,23 @@
 #include "..\\SF12_Math.h"
 #include "..\\Serialization.h"
 #include "..\\Containers.h"
+#include "..\\FileIO.h"
 #include "GraphicsTypes.h"
+#include "MeshOptimizer.h"
+#include "Meshlets.h"
 
 struct aiMesh;
 
+namespace enki
+{
+    class TaskScheduler;
+}
+
 namespace SampleFramework12
 {
 
+struct Hash;
+
 struct MeshVertex
 {
     Float3 Position;
@@ -64,6 +74,23 @@ struct MeshVertex
     }
 };
 
+// The vertex layout of the GPU vertex buffer, which is 20 bytes instead of the 56 bytes of MeshVertex.
+// Positions are 16-bit SNORM relative to the bounds of their mesh (see Mesh::PositionScale()), normals
+// and tangents are octahedral-encoded as 2 16-bit SNORM values, and UVs are half precision. The
+// bitangent is rebuilt as cross(normal, tangent) scaled by the sign in the w component of the position.
+struct PackedMeshVertex
+{
+    int16 Position[4];
+    int16 Normal[2];
+    int16 Tangent[2];
+    Half2 UV;
+};
+
+StaticAssert_(sizeof(PackedMeshVertex) == 20);
+
+PackedMeshVertex PackMeshVertex(const MeshVertex& vertex, const Float3& positionScale, const Float3& positionOffset);
+MeshVertex UnpackMeshVertex(const PackedMeshVertex& vertex, const Float3& positionScale, const Float3& positionOffset);
+
 enum class MaterialTextures
 {
     Albedo = 0,
@@ -149,6 +176,14 @@ struct PointLight
     Float3 Intensity;
 };
 
+// Placement of a mesh in the scene. A mesh that's referenced by several nodes stores its
+// vertices and indices once, and gets an instance for every node.
+struct MeshInstance
+{
+    Float4x4 Transform;
+    uint32 MeshIdx = 0;
+};
+
 class Mesh
 {
     friend class Model;
@@ -164,6 +199,13 @@ public:
     void InitFromAssimpMesh(const aiMesh& assimpMesh, float sceneScale,
                             MeshVertex* dstVertices, uint8* dstIndices, IndexType indexType);
 
+    // Reorders the triangles and vertices written by one of the Init functions, see MeshOptimizer.h
+    void OptimizeVertexOrder(MeshVertex* meshVertices, uint8* meshIndices,
+                             VertexCacheStats& statsBefore, VertexCacheStats& statsAfter);
+
+    // Splits every mesh part into meshlets, see Meshlets.h
+    void BuildMeshlets(const MeshVertex* meshVertices, const uint8* meshIndices);
+
     // Procedural generation
     void InitBox(const Float3& dimensions, const Float3& position,
                  const Quaternion& orientation, uint32 materialIdx,
@@ -200,6 +242,14 @@ public:
     const Float3& AABBMin() const { return aabbMin; }
     const Float3& AABBMax() const { return aabbMax; }
 
+    const Array<Meshlet>& Meshlets() const { return meshlets; }
+    uint64 NumMeshlets() const { return meshlets.Size(); }
+    const Array<uint32>& MeshletVertices() const { return meshletVertices; }
+
+    // Dequantizes the positions in the packed vertex buffer as position * PositionScale() + PositionOffset()
+    const Float3& PositionScale() const { return positionScale; }
+    const Float3& PositionOffset() const { return positionOffset; }
+
     static const char* InputElementTypeString(InputElementType elemType);
 
     template<typename TSerializer> void Serialize(TSerializer& serializer)
@@ -214,6 +264,8 @@ public:
         indexType = IndexType(idxType);
         SerializeItem(serializer, aabbMin);
         SerializeItem(serializer, aabbMax);
+        BulkSerializeItem(serializer, meshlets);
+        BulkSerializeItem(serializer, meshletVertices);
     }
 
 protected:
@@ -235,6 +287,12 @@ protected:
 
     Float3 aabbMin;
     Float3 aabbMax;
+
+    Float3 positionScale = Float3(1.0f, 1.0f, 1.0f);
+    Float3 positionOffset;
+
+    Array<Meshlet> meshlets;
+    Array<uint32> meshletVertices;
 };
 
 struct ModelLoadSettings
@@ -244,8 +302,16 @@ struct ModelLoadSettings
     float SceneScale = 1.0f;
     bool ForceSRGB = false;
     bool MergeMeshes = true;
+    bool UseSceneCache = true;      // Map a scene cache file next to the model instead of importing, see CreateWithAssimp()
+    enki::TaskScheduler* Scheduler = nullptr;   // Decodes the material textures in parallel when set
+    bool OptimizeVertexOrder = false;           // Reorders imported meshes for vertex cache and vertex fetch locality
 };
 
+// Written at the start of serialized model data. The version needs to be bumped whenever Model::Serialize()
+// or Mesh::Serialize() change what they write, so that older files get rejected instead of being read as garbage.
+static const uint32 MeshDataMagic = 0x4C444D53;     // "SMDL"
+static const uint32 MeshDataVersion = 2;            // Version 2 added mesh instances and meshlets
+
 class Model
 {
 public:
@@ -255,7 +321,9 @@ public:
         Assert_(meshes.Size() == 0);
     }
 
-    // Loading from file formats
+    // Loading from file formats. Assimp imports get saved to a scene cache file next to the model, which
+    // is keyed by a hash of the source file and the load settings. Later loads map the cache file and use
+    // its vertex and index data in place, instead of importing again.
     void CreateWithAssimp(const ModelLoadSettings& settings);
 
     void CreateFromMeshData(const wchar* filePath);
@@ -275,10 +343,16 @@ public:
 
     void Shutdown();
 
+    // Moves an instance, which requires refitting or rebuilding any acceleration structures
+    void SetInstanceTransform(uint64 instanceIdx, const Float4x4& transform);
+
     // Accessors
     const Array<Mesh>& Meshes() const { return meshes; }
     uint64 NumMeshes() const { return meshes.Size(); }
 
+    const Array<MeshInstance>& Instances() const { return meshInstances; }
+    uint64 NumInstances() const { return meshInstances.Size(); }
+
     const Float3& AABBMin() const { return aabbMin; }
     const Float3& AABBMax() const { return aabbMax; }
 
@@ -288,14 +362,17 @@ public:
     const Array<ModelSpotLight>& SpotLights() const { return spotLights; }
     const Array<PointLight>& PointLights() const { return pointLights; }
 
-    const StructuredBuffer& VertexBuffer() const { return vertexBuffer; }
+    const StructuredBuffer& VertexBuffer() const { return vertexBuffer; }      // Contains PackedMeshVertex elements
     const FormattedBuffer& IndexBuffer() const { return indexBuffer; }
 
-    const MeshVertex* Vertices() const { return vertices.Data(); }
-    const uint16* Indices() const { Assert_(indexType == IndexType::Index16Bit); return (const uint16*)indices.Data(); }
-    const uint32* Indices32() const { Assert_(indexType == IndexType::Index32Bit); return (const uint32*)indices.Data(); }
+    const MeshVertex* Vertices() const { return vertexData; }
+    const uint16* Indices() const { Assert_(indexType == IndexType::Index16Bit); return (const uint16*)indexData; }
+    const uint32* Indices32() const { Assert_(indexType == IndexType::Index32Bit); return (const uint32*)indexData; }
+    bool32 LoadedFromSceneCache() const { return sceneCacheFile.IsOpen(); }
 
+    const std::wstring& FilePath() const { return filePath; }
     const std::wstring& FileDirectory() const { return fileDirectory; }
+    bool32 ForceSRGB() const { return forceSRGB; }
 
     static const D3D12_INPUT_ELEMENT_DESC* InputElements();
     static const InputElementType* InputElementTypes();
@@ -305,11 +382,21 @@ public:
     DXGI_FORMAT IndexBufferFormat() const { return indexType == IndexType::Index32Bit ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT; }
     uint32 IndexSize() const { return indexType == IndexType::Index32Bit ? 4 : 2; }
 
-    // Serialization
+    // Serialization, which only works for models that own their vertex and index data
     template<typename TSerializer>
     void Serialize(TSerializer& serializer)
     {
+        Assert_(sceneCacheFile.IsOpen() == false);
+
+        uint32 magic = MeshDataMagic;
+        uint32 version = MeshDataVersion;
+        SerializeItem(serializer, magic);
+        SerializeItem(serializer, version);
+        if(magic != MeshDataMagic || version != MeshDataVersion)
+            throw Exception(MakeString(L"Mesh data file '%ls' is out of date or invalid, and needs to be re-exported", filePath.c_str()));
+
         SerializeItem(serializer, meshes);
+        BulkSerializeItem(serializer, meshInstances);
         SerializeItem(serializer, meshMaterials);
         BulkSerializeItem(serializer, spotLights);
         BulkSerializeItem(serializer, pointLights);
@@ -326,11 +413,19 @@ public:
 protected:
 
         void CreateBuffers();
+    void CreateDefaultInstances();
+    void ComputeBounds();
+
+    void ImportWithAssimp(const ModelLoadSettings& settings);
+    bool MapSceneCache(const wchar* cachePath, const Hash& key);
+    void WriteSceneCache(const wchar* cachePath, const Hash& key) const;
 
     Array<Mesh> meshes;
+    Array<MeshInstance> meshInstances;
     Array<MeshMaterial> meshMaterials;
     Array<ModelSpotLight> spotLights;
     Array<PointLight> pointLights;
+    std::wstring filePath;
     std::wstring fileDirectory;
     bool32 forceSRGB = false;
     Float3 aabbMin;
@@ -342,6 +437,13 @@ protected:
     Array<uint8> indices;
     IndexType indexType = IndexType::Index16Bit;
 
+    // Vertex and index data, which either points at the arrays above or into the mapped scene cache file
+    const MeshVertex* vertexData = nullptr;
+    uint64 numVertices = 0;
+    const uint8* indexData = nullptr;
+    uint64 indexDataSize = 0;
+    MappedFile sceneCacheFile;
+
     GrowableList<MaterialTexture*> materialTextures;
 };
 
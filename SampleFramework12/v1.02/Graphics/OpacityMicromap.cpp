@@ -0,0 +1,444 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "OpacityMicromap.h"
+#include "Model.h"
+#include "..\\FileIO.h"
+#include "..\\Utility.h"
+#include "..\\Timer.h"
+#include "..\\MurmurHash.h"
+#include "..\\Serialization.h"
+#include "..\\EnkiTS\\TaskScheduler.h"
+
+namespace SampleFramework12
+{
+
+// Increment this whenever the classification or the file layout changes, to invalidate old cache files
+static const uint64 CacheVersion = 1;
+
+// Number of micro-triangle edges along each edge of the base triangle
+static const uint32 SubdivisionSize = 1 << OpacityMicromap::SubdivisionLevel;
+
+// Micro-triangles are ordered by row along the V axis. Each row has a "lower" triangle for every cell,
+// and an "upper" triangle for every cell except the last one.
+static uint32 MicroTriangleIndex(uint32 i, uint32 j, bool upper)
+{
+    return j * (2 * SubdivisionSize - j) + 2 * i + (upper ? 1 : 0);
+}
+
+static Float2 TextureOpacityRange(const TextureData<Float4>& texture)
+{
+    Float2 range = Float2(FloatMax, -FloatMax);
+    for(uint64 i = 0; i < uint64(texture.Width) * texture.Height; ++i)
+    {
+        range.x = Min(range.x, texture.Texels[i].x);
+        range.y = Max(range.y, texture.Texels[i].x);
+    }
+
+    return range;
+}
+
+// Returns the min and max opacity of every texel that bilinear filtering could touch for a sample point
+// inside of a UV-space triangle, using the bounding box of the triangle and SampleTexture2D()'s wrapping
+static Float2 FootprintOpacityRange(const TextureData<Float4>& texture, Float2 textureRange, const Float2* uvs)
+{
+    const int64 width = int64(texture.Width);
+    const int64 height = int64(texture.Height);
+
+    float minX = FloatMax;
+    float minY = FloatMax;
+    float maxX = -FloatMax;
+    float maxY = -FloatMax;
+    for(uint32 i = 0; i < 3; ++i)
+    {
+        const float x = uvs[i].x * width - 0.5f;
+        const float y = uvs[i].y * height - 0.5f;
+        minX = Min(minX, x);
+        minY = Min(minY, y);
+        maxX = Max(maxX, x);
+        maxY = Max(maxY, y);
+    }
+
+    // Huge or broken UV's will touch the entire texture anyway
+    const float maxCoord = float(1 << 24);
+    if(std::isfinite(minX + minY + maxX + maxY) == false || Max(std::abs(minX), std::abs(maxX)) > maxCoord ||
+       Max(std::abs(minY), std::abs(maxY)) > maxCoord)
+        return textureRange;
+
+    // Filtering touches the texel at the sample position and the next one, plus a bit of slop
+    // for barycentrics from a hit point that land just outside of the micro-triangle
+    int64 startX = int64(std::floor(minX - 0.01f));
+    int64 startY = int64(std::floor(minY - 0.01f));
+    int64 endX = int64(std::floor(maxX + 0.01f)) + 1;
+    int64 endY = int64(std::floor(maxY + 0.01f)) + 1;
+
+    const bool coversWidth = endX - startX + 1 >= width;
+    const bool coversHeight = endY - startY + 1 >= height;
+    if(coversWidth && coversHeight)
+        return textureRange;
+
+    if(coversWidth)
+    {
+        startX = 0;
+        endX = width - 1;
+    }
+
+    if(coversHeight)
+    {
+        startY = 0;
+        endY = height - 1;
+    }
+
+    Float2 range = Float2(FloatMax, -FloatMax);
+    for(int64 y = startY; y <= endY; ++y)
+    {
+        const int64 wrappedY = ((y % height) + height) % height;
+        for(int64 x = startX; x <= endX; ++x)
+        {
+            const int64 wrappedX = ((x % width) + width) % width;
+            const float opacity = texture.Texels[wrappedY * width + wrappedX].x;
+            range.x = Min(range.x, opacity);
+            range.y = Max(range.y, opacity);
+        }
+    }
+
+    return range;
+}
+
+static OpacityState ClassifyOpacityRange(Float2 range, float alphaThreshold)
+{
+    if(range.x >= alphaThreshold)
+        return OpacityState::Opaque;
+    else if(range.y < alphaThreshold)
+        return OpacityState::Transparent;
+    else
+        return OpacityState::Unknown;
+}
+
+// Hashes everything that can affect the classification, so that stale cache files get rebuilt
+static Hash MakeCacheKey(const Model& model, float alphaThreshold)
+{
+    const uint64 keyData[] = { CacheVersion, OpacityMicromap::SubdivisionLevel };
+    Hash key = GenerateHash(keyData, int32(sizeof(keyData)));
+    key = CombineHashes(key, GenerateHash(&alphaThreshold, int32(sizeof(alphaThreshold))));
+
+    uint64 numVertices = 0;
+    uint64 numIndices = 0;
+    for(const Mesh& mesh : model.Meshes())
+    {
+        numVertices += mesh.NumVertices();
+        numIndices += mesh.NumIndices();
+    }
+
+    const void* indices = model.IndexBufferType() == IndexType::Index32Bit ? (const void*)model.Indices32() : (const void*)model.Indices();
+    key = CombineHashes(key, GenerateHash(model.Vertices(), int32(numVertices * sizeof(MeshVertex))));
+    key = CombineHashes(key, GenerateHash(indices, int32(numIndices * model.IndexSize())));
+
+    for(const MeshMaterial& material : model.Materials())
+    {
+        const uint32 texIdx = material.TextureIndices[uint64(MaterialTextures::Opacity)];
+        const uint32 meshKey[] = { texIdx, material.Textures[uint64(MaterialTextures::Opacity)] != nullptr ? 1u : 0u };
+        key = CombineHashes(key, GenerateHash(meshKey, int32(sizeof(meshKey))));
+    }
+
+    const GrowableList<MaterialTexture*>& materialTextures = model.MaterialTextures();
+    for(uint64 i = 0; i < materialTextures.Count(); ++i)
+    {
+        const std::wstring& name = materialTextures[i]->Name;
+        const uint64 timestamp = FileExists(name.c_str()) ? GetFileTimestamp(name.c_str()) : 0;
+        key = CombineHashes(key, GenerateHash(name.data(), int32(name.length() * sizeof(wchar))));
+        key = CombineHashes(key, GenerateHash(&timestamp, int32(sizeof(timestamp))));
+    }
+
+    return key;
+}
+
+void OpacityMicromap::Initialize(const Model& model, const Array<TextureData<Float4>>& textures, float alphaThreshold,
+                                 enki::TaskScheduler* scheduler)
+{
+    Shutdown();
+
+    Timer timer;
+
+    Hash key = MakeCacheKey(model, alphaThreshold);
+    const std::wstring cachePath = model.FilePath().length() > 0 ? GetFilePathWithoutExtension(model.FilePath().c_str()) + L".omm" : L"";
+
+    if(cachePath.length() > 0 && FileExists(cachePath.c_str()))
+    {
+        FileReadSerializer serializer(cachePath.c_str());
+
+        Hash cacheKey;
+        SerializeData(serializer, cacheKey);
+        if(cacheKey == key)
+        {
+            Serialize(serializer);
+            stats.LoadedFromCache = true;
+        }
+    }
+
+    if(stats.LoadedFromCache == false)
+    {
+        Build(model, textures, alphaThreshold, scheduler);
+
+        if(cachePath.length() > 0)
+        {
+            FileWriteSerializer serializer(cachePath.c_str());
+            SerializeData(serializer, key);
+            Serialize(serializer);
+        }
+    }
+
+    ComputeStats(model);
+
+    timer.Update();
+    stats.BuildTimeMS = timer.ElapsedMillisecondsF();
+}
+
+void OpacityMicromap::Shutdown()
+{
+    meshTriangleOffsets.Shutdown();
+    triangleDescs.Shutdown();
+    microStates.Shutdown();
+    stats = OpacityMicromapStats();
+}
+
+void OpacityMicromap::Build(const Model& model, const Array<TextureData<Float4>>& textures, float alphaThreshold,
+                            enki::TaskScheduler* scheduler)
+{
+    const Array<Mesh>& meshes = model.Meshes();
+    const uint32 numMeshes = uint32(meshes.Size());
+    const MeshVertex* vertices = model.Vertices();
+    const bool indices32 = model.IndexBufferType() == IndexType::Index32Bit;
+
+    // Make a list of all triangles that use an opacity map
+    struct AlphaTestedTriangle
+    {
+        uint32 MeshIdx;
+        uint32 PrimitiveIdx;
+    };
+
+    GrowableList<AlphaTestedTriangle> alphaTestedTriangles;
+    meshTriangleOffsets.Init(numMeshes);
+    uint32 numTriangles = 0;
+    for(uint32 meshIdx = 0; meshIdx < numMeshes; ++meshIdx)
+    {
+        const Mesh& mesh = meshes[meshIdx];
+        meshTriangleOffsets[meshIdx] = numTriangles;
+
+        const uint32 numMeshTriangles = mesh.NumIndices() / 3;
+        numTriangles += numMeshTriangles;
+
+        const MeshMaterial& material = model.Materials()[mesh.MeshParts()[0].MaterialIdx];
+        if(material.Textures[uint64(MaterialTextures::Opacity)] == nullptr)
+            continue;
+
+        for(uint32 primIdx = 0; primIdx < numMeshTriangles; ++primIdx)
+            alphaTestedTriangles.Add({ meshIdx, primIdx });
+    }
+
+    triangleDescs.Init(numTriangles, uint32(OpacityState::Opaque));
+
+    const uint32 numAlphaTestedTriangles = uint32(alphaTestedTriangles.Count());
+    if(numAlphaTestedTriangles == 0)
+        return;
+
+    Array<Float2> textureRanges(textures.Size());
+    for(uint64 texIdx = 0; texIdx < textures.Size(); ++texIdx)
+        textureRanges[texIdx] = TextureOpacityRange(textures[texIdx]);
+
+    // Classify every micro-triangle
+    Array<OpacityState> states(uint64(numAlphaTestedTriangles) * NumMicroTriangles);
+    auto classifyTriangle = [&](uint32 alphaTriIdx)
+    {
+        const AlphaTestedTriangle& alphaTri = alphaTestedTriangles[alphaTriIdx];
+        const Mesh& mesh = meshes[alphaTri.MeshIdx];
+        const MeshMaterial& material = model.Materials()[mesh.MeshParts()[0].MaterialIdx];
+        OpacityState* triStates = &states[uint64(alphaTriIdx) * NumMicroTriangles];
+
+        const uint32 texIdx = material.TextureIndices[uint64(MaterialTextures::Opacity)];
+        if(texIdx >= textures.Size() || textures[texIdx].Texels.Size() == 0)
+        {
+            for(uint32 i = 0; i < NumMicroTriangles; ++i)
+                triStates[i] = OpacityState::Unknown;
+            return;
+        }
+
+        const TextureData<Float4>& texture = textures[texIdx];
+        const Float2 textureRange = textureRanges[texIdx];
+
+        // Every micro-triangle would get the same result if the whole texture agrees
+        const OpacityState textureState = ClassifyOpacityRange(textureRange, alphaThreshold);
+        if(textureState != OpacityState::Unknown)
+        {
+            for(uint32 i = 0; i < NumMicroTriangles; ++i)
+                triStates[i] = textureState;
+            return;
+        }
+
+        Float2 uv[3];
+        for(uint32 i = 0; i < 3; ++i)
+        {
+            const uint32 globalIdx = mesh.IndexOffset() + alphaTri.PrimitiveIdx * 3 + i;
+            const uint32 idx = (indices32 ? model.Indices32()[globalIdx] : model.Indices()[globalIdx]) + mesh.VertexOffset();
+            uv[i] = vertices[idx].UV;
+        }
+
+        auto barycentricToUV = [&](uint32 i, uint32 j)
+        {
+            const float u = float(i) / SubdivisionSize;
+            const float v = float(j) / SubdivisionSize;
+            return uv[0] + (uv[1] - uv[0]) * u + (uv[2] - uv[0]) * v;
+        };
+
+        for(uint32 j = 0; j < SubdivisionSize; ++j)
+        {
+            for(uint32 i = 0; i < SubdivisionSize - j; ++i)
+            {
+                const Float2 lowerUVs[3] = { barycentricToUV(i, j), barycentricToUV(i + 1, j), barycentricToUV(i, j + 1) };
+                const Float2 lowerRange = FootprintOpacityRange(texture, textureRange, lowerUVs);
+                triStates[MicroTriangleIndex(i, j, false)] = ClassifyOpacityRange(lowerRange, alphaThreshold);
+
+                if(i + j < SubdivisionSize - 1)
+                {
+                    const Float2 upperUVs[3] = { barycentricToUV(i + 1, j), barycentricToUV(i + 1, j + 1), barycentricToUV(i, j + 1) };
+                    const Float2 upperRange = FootprintOpacityRange(texture, textureRange, upperUVs);
+                    triStates[MicroTriangleIndex(i, j, true)] = ClassifyOpacityRange(upperRange, alphaThreshold);
+                }
+            }
+        }
+    };
+
+    if(scheduler != nullptr)
+    {
+        enki::TaskSet taskSet(numAlphaTestedTriangles, [&](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            for(uint32 alphaTriIdx = range.start; alphaTriIdx < range.end; ++alphaTriIdx)
+                classifyTriangle(alphaTriIdx);
+        });
+
+        scheduler->AddTaskSetToPipe(&taskSet);
+        scheduler->WaitforTaskSet(&taskSet);
+    }
+    else
+    {
+        for(uint32 alphaTriIdx = 0; alphaTriIdx < numAlphaTestedTriangles; ++alphaTriIdx)
+            classifyTriangle(alphaTriIdx);
+    }
+
+    // Collapse triangles with a single state, and pack the rest into 2 bits per micro-triangle
+    GrowableList<uint32> packedStates;
+    for(uint32 alphaTriIdx = 0; alphaTriIdx < numAlphaTestedTriangles; ++alphaTriIdx)
+    {
+        const AlphaTestedTriangle& alphaTri = alphaTestedTriangles[alphaTriIdx];
+        const OpacityState* triStates = &states[uint64(alphaTriIdx) * NumMicroTriangles];
+        uint32& desc = triangleDescs[meshTriangleOffsets[alphaTri.MeshIdx] + alphaTri.PrimitiveIdx];
+
+        bool uniform = true;
+        for(uint32 i = 1; i < NumMicroTriangles && uniform; ++i)
+            uniform = triStates[i] == triStates[0];
+
+        if(uniform)
+        {
+            desc = uint32(triStates[0]);
+            continue;
+        }
+
+        Assert_(packedStates.Count() < MicromapDescBit);
+        desc = MicromapDescBit | uint32(packedStates.Count());
+        for(uint32 wordIdx = 0; wordIdx < WordsPerTriangle; ++wordIdx)
+        {
+            uint32 word = 0;
+            for(uint32 i = 0; i < 16 && wordIdx * 16 + i < NumMicroTriangles; ++i)
+                word |= uint32(triStates[wordIdx * 16 + i]) << (i * 2);
+            packedStates.Add(word);
+        }
+    }
+
+    microStates.Init(packedStates.Count());
+    for(uint64 i = 0; i < packedStates.Count(); ++i)
+        microStates[i] = packedStates[i];
+}
+
+void OpacityMicromap::ComputeStats(const Model& model)
+{
+    stats.NumAlphaTestedTriangles = 0;
+    stats.NumOpaqueTriangles = 0;
+    stats.NumTransparentTriangles = 0;
+    stats.NumUnknownTriangles = 0;
+    stats.NumSubdividedTriangles = 0;
+
+    uint64 numUnknownMicroTriangles = 0;
+    const Array<Mesh>& meshes = model.Meshes();
+    for(uint64 meshIdx = 0; meshIdx < meshes.Size(); ++meshIdx)
+    {
+        const Mesh& mesh = meshes[meshIdx];
+        const MeshMaterial& material = model.Materials()[mesh.MeshParts()[0].MaterialIdx];
+        if(material.Textures[uint64(MaterialTextures::Opacity)] == nullptr)
+            continue;
+
+        const uint32 numMeshTriangles = mesh.NumIndices() / 3;
+        stats.NumAlphaTestedTriangles += numMeshTriangles;
+
+        for(uint32 primIdx = 0; primIdx < numMeshTriangles; ++primIdx)
+        {
+            const uint32 desc = triangleDescs[meshTriangleOffsets[meshIdx] + primIdx];
+            if(desc & MicromapDescBit)
+            {
+                stats.NumSubdividedTriangles += 1;
+
+                const uint32 offset = desc & ~MicromapDescBit;
+                for(uint32 i = 0; i < NumMicroTriangles; ++i)
+                {
+                    const uint32 state = (microStates[offset + i / 16] >> ((i % 16) * 2)) & 0x3;
+                    numUnknownMicroTriangles += state == uint32(OpacityState::Unknown) ? 1 : 0;
+                }
+            }
+            else if(desc == uint32(OpacityState::Opaque))
+            {
+                stats.NumOpaqueTriangles += 1;
+            }
+            else if(desc == uint32(OpacityState::Transparent))
+            {
+                stats.NumTransparentTriangles += 1;
+            }
+            else
+            {
+                stats.NumUnknownTriangles += 1;
+                numUnknownMicroTriangles += NumMicroTriangles;
+            }
+        }
+    }
+
+    const uint64 numAlphaTestedMicroTriangles = uint64(stats.NumAlphaTestedTriangles) * NumMicroTriangles;
+    stats.UnknownMicroTriangleFraction = numAlphaTestedMicroTriangles > 0 ? float(double(numUnknownMicroTriangles) / numAlphaTestedMicroTriangles) : 0.0f;
+}
+
+OpacityState OpacityMicromap::Lookup(uint32 geometryIdx, uint32 primitiveIdx, Float2 barycentrics) const
+{
+    const uint32 desc = triangleDescs[meshTriangleOffsets[geometryIdx] + primitiveIdx];
+    if((desc & MicromapDescBit) == 0)
+        return OpacityState(desc);
+
+    const float u = barycentrics.x * SubdivisionSize;
+    const float v = barycentrics.y * SubdivisionSize;
+    const uint32 j = uint32(Clamp(v, 0.0f, float(SubdivisionSize - 1)));
+    uint32 i = uint32(Clamp(u, 0.0f, float(SubdivisionSize - 1)));
+    if(i + j > SubdivisionSize - 1)
+        i = SubdivisionSize - 1 - j;
+
+    const bool upper = i + j < SubdivisionSize - 1 && (u - i) + (v - j) > 1.0f;
+    const uint32 microTriIdx = MicroTriangleIndex(i, j, upper);
+
+    const uint32 offset = desc & ~MicromapDescBit;
+    return OpacityState((microStates[offset + microTriIdx / 16] >> ((microTriIdx % 16) * 2)) & 0x3);
+}
+
+}
@@ -0,0 +1,99 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\Containers.h"
+#include "..\\SF12_Math.h"
+#include "Textures.h"
+
+namespace enki
+{
+    class TaskScheduler;
+}
+
+namespace SampleFramework12
+{
+
+class Model;
+
+enum class OpacityState : uint8
+{
+    Transparent = 0,
+    Opaque = 1,
+    Unknown = 2,
+};
+
+struct OpacityMicromapStats
+{
+    uint32 NumAlphaTestedTriangles = 0;
+    uint32 NumOpaqueTriangles = 0;
+    uint32 NumTransparentTriangles = 0;
+    uint32 NumUnknownTriangles = 0;
+    uint32 NumSubdividedTriangles = 0;
+    float UnknownMicroTriangleFraction = 0.0f;
+    float BuildTimeMS = 0.0f;
+    bool LoadedFromCache = false;
+};
+
+// Conservative opacity classification for alpha-tested triangles. Each triangle is split into
+// 4^SubdivisionLevel micro-triangles in barycentric space, and the UV footprint of each one is
+// rasterized against the material's opacity map to determine whether every possible alpha test
+// result is the same. Triangles where all micro-triangles agree are stored as a single state.
+// Results are cached next to the model file, keyed by a hash of the inputs.
+class OpacityMicromap
+{
+
+public:
+
+    ~OpacityMicromap()
+    {
+        Assert_(triangleDescs.Size() == 0);
+    }
+
+    // textures must have the decoded contents of model.MaterialTextures(), in the same order
+    void Initialize(const Model& model, const Array<TextureData<Float4>>& textures, float alphaThreshold,
+                    enki::TaskScheduler* scheduler = nullptr);
+    void Shutdown();
+
+    OpacityState Lookup(uint32 geometryIdx, uint32 primitiveIdx, Float2 barycentrics) const;
+
+    const OpacityMicromapStats& Stats() const { return stats; }
+
+    static const uint32 SubdivisionLevel = 3;
+    static const uint32 NumMicroTriangles = 1 << (SubdivisionLevel * 2);
+    static const uint32 WordsPerTriangle = (NumMicroTriangles * 2 + 31) / 32;
+
+    template<typename TSerializer>
+    void Serialize(TSerializer& serializer)
+    {
+        BulkSerializeItem(serializer, meshTriangleOffsets);
+        BulkSerializeItem(serializer, triangleDescs);
+        BulkSerializeItem(serializer, microStates);
+    }
+
+protected:
+
+    void Build(const Model& model, const Array<TextureData<Float4>>& textures, float alphaThreshold,
+               enki::TaskScheduler* scheduler);
+    void ComputeStats(const Model& model);
+
+    // Per-triangle descriptors are either a uniform OpacityState, or have the high bit set
+    // and store the offset of the triangle's 2-bit micro-triangle states
+    static const uint32 MicromapDescBit = 0x80000000;
+
+    Array<uint32> meshTriangleOffsets;
+    Array<uint32> triangleDescs;
+    Array<uint32> microStates;
+    OpacityMicromapStats stats;
+};
+
+}
@@ -228,6 +228,33 @@ Float3 SampleDirectionGGX(const Float3& v, const Float3& n, float roughness, con
     return Float3::Normalize(sampleDir);
 }
 
+// Samples the distribution of visible normals for a GGX BRDF. The view direction
+// and returned microfacet normal are both in tangent space.
+Float3 SampleGGXVisibleNormal(const Float3& wo, float ax, float ay, float u1, float u2)
+{
+    // Stretch the view vector so we are sampling as though
+    // roughness==1
+    Float3 v = Float3::Normalize(Float3(wo.x * ax, wo.y * ay, wo.z));
+
+    // Build an orthonormal basis with v, t1, and t2
+    Float3 t1 = (v.z < 0.999f) ? Float3::Normalize(Float3::Cross(v, Float3(0.0f, 0.0f, 1.0f))) : Float3(1.0f, 0.0f, 0.0f);
+    Float3 t2 = Float3::Cross(t1, v);
+
+    // Choose a point on a disk with each half of the disk weighted
+    // proportionally to its projection onto direction v
+    float a = 1.0f / (1.0f + v.z);
+    float r = std::sqrt(u1);
+    float phi = (u2 < a) ? (u2 / a) * Pi : Pi + (u2 - a) / (1.0f - a) * Pi;
+    float p1 = r * std::cos(phi);
+    float p2 = r * std::sin(phi) * ((u2 < a) ? 1.0f : v.z);
+
+    // Calculate the normal in this stretched tangent space
+    Float3 n = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * v;
+
+    // Unstretch and normalize the normal
+    return Float3::Normalize(Float3(ax * n.x, ay * n.y, std::max(0.0f, n.z)));
+}
+
 // Returns a point inside of a unit sphere
 Float3 SampleSphere(float x1, float x2, float x3, float u1)
 {
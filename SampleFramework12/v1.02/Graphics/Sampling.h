@@ -17,6 +17,7 @@ namespace SampleFramework12
 Float2 SquareToConcentricDiskMapping(float x, float y, float numSides, float polygonAmount);
 Float2 SquareToConcentricDiskMapping(float x, float y);
 Float3 SampleDirectionGGX(const Float3& v, const Float3& n, float roughness, const Float3x3& tangentToWorld, float u1, float u2);
+Float3 SampleGGXVisibleNormal(const Float3& wo, float ax, float ay, float u1, float u2);
 Float3 SampleSphere(float x1, float x2, float x3, float u1);
 Float3 SampleDirectionSphere(float u1, float u2);
 Float3 SampleDirectionHemisphere(float u1, float u2);
@@ -45,6 +45,116 @@ static float IrradianceIntegral(float theta)
     return Pi * sinTheta * sinTheta;
 }
 
+static const uint64 CubeMapRes = 128;
+
+// Maps a position on one of the cube faces in [-1, 1] to a direction. Matches MapXYSToDirection().
+static Float3 CubeFaceToDirection(float u, float v, uint64 face)
+{
+    // +x, -x, +y, -y, +z, -z
+    switch(face) {
+    case 0:
+        return Float3::Normalize(Float3(1.0f, v, -u));
+    case 1:
+        return Float3::Normalize(Float3(-1.0f, v, u));
+    case 2:
+        return Float3::Normalize(Float3(u, 1.0f, -v));
+    case 3:
+        return Float3::Normalize(Float3(u, -1.0f, v));
+    case 4:
+        return Float3::Normalize(Float3(u, v, 1.0f));
+    default:
+        return Float3::Normalize(Float3(-u, v, -1.0f));
+    }
+}
+
+// Inverse of CubeFaceToDirection()
+static uint64 DirectionToCubeFace(const Float3& dir, float& u, float& v)
+{
+    const float maxComponent = Max(Max(std::abs(dir.x), std::abs(dir.y)), std::abs(dir.z));
+    if(dir.x == maxComponent)
+    {
+        u = -dir.z / dir.x;
+        v = dir.y / dir.x;
+        return 0;
+    }
+    else if(-dir.x == maxComponent)
+    {
+        u = dir.z / -dir.x;
+        v = dir.y / -dir.x;
+        return 1;
+    }
+    else if(dir.y == maxComponent)
+    {
+        u = dir.x / dir.y;
+        v = -dir.z / dir.y;
+        return 2;
+    }
+    else if(-dir.y == maxComponent)
+    {
+        u = dir.x / -dir.y;
+        v = dir.z / -dir.y;
+        return 3;
+    }
+    else if(dir.z == maxComponent)
+    {
+        u = dir.x / dir.z;
+        v = dir.y / dir.z;
+        return 4;
+    }
+
+    u = -dir.x / -dir.z;
+    v = dir.y / -dir.z;
+    return 5;
+}
+
+// Builds an alias table for picking an element in proportion to its weight with a single random number [Vose91]
+static void BuildAliasTable(const Array<float>& weights, Array<float>& probabilities, Array<float>& thresholds, Array<uint32>& aliases)
+{
+    const uint64 numElements = weights.Size();
+    probabilities.Init(numElements);
+    thresholds.Init(numElements);
+    aliases.Init(numElements);
+
+    double weightSum = 0.0;
+    for(uint64 i = 0; i < numElements; ++i)
+        weightSum += weights[i];
+
+    Array<uint32> small(numElements);
+    Array<uint32> large(numElements);
+    uint64 numSmall = 0;
+    uint64 numLarge = 0;
+
+    for(uint64 i = 0; i < numElements; ++i)
+    {
+        probabilities[i] = weightSum > 0.0 ? float(weights[i] / weightSum) : 1.0f / numElements;
+        thresholds[i] = probabilities[i] * numElements;
+        aliases[i] = uint32(i);
+        if(thresholds[i] < 1.0f)
+            small[numSmall++] = uint32(i);
+        else
+            large[numLarge++] = uint32(i);
+    }
+
+    // Fill up the under-full entries with the remainder of the over-full ones
+    while(numSmall > 0 && numLarge > 0)
+    {
+        const uint32 smallIdx = small[--numSmall];
+        const uint32 largeIdx = large[--numLarge];
+        aliases[smallIdx] = largeIdx;
+        thresholds[largeIdx] -= 1.0f - thresholds[smallIdx];
+        if(thresholds[largeIdx] < 1.0f)
+            small[numSmall++] = largeIdx;
+        else
+            large[numLarge++] = largeIdx;
+    }
+
+    // Anything that's left is only off from 1 due to round-off
+    while(numLarge > 0)
+        thresholds[large[--numLarge]] = 1.0f;
+    while(numSmall > 0)
+        thresholds[small[--numSmall]] = 1.0f;
+}
+
 bool SkyCache::Init(const Float3& sunDirection_, float sunSize, const Float3& groundAlbedo_, float turbidity, bool createCubemap)
 {
     Float3 sunDirection = sunDirection_;
@@ -157,11 +267,11 @@ bool SkyCache::Init(const Float3& sunDirection_, float sunSize, const Float3& gr
     {
         // Make a pre-computed cubemap with the sky radiance values, minus the sun.
         // For this we again pre-scale by our FP16 scale factor so that we can use an FP16 format.
-        const uint64 CubeMapRes = 128;
         const uint64 NumTexels = CubeMapRes * CubeMapRes * 6;
         Array<Float3> samples(NumTexels);
         Array<Float3> sampleDirs(NumTexels);
         Array<Half4> texels(NumTexels);
+        Array<float> samplingWeights(NumTexels);
 
         // We'll also project the sky onto SH coefficients for use during rendering
         SH = SH9Color();
@@ -192,14 +302,22 @@ bool SkyCache::Init(const Float3& sunDirection_, float sunSize, const Float3& gr
 
                     SH += ProjectOntoSH9Color(dir, radiance) * weight;
                     weightSum += weight;
+
+                    // Use the luminance of what ends up in the FP16 texture, so that the PDFs match what gets sampled
+                    samplingWeights[idx] = ComputeLuminance(texels[idx].ToFloat3()) * weight;
                 }
             }
         }
 
         SH *= (4.0f * 3.14159f) / weightSum;
 
+        BuildAliasTable(samplingWeights, TexelProbabilities, AliasThresholds, AliasIndices);
+
         Create2DTexture(CubeMap, CubeMapRes, CubeMapRes, 1, 1, DXGI_FORMAT_R16G16B16A16_FLOAT, true, texels.Data());
 
+        CubeMapData.Init(uint32(CubeMapRes), uint32(CubeMapRes), 6);
+        memcpy(CubeMapData.Texels.Data(), texels.Data(), texels.MemorySize());
+
         SGSolveParams solveParams;
         solveParams.SampleDirs = sampleDirs.Data();
         solveParams.SampleValues = samples.Data();
@@ -235,6 +353,10 @@ void SkyCache::Shutdown()
     }
 
     CubeMap.Shutdown();
+    CubeMapData.Init(0, 0, 0);
+    TexelProbabilities.Shutdown();
+    AliasThresholds.Shutdown();
+    AliasIndices.Shutdown();
     Turbidity = 0.0f;
     Albedo = 0.0f;
     Elevation = 0.0f;
@@ -269,6 +391,58 @@ Float3 SkyCache::Sample(Float3 sampleDir) const
     return radiance * FP16Scale;
 }
 
+// Picks a cubemap texel from the alias table, and then a uniformly-distributed point on that texel
+Float3 SkyCache::SampleCubeMapDirection(Float2 u, float& pdf) const
+{
+    Assert_(CanSampleCubeMap());
+
+    const uint64 numTexels = AliasIndices.Size();
+    const float scaledU = u.x * numTexels;
+    uint64 texelIdx = Min(uint64(scaledU), numTexels - 1);
+    const float threshold = AliasThresholds[texelIdx];
+
+    // Re-use what's left of the random number for the position within the texel
+    float texelU = scaledU - texelIdx;
+    if(texelU < threshold)
+    {
+        texelU = texelU / threshold;
+    }
+    else
+    {
+        texelU = (texelU - threshold) / (1.0f - threshold);
+        texelIdx = AliasIndices[texelIdx];
+    }
+
+    const uint64 face = texelIdx / (CubeMapRes * CubeMapRes);
+    const uint64 y = (texelIdx / CubeMapRes) % CubeMapRes;
+    const uint64 x = texelIdx % CubeMapRes;
+
+    const float faceU = ((x + Saturate(texelU)) / CubeMapRes) * 2.0f - 1.0f;
+    const float faceV = 1.0f - ((y + u.y) / CubeMapRes) * 2.0f;
+
+    // Convert from a density on the face to a density over solid angle
+    const float temp = 1.0f + faceU * faceU + faceV * faceV;
+    pdf = TexelProbabilities[texelIdx] * (CubeMapRes * CubeMapRes / 4.0f) * temp * std::sqrt(temp);
+
+    return CubeFaceToDirection(faceU, faceV, face);
+}
+
+float SkyCache::CubeMapDirectionPDF(const Float3& dir) const
+{
+    Assert_(CanSampleCubeMap());
+
+    float faceU = 0.0f;
+    float faceV = 0.0f;
+    const uint64 face = DirectionToCubeFace(dir, faceU, faceV);
+
+    const uint64 x = Min(uint64(Saturate(faceU * 0.5f + 0.5f) * CubeMapRes), CubeMapRes - 1);
+    const uint64 y = Min(uint64(Saturate(0.5f - faceV * 0.5f) * CubeMapRes), CubeMapRes - 1);
+    const uint64 texelIdx = (face * CubeMapRes * CubeMapRes) + (y * CubeMapRes) + x;
+
+    const float temp = 1.0f + faceU * faceU + faceV * faceV;
+    return TexelProbabilities[texelIdx] * (CubeMapRes * CubeMapRes / 4.0f) * temp * std::sqrt(temp);
+}
+
 #endif // EnableSkyModel_
 
 // == Skybox ======================================================================================
@@ -15,6 +15,7 @@
 #include "..\\SF12_Math.h"
 #include "ShaderCompilation.h"
 #include "GraphicsTypes.h"
+#include "Textures.h"
 #include "SH.h"
 #include "SG.h"
 
@@ -41,9 +42,15 @@ struct SkyCache
     Float3 Albedo;
     float Elevation = 0.0f;
     Texture CubeMap;
+    TextureData<Half4> CubeMapData;     // CPU copy of the cubemap texels, for CPU ray tracing
     SH9Color SH;
     SG9 SG;
 
+    // Alias table for importance sampling the cubemap texels in proportion to luminance * solid angle
+    Array<float> TexelProbabilities;
+    Array<float> AliasThresholds;
+    Array<uint32> AliasIndices;
+
     bool Init(const Float3& sunDirection, float sunSize, const Float3& groundAlbedo, float turbidity, bool createCubemap);
     void Shutdown();
     ~SkyCache();
@@ -51,6 +58,11 @@ struct SkyCache
     bool Initialized() const { return StateR != nullptr; }
 
     Float3 Sample(Float3 sampleDir) const;
+
+    // Importance sampling of the cubemap, with PDFs with respect to solid angle
+    bool CanSampleCubeMap() const { return AliasIndices.Size() > 0; }
+    Float3 SampleCubeMapDirection(Float2 u, float& pdf) const;
+    float CubeMapDirectionPDF(const Float3& dir) const;
 };
 
 #endif // EnableSkyModel_
@@ -0,0 +1,320 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "SobolSampler.h"
+#include "Sampling.h"
+
+#include <immintrin.h>
+
+namespace SampleFramework12
+{
+
+// Generator matrix for the second Sobol dimension, as one column per bit of the sample index.
+// The first dimension is just the radical inverse, so it doesn't need one.
+static const uint32 SobolMatrix1[32] =
+{
+    0x80000000, 0xC0000000, 0xA0000000, 0xF0000000, 0x88000000, 0xCC000000, 0xAA000000, 0xFF000000,
+    0x80800000, 0xC0C00000, 0xA0A00000, 0xF0F00000, 0x88880000, 0xCCCC0000, 0xAAAA0000, 0xFFFF0000,
+    0x80008000, 0xC000C000, 0xA000A000, 0xF000F000, 0x88008800, 0xCC00CC00, 0xAA00AA00, 0xFF00FF00,
+    0x80808080, 0xC0C0C0C0, 0xA0A0A0A0, 0xF0F0F0F0, 0x88888888, 0xCCCCCCCC, 0xAAAAAAAA, 0xFFFFFFFF,
+};
+
+static uint32 ReverseBits(uint32 bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits;
+}
+
+// Integer hash with good avalanche behavior ("lowbias32" by Chris Wellons)
+static uint32 HashUInt32(uint32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32 HashCombine(uint32 seed, uint32 value)
+{
+    return seed ^ (HashUInt32(value) + (seed << 6) + (seed >> 2));
+}
+
+// Permutation where every bit only depends on the bits below it, which makes it an Owen scramble when
+// applied to bit-reversed values. Uses the improved constants from Nathan Vegdahl.
+static uint32 LaineKarrasPermutation(uint32 x, uint32 seed)
+{
+    x ^= x * 0x3D20ADEA;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526C56;
+    x ^= x * 0x53A22864;
+    return x;
+}
+
+static uint32 NestedUniformScramble(uint32 x, uint32 seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+static uint32 Sobol1(uint32 index)
+{
+    uint32 result = 0;
+    for(uint32 bit = 0; index != 0; index >>= 1, ++bit)
+    {
+        if(index & 1)
+            result ^= SobolMatrix1[bit];
+    }
+    return result;
+}
+
+// Converts to [0, 1) using the top 24 bits, since that's all that fits in a float
+static float ToUnitFloat(uint32 x)
+{
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+uint32 SobolSeed(uint32 pixelIdx, uint32 dimIdx)
+{
+    return HashUInt32(HashCombine(HashUInt32(pixelIdx), dimIdx));
+}
+
+Float2 SampleSobol2D(uint32 sampleIdx, uint32 seed)
+{
+    // Shuffling the index with an Owen scramble means that the first N samples are a random block of N
+    // consecutive points from the sequence, instead of always being the same ones. The first dimension is
+    // the radical inverse of the index, so its reversal and the scramble's reversal cancel out.
+    const uint32 index = NestedUniformScramble(sampleIdx, seed);
+    const uint32 x = ReverseBits(LaineKarrasPermutation(index, HashCombine(seed, 0)));
+    const uint32 y = NestedUniformScramble(Sobol1(index), HashCombine(seed, 1));
+    return Float2(ToUnitFloat(x), ToUnitFloat(y));
+}
+
+// 8-wide versions of the helpers above, for generating many dimensions at once
+static __m256i ReverseBits8(__m256i bits)
+{
+    const __m256i mask1 = _mm256_set1_epi32(0x55555555);
+    const __m256i mask2 = _mm256_set1_epi32(0x33333333);
+    const __m256i mask4 = _mm256_set1_epi32(0x0F0F0F0F);
+    const __m256i mask8 = _mm256_set1_epi32(0x00FF00FF);
+    bits = _mm256_or_si256(_mm256_slli_epi32(bits, 16), _mm256_srli_epi32(bits, 16));
+    bits = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(bits, mask1), 1), _mm256_and_si256(_mm256_srli_epi32(bits, 1), mask1));
+    bits = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(bits, mask2), 2), _mm256_and_si256(_mm256_srli_epi32(bits, 2), mask2));
+    bits = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(bits, mask4), 4), _mm256_and_si256(_mm256_srli_epi32(bits, 4), mask4));
+    bits = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(bits, mask8), 8), _mm256_and_si256(_mm256_srli_epi32(bits, 8), mask8));
+    return bits;
+}
+
+static __m256i HashUInt32_8(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7FEB352D));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(int32(0x846CA68B)));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return x;
+}
+
+static __m256i HashCombine8(__m256i seed, uint32 value)
+{
+    const __m256i valueHash = _mm256_set1_epi32(int32(HashUInt32(value)));
+    return _mm256_xor_si256(seed, _mm256_add_epi32(_mm256_add_epi32(valueHash, _mm256_slli_epi32(seed, 6)), _mm256_srli_epi32(seed, 2)));
+}
+
+static __m256i LaineKarrasPermutation8(__m256i x, __m256i seed)
+{
+    x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32(0x3D20ADEA)));
+    x = _mm256_add_epi32(x, seed);
+    x = _mm256_mullo_epi32(x, _mm256_or_si256(_mm256_srli_epi32(seed, 16), _mm256_set1_epi32(1)));
+    x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32(0x05526C56)));
+    x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32(0x53A22864)));
+    return x;
+}
+
+static __m256i Sobol1_8(__m256i index)
+{
+    __m256i result = _mm256_setzero_si256();
+    for(uint32 bit = 0; bit < 32; ++bit)
+    {
+        // Moves the bit to the top and smears it down into a mask
+        const __m256i bitMask = _mm256_srai_epi32(_mm256_slli_epi32(index, 31 - bit), 31);
+        result = _mm256_xor_si256(result, _mm256_and_si256(bitMask, _mm256_set1_epi32(int32(SobolMatrix1[bit]))));
+    }
+    return result;
+}
+
+void GenerateSobolSamples2D(Float2* samples, uint32 sampleIdx, uint32 pixelIdx, uint32 firstDimIdx, uint32 numDimensions)
+{
+    const __m256i pixelHash = _mm256_set1_epi32(int32(HashUInt32(pixelIdx)));
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 scale = _mm256_set1_ps(1.0f / 16777216.0f);
+
+    uint32 dimIdx = 0;
+    for(; dimIdx + 8 <= numDimensions; dimIdx += 8)
+    {
+        // Same as SobolSeed(), with one dimension per lane
+        const __m256i dims = _mm256_add_epi32(_mm256_set1_epi32(int32(firstDimIdx + dimIdx)), laneOffsets);
+        const __m256i dimHashes = HashUInt32_8(dims);
+        const __m256i seeds = HashUInt32_8(_mm256_xor_si256(pixelHash, _mm256_add_epi32(_mm256_add_epi32(dimHashes, _mm256_slli_epi32(pixelHash, 6)),
+                                                                                         _mm256_srli_epi32(pixelHash, 2))));
+
+        const __m256i index = ReverseBits8(LaineKarrasPermutation8(ReverseBits8(_mm256_set1_epi32(int32(sampleIdx))), seeds));
+        const __m256i x = ReverseBits8(LaineKarrasPermutation8(index, HashCombine8(seeds, 0)));
+        const __m256i y = ReverseBits8(LaineKarrasPermutation8(ReverseBits8(Sobol1_8(index)), HashCombine8(seeds, 1)));
+
+        const __m256 xf = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)), scale);
+        const __m256 yf = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(y, 8)), scale);
+
+        // Interleave into XY pairs
+        const __m256 lo = _mm256_unpacklo_ps(xf, yf);
+        const __m256 hi = _mm256_unpackhi_ps(xf, yf);
+        float* dst = &samples[dimIdx].x;
+        _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+
+    for(; dimIdx < numDimensions; ++dimIdx)
+        samples[dimIdx] = SampleSobol2D(sampleIdx, SobolSeed(pixelIdx, firstDimIdx + dimIdx));
+}
+
+// == SobolSampleTable ============================================================================
+
+bool SobolSampleTable::Initialize(uint32 tileSize_, uint32 numSamples_, uint32 numDimensions_, uint64 maxMemorySize)
+{
+    Shutdown();
+
+    const uint64 numTilePixels = uint64(tileSize_) * tileSize_;
+    const uint64 numEntries = numTilePixels * numSamples_ * numDimensions_;
+    if(numEntries == 0 || numEntries * sizeof(uint32) > maxMemorySize)
+        return false;
+
+    tileSize = tileSize_;
+    numSamples = numSamples_;
+    numDimensions = numDimensions_;
+    samples.Init(numEntries);
+
+    Array<Float2> dimSamples(numDimensions);
+    for(uint32 pixelIdx = 0; pixelIdx < numTilePixels; ++pixelIdx)
+    {
+        for(uint32 sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+        {
+            GenerateSobolSamples2D(dimSamples.Data(), sampleIdx, pixelIdx, 0, numDimensions);
+
+            uint32* dst = &samples[(uint64(pixelIdx) * numSamples + sampleIdx) * numDimensions];
+            for(uint32 dimIdx = 0; dimIdx < numDimensions; ++dimIdx)
+            {
+                const uint32 x = Min(uint32(dimSamples[dimIdx].x * 65536.0f), 0xFFFFu);
+                const uint32 y = Min(uint32(dimSamples[dimIdx].y * 65536.0f), 0xFFFFu);
+                dst[dimIdx] = x | (y << 16);
+            }
+        }
+    }
+
+    return true;
+}
+
+void SobolSampleTable::Shutdown()
+{
+    samples.Shutdown();
+    tileSize = 0;
+    numSamples = 0;
+    numDimensions = 0;
+}
+
+Float2 SobolSampleTable::Sample(uint32 pixelX, uint32 pixelY, uint32 sampleIdx, uint32 dimIdx) const
+{
+    Assert_(Contains(sampleIdx, dimIdx));
+
+    const uint32 tilePixelIdx = (pixelY % tileSize) * tileSize + (pixelX % tileSize);
+    const uint32 packed = samples[(uint64(tilePixelIdx) * numSamples + sampleIdx) * numDimensions + dimIdx];
+
+    // XOR-ing with a random value is a digital shift, which is a special case of an Owen scramble
+    const uint32 tileIdx = (pixelY / tileSize) << 16 | (pixelX / tileSize);
+    const uint32 shift = SobolSeed(tileIdx, dimIdx);
+    const uint32 x = (packed ^ shift) & 0xFFFF;
+    const uint32 y = (packed ^ shift) >> 16;
+    return Float2((x + 0.5f) * (1.0f / 65536.0f), (y + 0.5f) * (1.0f / 65536.0f));
+}
+
+// == Convergence test ============================================================================
+
+static const char* ConvergenceFunctionNames[SamplerConvergenceResult::NumFunctions] = { "Disk", "Triangle", "Gaussian", "Bilinear" };
+static const float GaussianSigma = 0.15f;
+
+const char* SamplerConvergenceFunctionName(uint32 functionIdx)
+{
+    Assert_(functionIdx < SamplerConvergenceResult::NumFunctions);
+    return ConvergenceFunctionNames[functionIdx];
+}
+
+static void EvaluateConvergenceFunctions(Float2 sample, double* values)
+{
+    const float dx = sample.x - 0.5f;
+    const float dy = sample.y - 0.5f;
+    values[0] += dx * dx + dy * dy < 0.2f ? 1.0 : 0.0;
+    values[1] += sample.x + sample.y < 1.0f ? 1.0 : 0.0;
+    values[2] += std::exp(-(dx * dx + dy * dy) / (2.0f * GaussianSigma * GaussianSigma));
+    values[3] += sample.x * sample.y;
+}
+
+void TestSamplerConvergence(uint32 maxSqrtNumSamples, uint32 numPatterns, Array<SamplerConvergenceResult>& results)
+{
+    const double gaussian1D = GaussianSigma * std::sqrt(2.0 * Pi) * std::erf(0.5 / (GaussianSigma * std::sqrt(2.0)));
+    const double references[SamplerConvergenceResult::NumFunctions] = { Pi * 0.2, 0.5, gaussian1D * gaussian1D, 0.25 };
+
+    uint32 numLevels = 0;
+    for(uint32 sqrtNumSamples = 1; sqrtNumSamples <= maxSqrtNumSamples; sqrtNumSamples *= 2)
+        ++numLevels;
+    results.Init(numLevels);
+
+    for(uint32 levelIdx = 0; levelIdx < numLevels; ++levelIdx)
+    {
+        const uint32 sqrtNumSamples = 1 << levelIdx;
+        const uint32 numSamples = sqrtNumSamples * sqrtNumSamples;
+
+        double cmjSquaredError[SamplerConvergenceResult::NumFunctions] = { };
+        double sobolSquaredError[SamplerConvergenceResult::NumFunctions] = { };
+        for(uint32 patternIdx = 0; patternIdx < numPatterns; ++patternIdx)
+        {
+            double cmjSums[SamplerConvergenceResult::NumFunctions] = { };
+            double sobolSums[SamplerConvergenceResult::NumFunctions] = { };
+            const uint32 seed = SobolSeed(patternIdx, 0);
+            for(uint32 sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+            {
+                EvaluateConvergenceFunctions(SampleCMJ2D(sampleIdx, sqrtNumSamples, sqrtNumSamples, patternIdx), cmjSums);
+                EvaluateConvergenceFunctions(SampleSobol2D(sampleIdx, seed), sobolSums);
+            }
+
+            for(uint32 i = 0; i < SamplerConvergenceResult::NumFunctions; ++i)
+            {
+                const double cmjError = cmjSums[i] / numSamples - references[i];
+                const double sobolError = sobolSums[i] / numSamples - references[i];
+                cmjSquaredError[i] += cmjError * cmjError;
+                sobolSquaredError[i] += sobolError * sobolError;
+            }
+        }
+
+        SamplerConvergenceResult& result = results[levelIdx];
+        result.NumSamples = numSamples;
+        for(uint32 i = 0; i < SamplerConvergenceResult::NumFunctions; ++i)
+        {
+            result.CMJError[i] = float(std::sqrt(cmjSquaredError[i] / Max(numPatterns, 1u)));
+            result.SobolError[i] = float(std::sqrt(sobolSquaredError[i] / Max(numPatterns, 1u)));
+        }
+    }
+}
+
+}
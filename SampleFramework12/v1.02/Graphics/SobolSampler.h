@@ -0,0 +1,75 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\Containers.h"
+#include "..\\SF12_Math.h"
+
+namespace SampleFramework12
+{
+
+// Owen-scrambled Sobol samples, using the padded 2D construction from "Practical Hash-based Owen
+// Scrambling" [Burley20]. Every 2D dimension of every pixel has its own seed, which picks both the
+// scramble and a shuffled order for the sample indices. Any power-of-2 run of samples starting at 0
+// is then a (0, m, 2)-net, without having to pick the sample count up front like CMJ does.
+uint32 SobolSeed(uint32 pixelIdx, uint32 dimIdx);
+Float2 SampleSobol2D(uint32 sampleIdx, uint32 seed);
+
+// Same as calling SampleSobol2D() with SobolSeed(pixelIdx, firstDimIdx + i) for every dimension,
+// but generates 8 dimensions at a time with AVX2
+void GenerateSobolSamples2D(Float2* samples, uint32 sampleIdx, uint32 pixelIdx, uint32 firstDimIdx, uint32 numDimensions);
+
+// Precomputed Sobol samples for a square tile of pixels, which gets repeated across the screen. Every
+// repetition gets a random digital shift per dimension, which keeps the samples scrambled without
+// needing a separate table for every tile. Samples are stored with 16 bits per component.
+class SobolSampleTable
+{
+
+public:
+
+    // Returns false without allocating anything if the table would need more than maxMemorySize bytes
+    bool Initialize(uint32 tileSize, uint32 numSamples, uint32 numDimensions, uint64 maxMemorySize);
+    void Shutdown();
+
+    uint32 TileSize() const { return tileSize; }
+    uint32 NumSamples() const { return numSamples; }
+    uint32 NumDimensions() const { return numDimensions; }
+    uint64 MemorySize() const { return samples.MemorySize(); }
+
+    bool Contains(uint32 sampleIdx, uint32 dimIdx) const { return sampleIdx < numSamples && dimIdx < numDimensions; }
+    Float2 Sample(uint32 pixelX, uint32 pixelY, uint32 sampleIdx, uint32 dimIdx) const;
+
+protected:
+
+    Array<uint32> samples;          // [pixel][sample][dimension], with X in the low 16 bits and Y in the high 16 bits
+    uint32 tileSize = 0;
+    uint32 numSamples = 0;
+    uint32 numDimensions = 0;
+};
+
+// RMS error from integrating a few analytic functions over the unit square, over many independent patterns
+struct SamplerConvergenceResult
+{
+    static const uint32 NumFunctions = 4;
+
+    uint32 NumSamples = 0;
+    float CMJError[NumFunctions] = { };
+    float SobolError[NumFunctions] = { };
+};
+
+// Names of the functions that SamplerConvergenceResult has errors for
+const char* SamplerConvergenceFunctionName(uint32 functionIdx);
+
+// Measures convergence with CMJ and Owen-scrambled Sobol at 1, 4, 16, ... samples, up to maxSqrtNumSamples^2
+void TestSamplerConvergence(uint32 maxSqrtNumSamples, uint32 numPatterns, Array<SamplerConvergenceResult>& results);
+
+}
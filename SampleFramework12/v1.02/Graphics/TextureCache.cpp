@@ -0,0 +1,450 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#include "PCH.h"
+
+#include "TextureCache.h"
+#include "BCDecoders.h"
+
+namespace SampleFramework12
+{
+
+static const uint32 InvalidSlot = uint32(-1);
+
+// Every TextureCache gets its own ID for tagging decoded blocks
+static std::atomic<uint32> NextCacheID = 0;
+
+// Small direct-mapped cache of recently decoded BC blocks, which every thread keeps for itself
+struct DecodedBlockCache
+{
+    static const uint32 NumEntriesLog2 = 10;
+    static const uint32 NumEntries = 1 << NumEntriesLog2;
+
+    Array<uint64> Keys;
+    Array<Float4> Texels;               // BCBlockNumTexels for every entry
+};
+
+static thread_local DecodedBlockCache decodedBlocks;
+
+// Spreads the low 16 bits out so that there's a zero bit between each of them
+static uint32 SpreadBits2D(uint32 x)
+{
+    x &= 0xFFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+static uint32 MortonCode2D(uint32 x, uint32 y)
+{
+    return SpreadBits2D(x) | (SpreadBits2D(y) << 1);
+}
+
+static uint32 NextPow2(uint32 x)
+{
+    uint32 result = 1;
+    while(result < x)
+        result *= 2;
+    return result;
+}
+
+void TextureCache::Shard::Unlink(uint32 slot)
+{
+    if(Prev[slot] != InvalidSlot)
+        Next[Prev[slot]] = Next[slot];
+    else
+        Head = Next[slot];
+
+    if(Next[slot] != InvalidSlot)
+        Prev[Next[slot]] = Prev[slot];
+    else
+        Tail = Prev[slot];
+}
+
+void TextureCache::Shard::PushFront(uint32 slot)
+{
+    Prev[slot] = InvalidSlot;
+    Next[slot] = Head;
+    if(Head != InvalidSlot)
+        Prev[Head] = slot;
+    Head = slot;
+    if(Tail == InvalidSlot)
+        Tail = slot;
+}
+
+void TextureCache::Initialize(const Array<TextureData<Float4>>& textureData, const Array<BCTextureData>& bcTextureData, uint64 cacheSizeInBytes)
+{
+    Shutdown();
+
+    textures.Init(textureData.Size());
+    cacheID = NextCacheID++;
+
+    uint32 numTiles = 0;
+    for(uint64 i = 0; i < textureData.Size(); ++i)
+    {
+        if(i < bcTextureData.Size() && bcTextureData[i].Blocks.Size() > 0)
+            InitCompressedMips(bcTextureData[i], textures[i]);
+        else
+            BuildMips(textureData[i], textures[i], numTiles);
+    }
+
+    tileSlots.Init(numTiles, InvalidSlot);
+
+    // There's no point in having more slots than there are tiles
+    const uint64 tileMemorySize = TileNumTexels * sizeof(Float4);
+    const uint64 numSlots = Min<uint64>(Max<uint64>(cacheSizeInBytes / tileMemorySize, NumShards), numTiles);
+    numSlotsPerShard = uint32((numSlots + NumShards - 1) / NumShards);
+
+    shards.Init(NumShards);
+    for(Shard& shard : shards)
+    {
+        shard.Texels.Init(uint64(numSlotsPerShard) * TileNumTexels);
+        shard.SlotTiles.Init(numSlotsPerShard, InvalidSlot);
+        shard.Prev.Init(numSlotsPerShard, InvalidSlot);
+        shard.Next.Init(numSlotsPerShard, InvalidSlot);
+    }
+}
+
+void TextureCache::Shutdown()
+{
+    textures.Shutdown();
+    tileSlots.Shutdown();
+    shards.Shutdown();
+    numSlotsPerShard = 0;
+}
+
+// 2x2 box filter, where the last row and column get repeated for odd sizes
+static void Downsample(const Array<Float4>& src, uint32 srcWidth, uint32 srcHeight, Array<Float4>& dst, uint32 dstWidth, uint32 dstHeight)
+{
+    dst.Init(uint64(dstWidth) * dstHeight);
+    for(uint32 y = 0; y < dstHeight; ++y)
+    {
+        const uint32 y0 = Min(y * 2, srcHeight - 1);
+        const uint32 y1 = Min(y * 2 + 1, srcHeight - 1);
+        for(uint32 x = 0; x < dstWidth; ++x)
+        {
+            const uint32 x0 = Min(x * 2, srcWidth - 1);
+            const uint32 x1 = Min(x * 2 + 1, srcWidth - 1);
+            const Float4 sum = src[y0 * srcWidth + x0] + src[y0 * srcWidth + x1] +
+                               src[y1 * srcWidth + x0] + src[y1 * srcWidth + x1];
+            dst[y * dstWidth + x] = sum * 0.25f;
+        }
+    }
+}
+
+// Generates the mip chain down to 1x1, and copies every level into its tiles
+void TextureCache::BuildMips(const TextureData<Float4>& textureData, TiledTexture& texture, uint32& numTiles) const
+{
+    uint32 width = Max(textureData.Width, 1u);
+    uint32 height = Max(textureData.Height, 1u);
+    texture.LODBias = 0.5f * std::log2(float(width) * float(height));
+
+    // Work out the layout of every level first, so that all of the tiles can go in one allocation
+    uint64 numTexels = 0;
+    texture.NumMips = 0;
+    while(texture.NumMips < MaxMips)
+    {
+        TileMip& mip = texture.Mips[texture.NumMips++];
+        mip.Width = width;
+        mip.Height = height;
+        mip.TileDim = Min(NextPow2(Max(width, height)), TileSize);
+        mip.NumTilesX = (width + mip.TileDim - 1) / mip.TileDim;
+        mip.FirstTile = numTiles;
+        mip.TexelOffset = numTexels;
+
+        const uint32 numTilesY = (height + mip.TileDim - 1) / mip.TileDim;
+        numTiles += mip.NumTilesX * numTilesY;
+        numTexels += uint64(mip.NumTilesX) * numTilesY * mip.TileDim * mip.TileDim;
+
+        if(width == 1 && height == 1)
+            break;
+
+        width = Max(width / 2, 1u);
+        height = Max(height / 2, 1u);
+    }
+
+    texture.Texels.Init(numTexels);
+
+    Array<Float4> levels[2];
+    uint32 currLevel = 0;
+    levels[currLevel].Init(uint64(texture.Mips[0].Width) * texture.Mips[0].Height, Float4(0.0f, 0.0f, 0.0f, 0.0f));
+    if(textureData.Texels.Size() >= levels[currLevel].Size())
+        memcpy(levels[currLevel].Data(), textureData.Texels.Data(), levels[currLevel].MemorySize());
+
+    for(uint32 mipLevel = 0; mipLevel < texture.NumMips; ++mipLevel)
+    {
+        const TileMip& mip = texture.Mips[mipLevel];
+        const Array<Float4>& mipTexels = levels[currLevel];
+        const uint32 numTilesY = (mip.Height + mip.TileDim - 1) / mip.TileDim;
+        const uint32 tileNumTexels = mip.TileDim * mip.TileDim;
+
+        for(uint32 tileY = 0; tileY < numTilesY; ++tileY)
+        {
+            for(uint32 tileX = 0; tileX < mip.NumTilesX; ++tileX)
+            {
+                Half4* tileTexels = &texture.Texels[mip.TexelOffset + uint64(tileY * mip.NumTilesX + tileX) * tileNumTexels];
+                for(uint32 y = 0; y < mip.TileDim; ++y)
+                {
+                    // Texels past the edge of the texture are never sampled, so they just get the edge texels
+                    const uint32 srcY = Min(tileY * mip.TileDim + y, mip.Height - 1);
+                    for(uint32 x = 0; x < mip.TileDim; ++x)
+                    {
+                        const uint32 srcX = Min(tileX * mip.TileDim + x, mip.Width - 1);
+                        tileTexels[MortonCode2D(x, y)] = Half4(mipTexels[srcY * mip.Width + srcX]);
+                    }
+                }
+            }
+        }
+
+        if(mipLevel + 1 < texture.NumMips)
+        {
+            const TileMip& nextMip = texture.Mips[mipLevel + 1];
+            Downsample(mipTexels, mip.Width, mip.Height, levels[currLevel ^ 1], nextMip.Width, nextMip.Height);
+            currLevel ^= 1;
+        }
+    }
+}
+
+// BC textures keep the mips from the DDS file, since generating new ones would need to re-encode them
+void TextureCache::InitCompressedMips(const BCTextureData& bcTextureData, TiledTexture& texture) const
+{
+    const uint32 width = Max(bcTextureData.Width, 1u);
+    const uint32 height = Max(bcTextureData.Height, 1u);
+    texture.LODBias = 0.5f * std::log2(float(width) * float(height));
+    texture.NumMips = Min(Max(bcTextureData.NumMips, 1u), MaxMips);
+    texture.BCFormat = bcTextureData.Format;
+    texture.BCBlockSize = BCBlockSize(bcTextureData.Format);
+    texture.SRGB = bcTextureData.SRGB;
+    Assert_(texture.BCBlockSize > 0);
+
+    for(uint32 mipLevel = 0; mipLevel < texture.NumMips; ++mipLevel)
+    {
+        TileMip& mip = texture.Mips[mipLevel];
+        mip.Width = Max(width >> mipLevel, 1u);
+        mip.Height = Max(height >> mipLevel, 1u);
+        mip.TileDim = BCBlockDim;
+        mip.NumTilesX = (mip.Width + BCBlockDim - 1) / BCBlockDim;
+        mip.TexelOffset = bcTextureData.MipOffsets[mipLevel];
+    }
+
+    texture.Blocks.Init(bcTextureData.Blocks.Size());
+    memcpy(texture.Blocks.Data(), bcTextureData.Blocks.Data(), bcTextureData.Blocks.MemorySize());
+}
+
+// Returns the decoded texels for a tile, decoding it into the least recently used slot if it isn't
+// already resident. The shard's lock must be held for as long as the texels are being read.
+const Float4* TextureCache::AcquireTile(Shard& shard, uint32 textureIdx, uint32 mipLevel, uint32 tileIdx) const
+{
+    const uint32 globalTileIdx = textures[textureIdx].Mips[mipLevel].FirstTile + tileIdx;
+    uint32 slot = tileSlots[globalTileIdx];
+    if(slot != InvalidSlot)
+    {
+        shard.NumHits += 1;
+        if(shard.Head != slot)
+        {
+            shard.Unlink(slot);
+            shard.PushFront(slot);
+        }
+    }
+    else
+    {
+        shard.NumMisses += 1;
+        if(shard.NumUsedSlots < numSlotsPerShard)
+        {
+            slot = shard.NumUsedSlots++;
+        }
+        else
+        {
+            slot = shard.Tail;
+            shard.Unlink(slot);
+            tileSlots[shard.SlotTiles[slot]] = InvalidSlot;
+            shard.NumEvictions += 1;
+        }
+
+        DecodeTile(textureIdx, mipLevel, tileIdx, &shard.Texels[uint64(slot) * TileNumTexels]);
+        shard.SlotTiles[slot] = globalTileIdx;
+        tileSlots[globalTileIdx] = slot;
+        shard.PushFront(slot);
+    }
+
+    return &shard.Texels[uint64(slot) * TileNumTexels];
+}
+
+void TextureCache::DecodeTile(uint32 textureIdx, uint32 mipLevel, uint32 tileIdx, Float4* dst) const
+{
+    const TiledTexture& texture = textures[textureIdx];
+    const TileMip& mip = texture.Mips[mipLevel];
+    const uint64 tileNumTexels = mip.TileDim * mip.TileDim;
+    const Half4* src = &texture.Texels[mip.TexelOffset + tileIdx * tileNumTexels];
+
+    DirectX::PackedVector::XMConvertHalfToFloatStream(reinterpret_cast<float*>(dst), sizeof(float),
+                                                      reinterpret_cast<const DirectX::PackedVector::HALF*>(src),
+                                                      sizeof(DirectX::PackedVector::HALF), tileNumTexels * 4);
+}
+
+// Returns the decoded texels for a BC block from the calling thread's decoded block cache, decoding it first
+// if it isn't there. The texels are only valid until the next call on the same thread.
+const Float4* TextureCache::AcquireBlock(uint32 textureIdx, uint32 mipLevel, uint32 blockIdx) const
+{
+    DecodedBlockCache& cache = decodedBlocks;
+    if(cache.Keys.Size() == 0)
+    {
+        cache.Keys.Init(DecodedBlockCache::NumEntries, uint64(-1));
+        cache.Texels.Init(uint64(DecodedBlockCache::NumEntries) * BCBlockNumTexels);
+    }
+
+    Assert_(textureIdx < (1 << 16));
+    Assert_(blockIdx < (1 << 24));
+    const uint64 key = (uint64(cacheID & 0xFFFFF) << 44) | (uint64(textureIdx) << 28) | (uint64(mipLevel) << 24) | blockIdx;
+    const uint64 entryIdx = (key * 0x9E3779B97F4A7C15ull) >> (64 - DecodedBlockCache::NumEntriesLog2);
+    Float4* texels = &cache.Texels[entryIdx * BCBlockNumTexels];
+    if(cache.Keys[entryIdx] == key)
+        return texels;
+
+    const TiledTexture& texture = textures[textureIdx];
+    const uint8* block = &texture.Blocks[texture.Mips[mipLevel].TexelOffset + uint64(blockIdx) * texture.BCBlockSize];
+    DecodeBCBlock(texture.BCFormat, block, texels);
+    if(texture.SRGB)
+    {
+        for(uint32 i = 0; i < BCBlockNumTexels; ++i)
+            texels[i] = Float4(SRGBToLinear(texels[i].To3D()), texels[i].w);
+    }
+
+    cache.Keys[entryIdx] = key;
+    numBlocksDecoded.fetch_add(1, std::memory_order_relaxed);
+    return texels;
+}
+
+Float4 TextureCache::SampleLevel(uint32 textureIdx, Float2 uv, uint32 mipLevel) const
+{
+    const TiledTexture& texture = textures[textureIdx];
+    mipLevel = Min(mipLevel, texture.NumMips - 1);
+    const TileMip& mip = texture.Mips[mipLevel];
+
+    Float2 texSize = Float2(float(mip.Width), float(mip.Height));
+    Float2 samplePos = Frac(uv - Float2(0.5f / texSize.x, 0.5f / texSize.y));
+    if(samplePos.x < 0.0f)
+        samplePos.x = 1.0f + samplePos.x;
+    if(samplePos.y < 0.0f)
+        samplePos.y = 1.0f + samplePos.y;
+    samplePos *= texSize;
+
+    const uint32 x0 = Min(uint32(samplePos.x), mip.Width - 1);
+    const uint32 y0 = Min(uint32(samplePos.y), mip.Height - 1);
+    const uint32 x1 = x0 + 1 < mip.Width ? x0 + 1 : 0;
+    const uint32 y1 = y0 + 1 < mip.Height ? y0 + 1 : 0;
+    const uint32 texelX[4] = { x0, x1, x0, x1 };
+    const uint32 texelY[4] = { y0, y0, y1, y1 };
+
+    uint32 tiles[4] = { };
+    uint32 tileTexels[4] = { };
+    for(uint32 i = 0; i < 4; ++i)
+    {
+        tiles[i] = (texelY[i] / mip.TileDim) * mip.NumTilesX + (texelX[i] / mip.TileDim);
+        tileTexels[i] = MortonCode2D(texelX[i] % mip.TileDim, texelY[i] % mip.TileDim);
+    }
+
+    // Usually all 4 texels come from the same tile, in which case it only gets looked up once
+    DirectX::XMVECTOR samples[4];
+    bool fetched[4] = { };
+    if(texture.BCFormat != DXGI_FORMAT_UNKNOWN)
+    {
+        for(uint32 i = 0; i < 4; ++i)
+        {
+            if(fetched[i])
+                continue;
+
+            const Float4* texels = AcquireBlock(textureIdx, mipLevel, tiles[i]);
+            for(uint32 j = i; j < 4; ++j)
+            {
+                if(tiles[j] == tiles[i])
+                {
+                    samples[j] = texels[(texelY[j] % BCBlockDim) * BCBlockDim + (texelX[j] % BCBlockDim)].ToSIMD();
+                    fetched[j] = true;
+                }
+            }
+        }
+    }
+
+    for(uint32 i = 0; i < 4; ++i)
+    {
+        if(fetched[i])
+            continue;
+
+        Shard& shard = shards[(mip.FirstTile + tiles[i]) % NumShards];
+        AcquireSRWLockExclusive(&shard.Lock);
+
+        const Float4* texels = AcquireTile(shard, textureIdx, mipLevel, tiles[i]);
+        for(uint32 j = i; j < 4; ++j)
+        {
+            if(tiles[j] == tiles[i])
+            {
+                samples[j] = texels[tileTexels[j]].ToSIMD();
+                fetched[j] = true;
+            }
+        }
+
+        ReleaseSRWLockExclusive(&shard.Lock);
+    }
+
+    const Float2 lerpAmts = Float2(Frac(samplePos.x), Frac(samplePos.y));
+    return Float4(DirectX::XMVectorLerp(DirectX::XMVectorLerp(samples[0], samples[1], lerpAmts.x),
+                                        DirectX::XMVectorLerp(samples[2], samples[3], lerpAmts.x), lerpAmts.y));
+}
+
+Float4 TextureCache::Sample(uint32 textureIdx, Float2 uv, float lod) const
+{
+    const uint32 numMips = textures[textureIdx].NumMips;
+    lod = Clamp(lod, 0.0f, float(numMips - 1));
+
+    const uint32 mipLevel = uint32(lod);
+    const float mipLerp = lod - float(mipLevel);
+    if(mipLerp <= 0.0f || mipLevel + 1 >= numMips)
+        return SampleLevel(textureIdx, uv, mipLevel);
+
+    const Float4 sample0 = SampleLevel(textureIdx, uv, mipLevel);
+    const Float4 sample1 = SampleLevel(textureIdx, uv, mipLevel + 1);
+    return Float4(DirectX::XMVectorLerp(sample0.ToSIMD(), sample1.ToSIMD(), mipLerp));
+}
+
+TextureCacheStats TextureCache::Stats() const
+{
+    TextureCacheStats stats;
+    for(const TiledTexture& texture : textures)
+    {
+        stats.SourceMemorySize += texture.Texels.MemorySize();
+        stats.CompressedMemorySize += texture.Blocks.MemorySize();
+    }
+    stats.NumBlocksDecoded = numBlocksDecoded;
+
+    for(const Shard& shard : shards)
+    {
+        stats.NumHits += shard.NumHits;
+        stats.NumMisses += shard.NumMisses;
+        stats.NumEvictions += shard.NumEvictions;
+        stats.CacheMemorySize += shard.Texels.MemorySize();
+    }
+
+    return stats;
+}
+
+void TextureCache::ResetStats()
+{
+    numBlocksDecoded = 0;
+    for(Shard& shard : shards)
+    {
+        shard.NumHits = 0;
+        shard.NumMisses = 0;
+        shard.NumEvictions = 0;
+    }
+}
+
+}
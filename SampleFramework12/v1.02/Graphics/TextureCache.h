@@ -0,0 +1,146 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#pragma once
+
+#include "..\\PCH.h"
+
+#include "..\\Containers.h"
+#include "..\\SF12_Math.h"
+#include "Textures.h"
+
+#include <atomic>
+
+namespace SampleFramework12
+{
+
+struct TextureCacheStats
+{
+    uint64 NumHits = 0;
+    uint64 NumMisses = 0;
+    uint64 NumEvictions = 0;
+    uint64 NumBlocksDecoded = 0;    // BC blocks that missed in the per-thread decoded block caches
+    uint64 SourceMemorySize = 0;    // Tiled mip chains for uncompressed textures, in bytes
+    uint64 CompressedMemorySize = 0;// BC mip chains, in bytes
+    uint64 CacheMemorySize = 0;     // Decoded tile slots, in bytes
+};
+
+// CPU texture storage for ray tracing, where every texture gets a full mip chain that's split up into
+// square tiles with their texels in Morton order. Texels are stored at half precision, and decoded to
+// full precision one tile at a time into a fixed-size pool of tile slots that all threads share.
+// The tile slots are split into shards that each have their own lock and LRU list, so that threads
+// that are working on different tiles don't have to wait for each other.
+// Textures that were loaded from BC-compressed DDS files skip the tiles entirely, and are sampled straight
+// from their compressed mips. Every thread decodes the blocks that it touches into its own small cache of
+// decoded blocks, which means that those lookups never need to take a lock.
+class TextureCache
+{
+
+public:
+
+    static const uint32 TileSize = 64;
+    static const uint32 TileNumTexels = TileSize * TileSize;
+    static const uint32 NumShards = 64;
+
+    ~TextureCache()
+    {
+        Assert_(textures.Size() == 0);
+    }
+
+    // Generates the tiled mip chains from the first slice of every texture, except for the ones that have
+    // compressed blocks in bcTextureData which get used as-is. The source textures aren't needed after this returns.
+    void Initialize(const Array<TextureData<Float4>>& textureData, const Array<BCTextureData>& bcTextureData, uint64 cacheSizeInBytes);
+    void Shutdown();
+
+    // Trilinear lookup with wrap addressing, where lod is the mip level to sample
+    Float4 Sample(uint32 textureIdx, Float2 uv, float lod) const;
+
+    // Bilinear lookup from a single mip level
+    Float4 SampleLevel(uint32 textureIdx, Float2 uv, uint32 mipLevel) const;
+
+    uint32 NumTextures() const { return uint32(textures.Size()); }
+    uint32 Width(uint32 textureIdx) const { return textures[textureIdx].Mips[0].Width; }
+    uint32 Height(uint32 textureIdx) const { return textures[textureIdx].Mips[0].Height; }
+    uint32 NumMips(uint32 textureIdx) const { return textures[textureIdx].NumMips; }
+    bool IsCompressed(uint32 textureIdx) const { return textures[textureIdx].BCFormat != DXGI_FORMAT_UNKNOWN; }
+
+    // log2(sqrt(width * height)), which converts a UV-space footprint to a mip level
+    float LODBias(uint32 textureIdx) const { return textures[textureIdx].LODBias; }
+
+    // Only accurate while no other thread is sampling
+    TextureCacheStats Stats() const;
+    void ResetStats();
+
+    static const uint32 MaxMips = 16;
+
+protected:
+
+    // For BC textures the tiles are the 4x4 blocks, and TexelOffset is the offset of the mip's first block in bytes
+    struct TileMip
+    {
+        uint32 Width = 0;
+        uint32 Height = 0;
+        uint32 TileDim = 0;             // Smaller than TileSize for mips that fit in a single tile
+        uint32 NumTilesX = 0;
+        uint32 FirstTile = 0;           // Index into tileSlots
+        uint64 TexelOffset = 0;         // Offset of the first tile in the texture's texels
+    };
+
+    struct TiledTexture
+    {
+        Array<Half4> Texels;
+        Array<uint8> Blocks;            // Only used for BC textures
+        TileMip Mips[MaxMips];
+        uint32 NumMips = 0;
+        float LODBias = 0.0f;
+        DXGI_FORMAT BCFormat = DXGI_FORMAT_UNKNOWN;
+        uint32 BCBlockSize = 0;
+        bool SRGB = false;
+    };
+
+    struct alignas(64) Shard
+    {
+        SRWLOCK Lock = SRWLOCK_INIT;
+        Array<Float4> Texels;           // TileNumTexels for every slot
+        Array<uint32> SlotTiles;        // Tile that's resident in each slot, or uint32(-1)
+        Array<uint32> Prev;             // LRU list links, with the most recently used slot at the head
+        Array<uint32> Next;
+        uint32 Head = uint32(-1);
+        uint32 Tail = uint32(-1);
+        uint32 NumUsedSlots = 0;
+
+        uint64 NumHits = 0;
+        uint64 NumMisses = 0;
+        uint64 NumEvictions = 0;
+
+        void Unlink(uint32 slot);
+        void PushFront(uint32 slot);
+    };
+
+    void BuildMips(const TextureData<Float4>& textureData, TiledTexture& texture, uint32& numTiles) const;
+    void InitCompressedMips(const BCTextureData& bcTextureData, TiledTexture& texture) const;
+    const Float4* AcquireTile(Shard& shard, uint32 textureIdx, uint32 mipLevel, uint32 tileIdx) const;
+    void DecodeTile(uint32 textureIdx, uint32 mipLevel, uint32 tileIdx, Float4* dst) const;
+    const Float4* AcquireBlock(uint32 textureIdx, uint32 mipLevel, uint32 blockIdx) const;
+
+    Array<TiledTexture> textures;
+
+    // Slot for every tile of every texture, or uint32(-1) if it isn't resident. Entries are only
+    // accessed while holding the lock of the tile's shard.
+    mutable Array<uint32> tileSlots;
+    mutable Array<Shard> shards;
+    uint32 numSlotsPerShard = 0;
+
+    // Tags the entries in the per-thread decoded block caches, so that they never return blocks from a
+    // previous Initialize() call
+    uint32 cacheID = 0;
+    mutable std::atomic<uint64> numBlocksDecoded = 0;
+};
+
+}
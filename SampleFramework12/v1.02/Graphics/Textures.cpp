@@ -17,10 +17,15 @@
 #include "GraphicsTypes.h"
 #include "TinyEXR.h"
 #include "DX12.h"
+#include "BCDecoders.h"
+#include "..\\EnkiTS\\TaskScheduler.h"
 
 namespace SampleFramework12
 {
 
+// Upload memory for one batch of LoadTextures(), which is half of the upload ring buffer
+static const uint64 MaxTextureUploadBatchSize = 32 * 1024 * 1024;
+
 // Returns the number of mip levels given a texture size
 static uint64 NumMipLevels(uint64 width, uint64 height, uint64 depth = 1)
 {
@@ -35,14 +40,13 @@ static uint64 NumMipLevels(uint64 width, uint64 height, uint64 depth = 1)
     return numMips;
 }
 
-void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
+// Loads a texture file into system memory, and generates mips for formats that don't store them. This
+// doesn't touch the device, so it's safe to call from several threads at once.
+static void DecodeTextureFile(const wchar* filePath, DirectX::ScratchImage& image)
 {
-    texture.Shutdown();
     if(FileExists(filePath) == false)
         throw Exception(MakeString(L"Texture file with path '%ls' does not exist", filePath));
 
-    DirectX::ScratchImage image;
-
     const std::wstring extension = GetFileExtension(filePath);
     if(extension == L"DDS" || extension == L"dds")
     {
@@ -60,6 +64,12 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
         DXCall(DirectX::LoadFromWICFile(filePath, DirectX::WIC_FLAGS_NONE, nullptr, tempImage));
         DXCall(DirectX::GenerateMipMaps(*tempImage.GetImage(0, 0, 0), DirectX::TEX_FILTER_DEFAULT, 0, image, false));
     }
+}
+
+// Creates the resource and SRV for a decoded image, and returns how much upload memory its data needs
+static uint64 CreateTextureFromImage(Texture& texture, const DirectX::ScratchImage& image, const wchar* name, bool forceSRGB)
+{
+    texture.Shutdown();
 
     const DirectX::TexMetadata& metaData = image.GetMetadata();
     DXGI_FORMAT format = metaData.format;
@@ -84,7 +94,7 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
     ID3D12Device* device = DX12::Device;
     DXCall(device->CreateCommittedResource(DX12::GetDefaultHeapProps(), D3D12_HEAP_FLAG_NONE, &textureDesc,
                                            D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&texture.Resource)));
-    texture.Resource->SetName(filePath);
+    texture.Resource->SetName(name);
 
     PersistentDescriptorAlloc srvAlloc = DX12::SRVDescriptorHeap.AllocatePersistent();
     texture.SRV = srvAlloc.Index;
@@ -105,6 +115,29 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
     for(uint32 i = 0; i < DX12::SRVDescriptorHeap.NumHeaps; ++i)
         device->CreateShaderResourceView(texture.Resource, srvDescPtr, srvAlloc.Handles[i]);
 
+    texture.Width = uint32(metaData.width);
+    texture.Height = uint32(metaData.height);
+    texture.Depth = uint32(metaData.depth);
+    texture.NumMips = uint32(metaData.mipLevels);
+    texture.ArraySize = uint32(metaData.arraySize);
+    texture.Format = metaData.format;
+    texture.Cubemap = metaData.IsCubemap() ? 1 : 0;
+
+    const uint64 numSubResources = metaData.mipLevels * metaData.arraySize;
+    uint64 textureMemSize = 0;
+    device->GetCopyableFootprints(&textureDesc, 0, uint32(numSubResources), 0, nullptr, nullptr, nullptr, &textureMemSize);
+
+    return textureMemSize;
+}
+
+// Copies every subresource of a decoded image into upload memory, and records the copies into the texture
+static void UploadImage(const Texture& texture, const DirectX::ScratchImage& image, ID3D12GraphicsCommandList* cmdList,
+                        ID3D12Resource* uploadResource, uint8* uploadMem, uint64 resourceOffset)
+{
+    ID3D12Device* device = DX12::Device;
+    D3D12_RESOURCE_DESC textureDesc = texture.Resource->GetDesc();
+    const DirectX::TexMetadata& metaData = image.GetMetadata();
+
     const uint64 numSubResources = metaData.mipLevels * metaData.arraySize;
     D3D12_PLACED_SUBRESOURCE_FOOTPRINT* layouts = (D3D12_PLACED_SUBRESOURCE_FOOTPRINT*)_alloca(sizeof(D3D12_PLACED_SUBRESOURCE_FOOTPRINT) * numSubResources);
     uint32* numRows = (uint32*)_alloca(sizeof(uint32) * numSubResources);
@@ -113,10 +146,6 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
     uint64 textureMemSize = 0;
     device->GetCopyableFootprints(&textureDesc, 0, uint32(numSubResources), 0, layouts, numRows, rowSizes, &textureMemSize);
 
-    // Get a GPU upload buffer
-    UploadContext uploadContext = DX12::ResourceUploadBegin(textureMemSize);
-    uint8* uploadMem = reinterpret_cast<uint8*>(uploadContext.CPUAddress);
-
     for(uint64 arrayIdx = 0; arrayIdx < metaData.arraySize; ++arrayIdx)
     {
 
@@ -128,7 +157,7 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
             const uint64 subResourceHeight = numRows[subResourceIdx];
             const uint64 subResourcePitch = subResourceLayout.Footprint.RowPitch;
             const uint64 subResourceDepth = subResourceLayout.Footprint.Depth;
-            uint8* dstSubResourceMem = reinterpret_cast<uint8*>(uploadMem) + subResourceLayout.Offset;
+            uint8* dstSubResourceMem = uploadMem + subResourceLayout.Offset;
 
             for(uint64 z = 0; z < subResourceDepth; ++z)
             {
@@ -153,22 +182,135 @@ void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
         dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
         dst.SubresourceIndex = uint32(subResourceIdx);
         D3D12_TEXTURE_COPY_LOCATION src = { };
-        src.pResource = uploadContext.Resource;
+        src.pResource = uploadResource;
         src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
         src.PlacedFootprint = layouts[subResourceIdx];
-        src.PlacedFootprint.Offset += uploadContext.ResourceOffset;
-        uploadContext.CmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+        src.PlacedFootprint.Offset += resourceOffset;
+        cmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
     }
+}
 
-    DX12::ResourceUploadEnd(uploadContext);
+void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB)
+{
+    TextureLoadDesc loadDesc;
+    loadDesc.Texture = &texture;
+    loadDesc.FilePath = filePath;
+    loadDesc.ForceSRGB = forceSRGB;
+    LoadTextures(&loadDesc, 1);
+}
 
-    texture.Width = uint32(metaData.width);
-    texture.Height = uint32(metaData.height);
-    texture.Depth = uint32(metaData.depth);
-    texture.NumMips = uint32(metaData.mipLevels);
-    texture.ArraySize = uint32(metaData.arraySize);
-    texture.Format = metaData.format;
-    texture.Cubemap = metaData.IsCubemap() ? 1 : 0;
+void LoadTextures(const TextureLoadDesc* loadDescs, uint64 numTextures, enki::TaskScheduler* scheduler)
+{
+    if(numTextures == 0)
+        return;
+
+    // The files get decoded and their mips built on the worker threads, a group at a time with one texture
+    // for every thread. While a group decodes, the calling thread uploads the group before it. Decoded
+    // textures wait until they fill up a batch, which then goes up with its own command list and fence and
+    // frees its images once they've been copied into upload memory. This keeps roughly one batch and two
+    // groups of decoded images in memory, no matter how many textures are being loaded.
+    const uint64 decodeGroupSize = scheduler != nullptr ? Max<uint64>(scheduler->GetNumTaskThreads(), 1) : 1;
+
+    Array<DirectX::ScratchImage> images(numTextures);
+    Array<std::wstring> errors(numTextures);
+    Array<uint64> uploadSizes(numTextures);
+
+    // Exceptions can't cross the task scheduler, so each decode holds on to its error message until its group has finished
+    auto decodeTexture = [&](uint64 texIdx)
+    {
+        try
+        {
+            DecodeTextureFile(loadDescs[texIdx].FilePath, images[texIdx]);
+        }
+        catch(const Exception& e)
+        {
+            errors[texIdx] = e.GetMessage();
+        }
+    };
+
+    enki::TaskSet decodeTask;
+    auto startDecode = [&](uint64 groupStart)
+    {
+        const uint64 groupEnd = Min(groupStart + decodeGroupSize, numTextures);
+        if(scheduler == nullptr)
+        {
+            for(uint64 texIdx = groupStart; texIdx < groupEnd; ++texIdx)
+                decodeTexture(texIdx);
+            return;
+        }
+
+        decodeTask.m_SetSize = uint32(groupEnd - groupStart);
+        decodeTask.m_Function = [&, groupStart](enki::TaskSetPartition range, uint32_t threadNum)
+        {
+            // WIC needs COM to be initialized on every thread that uses it. This fails harmlessly on
+            // the calling thread, which already has it.
+            const HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+            for(uint32 i = range.start; i < range.end; ++i)
+                decodeTexture(groupStart + i);
+
+            if(SUCCEEDED(comResult))
+                CoUninitialize();
+        };
+
+        scheduler->AddTaskSetToPipe(&decodeTask);
+    };
+
+    startDecode(0);
+
+    uint64 batchStart = 0;
+    for(uint64 groupStart = 0; groupStart < numTextures; groupStart += decodeGroupSize)
+    {
+        const uint64 groupEnd = Min(groupStart + decodeGroupSize, numTextures);
+        if(scheduler != nullptr)
+            scheduler->WaitforTaskSet(&decodeTask);
+
+        for(uint64 texIdx = groupStart; texIdx < groupEnd; ++texIdx)
+            if(errors[texIdx].length() > 0)
+                throw Exception(errors[texIdx]);
+
+        // Resources get created on this thread, since descriptor allocation isn't thread-safe
+        for(uint64 texIdx = groupStart; texIdx < groupEnd; ++texIdx)
+        {
+            const TextureLoadDesc& loadDesc = loadDescs[texIdx];
+            const uint64 uploadSize = CreateTextureFromImage(*loadDesc.Texture, images[texIdx], loadDesc.FilePath, loadDesc.ForceSRGB);
+            uploadSizes[texIdx] = AlignTo(uploadSize, uint64(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT));
+        }
+
+        // Kick off the next group before uploading, so that the worker threads decode it in the meantime
+        const bool lastGroup = groupEnd == numTextures;
+        if(lastGroup == false)
+            startDecode(groupEnd);
+
+        while(batchStart < groupEnd)
+        {
+            // A texture that's bigger than the batch size on its own gets a batch to itself
+            uint64 batchEnd = batchStart + 1;
+            uint64 batchSize = uploadSizes[batchStart];
+            while(batchEnd < groupEnd && batchSize + uploadSizes[batchEnd] <= MaxTextureUploadBatchSize)
+                batchSize += uploadSizes[batchEnd++];
+
+            // A batch that still has room waits for the next group, unless there's nothing left to decode
+            if(batchEnd == groupEnd && batchSize < MaxTextureUploadBatchSize && lastGroup == false)
+                break;
+
+            UploadContext uploadContext = DX12::ResourceUploadBegin(batchSize);
+            uint8* uploadMem = reinterpret_cast<uint8*>(uploadContext.CPUAddress);
+
+            uint64 batchOffset = 0;
+            for(uint64 texIdx = batchStart; texIdx < batchEnd; ++texIdx)
+            {
+                UploadImage(*loadDescs[texIdx].Texture, images[texIdx], uploadContext.CmdList, uploadContext.Resource,
+                            uploadMem + batchOffset, uploadContext.ResourceOffset + batchOffset);
+                images[texIdx].Release();
+                batchOffset += uploadSizes[texIdx];
+            }
+
+            DX12::ResourceUploadEnd(uploadContext);
+
+            batchStart = batchEnd;
+        }
+    }
 }
 
 void Create2DTexture(Texture& texture, uint64 width, uint64 height, uint64 numMips,
@@ -443,6 +585,123 @@ void GetTextureData(const Texture& texture, TextureData<Float4>& textureData)
     GetTextureData(texture, DXGI_FORMAT_R32G32B32A32_FLOAT, textureData);
 }
 
+// Loads a texture file and decodes its top-level mip into 32-bit floats on the CPU, without creating any GPU resources
+void LoadTextureData(const wchar* filePath, TextureData<Float4>& textureData, bool forceSRGB)
+{
+    if(FileExists(filePath) == false)
+        throw Exception(MakeString(L"Texture file with path '%ls' does not exist", filePath));
+
+    const std::wstring extension = GetFileExtension(filePath);
+    if(extension == L"EXR" || extension == L"exr")
+    {
+        // EXR files are already linear floats, which WIC doesn't know how to load
+        std::string filePathAnsi = WStringToAnsi(filePath);
+
+        float* texels = nullptr;
+        int width = 0;
+        int height = 0;
+        const char* errorString = nullptr;
+        if(LoadEXR(&texels, &width, &height, filePathAnsi.c_str(), &errorString) != 0)
+            throw Exception(MakeString(L"Failed to load EXR file '%ls': %ls", filePath, AnsiToWString(errorString ? errorString : "").c_str()));
+
+        textureData.Init(uint32(width), uint32(height), 1);
+        memcpy(textureData.Texels.Data(), texels, textureData.Texels.MemorySize());
+        free(texels);
+        return;
+    }
+
+    DirectX::ScratchImage image;
+
+    if(extension == L"DDS" || extension == L"dds")
+        DXCall(DirectX::LoadFromDDSFile(filePath, DirectX::DDS_FLAGS_NONE, nullptr, image));
+    else if(extension == L"TGA" || extension == L"tga")
+        DXCall(DirectX::LoadFromTGAFile(filePath, nullptr, image));
+    else
+        DXCall(DirectX::LoadFromWICFile(filePath, DirectX::WIC_FLAGS_NONE, nullptr, image));
+
+    const DirectX::TexMetadata& metaData = image.GetMetadata();
+    Assert_(metaData.dimension != DirectX::TEX_DIMENSION_TEXTURE3D);
+
+    const uint32 width = uint32(metaData.width);
+    const uint32 height = uint32(metaData.height);
+    const uint32 numSlices = uint32(metaData.arraySize);
+    textureData.Init(width, height, numSlices);
+
+    const DXGI_FORMAT dstFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    for(uint32 sliceIdx = 0; sliceIdx < numSlices; ++sliceIdx)
+    {
+        // Patch the format so that DirectXTex does the sRGB -> linear conversion, same as the texture sampler would
+        DirectX::Image srcImage = *image.GetImage(0, sliceIdx, 0);
+        if(forceSRGB)
+            srcImage.format = DirectX::MakeSRGB(srcImage.format);
+
+        DirectX::ScratchImage decodedImage;
+        const DirectX::Image* dstImage = &srcImage;
+        if(DirectX::IsCompressed(srcImage.format))
+        {
+            DXCall(DirectX::Decompress(srcImage, dstFormat, decodedImage));
+            dstImage = decodedImage.GetImage(0, 0, 0);
+        }
+        else if(srcImage.format != dstFormat)
+        {
+            DXCall(DirectX::Convert(srcImage, dstFormat, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, decodedImage));
+            dstImage = decodedImage.GetImage(0, 0, 0);
+        }
+
+        Float4* dstTexels = &textureData.Texels[sliceIdx * width * height];
+        for(uint32 y = 0; y < height; ++y)
+            memcpy(dstTexels + y * width, dstImage->pixels + y * dstImage->rowPitch, width * sizeof(Float4));
+    }
+}
+
+// Loads the compressed blocks for every mip of the first slice of a DDS file, without decoding them
+bool LoadBCTextureData(const wchar* filePath, BCTextureData& textureData, bool forceSRGB)
+{
+    if(FileExists(filePath) == false)
+        throw Exception(MakeString(L"Texture file with path '%ls' does not exist", filePath));
+
+    const std::wstring extension = GetFileExtension(filePath);
+    if(extension != L"DDS" && extension != L"dds")
+        return false;
+
+    // Check the header first, so that unsupported files don't get loaded twice
+    DirectX::TexMetadata metaData;
+    DXCall(DirectX::GetMetadataFromDDSFile(filePath, DirectX::DDS_FLAGS_NONE, metaData));
+    const uint32 blockSize = BCBlockSize(metaData.format);
+    if(metaData.dimension != DirectX::TEX_DIMENSION_TEXTURE2D || blockSize == 0)
+        return false;
+
+    DirectX::ScratchImage image;
+    DXCall(DirectX::LoadFromDDSFile(filePath, DirectX::DDS_FLAGS_NONE, nullptr, image));
+
+    textureData.Width = uint32(metaData.width);
+    textureData.Height = uint32(metaData.height);
+    textureData.NumMips = std::min(uint32(metaData.mipLevels), uint32(BCTextureData::MaxMips));
+    textureData.Format = metaData.format;
+    textureData.SRGB = forceSRGB || DirectX::IsSRGB(metaData.format);
+
+    uint64 numBytes = 0;
+    for(uint32 mipLevel = 0; mipLevel < textureData.NumMips; ++mipLevel)
+    {
+        const DirectX::Image& mipImage = *image.GetImage(mipLevel, 0, 0);
+        textureData.MipOffsets[mipLevel] = numBytes;
+        numBytes += ((mipImage.width + 3) / 4) * ((mipImage.height + 3) / 4) * blockSize;
+    }
+
+    textureData.Blocks.Init(numBytes);
+    for(uint32 mipLevel = 0; mipLevel < textureData.NumMips; ++mipLevel)
+    {
+        const DirectX::Image& mipImage = *image.GetImage(mipLevel, 0, 0);
+        const uint64 rowSize = ((mipImage.width + 3) / 4) * blockSize;
+        const uint64 numRows = (mipImage.height + 3) / 4;
+        uint8* dstBlocks = &textureData.Blocks[textureData.MipOffsets[mipLevel]];
+        for(uint64 row = 0; row < numRows; ++row)
+            memcpy(dstBlocks + row * rowSize, mipImage.pixels + row * mipImage.rowPitch, rowSize);
+    }
+
+    return true;
+}
+
 void Create2DTexture(Texture& texture, const TextureData<UByte4N>& textureData, bool srgb)
 {
     Assert_(textureData.Texels.Size() > 0);
@@ -15,6 +15,11 @@
 #include "..\\Serialization.h"
 #include "GraphicsTypes.h"
 
+namespace enki
+{
+    class TaskScheduler;
+}
+
 namespace SampleFramework12
 {
 
@@ -24,8 +29,18 @@ struct UByte4N;
 struct UShort4N;
 class File;
 
-// Texture loading and creation
+struct TextureLoadDesc
+{
+    Texture* Texture = nullptr;
+    const wchar* FilePath = nullptr;
+    bool ForceSRGB = false;
+};
+
+// Texture loading and creation. LoadTextures() decodes the files and generates their mips in parallel
+// when it's given a task scheduler, and uploads them in batches from the calling thread while the next
+// ones are decoding.
 void LoadTexture(Texture& texture, const wchar* filePath, bool forceSRGB = false);
+void LoadTextures(const TextureLoadDesc* loadDescs, uint64 numTextures, enki::TaskScheduler* scheduler = nullptr);
 void Create2DTexture(Texture& texture, uint64 width, uint64 height, uint64 numMips,
                      uint64 arraySize, DXGI_FORMAT format, bool cubeMap, const void* initData);
 void Create3DTexture(Texture& texture, uint64 width, uint64 height, uint64 depth, uint64 numMips,
@@ -70,6 +85,27 @@ void GetTextureData(const Texture& texture, TextureData<UShort4N>& textureData);
 void GetTextureData(const Texture& texture, TextureData<Half4>& textureData);
 void GetTextureData(const Texture& texture, TextureData<Float4>& textureData);
 
+// Decode a texture file directly on the CPU, without going through the GPU
+void LoadTextureData(const wchar* filePath, TextureData<Float4>& textureData, bool forceSRGB = false);
+
+// Compressed mip chain from the first slice of a DDS file, for sampling BC textures on the CPU without decoding them up front
+struct BCTextureData
+{
+    static const uint32 MaxMips = 16;
+
+    Array<uint8> Blocks;            // Every mip, one after another
+    uint64 MipOffsets[MaxMips] = { };
+    uint32 Width = 0;
+    uint32 Height = 0;
+    uint32 NumMips = 0;
+    DXGI_FORMAT Format = DXGI_FORMAT_UNKNOWN;
+    bool SRGB = false;              // RGB needs to be converted to linear after decoding
+};
+
+// Loads the blocks of a DDS file as-is. Returns false for files that aren't in one of the BC formats
+// that DecodeBCBlock() supports, which need to go through LoadTextureData() instead.
+bool LoadBCTextureData(const wchar* filePath, BCTextureData& textureData, bool forceSRGB = false);
+
 void SaveTextureAsDDS(const Texture& texture, const wchar* filePath);
 void SaveTextureAsEXR(const Texture& texture, const wchar* filePath);
 void SaveTextureAsEXR(const TextureData<Float4>& texture, const wchar* filePath);
@@ -20,6 +20,7 @@ typedef Microsoft::WRL::ComPtr<ID3DBlob> ID3DBlobPtr;
 // DXGI
 typedef Microsoft::WRL::ComPtr<IDXGIAdapter> IDXGIAdapterPtr;
 typedef Microsoft::WRL::ComPtr<IDXGIAdapter1> IDXGIAdapter1Ptr;
+typedef Microsoft::WRL::ComPtr<IDXGIAdapter3> IDXGIAdapter3Ptr;
 typedef Microsoft::WRL::ComPtr<IDXGIDevice> IDXGIDevicePtr;
 typedef Microsoft::WRL::ComPtr<IDXGIDevice1> IDXGIDevice1Ptr;
 typedef Microsoft::WRL::ComPtr<IDXGIDeviceSubObject> IDXGIDeviceSubObjectPtr;
@@ -158,4 +158,15 @@ Hash CombineHashes(Hash a, Hash b)
     return c;
 }
 
+Hash GenerateLargeHash(const void* key, uint64 len)
+{
+    const uint64 chunkSize = 1024 * 1024 * 1024;
+    const uint8* bytes = reinterpret_cast<const uint8*>(key);
+    Hash hash = GenerateHash(&len, int32(sizeof(len)));
+    for(uint64 offset = 0; offset < len; offset += chunkSize)
+        hash = CombineHashes(hash, GenerateHash(bytes + offset, int32(Min(chunkSize, len - offset))));
+
+    return hash;
+}
+
 }
\ No newline at end of file
@@ -33,4 +33,7 @@ inline bool operator==(const Hash& a, const Hash& b)
 Hash GenerateHash(const void* key, int32 len, uint32 seed = 0);
 Hash CombineHashes(Hash a, Hash b);
 
+// GenerateHash() takes a 32-bit length, so this hashes large buffers in pieces
+Hash GenerateLargeHash(const void* key, uint64 len);
+
 }
\ No newline at end of file
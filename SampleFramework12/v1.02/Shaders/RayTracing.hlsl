@@ -10,6 +10,8 @@
 #ifndef RAYTRACING_HLSL_
 #define RAYTRACING_HLSL_
 
+#include "VertexPacking.hlsl"
+
 struct MeshVertex
 {
     float3 Position;
@@ -19,6 +21,20 @@ struct MeshVertex
     float3 Bitangent;
 };
 
+MeshVertex UnpackMeshVertex(in PackedMeshVertex packed, in float3 positionScale, in float3 positionOffset)
+{
+    const float2 positionXY = UnpackSNorm16x2(packed.Position.x);
+    const float2 positionZW = UnpackSNorm16x2(packed.Position.y);
+
+    MeshVertex vtx;
+    vtx.Position = DequantizePosition(float3(positionXY, positionZW.x), positionScale, positionOffset);
+    DecodeTangentFrame(UnpackSNorm16x2(packed.Normal), UnpackSNorm16x2(packed.Tangent), positionZW.y,
+                       vtx.Normal, vtx.Tangent, vtx.Bitangent);
+    vtx.UV = float2(f16tof32(packed.UV), f16tof32(packed.UV >> 16));
+
+    return vtx;
+}
+
 float BarycentricLerp(in float v0, in float v1, in float v2, in float3 barycentrics)
 {
     return v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
@@ -330,5 +330,67 @@ float2 SampleCMJ2D(uint sampleIdx, uint numSamplesX, uint numSamplesY, uint patt
     return float2((sx + (sy + jx) / numSamplesY) / numSamplesX, (sampleIdx + jy) / N);
 }
 
+// Integer hash with good avalanche behavior ("lowbias32" by Chris Wellons)
+uint SobolHash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+uint SobolHashCombine(uint seed, uint value)
+{
+    return seed ^ (SobolHash(value) + (seed << 6) + (seed >> 2));
+}
+
+// Permutation where every bit only depends on the bits below it, which makes it an Owen scramble
+// when applied to bit-reversed values
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+    x ^= x * 0x3D20ADEA;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526C56;
+    x ^= x * 0x53A22864;
+    return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+    return reversebits(LaineKarrasPermutation(reversebits(x), seed));
+}
+
+// Second dimension of the Sobol sequence, with the generator matrix built up one column at a time
+uint Sobol1(uint index)
+{
+    uint result = 0;
+    uint column = 0x80000000;
+    for(; index != 0; index >>= 1)
+    {
+        if(index & 1)
+            result ^= column;
+        column ^= column >> 1;
+    }
+    return result;
+}
+
+uint SobolSeed(uint pixelIdx, uint dimIdx)
+{
+    return SobolHash(SobolHashCombine(SobolHash(pixelIdx), dimIdx));
+}
+
+// Returns a 2D sample from padded Owen-scrambled Sobol points [Burley 2020], matching SampleSobol2D()
+// in SobolSampler.cpp. Any power-of-2 run of samples starting at 0 is a (0, m, 2)-net.
+float2 SampleSobol2D(uint sampleIdx, uint seed)
+{
+    const uint index = NestedUniformScramble(sampleIdx, seed);
+    const uint x = reversebits(LaineKarrasPermutation(index, SobolHashCombine(seed, 0)));
+    const uint y = NestedUniformScramble(Sobol1(index), SobolHashCombine(seed, 1));
+    return float2(x >> 8, y >> 8) * (1.0f / 16777216.0f);
+}
+
 
 #endif // SAMPLING_HLSL_
\ No newline at end of file
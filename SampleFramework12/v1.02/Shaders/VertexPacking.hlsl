@@ -0,0 +1,55 @@
+//=================================================================================================
+//
+//  MJP's DX12 Sample Framework
+//  http://mynameismjp.wordpress.com/
+//
+//  All code licensed under the MIT license
+//
+//=================================================================================================
+
+#ifndef VERTEXPACKING_HLSL_
+#define VERTEXPACKING_HLSL_
+
+// Matches PackedMeshVertex in Model.h, for reading the vertex buffer as a StructuredBuffer
+struct PackedMeshVertex
+{
+    uint2 Position;     // 16-bit SNORM xyz relative to the mesh bounds, bitangent sign in w
+    uint Normal;        // Octahedral-encoded 16-bit SNORM
+    uint Tangent;       // Octahedral-encoded 16-bit SNORM
+    uint UV;            // Half precision
+};
+
+// Unpacks 2 16-bit SNORM values, with x in the low bits
+float2 UnpackSNorm16x2(in uint packed)
+{
+    const int2 values = int2(packed << 16, packed) >> 16;
+    return max(values / 32767.0f, -1.0f);
+}
+
+float3 OctDecode(in float2 e)
+{
+    float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+    if(n.z < 0.0f)
+    {
+        n.x = (1.0f - abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return normalize(n);
+}
+
+// Decodes a tangent frame from the values that the input assembler unpacked from the SNORM formats
+void DecodeTangentFrame(in float2 octNormal, in float2 octTangent, in float bitangentSign,
+                        out float3 normal, out float3 tangent, out float3 bitangent)
+{
+    normal = OctDecode(octNormal);
+    tangent = OctDecode(octTangent);
+    bitangent = cross(normal, tangent) * (bitangentSign < 0.0f ? -1.0f : 1.0f);
+}
+
+float3 DequantizePosition(in float3 position, in float3 positionScale, in float3 positionOffset)
+{
+    return position * positionScale + positionOffset;
+}
+
+#endif // VERTEXPACKING_HLSL_